@@ -0,0 +1,172 @@
+#include "benchUtil.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+
+static uint16_t registers[BENCH_REGISTERS];
+
+// allocations made by the calling thread, benches are linked with
+// -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc so calls land here
+static __thread long allocations = 0;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* pointer, size_t size);
+
+void* __wrap_malloc(size_t size) {
+    allocations++;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+    allocations++;
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* pointer, size_t size) {
+    allocations++;
+    return __real_realloc(pointer, size);
+}
+
+static int _readFull(int socketfd, uint8_t* buffer, int len) {
+    int got = 0;
+    while (got < len) {
+        int n = recv(socketfd, buffer + got, len - got, 0);
+        if (n <= 0) return -1;
+        got += n;
+    }
+    return got;
+}
+
+/**
+ * @brief answer FC03 and FC16 requests of one client until it disconnects
+ */
+static void* _serveClient(void* arg) {
+    int socketfd = (int)(intptr_t)arg;
+    uint8_t request[260], response[260];
+
+    int one = 1;
+    setsockopt(socketfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    for (;;) {
+        if (_readFull(socketfd, request, 7) < 0) break;
+        int pduLen = ((request[4] << 8) | request[5]) - 1;
+        if (pduLen < 1 || pduLen > 253 ||
+            _readFull(socketfd, request + 7, pduLen) < 0)
+            break;
+
+        uint8_t* pdu = request + 7;
+        uint16_t address = (pdu[1] << 8) | pdu[2];
+        uint16_t quantity = (pdu[3] << 8) | pdu[4];
+        int len = 0;
+
+        memcpy(response, request, 7);
+        if (address + quantity > BENCH_REGISTERS ||
+            (pdu[0] != 0x03 && pdu[0] != 0x10)) {
+            response[7] = pdu[0] | 0x80;
+            response[8] = pdu[0] == 0x03 || pdu[0] == 0x10 ? 0x02 : 0x01;
+            len = 2;
+        } else if (pdu[0] == 0x03) {
+            response[7] = 0x03;
+            response[8] = quantity * 2;
+            for (int i = 0; i < quantity; i++) {
+                response[9 + 2 * i] = registers[address + i] >> 8;
+                response[10 + 2 * i] = registers[address + i] & 0xFF;
+            }
+            len = 2 + quantity * 2;
+        } else {
+            for (int i = 0; i < quantity; i++)
+                registers[address + i] = (pdu[6 + 2 * i] << 8) | pdu[7 + 2 * i];
+            memcpy(response + 7, pdu, 5);
+            len = 5;
+        }
+
+        response[4] = (len + 1) >> 8;
+        response[5] = (len + 1) & 0xFF;
+        if (send(socketfd, response, 7 + len, 0) < 0) break;
+    }
+
+    close(socketfd);
+    return NULL;
+}
+
+static void* _acceptLoop(void* arg) {
+    int listenfd = (int)(intptr_t)arg;
+    for (;;) {
+        int clientfd = accept(listenfd, NULL, NULL);
+        if (clientfd < 0) continue;
+
+        pthread_t thread;
+        pthread_create(&thread, NULL, _serveClient, (void*)(intptr_t)clientfd);
+        pthread_detach(thread);
+    }
+    return NULL;
+}
+
+/**
+ * @brief start a loopback Modbus TCP responder in background threads
+ *
+ * @param port filled with the port the responder listens on
+ * @return 0 if success, -1 if error
+ */
+int benchStartServer(int* port) {
+    int listenfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenfd < 0) return -1;
+
+    int one = 1;
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in address = {.sin_family = AF_INET,
+                                  .sin_port = 0,
+                                  .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t len = sizeof(address);
+    if (bind(listenfd, (struct sockaddr*)&address, len) < 0 ||
+        listen(listenfd, 1024) < 0 ||
+        getsockname(listenfd, (struct sockaddr*)&address, &len) < 0) {
+        ERROR("cannot start bench server\n");
+        close(listenfd);
+        return -1;
+    }
+    *port = ntohs(address.sin_port);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, _acceptLoop,
+                       (void*)(intptr_t)listenfd) != 0)
+        return -1;
+    pthread_detach(thread);
+    return 0;
+}
+
+/**
+ * @brief monotonic wall clock in seconds
+ */
+double benchNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief CPU time consumed by the calling thread in seconds
+ */
+double benchThreadCpu(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief number of malloc/calloc/realloc calls made by the calling thread
+ */
+long benchAllocCount(void) {
+    return allocations;
+}
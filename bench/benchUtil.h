@@ -0,0 +1,15 @@
+#ifndef _BENCH_UTIL_H_
+#define _BENCH_UTIL_H_
+
+#include <inttypes.h>
+
+#define BENCH_REGISTERS 1024
+
+int benchStartServer(int* port);
+
+double benchNow(void);
+double benchThreadCpu(void);
+
+long benchAllocCount(void);
+
+#endif  // _BENCH_UTIL_H_
@@ -0,0 +1,157 @@
+/**
+ * Latency distribution of loopback Read Holding Registers transactions with
+ * the default and the low latency socket profiles: one request at a time,
+ * and a pipeline keeping a window of requests in flight, where Nagle holds
+ * new frames back until the previous ones are acknowledged.
+ *
+ * Usage: latencyBench [-n transactions] [-w window]
+ */
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "applicationLayer/modbusApp.h"
+#include "applicationLayer/modbusPipeline.h"
+#include "benchUtil.h"
+
+#define POLL_QUANTITY 10
+
+typedef struct _samples {
+    double* us;
+    int count;
+    int failures;
+} Samples;
+
+static int _compare(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void _report(const char* scenario, const char* profile,
+                    Samples* samples) {
+    qsort(samples->us, samples->count, sizeof(double), _compare);
+    double* us = samples->us;
+    int n = samples->count;
+    printf("%-10s %-12s %9.1f %9.1f %9.1f %9.1f\n", scenario, profile,
+           us[n / 2], us[(int)(n * 0.99)], us[(int)(n * 0.999)], us[n - 1]);
+}
+
+static int _sequential(int port, const TcpProfile* profile,
+                       Samples* samples) {
+    int socketfd = connectToServerProfile("127.0.0.1", port, profile);
+    if (socketfd < 0) return -1;
+
+    uint16_t values[POLL_QUANTITY];
+    for (int i = 0; i < samples->count; i++) {
+        double start = benchNow();
+        if (readHoldingRegistersInto(socketfd, (uint16_t)i, 0, POLL_QUANTITY,
+                                     values) != 0)
+            samples->failures++;
+        samples->us[i] = (benchNow() - start) * 1e6;
+    }
+
+    disconnectFromServer(socketfd);
+    return 0;
+}
+
+typedef struct _window {
+    Samples* samples;
+    int completed;
+} Window;
+
+static void _completed(ModbusTransaction* txn, void* context) {
+    Window* window = (Window*)context;
+    if (txn->responseLen < 0) window->samples->failures++;
+    window->samples->us[window->completed++] =
+        (txn->completedNs - txn->enqueuedNs) / 1e3;
+}
+
+static int _pipelined(int port, const TcpProfile* profile, int depth,
+                      Samples* samples) {
+    int socketfd = connectToServerProfile("127.0.0.1", port, profile);
+    if (socketfd < 0) return -1;
+    ModbusPipeline* pipeline = newModbusPipeline(socketfd, depth);
+    if (pipeline == NULL) return -1;
+
+    uint8_t pdu[MODBUS_RHR_REQUEST_LEN] = {0x03, 0, 0, 0, POLL_QUANTITY};
+    Window window = {.samples = samples};
+    int submitted = 0;
+
+    // refill the window as responses arrive, one small frame at a time
+    while (window.completed < samples->count) {
+        while (submitted < samples->count &&
+               submitted - window.completed < depth) {
+            if (pipelineSubmit(pipeline, pollLane, pdu, sizeof(pdu),
+                               _completed, &window) < 0)
+                return -1;
+            submitted++;
+            if (pipelineDispatch(pipeline) < 0) return -1;
+        }
+        if (pipelineProcess(pipeline) < 0) return -1;
+    }
+
+    freeModbusPipeline(pipeline);
+    disconnectFromServer(socketfd);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    int count = 20000;
+    int depth = 4;
+
+    int option;
+    while ((option = getopt(argc, argv, "n:w:")) != -1) {
+        switch (option) {
+            case 'n':
+                count = atoi(optarg);
+                break;
+            case 'w':
+                depth = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n transactions] [-w window]\n",
+                        argv[0]);
+                return -1;
+        }
+    }
+    if (count < 1 || depth < 1 || depth > MODBUS_PIPELINE_MAX_WINDOW) {
+        fprintf(stderr, "invalid parameters\n");
+        return -1;
+    }
+
+    int port;
+    if (benchStartServer(&port) < 0) return -1;
+
+    struct {
+        const char* name;
+        const TcpProfile* profile;
+    } profiles[] = {{"default", &tcpDefaultProfile},
+                    {"lowLatency", &tcpLowLatencyProfile}};
+
+    Samples samples = {.us = (double*)malloc(count * sizeof(double)),
+                       .count = count};
+    if (samples.us == NULL) return -1;
+
+    printf("%d transactions, pipeline window %d, latency in us\n\n", count,
+           depth);
+    printf("%-10s %-12s %9s %9s %9s %9s\n", "scenario", "profile", "p50",
+           "p99", "p99.9", "max");
+
+    int status = 0;
+    for (int p = 0; p < 2 && status == 0; p++) {
+        status = _sequential(port, profiles[p].profile, &samples);
+        if (status == 0) _report("sequential", profiles[p].name, &samples);
+    }
+    for (int p = 0; p < 2 && status == 0; p++) {
+        status = _pipelined(port, profiles[p].profile, depth, &samples);
+        if (status == 0) _report("pipelined", profiles[p].name, &samples);
+    }
+
+    free(samples.us);
+    if (status < 0 || samples.failures > 0) {
+        fprintf(stderr, "benchmark failed, %d failed transactions\n",
+                samples.failures);
+        return -1;
+    }
+    return 0;
+}
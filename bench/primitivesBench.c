@@ -0,0 +1,384 @@
+/**
+ * Microbenchmarks of the codec and transport primitives. Every case is
+ * calibrated to run for at least SAMPLE_TARGET_NS per sample, the median of
+ * the samples is reported with its median absolute deviation, together with
+ * the allocations and transport syscalls issued per operation.
+ *
+ * Usage: primitivesBench [-s samples] [-o save.txt] [-b baseline.txt]
+ *
+ * -o writes the results to a file that a later run can compare against
+ * with -b, which adds the relative change of each median.
+ */
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "applicationLayer/modbusApp.h"
+#include "applicationLayer/registerImage.h"
+#include "benchUtil.h"
+#include "transportLayer/dataPackaging.h"
+#include "transportLayer/tcpControl.h"
+
+#define SAMPLE_TARGET_NS 20e6
+#define DEFAULT_SAMPLES 15
+#define MAX_SAMPLES 101
+#define PARSE_FRAMES 64
+#define RHR_QUANTITY 10
+
+typedef struct _fixture {
+    int port;
+    int tcpfd;
+    int pair[2];
+    ModbusADU* request;
+    RequestTemplate readTemplate;
+    RegisterImage* image;
+    uint8_t frames[PARSE_FRAMES * MODBUS_MAX_ADU_SIZE];
+    int framesLen;
+} Fixture;
+
+typedef struct _benchCase {
+    const char* name;
+    int (*run)(Fixture* fixture, long iterations);
+} BenchCase;
+
+typedef struct _result {
+    char name[32];
+    double median;  // ns/op
+    double mad;     // ns/op
+    double allocs;  // per op
+    double syscalls;
+} Result;
+
+static volatile long sink;
+
+static int _newReadHoldingRegs(Fixture* fixture, long iterations) {
+    for (long i = 0; i < iterations; i++) {
+        int len;
+        uint8_t* pdu = newReadHoldingRegs((uint16_t)i, RHR_QUANTITY, &len);
+        if (pdu == NULL) return -1;
+        sink += pdu[1];
+        free(pdu);
+    }
+    return 0;
+}
+
+static int _newWriteMultipleRegs(Fixture* fixture, long iterations) {
+    uint16_t data[RHR_QUANTITY] = {0};
+    for (long i = 0; i < iterations; i++) {
+        int len;
+        data[0] = (uint16_t)i;
+        uint8_t* pdu =
+            newWriteMultipleRegs((uint16_t)i, RHR_QUANTITY, data, &len);
+        if (pdu == NULL) return -1;
+        sink += pdu[1];
+        free(pdu);
+    }
+    return 0;
+}
+
+static int _socketpairADU(Fixture* fixture, long iterations) {
+    for (long i = 0; i < iterations; i++) {
+        fixture->request->transactionID = (uint16_t)i;
+        if (sendModbusADU(fixture->pair[0], fixture->request) < 0) return -1;
+
+        ModbusADU* adu = receiveModbusADU(fixture->pair[1]);
+        if (adu == NULL) return -1;
+        sink += adu->transactionID;
+        freeModbusADU(adu);
+    }
+    return 0;
+}
+
+static int _readHoldingRegisters(Fixture* fixture, long iterations) {
+    for (long i = 0; i < iterations; i++) {
+        int len;
+        uint8_t* response = readHoldingRegisters(
+            fixture->tcpfd, (uint16_t)i, 0, RHR_QUANTITY, &len);
+        if (response == NULL) return -1;
+        sink += response[0];
+        free(response);
+    }
+    return 0;
+}
+
+static int _readHoldingRegistersInto(Fixture* fixture, long iterations) {
+    uint16_t values[RHR_QUANTITY];
+    for (long i = 0; i < iterations; i++) {
+        if (readHoldingRegistersInto(fixture->tcpfd, (uint16_t)i, 0,
+                                     RHR_QUANTITY, values) != 0)
+            return -1;
+        sink += values[0];
+    }
+    return 0;
+}
+
+static int _readHoldingRegistersTemplate(Fixture* fixture, long iterations) {
+    uint16_t values[RHR_QUANTITY];
+    for (long i = 0; i < iterations; i++) {
+        if (readHoldingRegistersTemplate(fixture->tcpfd, (uint16_t)i,
+                                         &fixture->readTemplate, values) != 0)
+            return -1;
+        sink += values[0];
+    }
+    return 0;
+}
+
+static int _parseFrames(Fixture* fixture, long iterations) {
+    int offset = 0;
+    for (long i = 0; i < iterations; i++) {
+        ModbusADU adu;
+        int len = parseModbusADU(fixture->frames + offset,
+                                 fixture->framesLen - offset, &adu);
+        if (len <= 0) return -1;
+        sink += adu.pdu[1];
+        offset += len;
+        if (offset == fixture->framesLen) offset = 0;
+    }
+    return 0;
+}
+
+static int _decodeFrames(Fixture* fixture, long iterations) {
+    int offset = 0;
+    for (long i = 0; i < iterations; i++) {
+        int len = MODBUS_MBAP_HEADER_SIZE - 1 +
+                  ((fixture->frames[offset + 4] << 8) |
+                   fixture->frames[offset + 5]);
+        ModbusADU* adu = decodeModbusADU(fixture->frames + offset, len);
+        if (adu == NULL) return -1;
+        sink += adu->pdu[1];
+        freeModbusADU(adu);
+        offset += len;
+        if (offset == fixture->framesLen) offset = 0;
+    }
+    return 0;
+}
+
+static int _imageScan(Fixture* fixture, long iterations) {
+    for (long i = 0; i < iterations; i++) {
+        if (imageScan(fixture->image, fixture->tcpfd, (uint16_t)i) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int _imageAcquire(Fixture* fixture, long iterations) {
+    for (long i = 0; i < iterations; i++) {
+        RegisterSnapshot snapshot;
+        if (imageAcquire(fixture->image, &snapshot) < 0) return -1;
+        sink += snapshot.values[i & (BENCH_REGISTERS - 1)];
+        imageRelease(fixture->image, &snapshot);
+    }
+    return 0;
+}
+
+static const BenchCase cases[] = {
+    {"newReadHoldingRegs", _newReadHoldingRegs},
+    {"newWriteMultipleRegs", _newWriteMultipleRegs},
+    {"socketpairSendReceive", _socketpairADU},
+    {"readHoldingRegisters", _readHoldingRegisters},
+    {"readHoldingRegistersInto", _readHoldingRegistersInto},
+    {"readHoldingRegsTemplate", _readHoldingRegistersTemplate},
+    {"parseModbusADU", _parseFrames},
+    {"decodeModbusADU", _decodeFrames},
+    {"imageScan", _imageScan},
+    {"imageAcquireRelease", _imageAcquire},
+};
+
+/**
+ * @brief fill the parse buffer with back to back FC03 responses
+ */
+static void _buildFrames(Fixture* fixture) {
+    uint8_t pdu[2 + 2 * RHR_QUANTITY] = {readHoldingRegsFuncCode,
+                                         2 * RHR_QUANTITY};
+    fixture->framesLen = 0;
+    for (int i = 0; i < PARSE_FRAMES; i++) {
+        pdu[2] = (uint8_t)i;
+        ModbusADU adu = {.transactionID = (uint16_t)i,
+                         .protocolIdentifier = PROTOCOL_ID,
+                         .length = sizeof(pdu) + 1,
+                         .unitIdentifier = UNIT_ID,
+                         .pdu = pdu};
+        fixture->framesLen +=
+            encodeModbusADU(&adu, fixture->frames + fixture->framesLen,
+                            sizeof(fixture->frames) - fixture->framesLen);
+    }
+}
+
+static int _setup(Fixture* fixture) {
+    if (benchStartServer(&fixture->port) < 0) return -1;
+    fixture->tcpfd = connectToServer("127.0.0.1", fixture->port);
+    if (fixture->tcpfd < 0) return -1;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fixture->pair) < 0) return -1;
+
+    uint8_t pdu[MODBUS_RHR_REQUEST_LEN];
+    encodeReadHoldingRegs(0, RHR_QUANTITY, pdu);
+    fixture->request = newModbusADU(0, pdu, sizeof(pdu));
+    if (fixture->request == NULL) return -1;
+
+    if (compileReadHoldingRegs(&fixture->readTemplate, 0, RHR_QUANTITY) < 0)
+        return -1;
+
+    fixture->image = newRegisterImage(0, BENCH_REGISTERS, 3);
+    if (fixture->image == NULL) return -1;
+
+    _buildFrames(fixture);
+    return 0;
+}
+
+static void _teardown(Fixture* fixture) {
+    freeModbusADU(fixture->request);
+    freeRegisterImage(fixture->image);
+    close(fixture->pair[0]);
+    close(fixture->pair[1]);
+    disconnectFromServer(fixture->tcpfd);
+}
+
+static int _compareDouble(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double _median(double* values, int count) {
+    qsort(values, count, sizeof(double), _compareDouble);
+    return count % 2 ? values[count / 2]
+                     : (values[count / 2 - 1] + values[count / 2]) / 2;
+}
+
+/**
+ * @brief calibrate, then time the case over the requested samples
+ */
+static int _measure(const BenchCase* bench, Fixture* fixture, int samples,
+                    Result* result) {
+    // the calibration run doubles as warm up
+    long iterations = 1;
+    for (;;) {
+        double start = benchNow();
+        if (bench->run(fixture, iterations) < 0) return -1;
+        if ((benchNow() - start) * 1e9 >= SAMPLE_TARGET_NS / 4) break;
+        iterations *= 2;
+    }
+    iterations *= 4;
+
+    double perOp[MAX_SAMPLES];
+    long allocs = benchAllocCount();
+    long syscalls = tcpSyscallCount();
+    for (int s = 0; s < samples; s++) {
+        double start = benchNow();
+        if (bench->run(fixture, iterations) < 0) return -1;
+        perOp[s] = (benchNow() - start) * 1e9 / iterations;
+    }
+    allocs = benchAllocCount() - allocs;
+    syscalls = tcpSyscallCount() - syscalls;
+
+    double total = (double)iterations * samples;
+    snprintf(result->name, sizeof(result->name), "%s", bench->name);
+    result->median = _median(perOp, samples);
+    for (int s = 0; s < samples; s++) {
+        double deviation = perOp[s] - result->median;
+        perOp[s] = deviation < 0 ? -deviation : deviation;
+    }
+    result->mad = _median(perOp, samples);
+    result->allocs = allocs / total;
+    result->syscalls = syscalls / total;
+    return 0;
+}
+
+/**
+ * @brief median of a case in a results file saved with -o
+ *
+ * @return the median in ns/op, or -1 if the case is not in the file
+ */
+static double _baselineMedian(FILE* baseline, const char* name) {
+    if (baseline == NULL) return -1;
+    rewind(baseline);
+
+    char line[128], saved[32];
+    double median;
+    while (fgets(line, sizeof(line), baseline) != NULL) {
+        if (sscanf(line, "%31s %lf", saved, &median) == 2 &&
+            strcmp(saved, name) == 0)
+            return median;
+    }
+    return -1;
+}
+
+static void _usage(const char* program) {
+    fprintf(stderr, "Usage: %s [-s samples] [-o save.txt] [-b baseline.txt]\n",
+            program);
+}
+
+int main(int argc, char* argv[]) {
+    int samples = DEFAULT_SAMPLES;
+    FILE* output = NULL;
+    FILE* baseline = NULL;
+
+    int option;
+    while ((option = getopt(argc, argv, "s:o:b:")) != -1) {
+        switch (option) {
+            case 's':
+                samples = atoi(optarg);
+                break;
+            case 'o':
+                output = fopen(optarg, "w");
+                if (output == NULL) {
+                    perror(optarg);
+                    return -1;
+                }
+                break;
+            case 'b':
+                baseline = fopen(optarg, "r");
+                if (baseline == NULL) {
+                    perror(optarg);
+                    return -1;
+                }
+                break;
+            default:
+                _usage(argv[0]);
+                return -1;
+        }
+    }
+    if (samples < 1 || samples > MAX_SAMPLES) {
+        fprintf(stderr, "samples must be between 1 and %d\n", MAX_SAMPLES);
+        return -1;
+    }
+
+    Fixture fixture;
+    if (_setup(&fixture) < 0) {
+        fprintf(stderr, "benchmark setup failed\n");
+        return -1;
+    }
+
+    printf("%-26s %10s %8s %10s %12s%s\n", "case", "ns/op", "+/-",
+           "allocs/op", "syscalls/op", baseline != NULL ? "   vs base" : "");
+
+    int status = 0;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        Result result;
+        if (_measure(&cases[i], &fixture, samples, &result) < 0) {
+            fprintf(stderr, "%s failed\n", cases[i].name);
+            status = -1;
+            continue;
+        }
+
+        printf("%-26s %10.1f %7.1f%% %10.2f %12.2f", result.name,
+               result.median, 100 * result.mad / result.median, result.allocs,
+               result.syscalls);
+        double base = _baselineMedian(baseline, result.name);
+        if (base > 0)
+            printf(" %+9.1f%%", 100 * (result.median - base) / base);
+        printf("\n");
+
+        if (output != NULL)
+            fprintf(output, "%s %.3f %.3f %.3f %.3f\n", result.name,
+                    result.median, result.mad, result.allocs, result.syscalls);
+    }
+
+    _teardown(&fixture);
+    if (output != NULL) fclose(output);
+    if (baseline != NULL) fclose(baseline);
+    return status;
+}
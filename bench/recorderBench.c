@@ -0,0 +1,171 @@
+/**
+ * Append and query cost of the scan recorder: -n scans of -r registers,
+ * RANDOM_REGISTERS of them random and the others constant, one scan per
+ * millisecond with some jitter. Reports the append rate, the recording size
+ * against the same scans as raw binary (timestamp + registers) and as a
+ * text dump (one line of decimal values per scan), then the cost of a full
+ * and of a narrow time range query.
+ *
+ * Usage: recorderBench [-n scans] [-r registers]
+ */
+#include <getopt.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "applicationLayer/scanRecorder.h"
+#include "benchUtil.h"
+
+#define RANDOM_REGISTERS 5
+#define PERIOD_NS 1000000ULL
+#define JITTER_NS 50000
+
+typedef struct _visit {
+    uint64_t scans;
+    uint64_t previousNs;
+    uint64_t sum;
+    int unordered;
+} Visit;
+
+static uint32_t _random(uint32_t* state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static int _visit(uint64_t timestampNs, const uint16_t* values,
+                  int registers, void* context) {
+    Visit* visit = (Visit*)context;
+    if (timestampNs < visit->previousNs) visit->unordered = 1;
+    visit->previousNs = timestampNs;
+    visit->sum += values[registers - 1];
+    visit->scans++;
+    return 0;
+}
+
+static long _fileSize(const char* path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (long)st.st_size : 0;
+}
+
+/**
+ * @brief time a query, checking the order and count of the scans visited
+ *
+ * @return scans visited, -1 if the query failed
+ */
+static long _query(ScanArchive* archive, uint64_t fromNs, uint64_t toNs,
+                   double* elapsed) {
+    Visit visit = {0};
+    double start = benchNow();
+    int ret = archiveQuery(archive, fromNs, toNs, _visit, &visit);
+    *elapsed = benchNow() - start;
+    return ret == 0 && !visit.unordered ? (long)visit.scans : -1;
+}
+
+int main(int argc, char* argv[]) {
+    int scans = 1000000;
+    int registers = 100;
+
+    int option;
+    while ((option = getopt(argc, argv, "n:r:")) != -1) {
+        switch (option) {
+            case 'n':
+                scans = atoi(optarg);
+                break;
+            case 'r':
+                registers = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n scans] [-r registers]\n",
+                        argv[0]);
+                return -1;
+        }
+    }
+    if (scans < 1 || registers <= RANDOM_REGISTERS || registers > 65535) {
+        fprintf(stderr, "invalid parameters\n");
+        return -1;
+    }
+
+    char path[] = "/tmp/recorderBenchXXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) return -1;
+    close(fd);
+    unlink(path);
+    char indexPath[PATH_MAX];
+    snprintf(indexPath, sizeof(indexPath), "%s.idx", path);
+
+    ScanRecorder* recorder = newScanRecorder(path, registers);
+    uint16_t* values = (uint16_t*)malloc(registers * sizeof(uint16_t));
+    if (recorder == NULL || values == NULL) return -1;
+    for (int r = 0; r < registers; r++) values[r] = r;
+
+    uint32_t state = 2463534242u;
+    uint64_t timestampNs = 0;
+    double textBytes = 0;
+    char line[16];
+    int status = 0;
+
+    double start = benchNow();
+    for (int i = 0; i < scans && status == 0; i++) {
+        timestampNs += PERIOD_NS - JITTER_NS + _random(&state) % JITTER_NS;
+        for (int r = 0; r < RANDOM_REGISTERS; r++)
+            values[r] = (uint16_t)_random(&state);
+        status = recorderAppend(recorder, timestampNs, values);
+    }
+    if (status == 0) status = recorderFlush(recorder);
+    double elapsed = benchNow() - start;
+    freeScanRecorder(recorder);
+    if (status < 0) {
+        fprintf(stderr, "recording failed\n");
+        return -1;
+    }
+
+    // the text dump is sized from the constant registers once, the random
+    // ones are averaged over a sample
+    for (int r = RANDOM_REGISTERS; r < registers; r++)
+        textBytes += snprintf(line, sizeof(line), " %u", values[r]);
+    double randomBytes = 0;
+    for (int i = 0; i < 10000; i++)
+        randomBytes += snprintf(line, sizeof(line), " %u",
+                                (uint16_t)_random(&state));
+    textBytes += RANDOM_REGISTERS * randomBytes / 10000;
+    textBytes += snprintf(line, sizeof(line), "%llu",
+                          (unsigned long long)timestampNs) + 1;
+    textBytes *= scans;
+
+    double rawBytes = (double)scans * (8 + 2 * registers);
+    long recorded = _fileSize(path) + _fileSize(indexPath);
+    printf("%d scans of %d registers, %d random\n", scans, registers,
+           RANDOM_REGISTERS);
+    printf("%-16s %10.1f Mreg/s %8.1f ns/scan\n", "append",
+           (double)scans * registers / elapsed / 1e6, elapsed * 1e9 / scans);
+    printf("%-16s %10.1f MiB %8.1fx raw %6.1fx text\n", "recording",
+           recorded / 1048576.0, rawBytes / recorded, textBytes / recorded);
+
+    ScanArchive* archive = openScanArchive(path);
+    if (archive == NULL) return -1;
+
+    long visited = _query(archive, 0, timestampNs, &elapsed);
+    printf("%-16s %10.1f Mreg/s %8ld scans\n", "query all",
+           (double)visited * registers / elapsed / 1e6, visited);
+    if (visited != scans) status = -1;
+
+    // one second out of the middle decodes only the blocks around it
+    uint64_t middleNs = timestampNs / 2;
+    long narrow = _query(archive, middleNs, middleNs + 1000 * PERIOD_NS,
+                         &elapsed);
+    printf("%-16s %10.1f us    %8ld scans\n", "query 1 s",
+           elapsed * 1e6, narrow);
+    if (narrow < 0) status = -1;
+
+    closeScanArchive(archive);
+    unlink(path);
+    unlink(indexPath);
+    free(values);
+    if (status < 0) fprintf(stderr, "scans lost or out of order\n");
+    return status;
+}
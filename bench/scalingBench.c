@@ -0,0 +1,185 @@
+/**
+ * Scaling of device polling over the work stealing pool: every cycle each
+ * device runs one job of POLLS_PER_JOB Read Holding Registers round trips
+ * on its own loopback connection. The run is repeated with 1, 2, 4, ... up
+ * to the requested number of workers, once with uniform devices and once
+ * with a few busy devices doing BURST_FACTOR times the work, all homed on
+ * the first worker.
+ *
+ * Usage: scalingBench [-w workers] [-d devices] [-c cycles] [-a]
+ *
+ * -a pins worker i to cpu i (modulo the online cpus). The loopback
+ * responder runs in the same process and competes for the same cores.
+ */
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "applicationLayer/modbusApp.h"
+#include "applicationLayer/workPool.h"
+#include "benchUtil.h"
+
+#define POLLS_PER_JOB 8
+#define POLL_QUANTITY 10
+#define BUSY_DEVICES 4
+#define BURST_FACTOR 16
+
+typedef struct _device {
+    int socketfd;
+    uint16_t nextId;
+    int home;   // worker its jobs are queued on, modulo the worker count
+    int polls;  // round trips per job
+    int failures;
+} Device;
+
+static void _pollDevice(void* argument) {
+    Device* device = (Device*)argument;
+    uint16_t values[POLL_QUANTITY];
+
+    for (int i = 0; i < device->polls; i++) {
+        uint16_t address =
+            (uint16_t)(i % (BENCH_REGISTERS / POLL_QUANTITY) * POLL_QUANTITY);
+        if (readHoldingRegistersInto(device->socketfd, device->nextId++,
+                                     address, POLL_QUANTITY, values) != 0)
+            device->failures++;
+    }
+}
+
+/**
+ * @brief poll every device for the given cycles with a pool of workers
+ *
+ * @return transactions per second, -1 if error
+ */
+static double _run(Device* devices, int count, int cycles, int workers,
+                   int pin, double* stolenShare) {
+    int cpus[WORK_POOL_MAX_WORKERS];
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int i = 0; i < workers; i++) cpus[i] = i % (online > 0 ? online : 1);
+
+    WorkPool* pool = newWorkPool(workers, pin ? cpus : NULL);
+    if (pool == NULL) return -1;
+
+    long transactions = 0;
+    double start = benchNow();
+    for (int c = 0; c < cycles; c++) {
+        for (int d = 0; d < count; d++) {
+            workPoolSubmit(pool, devices[d].home, _pollDevice, &devices[d]);
+            transactions += devices[d].polls;
+        }
+        workPoolWait(pool);
+    }
+    double elapsed = benchNow() - start;
+
+    uint64_t executed = 0, stolen = 0;
+    for (int w = 0; w < workers; w++) {
+        WorkStats stats;
+        workPoolGetStats(pool, w, &stats);
+        executed += stats.executed;
+        stolen += stats.stolen;
+    }
+    *stolenShare = executed ? (double)stolen / executed : 0;
+
+    freeWorkPool(pool);
+    return transactions / elapsed;
+}
+
+static int _scenario(const char* name, Device* devices, int count, int cycles,
+                     int maxWorkers, int pin) {
+    printf("%s\n%8s %12s %8s %8s\n", name, "workers", "txn/s", "speedup",
+           "stolen");
+
+    double base = 0;
+    for (int workers = 1;; workers *= 2) {
+        if (workers > maxWorkers) workers = maxWorkers;
+
+        double stolen;
+        double rate = _run(devices, count, cycles, workers, pin, &stolen);
+        if (rate < 0) return -1;
+        if (base == 0) base = rate;
+
+        printf("%8d %12.0f %7.2fx %7.1f%%\n", workers, rate, rate / base,
+               100 * stolen);
+        if (workers == maxWorkers) break;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    int maxWorkers = online > 0 ? (int)online : 1;
+    int count = 64;
+    int cycles = 200;
+    int pin = 0;
+
+    int option;
+    while ((option = getopt(argc, argv, "w:d:c:a")) != -1) {
+        switch (option) {
+            case 'w':
+                maxWorkers = atoi(optarg);
+                break;
+            case 'd':
+                count = atoi(optarg);
+                break;
+            case 'c':
+                cycles = atoi(optarg);
+                break;
+            case 'a':
+                pin = 1;
+                break;
+            default:
+                fprintf(stderr,
+                        "Usage: %s [-w workers] [-d devices] [-c cycles] "
+                        "[-a]\n",
+                        argv[0]);
+                return -1;
+        }
+    }
+    if (maxWorkers < 1 || maxWorkers > WORK_POOL_MAX_WORKERS || count < 1 ||
+        cycles < 1) {
+        fprintf(stderr, "invalid parameters\n");
+        return -1;
+    }
+
+    int port;
+    if (benchStartServer(&port) < 0) return -1;
+
+    Device* devices = (Device*)calloc(count, sizeof(Device));
+    if (devices == NULL) return -1;
+    for (int d = 0; d < count; d++) {
+        devices[d].socketfd = connectToServer("127.0.0.1", port);
+        // devices are sharded over the workers by number
+        devices[d].home = d;
+        devices[d].polls = POLLS_PER_JOB;
+        if (devices[d].socketfd < 0) return -1;
+    }
+
+    printf("%d devices, %d cycles, %ld online cpus%s\n\n", count, cycles,
+           online, pin ? ", pinned" : "");
+    int status = _scenario("uniform devices", devices, count, cycles,
+                           maxWorkers, pin);
+
+    // a few busy devices, all homed on the first worker: the others only
+    // get a share of their work by stealing it
+    for (int d = 0; d < BUSY_DEVICES && d < count; d++) {
+        devices[d].home = 0;
+        devices[d].polls = POLLS_PER_JOB * BURST_FACTOR;
+    }
+    printf("\n");
+    if (status == 0)
+        status = _scenario("bursty devices", devices, count, cycles / 4 + 1,
+                           maxWorkers, pin);
+
+    int failures = 0;
+    for (int d = 0; d < count; d++) {
+        failures += devices[d].failures;
+        disconnectFromServer(devices[d].socketfd);
+    }
+    free(devices);
+
+    if (failures > 0) {
+        fprintf(stderr, "%d polls failed\n", failures);
+        return -1;
+    }
+    return status;
+}
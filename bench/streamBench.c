@@ -0,0 +1,156 @@
+/**
+ * Throughput of the binary scan stream to a local consumer thread over a
+ * Unix domain socket pair: DEVICES devices of -r registers each publish
+ * scans in turn, flushed once per cycle like a poll loop does. The consumer
+ * parses every record and checks the values. Run once with a consumer that
+ * keeps up (streamBlock) and once with one that sleeps between reads
+ * (streamDrop), which must shed scans and report them as gaps.
+ *
+ * Usage: streamBench [-n scans] [-r registers]
+ */
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "applicationLayer/scanStream.h"
+#include "benchUtil.h"
+
+#define DEVICES 64
+#define READ_SIZE (256 * 1024)
+// the slow consumer takes SLOW_READ_SIZE bytes per SLOW_READ_US
+#define SLOW_READ_SIZE (16 * 1024)
+#define SLOW_READ_US 1000
+
+typedef struct _consumer {
+    int fd;
+    int slow;
+    uint64_t scans;
+    uint64_t registers;
+    uint64_t gaps;
+    uint64_t bad;
+} Consumer;
+
+static int _visit(const StreamHeader* record, void* context) {
+    Consumer* consumer = (Consumer*)context;
+
+    if (record->type == streamScan) {
+        const StreamScanRecord* scan = (const StreamScanRecord*)record;
+        const uint16_t* values = (const uint16_t*)(scan + 1);
+        int count = (record->length - sizeof(StreamScanRecord)) / 2;
+        // every register of a scan carries the low bits of its timestamp
+        if (values[0] != (uint16_t)scan->timestampNs ||
+            values[count - 1] != (uint16_t)scan->timestampNs)
+            consumer->bad++;
+        consumer->scans++;
+        consumer->registers += count;
+    } else if (record->type == streamGap) {
+        consumer->gaps += ((const StreamGapRecord*)record)->dropped;
+    }
+    return 0;
+}
+
+static void* _consume(void* argument) {
+    Consumer* consumer = (Consumer*)argument;
+    uint8_t* buffer = (uint8_t*)malloc(READ_SIZE);
+    int len = 0;
+
+    for (;;) {
+        int size = consumer->slow ? SLOW_READ_SIZE : READ_SIZE - len;
+        ssize_t n = read(consumer->fd, buffer + len, size);
+        if (n <= 0) break;
+        len += n;
+
+        int consumed;
+        if (streamParse(buffer, len, &consumed, _visit, consumer) < 0) break;
+        memmove(buffer, buffer + consumed, len - consumed);
+        len -= consumed;
+        if (consumer->slow) usleep(SLOW_READ_US);
+    }
+
+    free(buffer);
+    return NULL;
+}
+
+static int _run(const char* scenario, StreamPolicy policy, int slow,
+                int scans, int registers) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) return -1;
+
+    Consumer consumer = {.fd = fds[1], .slow = slow};
+    pthread_t thread;
+    pthread_create(&thread, NULL, _consume, &consumer);
+
+    ScanStream* stream = newScanStream(fds[0], policy, 0);
+    if (stream == NULL) return -1;
+    int schema[DEVICES];
+    for (int d = 0; d < DEVICES; d++)
+        schema[d] = streamAddSchema(stream, d, 0, registers, "device");
+
+    uint16_t* values = (uint16_t*)malloc(registers * sizeof(uint16_t));
+    double start = benchNow();
+    for (int i = 0; i < scans; i++) {
+        uint64_t timestampNs = i + 1;
+        for (int r = 0; r < registers; r++) values[r] = (uint16_t)timestampNs;
+        if (streamPublish(stream, schema[i % DEVICES], timestampNs, values) <
+            0)
+            break;
+        if (i % DEVICES == DEVICES - 1) streamFlush(stream);
+    }
+
+    StreamStats stats;
+    streamGetStats(stream, &stats);
+    freeScanStream(stream);
+    double elapsed = benchNow() - start;
+    shutdown(fds[0], SHUT_WR);
+    pthread_join(thread, NULL);
+    close(fds[0]);
+    close(fds[1]);
+    free(values);
+
+    printf("%-6s %-6s %9.1f %9.1f %9.1f %9lu %9lu %6lu\n", scenario,
+           policy == streamBlock ? "block" : "drop",
+           consumer.registers / elapsed / 1e6, stats.bytes / elapsed / 1e6,
+           stats.writes ? (double)stats.bytes / stats.writes / 1024 : 0.0,
+           (unsigned long)stats.dropped, (unsigned long)consumer.gaps,
+           (unsigned long)consumer.bad);
+    return consumer.scans + consumer.gaps == (uint64_t)scans &&
+                   consumer.bad == 0
+               ? 0
+               : -1;
+}
+
+int main(int argc, char* argv[]) {
+    int scans = 1000000;
+    int registers = 100;
+
+    int option;
+    while ((option = getopt(argc, argv, "n:r:")) != -1) {
+        switch (option) {
+            case 'n':
+                scans = atoi(optarg);
+                break;
+            case 'r':
+                registers = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n scans] [-r registers]\n",
+                        argv[0]);
+                return -1;
+        }
+    }
+    if (scans < 1 || registers < 1 || registers > 65535) {
+        fprintf(stderr, "invalid parameters\n");
+        return -1;
+    }
+
+    printf("%-6s %-6s %9s %9s %9s %9s %9s %6s\n", "reader", "policy", "Mreg/s",
+           "MB/s", "KB/write", "dropped", "gaps", "bad");
+    int status = _run("fast", streamBlock, 0, scans, registers);
+    if (_run("slow", streamDrop, 1, scans, registers) < 0) status = -1;
+    if (status < 0) fprintf(stderr, "records lost or corrupted\n");
+    return status;
+}
@@ -0,0 +1,144 @@
+/**
+ * Compile time and lookup cost of a generated tag map: DEVICES devices of
+ * TAGS_PER_DEVICE tags of every type. Reports the median compile time, then
+ * ns and allocations per name lookup, address lookup and decode.
+ *
+ * Usage: tagMapBench [-t tags] [-r runs]
+ */
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "applicationLayer/tagMap.h"
+#include "benchUtil.h"
+
+#define TAGS_PER_DEVICE 100
+#define LOOKUPS 1000000
+
+static const char* types[] = {"u16", "i16", "u32", "f32s", "bit3"};
+
+static char* _generate(int tags, size_t* len) {
+    int devices = (tags + TAGS_PER_DEVICE - 1) / TAGS_PER_DEVICE;
+    size_t capacity = (size_t)devices * 64 + (size_t)tags * 64;
+    char* text = (char*)malloc(capacity);
+    if (text == NULL) return NULL;
+
+    size_t used = 0;
+    for (int d = 0, t = 0; d < devices; d++) {
+        used += sprintf(text + used, "device,plc%d,10.0.%d.%d,502,%d\n", d,
+                        d / 250, d % 250 + 1, d % 247 + 1);
+        // written in reverse address order, the compiler sorts them
+        for (int i = TAGS_PER_DEVICE - 1; i >= 0 && t < tags; i--, t++)
+            used += sprintf(text + used, "tag,t%d,%d,%s,0.1,-5\n", i, 2 * i,
+                            types[i % 5]);
+    }
+    *len = used;
+    return text;
+}
+
+static int _compareDouble(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char* argv[]) {
+    int tags = 100000;
+    int runs = 9;
+
+    int option;
+    while ((option = getopt(argc, argv, "t:r:")) != -1) {
+        switch (option) {
+            case 't':
+                tags = atoi(optarg);
+                break;
+            case 'r':
+                runs = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-t tags] [-r runs]\n", argv[0]);
+                return -1;
+        }
+    }
+    if (tags < 1 || runs < 1) {
+        fprintf(stderr, "invalid parameters\n");
+        return -1;
+    }
+
+    size_t len;
+    char* text = _generate(tags, &len);
+    if (text == NULL) return -1;
+
+    double* times = (double*)malloc(runs * sizeof(double));
+    TagMap* map = NULL;
+    for (int r = 0; r < runs; r++) {
+        freeTagMap(map);
+        double start = benchNow();
+        map = parseTagMap(text, len);
+        times[r] = benchNow() - start;
+        if (map == NULL) return -1;
+    }
+    qsort(times, runs, sizeof(double), _compareDouble);
+    printf("%d tags, %d devices, %.1f KiB config\n", tagMapTags(map),
+           tagMapDevices(map), len / 1024.0);
+    printf("%-16s %10.2f ms\n", "compile", times[runs / 2] * 1e3);
+
+    // every name must come back to its own slot
+    char (*names)[32] = malloc((size_t)tags * sizeof(*names));
+    for (int slot = 0; slot < tags; slot++) {
+        strcpy(names[slot], tagMapName(map, slot));
+        if (tagMapFind(map, names[slot]) != slot) {
+            fprintf(stderr, "lookup of %s failed\n", names[slot]);
+            return -1;
+        }
+    }
+    if (tagMapFind(map, "plc0.missing") != -1) return -1;
+
+    long allocs = benchAllocCount();
+    double start = benchNow();
+    long found = 0;
+    for (int i = 0; i < LOOKUPS; i++)
+        found += tagMapFind(map, names[(long)i * 7919 % tags]) >= 0;
+    double elapsed = benchNow() - start;
+    printf("%-16s %10.1f ns/op %6.2f allocs/op\n", "find",
+           elapsed * 1e9 / LOOKUPS,
+           (double)(benchAllocCount() - allocs) / LOOKUPS);
+
+    int devices = tagMapDevices(map);
+    allocs = benchAllocCount();
+    start = benchNow();
+    for (int i = 0; i < LOOKUPS; i++)
+        found += tagMapFindAddress(map, i % devices,
+                                   2 * (i % TAGS_PER_DEVICE)) >= 0;
+    elapsed = benchNow() - start;
+    printf("%-16s %10.1f ns/op %6.2f allocs/op\n", "findAddress",
+           elapsed * 1e9 / LOOKUPS,
+           (double)(benchAllocCount() - allocs) / LOOKUPS);
+
+    uint16_t registers[2 * TAGS_PER_DEVICE + 2];
+    for (int i = 0; i < 2 * TAGS_PER_DEVICE + 2; i++) registers[i] = i * 257;
+    double sum = 0;
+    allocs = benchAllocCount();
+    start = benchNow();
+    for (int i = 0; i < LOOKUPS; i++) {
+        double value;
+        if (tagDecode(tagMapDecoder(map, i % tags), registers, 0,
+                      2 * TAGS_PER_DEVICE + 2, &value) == 0)
+            sum += value;
+    }
+    elapsed = benchNow() - start;
+    printf("%-16s %10.1f ns/op %6.2f allocs/op\n", "decode",
+           elapsed * 1e9 / LOOKUPS,
+           (double)(benchAllocCount() - allocs) / LOOKUPS);
+
+    if (found != 2L * LOOKUPS || sum == 0) {
+        fprintf(stderr, "unexpected lookup results\n");
+        return -1;
+    }
+
+    free(names);
+    free(times);
+    free(text);
+    freeTagMap(map);
+    return 0;
+}
@@ -0,0 +1,64 @@
+/**
+ * Compares the blocking and io_uring transport backends on a loopback
+ * Read Holding Registers round trip: syscalls per transaction and client
+ * CPU time per 100k requests.
+ *
+ * Usage: transportBench [transactions]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "applicationLayer/modbusApp.h"
+#include "benchUtil.h"
+#include "transportLayer/tcpControl.h"
+
+static int _run(const char* name, TcpBackend requested, int port, int count) {
+    if (tcpSelectBackend(requested) != requested) {
+        printf("%-10s unavailable\n", name);
+        return 0;
+    }
+
+    int socketfd = connectToServer("127.0.0.1", port);
+    if (socketfd < 0) return -1;
+
+    long syscalls = tcpSyscallCount();
+    double cpu = benchThreadCpu();
+    double start = benchNow();
+
+    for (int i = 0; i < count; i++) {
+        int len;
+        uint8_t* response =
+            readHoldingRegisters(socketfd, (uint16_t)i, 0, 10, &len);
+        if (response == NULL) {
+            disconnectFromServer(socketfd);
+            return -1;
+        }
+        free(response);
+    }
+
+    double elapsed = benchNow() - start;
+    cpu = benchThreadCpu() - cpu;
+    syscalls = tcpSyscallCount() - syscalls;
+
+    printf("%-10s %8.2f syscalls/txn %10.0f txn/s %8.1f ms cpu/100k txn\n",
+           name, (double)syscalls / count, count / elapsed,
+           cpu * 1e3 * 100000 / count);
+
+    disconnectFromServer(socketfd);
+    tcpSelectBackend(tcpBlockingBackend);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    int count = argc > 1 ? atoi(argv[1]) : 100000;
+
+    int port;
+    if (benchStartServer(&port) < 0) return -1;
+
+    if (_run("blocking", tcpBlockingBackend, port, count) < 0 ||
+        _run("io_uring", tcpUringBackend, port, count) < 0) {
+        fprintf(stderr, "benchmark failed\n");
+        return -1;
+    }
+    return 0;
+}
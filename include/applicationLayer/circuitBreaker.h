@@ -0,0 +1,48 @@
+#ifndef _CIRCUIT_BREAKER_H_
+#define _CIRCUIT_BREAKER_H_
+
+#include <inttypes.h>
+
+#include "transportLayer/modbusError.h"
+
+#define BREAKER_DEFAULT_THRESHOLD 3
+#define BREAKER_DEFAULT_BACKOFF_NS 1000000000ULL       // 1 s
+#define BREAKER_DEFAULT_MAX_BACKOFF_NS 30000000000ULL  // 30 s
+
+typedef enum t_breakerState {
+    breakerClosed = 0,    // healthy, requests go to the device
+    breakerOpen = 1,      // unresponsive, requests fail without being sent
+    breakerHalfOpen = 2,  // one probe request is testing recovery
+} BreakerState;
+
+/**
+ * @brief health of one device
+ *
+ * After threshold consecutive failures the breaker opens and requests fail
+ * fast. Once backoffNs has passed a single probe is let through: success
+ * closes the breaker, failure reopens it with the backoff doubled up to
+ * maxBackoffNs.
+ *
+ * @param failures consecutive failures seen while closed
+ * @param retryAt CLOCK_MONOTONIC time of the next probe while open
+ * @param trips times the breaker opened
+ * @param rejected requests failed fast
+ */
+typedef struct _circuitBreaker {
+    BreakerState state;
+    int threshold;
+    int failures;
+    uint64_t baseBackoffNs;
+    uint64_t maxBackoffNs;
+    uint64_t backoffNs;
+    uint64_t retryAt;
+    uint64_t trips;
+    uint64_t rejected;
+} CircuitBreaker;
+
+void breakerInit(CircuitBreaker* breaker, int threshold, uint64_t backoffNs,
+                 uint64_t maxBackoffNs);
+int breakerAllow(CircuitBreaker* breaker);
+void breakerRecord(CircuitBreaker* breaker, int result);
+
+#endif  // _CIRCUIT_BREAKER_H_
@@ -0,0 +1,105 @@
+#ifndef _DEVICE_FARM_H_
+#define _DEVICE_FARM_H_
+
+#include <inttypes.h>
+
+#define FARM_MAX_PORTS 1024
+#define FARM_MAX_UNITS 247
+#define FARM_MAX_THREADS 64
+
+/**
+ * @brief behaviour of a simulated slave
+ *
+ * Holding and input registers share one map of `registers` words starting
+ * at address 0. Register `a` of unit `u` starts as (u << 8) | (a & 0xFF),
+ * so clients can tell which device answered.
+ *
+ * @param registers size of the register map, 1 to 65536
+ * @param latencyUs base response latency
+ * @param jitterUs uniform extra latency, 0 to jitterUs
+ * @param tailRate fraction of responses delayed by an extra tailUs, to
+ * shape the tail of the distribution
+ * @param tailUs extra latency of tail responses
+ * @param dropRate fraction of requests left unanswered
+ * @param exceptionRate fraction of valid requests answered with
+ * exceptionCode
+ * @param exceptionCode injected exception, e.g. 0x04 server device failure
+ */
+typedef struct _deviceProfile {
+    uint32_t registers;
+    uint32_t latencyUs;
+    uint32_t jitterUs;
+    double tailRate;
+    uint32_t tailUs;
+    double dropRate;
+    double exceptionRate;
+    uint8_t exceptionCode;
+} DeviceProfile;
+
+/**
+ * @brief layout of a farm: `ports` listening ports, each serving unit ids 1
+ * to `units`, for ports * units devices
+ *
+ * @param basePort first port, consecutive ports follow; 0 for ephemeral
+ * ports, see farmPort
+ * @param ports listening ports, 1 to FARM_MAX_PORTS
+ * @param units unit ids per port, 1 to FARM_MAX_UNITS; other unit ids are
+ * answered with exception 0x0B (gateway target failed to respond)
+ * @param threads event loop threads, ports are spread over them
+ * @param profile initial behaviour of every device
+ * @param seed seed of the drop, exception and latency draws
+ */
+typedef struct _farmConfig {
+    int basePort;
+    int ports;
+    int units;
+    int threads;
+    DeviceProfile profile;
+    uint32_t seed;
+} FarmConfig;
+
+/**
+ * @brief farm wide counters
+ *
+ * @param connections connections accepted
+ * @param requests requests parsed
+ * @param responses responses sent, including exceptions
+ * @param exceptions exception responses, injected or not
+ * @param dropped requests left unanswered on purpose
+ * @param writes socket writes of responses, a write carries every response
+ * ready at once on its connection
+ */
+typedef struct _farmStats {
+    uint64_t connections;
+    uint64_t requests;
+    uint64_t responses;
+    uint64_t exceptions;
+    uint64_t dropped;
+    uint64_t writes;
+} FarmStats;
+
+/**
+ * @brief simulated Modbus TCP slaves served by event loop threads over
+ * loopback or any local address
+ *
+ * Each thread runs an epoll loop over its listening ports and their
+ * connections. Requests are answered in arrival order unless latency draws
+ * reorder them, like a gateway in front of independent devices. Every
+ * complete request of a read is executed before the responses are written
+ * back together, so pipelining clients get one write per read, not one per
+ * response.
+ * Supported functions: 0x03, 0x04, 0x06 and 0x10.
+ */
+typedef struct _deviceFarm DeviceFarm;
+
+DeviceFarm* newDeviceFarm(const FarmConfig* config);
+void freeDeviceFarm(DeviceFarm* farm);
+
+int farmPort(DeviceFarm* farm, int index);
+int farmSetProfile(DeviceFarm* farm, int index, uint8_t unit,
+                   const DeviceProfile* profile);
+uint16_t* farmRegisters(DeviceFarm* farm, int index, uint8_t unit,
+                        uint32_t* count);
+void farmGetStats(DeviceFarm* farm, FarmStats* stats);
+
+#endif  // _DEVICE_FARM_H_
@@ -4,12 +4,21 @@
 
 #include <inttypes.h>
 
+#include "transportLayer/tcpControl.h"
+
 #define MODBUS_ADDRESS_MIN 0x0000       // 0
 #define MODBUS_ADDRESS_MAX 0xFFFF       // 65535
 #define MODBUS_QUANTITY_MIN 0x0001      // 1
 #define MODBUS_RHR_QUANTITY_MAX 0x007D  // 125
 #define MODBUS_WMR_QUANTITY_MAX 0x007B  // 123
 
+// request pdu lengths: function code, address, quantity (+ byte count, data)
+#define MODBUS_RHR_REQUEST_LEN 5
+#define MODBUS_WMR_REQUEST_LEN(quantity) (6 + 2 * (quantity))
+
+// MBAP header + Read Holding Registers request pdu
+#define MODBUS_RHR_FRAME_LEN (7 + MODBUS_RHR_REQUEST_LEN)
+
 #define TIMEOUT_SEC 1
 #define TIMEOUT_USEC 0
 
@@ -18,7 +27,41 @@ typedef enum t_functionCode {
     writeMultipleRegsFuncCode = 0x10,  // 16
 } functionCode;
 
+int encodeReadHoldingRegs(uint16_t startingAddress, uint16_t quantity,
+                          uint8_t* pdu);
+int encodeWriteMultipleRegs(uint16_t startingAddress, uint16_t quantity,
+                            uint16_t* data, uint8_t* pdu);
+uint8_t* newReadHoldingRegs(uint16_t startingAddress, uint16_t quantity,
+                            int* len);
+uint8_t* newWriteMultipleRegs(uint16_t startingAddress, uint16_t quantity,
+                              uint16_t* data, int* len);
+
+/**
+ * @brief Read Holding Registers request compiled once for a fixed
+ * address/quantity pair, only the transaction id is patched per send
+ *
+ * @param frame complete request frame
+ * @param quantity number of registers read
+ * @param responseLen expected length of a successful response pdu
+ */
+typedef struct _requestTemplate {
+    uint8_t frame[MODBUS_RHR_FRAME_LEN];
+    uint16_t quantity;
+    int responseLen;
+} RequestTemplate;
+
+int compileReadHoldingRegs(RequestTemplate* request, uint16_t startingAddress,
+                           uint16_t quantity);
+
+int parseReadHoldingRegsResponse(uint8_t* response, int rlen,
+                                 uint16_t quantity, uint16_t* values);
+int parseWriteMultipleRegsResponse(uint8_t* response, int rlen,
+                                   uint16_t startingAddress,
+                                   uint16_t quantity);
+
 int connectToServer(char* ip, int port);
+int connectToServerTLS(char* ip, int port);
+int connectToServerProfile(char* ip, int port, const TcpProfile* profile);
 void disconnectFromServer(int socketfd);
 
 uint8_t* writeMultipleRegisters(int socketfd, uint16_t id,
@@ -28,4 +71,13 @@ uint8_t* readHoldingRegisters(int socketfd, uint16_t id,
                               uint16_t startingAddress, uint16_t quantity,
                               int* rlen);
 
+int writeMultipleRegistersFrom(int socketfd, uint16_t id,
+                               uint16_t startingAddress, uint16_t quantity,
+                               uint16_t* data);
+int readHoldingRegistersInto(int socketfd, uint16_t id,
+                             uint16_t startingAddress, uint16_t quantity,
+                             uint16_t* values);
+int readHoldingRegistersTemplate(int socketfd, uint16_t id,
+                                 RequestTemplate* request, uint16_t* values);
+
 #endif  // _MODBUS_APP_H_
\ No newline at end of file
@@ -0,0 +1,48 @@
+#ifndef _MODBUS_CLIENT_H_
+#define _MODBUS_CLIENT_H_
+
+#include <inttypes.h>
+
+#include "applicationLayer/circuitBreaker.h"
+
+/**
+ * @brief connection to one server that can be shared by many threads
+ *
+ * The client owns the socket, hands out transaction identifiers and
+ * serialises frame writes. While several threads wait for responses, one of
+ * them reads frames off the socket and hands each one to the thread that
+ * sent the matching request.
+ *
+ * Each unit has a circuit breaker: once a unit stops answering its requests
+ * fail immediately, without waiting for the receive timeout, until a probe
+ * gets an answer again.
+ *
+ * The io_uring backend (tcpUringBackend) belongs to one thread: a client
+ * used through it is single threaded, and requests from any other thread
+ * fail with modbusErrInvalid. Threads sharing a client must all use the
+ * blocking backend.
+ */
+typedef struct _modbusClient ModbusClient;
+
+ModbusClient* newModbusClient(char* ip, int port);
+ModbusClient* newModbusClientTLS(char* ip, int port);
+void freeModbusClient(ModbusClient* client);
+
+void clientSetBreaker(ModbusClient* client, int threshold, uint64_t backoffNs,
+                      uint64_t maxBackoffNs);
+void clientUnitHealth(ModbusClient* client, uint8_t unit,
+                      CircuitBreaker* breaker);
+
+uint8_t* clientTransact(ModbusClient* client, uint8_t* pdu, int pduLen,
+                        int* rlen);
+uint8_t* clientTransactUnit(ModbusClient* client, uint8_t unit, uint8_t* pdu,
+                            int pduLen, int* rlen);
+uint8_t* clientReadHoldingRegisters(ModbusClient* client,
+                                    uint16_t startingAddress,
+                                    uint16_t quantity, int* rlen);
+uint8_t* clientWriteMultipleRegisters(ModbusClient* client,
+                                      uint16_t startingAddress,
+                                      uint16_t quantity, uint16_t* data,
+                                      int* rlen);
+
+#endif  // _MODBUS_CLIENT_H_
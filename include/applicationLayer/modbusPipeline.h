@@ -0,0 +1,153 @@
+#ifndef _MODBUS_PIPELINE_H_
+#define _MODBUS_PIPELINE_H_
+
+#include <inttypes.h>
+
+#include "applicationLayer/requestQueue.h"
+#include "transportLayer/slabPool.h"
+
+// maximum transactions in flight on one connection, power of 2
+#define MODBUS_PIPELINE_MAX_WINDOW 256
+
+// default bounds on queued (not yet sent) transactions
+#define PIPELINE_DEFAULT_QUEUE_LIMIT 4096
+#define PIPELINE_DEFAULT_UNIT_QUEUE_LIMIT 1024
+
+// response times kept to compute the hedge delay, power of 2
+#define PIPELINE_LATENCY_SAMPLES 256
+
+/**
+ * @brief what pipelineSubmitUnit does when a queue bound is reached
+ */
+typedef enum t_overloadPolicy {
+    overloadReject = 0,          // fail the new request
+    overloadDropOldestPoll = 1,  // fail the oldest queued poll to make room
+    overloadBlock = 2,           // process the connection until there is room
+} OverloadPolicy;
+
+/**
+ * @brief queue metrics of a pipeline
+ *
+ * @param depth transactions queued now, in flight ones excluded
+ * @param peakDepth highest depth seen
+ * @param accepted requests queued
+ * @param rejected requests refused because a bound was reached
+ * @param dropped queued polls failed to make room
+ * @param blocked submissions that had to wait for room
+ * @param sent transactions sent, per lane
+ * @param totalWaitNs time between queueing and sending, summed per lane,
+ *   divide by sent for the mean
+ * @param maxWaitNs longest time between queueing and sending, per lane
+ */
+typedef struct _queueStats {
+    int depth;
+    int peakDepth;
+    uint64_t accepted;
+    uint64_t rejected;
+    uint64_t dropped;
+    uint64_t blocked;
+    uint64_t sent[REQUEST_LANES];
+    uint64_t totalWaitNs[REQUEST_LANES];
+    uint64_t maxWaitNs[REQUEST_LANES];
+} QueueStats;
+
+/**
+ * @brief when a read is sent a second time
+ *
+ * A Read Holding or Input Registers request (FC03/FC04) still unanswered
+ * after the hedge delay is sent again with a new transaction id; the first
+ * response completes the transaction and the other is discarded. The delay
+ * is the given percentile of the recent response times, never less than
+ * minDelayNs. Every read sent earns `budget` hedges, up to `burst`, and
+ * each hedge spends one, so hedges stay below that share of the traffic.
+ *
+ * @param percentile of the response times, e.g. 0.95
+ * @param minDelayNs lower bound of the delay, used alone until enough
+ * responses were timed
+ * @param budget hedges earned per read sent, e.g. 0.05
+ * @param burst most hedges that can be saved up
+ */
+typedef struct _hedgePolicy {
+    double percentile;
+    uint64_t minDelayNs;
+    double budget;
+    double burst;
+} HedgePolicy;
+
+/**
+ * @brief how failed transactions are sent again, any function code
+ *
+ * A transaction failing with a retryable error or exception (see
+ * modbusRetryable) is queued again after a backoff that doubles with each
+ * attempt, up to maxBackoffNs, and is jittered to between half and all of
+ * it so that devices recovering together are not hit together.
+ *
+ * @param retries attempts after the first one
+ * @param backoffNs backoff before the first retry
+ * @param maxBackoffNs longest backoff
+ */
+typedef struct _retryPolicy {
+    int retries;
+    uint64_t backoffNs;
+    uint64_t maxBackoffNs;
+} RetryPolicy;
+
+/**
+ * @brief hedging and retry metrics of a pipeline
+ *
+ * @param hedged hedges sent
+ * @param hedgeWins hedged reads answered first by the hedge
+ * @param hedgeDenied hedges not sent for lack of budget
+ * @param discarded late responses to a copy that was no longer awaited
+ * @param retried transactions queued again after a failure
+ * @param delayNs current hedge delay
+ */
+typedef struct _hedgeStats {
+    uint64_t hedged;
+    uint64_t hedgeWins;
+    uint64_t hedgeDenied;
+    uint64_t discarded;
+    uint64_t retried;
+    uint64_t delayNs;
+} HedgeStats;
+
+/**
+ * @brief a connection that keeps several transactions in flight, sent from
+ * its priority lanes and matched back by transaction identifier
+ *
+ * One pipeline can serve every unit behind a gateway, each request carries
+ * its own unit identifier.
+ *
+ * Hedges and retries go out from pipelineDispatch: an event loop calls it
+ * again by pipelineNextDeadline, as the task loop does. It also calls
+ * pipelineExpire, which fails each transaction on its own deadline.
+ */
+typedef struct _modbusPipeline ModbusPipeline;
+
+ModbusPipeline* newModbusPipeline(int socketfd, int window);
+void freeModbusPipeline(ModbusPipeline* pipeline);
+
+int pipelineSetLaneCap(ModbusPipeline* pipeline, RequestLane lane, int cap);
+int pipelineSetUnitCap(ModbusPipeline* pipeline, int cap);
+int pipelineSetQueueLimits(ModbusPipeline* pipeline, int limit, int unitLimit,
+                           OverloadPolicy policy);
+int pipelineSetHedging(ModbusPipeline* pipeline, const HedgePolicy* policy);
+int pipelineSetRetry(ModbusPipeline* pipeline, const RetryPolicy* policy);
+
+int pipelineSubmit(ModbusPipeline* pipeline, RequestLane lane, uint8_t* pdu,
+                   int pduLen, TransactionCallback callback, void* context);
+int pipelineSubmitUnit(ModbusPipeline* pipeline, uint8_t unit,
+                       RequestLane lane, uint8_t* pdu, int pduLen,
+                       TransactionCallback callback, void* context);
+int pipelineDispatch(ModbusPipeline* pipeline);
+int pipelineProcess(ModbusPipeline* pipeline);
+int pipelinePending(ModbusPipeline* pipeline);
+uint64_t pipelineNextDeadline(ModbusPipeline* pipeline);
+int pipelineSocket(ModbusPipeline* pipeline);
+void pipelineAbort(ModbusPipeline* pipeline);
+uint64_t pipelineExpire(ModbusPipeline* pipeline, uint64_t timeoutNs);
+void pipelineAllocatorStats(ModbusPipeline* pipeline, SlabStats* stats);
+void pipelineQueueStats(ModbusPipeline* pipeline, QueueStats* stats);
+void pipelineHedgeStats(ModbusPipeline* pipeline, HedgeStats* stats);
+
+#endif  // _MODBUS_PIPELINE_H_
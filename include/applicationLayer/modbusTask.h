@@ -0,0 +1,51 @@
+#ifndef _MODBUS_TASK_H_
+#define _MODBUS_TASK_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include "applicationLayer/modbusPipeline.h"
+
+#define TASK_DEFAULT_STACK_SIZE (64 * 1024)
+
+/**
+ * @brief body of a task, runs on its own stack and may call the await
+ * functions below, which suspend the task until their result is ready
+ */
+typedef void (*TaskFunction)(void* argument);
+
+/**
+ * @brief single threaded event loop running stackful tasks over pipelined
+ * connections
+ *
+ * Tasks are cooperative: they only give up the thread in the await
+ * functions, taskSleep and taskYield. Each thread that wants to run tasks
+ * creates its own loop; pipelines and tasks belong to one loop. Pipelines
+ * must use the blocking transport backend (the default), readiness is
+ * taken from poll on their sockets.
+ *
+ * Stacks are fixed size and not guarded, tasks must not keep large buffers
+ * on the stack.
+ */
+typedef struct _taskLoop TaskLoop;
+
+TaskLoop* newTaskLoop(size_t stackSize);
+void freeTaskLoop(TaskLoop* loop);
+
+int taskLoopAddPipeline(TaskLoop* loop, ModbusPipeline* pipeline);
+int taskSpawn(TaskLoop* loop, TaskFunction function, void* argument);
+int taskLoopRun(TaskLoop* loop);
+
+void taskYield(void);
+void taskSleep(uint64_t ns);
+
+int awaitTransact(ModbusPipeline* pipeline, uint8_t unit, RequestLane lane,
+                  uint8_t* pdu, int pduLen, uint8_t* response);
+int awaitReadHoldingRegisters(ModbusPipeline* pipeline, uint8_t unit,
+                              uint16_t startingAddress, uint16_t quantity,
+                              uint16_t* values);
+int awaitWriteMultipleRegisters(ModbusPipeline* pipeline, uint8_t unit,
+                                uint16_t startingAddress, uint16_t quantity,
+                                uint16_t* data);
+
+#endif  // _MODBUS_TASK_H_
@@ -0,0 +1,50 @@
+#ifndef _POLL_SCHEDULER_H_
+#define _POLL_SCHEDULER_H_
+
+#include <inttypes.h>
+
+#define POLL_PERIOD_MIN_NS 1000000ULL               // 1 ms
+#define POLL_PERIOD_MAX_NS (3600ULL * 1000000000ULL)  // 1 hour
+
+/**
+ * @brief work done by a poll group on each of its deadlines
+ *
+ * @param context pointer given when the group was added
+ * @return 0 to keep polling, anything else stops the scheduler and is
+ * returned by schedulerRun
+ */
+typedef int (*PollCallback)(void* context);
+
+/**
+ * @brief timing statistics of a poll group
+ *
+ * @param runs number of times the callback ran
+ * @param overruns deadlines skipped because a run ended past the next one
+ * @param maxJitterNs worst delay between a deadline and the callback start
+ * @param totalJitterNs sum of the delays, divide by runs for the mean
+ * @param lastDurationNs duration of the last callback run
+ * @param maxDurationNs longest callback run
+ */
+typedef struct _pollStats {
+    uint64_t runs;
+    uint64_t overruns;
+    int64_t maxJitterNs;
+    int64_t totalJitterNs;
+    int64_t lastDurationNs;
+    int64_t maxDurationNs;
+} PollStats;
+
+typedef struct _pollScheduler PollScheduler;
+
+PollScheduler* newPollScheduler(void);
+void freePollScheduler(PollScheduler* scheduler);
+
+int schedulerAddGroup(PollScheduler* scheduler, uint64_t periodNs,
+                      PollCallback callback, void* context);
+int schedulerRunOnce(PollScheduler* scheduler);
+int schedulerRun(PollScheduler* scheduler);
+void schedulerStop(PollScheduler* scheduler);
+
+int schedulerGetStats(PollScheduler* scheduler, int group, PollStats* stats);
+
+#endif  // _POLL_SCHEDULER_H_
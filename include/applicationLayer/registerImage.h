@@ -0,0 +1,71 @@
+#ifndef _REGISTER_IMAGE_H_
+#define _REGISTER_IMAGE_H_
+
+#include <inttypes.h>
+
+#define IMAGE_MIN_BUFFERS 2
+#define IMAGE_MAX_BUFFERS 8
+
+/**
+ * @brief consistent view of one complete scan, valid until imageRelease
+ *
+ * @param values registers firstAddress to firstAddress + count - 1
+ * @param firstAddress address of values[0]
+ * @param count registers in the image
+ * @param sequence number of the scan, 1 for the first published one
+ * @param timestampNs CLOCK_MONOTONIC time the scan started
+ * @param buffer buffer held by the snapshot, for imageRelease
+ */
+typedef struct _registerSnapshot {
+    const uint16_t* values;
+    uint16_t firstAddress;
+    uint32_t count;
+    uint64_t sequence;
+    uint64_t timestampNs;
+    int buffer;
+} RegisterSnapshot;
+
+/**
+ * @brief scan statistics of an image
+ *
+ * @param published scans published
+ * @param failed scans abandoned because a read failed
+ * @param skipped scans not started because readers held every spare buffer
+ */
+typedef struct _imageStats {
+    uint64_t published;
+    uint64_t failed;
+    uint64_t skipped;
+} ImageStats;
+
+/**
+ * @brief multi-buffered image of a device's register span
+ *
+ * One poller writes, any number of threads read, nobody locks. The poller
+ * fills a back buffer (imageBegin) and publishes it with one atomic store
+ * of its index together with the next sequence number (imagePublish).
+ * Readers pin the published buffer (imageAcquire) and read it in place
+ * while the poller fills another one, so a scan split over several
+ * requests is never seen half updated.
+ *
+ * With 2 buffers a scan is skipped while a reader still holds the previous
+ * image, with 3 or more the poller always finds a free one unless readers
+ * hold snapshots across several scans.
+ */
+typedef struct _registerImage RegisterImage;
+
+RegisterImage* newRegisterImage(uint16_t firstAddress, uint32_t count,
+                                int buffers);
+void freeRegisterImage(RegisterImage* image);
+
+uint16_t* imageBegin(RegisterImage* image);
+void imagePublish(RegisterImage* image, uint64_t timestampNs);
+void imageAbandon(RegisterImage* image);
+int imageScan(RegisterImage* image, int socketfd, uint16_t id);
+
+int imageAcquire(RegisterImage* image, RegisterSnapshot* snapshot);
+void imageRelease(RegisterImage* image, RegisterSnapshot* snapshot);
+uint64_t imageSequence(RegisterImage* image);
+void imageGetStats(RegisterImage* image, ImageStats* stats);
+
+#endif  // _REGISTER_IMAGE_H_
@@ -0,0 +1,123 @@
+#ifndef _REQUEST_QUEUE_H_
+#define _REQUEST_QUEUE_H_
+
+#include <inttypes.h>
+
+#include "transportLayer/dataPackaging.h"
+
+/**
+ * @brief dispatch priority of a transaction, lower values go first
+ */
+typedef enum t_requestLane {
+    commandLane = 0,     // operator writes and setpoints
+    alarmLane = 1,       // alarm and event reads
+    pollLane = 2,        // normal cyclic polling
+    backgroundLane = 3,  // bulk uploads, diagnostics
+} RequestLane;
+
+#define REQUEST_LANES 4
+
+// a waiting lane is served after being passed over this many times
+#define REQUEST_STARVATION_LIMIT 8
+
+// lanes from this one on share lowInFlightCap
+#define REQUEST_LOW_LANES pollLane
+
+// unit identifiers addressable on one connection (0 to 255)
+#define REQUEST_UNITS 256
+
+typedef struct _modbusTransaction ModbusTransaction;
+
+/**
+ * @brief called once per transaction, when its response arrives or when it
+ * fails (responseLen < 0), after any retries
+ */
+typedef void (*TransactionCallback)(ModbusTransaction* txn, void* context);
+
+/**
+ * @brief one request/response exchange
+ *
+ * @param id transaction identifier, assigned when the request is sent
+ * @param unit unit identifier of the addressed slave
+ * @param lane dispatch priority
+ * @param pdu request protocol data unit
+ * @param response response protocol data unit
+ * @param responseLen response length, a negative ModbusError if the
+ * transaction failed
+ * @param enqueuedNs, sentNs, completedNs CLOCK_MONOTONIC timestamps
+ * @param attempts sends so far, retries included
+ * @param retryAt CLOCK_MONOTONIC time a failed transaction is sent again
+ * @param twin the other copy while a hedged read is in flight
+ * @param hedge set on the copy, which has no callback of its own
+ * @param next queue link
+ */
+struct _modbusTransaction {
+    uint16_t id;
+    uint8_t unit;
+    RequestLane lane;
+    uint8_t pdu[MODBUS_MAX_PDU_SIZE];
+    int pduLen;
+    uint8_t response[MODBUS_MAX_PDU_SIZE];
+    int responseLen;
+    uint64_t enqueuedNs;
+    uint64_t sentNs;
+    uint64_t completedNs;
+    int attempts;
+    uint64_t retryAt;
+    ModbusTransaction* twin;
+    int hedge;
+    TransactionCallback callback;
+    void* context;
+    ModbusTransaction* next;
+};
+
+/**
+ * @brief FIFO of one unit within a lane
+ *
+ * @param next following unit in the lane's round robin ring
+ */
+typedef struct _unitQueue {
+    ModbusTransaction* head;
+    ModbusTransaction* tail;
+    uint8_t next;
+} UnitQueue;
+
+/**
+ * @brief per connection queues, one per lane, each split into one FIFO per
+ * unit served round robin so a busy unit cannot starve the others
+ *
+ * @param ring last unit of each lane's round robin ring of units with
+ *   queued work, -1 if the lane is empty
+ * @param inFlightCap maximum number of sent but unanswered transactions of
+ *   each lane
+ * @param lowInFlightCap maximum of the poll and background lanes together,
+ *   below the window so commands and alarms keep a slot
+ * @param skipped times each lane was passed over while it had work
+ * @param unitInFlightCap maximum number of sent but unanswered transactions
+ *   of each unit
+ * @param unitDepth queued transactions of each unit, all lanes together
+ */
+typedef struct _requestQueue {
+    UnitQueue units[REQUEST_LANES][REQUEST_UNITS];
+    int ring[REQUEST_LANES];
+    int depth[REQUEST_LANES];
+    int inFlight[REQUEST_LANES];
+    int inFlightCap[REQUEST_LANES];
+    int lowInFlightCap;
+    int skipped[REQUEST_LANES];
+    int unitInFlight[REQUEST_UNITS];
+    int unitInFlightCap;
+    int unitDepth[REQUEST_UNITS];
+} RequestQueue;
+
+void requestQueueInit(RequestQueue* queue, int window);
+void requestQueuePush(RequestQueue* queue, ModbusTransaction* txn);
+ModbusTransaction* requestQueuePop(RequestQueue* queue);
+ModbusTransaction* requestQueueTake(RequestQueue* queue);
+ModbusTransaction* requestQueueEvict(RequestQueue* queue, RequestLane lane,
+                                     int unit);
+void requestQueueRelease(RequestQueue* queue, ModbusTransaction* txn);
+
+int requestQueueDepth(RequestQueue* queue);
+
+#endif  // _REQUEST_QUEUE_H_
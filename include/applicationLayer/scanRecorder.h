@@ -0,0 +1,44 @@
+#ifndef _SCAN_RECORDER_H_
+#define _SCAN_RECORDER_H_
+
+#include <inttypes.h>
+
+// scans buffered in memory and compressed together
+#define RECORDER_BLOCK_SCANS 256
+
+/**
+ * @brief append-only writer of one device's scans
+ *
+ * Scans are buffered RECORDER_BLOCK_SCANS at a time and written as one
+ * compressed block: delta-of-delta timestamps followed by one column per
+ * register of run length encoded value deltas. Every block gets an entry in
+ * the "<path>.idx" side file, used to find blocks by time.
+ */
+typedef struct _scanRecorder ScanRecorder;
+
+/**
+ * @brief read-only, memory mapped view of a recorded file
+ */
+typedef struct _scanArchive ScanArchive;
+
+/**
+ * @brief called for every scan found by archiveQuery
+ *
+ * @return 0 to continue, anything else stops the query and is returned
+ */
+typedef int (*ScanVisitor)(uint64_t timestampNs, const uint16_t* values,
+                           int registers, void* context);
+
+ScanRecorder* newScanRecorder(const char* path, int registers);
+int recorderAppend(ScanRecorder* recorder, uint64_t timestampNs,
+                   const uint16_t* values);
+int recorderFlush(ScanRecorder* recorder);
+void freeScanRecorder(ScanRecorder* recorder);
+
+ScanArchive* openScanArchive(const char* path);
+int archiveRegisters(ScanArchive* archive);
+int archiveQuery(ScanArchive* archive, uint64_t fromNs, uint64_t toNs,
+                 ScanVisitor visitor, void* context);
+void closeScanArchive(ScanArchive* archive);
+
+#endif  // _SCAN_RECORDER_H_
@@ -0,0 +1,128 @@
+#ifndef _SCAN_STREAM_H_
+#define _SCAN_STREAM_H_
+
+#include <inttypes.h>
+
+#define STREAM_MAGIC 0x5453424D  // "MBST"
+#define STREAM_VERSION 1
+
+// bytes buffered before publishing writes them out
+#define STREAM_BATCH_BYTES (64 * 1024)
+#define STREAM_DEFAULT_LIMIT (4 * 1024 * 1024)
+
+#define STREAM_MAX_SCHEMAS 65535
+#define STREAM_NAME_MAX 64
+
+/**
+ * @brief record types, see the record structures below
+ */
+typedef enum t_streamRecordType {
+    streamHello = 1,   // first record of a stream
+    streamSchema = 2,  // layout of the scans tagged with its schema id
+    streamScan = 3,    // one scan of a device
+    streamGap = 4,     // scans dropped since the previous record
+} StreamRecordType;
+
+/**
+ * @brief what streamPublish does when the consumer is behind by the limit
+ */
+typedef enum t_streamPolicy {
+    streamBlock = 0,  // wait until the consumer catches up
+    streamDrop = 1,   // drop the scan, a streamGap record reports it
+} StreamPolicy;
+
+// Records are written in host byte order, the consumer is local. Every
+// record starts with a StreamHeader whose length covers the whole record,
+// header included, so unknown types can be skipped.
+
+typedef struct __attribute__((packed)) _streamHeader {
+    uint32_t length;
+    uint16_t type;
+    uint16_t schema;  // schema id for streamSchema and streamScan, else 0
+} StreamHeader;
+
+typedef struct __attribute__((packed)) _streamHello {
+    StreamHeader header;
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+} StreamHello;
+
+/**
+ * @brief sent once per schema, before its first scan; the name (not NUL
+ * terminated) fills the rest of the record
+ */
+typedef struct __attribute__((packed)) _streamSchemaRecord {
+    StreamHeader header;
+    uint32_t device;  // caller defined device id
+    uint16_t firstAddress;
+    uint16_t count;
+} StreamSchemaRecord;
+
+/**
+ * @brief count registers from the schema's firstAddress follow
+ */
+typedef struct __attribute__((packed)) _streamScanRecord {
+    StreamHeader header;
+    uint64_t timestampNs;
+} StreamScanRecord;
+
+typedef struct __attribute__((packed)) _streamGapRecord {
+    StreamHeader header;
+    uint64_t dropped;
+} StreamGapRecord;
+
+/**
+ * @brief stream statistics
+ *
+ * @param scans scans published
+ * @param registers register values published
+ * @param bytes bytes written to the consumer
+ * @param writes write calls
+ * @param dropped scans dropped by streamDrop
+ * @param blocked times streamBlock waited for the consumer
+ */
+typedef struct _streamStats {
+    uint64_t scans;
+    uint64_t registers;
+    uint64_t bytes;
+    uint64_t writes;
+    uint64_t dropped;
+    uint64_t blocked;
+} StreamStats;
+
+/**
+ * @brief called by streamParse for every complete record
+ *
+ * @return 0 to continue, anything else stops the parse and is returned
+ */
+typedef int (*StreamVisitor)(const StreamHeader* record, void* context);
+
+/**
+ * @brief binary stream of scan results to one local consumer, over a Unix
+ * domain socket, a pipe or any file descriptor
+ *
+ * Scans of every device are appended to one buffer as length prefixed
+ * records tagged with their schema, and written out STREAM_BATCH_BYTES at
+ * a time or on streamFlush, without text formatting. Output the consumer
+ * has not taken yet stays buffered; beyond the limit the policy applies.
+ */
+typedef struct _scanStream ScanStream;
+
+int streamConnect(const char* path);
+
+ScanStream* newScanStream(int fd, StreamPolicy policy, int limit);
+void freeScanStream(ScanStream* stream);
+
+int streamAddSchema(ScanStream* stream, uint32_t device,
+                    uint16_t firstAddress, uint16_t count, const char* name);
+int streamPublish(ScanStream* stream, int schema, uint64_t timestampNs,
+                  const uint16_t* values);
+int streamFlush(ScanStream* stream);
+int streamBuffered(ScanStream* stream);
+void streamGetStats(ScanStream* stream, StreamStats* stats);
+
+int streamParse(const uint8_t* buffer, int len, int* consumed,
+                StreamVisitor visitor, void* context);
+
+#endif  // _SCAN_STREAM_H_
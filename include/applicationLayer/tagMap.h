@@ -0,0 +1,98 @@
+#ifndef _TAG_MAP_H_
+#define _TAG_MAP_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+
+/**
+ * @brief how the registers of a tag are turned into a value
+ *
+ * 32 bit types span two registers, high word first unless word swapped
+ * (the "s" suffix in the configuration, e.g. f32s). tagBit takes one bit of
+ * a single register.
+ */
+typedef enum t_tagType {
+    tagU16 = 0,
+    tagI16,
+    tagU32,
+    tagI32,
+    tagF32,
+    tagBit,
+} TagType;
+
+/**
+ * @brief precomputed decode descriptor of a tag, value = raw * scale +
+ * offset
+ *
+ * @param address first holding register
+ * @param words registers spanned, 1 or 2
+ * @param wordSwap low word first
+ * @param bit bit of a tagBit
+ * @param device index of the device
+ */
+typedef struct _tagDecoder {
+    uint16_t address;
+    uint8_t type;
+    uint8_t words;
+    uint8_t wordSwap;
+    uint8_t bit;
+    uint16_t device;
+    float scale;
+    float offset;
+} TagDecoder;
+
+/**
+ * @brief a device of the map and the span of registers its tags cover
+ *
+ * @param firstSlot slot of its first tag, its tags are the tagCount next
+ * slots, ordered by address
+ * @param firstAddress lowest register of its tags
+ * @param registerCount registers from firstAddress to the end of its last
+ * tag
+ */
+typedef struct _tagDevice {
+    const char* name;
+    const char* host;
+    int port;
+    uint8_t unit;
+    int firstSlot;
+    int tagCount;
+    uint16_t firstAddress;
+    uint32_t registerCount;
+} TagDevice;
+
+/**
+ * @brief devices and tags compiled into flat arrays
+ *
+ * Tags are numbered by slot: grouped by device, sorted by address within a
+ * device. Names are "<device>.<tag>" and are found through a perfect hash,
+ * one probe and one string compare per lookup. Nothing is allocated after
+ * loading.
+ *
+ * Configuration, one record per line, '#' starts a comment:
+ *
+ *   device,<name>,<host>,<port>,<unit>
+ *   tag,<name>,<address>,<type>[,<scale>[,<offset>]]
+ *
+ * A tag belongs to the last device above it. Types: u16, i16, u32, i32,
+ * f32, u32s, i32s, f32s (word swapped) and bit0 to bit15.
+ */
+typedef struct _tagMap TagMap;
+
+TagMap* loadTagMap(const char* path);
+TagMap* parseTagMap(const char* text, size_t len);
+void freeTagMap(TagMap* map);
+
+int tagMapDevices(TagMap* map);
+int tagMapTags(TagMap* map);
+int tagMapDevice(TagMap* map, int device, TagDevice* out);
+
+int tagMapFind(TagMap* map, const char* name);
+int tagMapFindAddress(TagMap* map, int device, uint16_t address);
+const char* tagMapName(TagMap* map, int slot);
+const TagDecoder* tagMapDecoder(TagMap* map, int slot);
+
+int tagDecode(const TagDecoder* decoder, const uint16_t* registers,
+              uint16_t firstAddress, int count, double* value);
+
+#endif  // _TAG_MAP_H_
@@ -0,0 +1,49 @@
+#ifndef _WORK_POOL_H_
+#define _WORK_POOL_H_
+
+#include <inttypes.h>
+
+#define WORK_POOL_MAX_WORKERS 256
+
+/**
+ * @brief one unit of work, e.g. a poll cycle of a device
+ */
+typedef void (*WorkFunction)(void* argument);
+
+/**
+ * @brief activity of one worker
+ *
+ * @param executed jobs run by the worker
+ * @param stolen jobs among them taken from another worker's queue
+ * @param idleWaits times the worker found no work anywhere and slept
+ */
+typedef struct _workStats {
+    uint64_t executed;
+    uint64_t stolen;
+    uint64_t idleWaits;
+} WorkStats;
+
+/**
+ * @brief worker threads, optionally pinned to cores, each owning a queue of
+ * jobs
+ *
+ * Jobs are queued on a home worker, so the devices of a shard keep running
+ * on the same core. A worker that runs out of work steals the oldest jobs of
+ * the others, so a burst on a few devices spreads over idle cores. A job
+ * can therefore run on any worker. Jobs use the blocking transport backend,
+ * because an io_uring instance belongs to a single thread.
+ */
+typedef struct _workPool WorkPool;
+
+WorkPool* newWorkPool(int workers, const int* cpus);
+void freeWorkPool(WorkPool* pool);
+
+int workPoolSubmit(WorkPool* pool, int home, WorkFunction function,
+                   void* argument);
+void workPoolWait(WorkPool* pool);
+
+int workPoolWorkers(WorkPool* pool);
+int workPoolCurrentWorker(void);
+int workPoolGetStats(WorkPool* pool, int worker, WorkStats* stats);
+
+#endif  // _WORK_POOL_H_
@@ -30,10 +30,21 @@ typedef struct _modbusADU {
 ModbusADU* newModbusADU(uint16_t transactionID, uint8_t* pdu, int pduLen);
 void freeModbusADU(ModbusADU* adu);
 
+int encodeModbusADU(ModbusADU* adu, uint8_t* frame, int frameLen);
+int parseMBAPHeader(uint8_t* header, ModbusADU* adu);
+int parseModbusADU(uint8_t* frame, int frameLen, ModbusADU* adu);
+ModbusADU* decodeModbusADU(uint8_t* frame, int frameLen);
+
 int sendModbusADU(int socketfd, ModbusADU* adu);
+int receiveModbusFrame(int socketfd, ModbusADU* adu, uint8_t* pdu,
+                       int pduCap);
 ModbusADU* receiveModbusADU(int socketfd);
 
 #define UNIT_ID 1
 #define PROTOCOL_ID 0
 
+#define MODBUS_MBAP_HEADER_SIZE 7
+#define MODBUS_MAX_PDU_SIZE 253
+#define MODBUS_MAX_ADU_SIZE (MODBUS_MBAP_HEADER_SIZE + MODBUS_MAX_PDU_SIZE)
+
 #endif  // _MODBUS_DATA_PACKAGING_H_
\ No newline at end of file
@@ -0,0 +1,59 @@
+#ifndef _MODBUS_ERROR_H_
+#define _MODBUS_ERROR_H_
+
+#include <inttypes.h>
+
+// exception codes of the Modbus application protocol
+#define MODBUS_ILLEGAL_FUNCTION 0x01
+#define MODBUS_ILLEGAL_DATA_ADDRESS 0x02
+#define MODBUS_ILLEGAL_DATA_VALUE 0x03
+#define MODBUS_SERVER_DEVICE_FAILURE 0x04
+#define MODBUS_ACKNOWLEDGE 0x05
+#define MODBUS_SERVER_DEVICE_BUSY 0x06
+// exception codes a gateway returns for a slave that does not answer
+#define MODBUS_GATEWAY_PATH_UNAVAILABLE 0x0A
+#define MODBUS_GATEWAY_TARGET_FAILED 0x0B
+
+// messages logged per error code and window, the rest are only counted
+#define MODBUS_LOG_BURST 5
+#define MODBUS_LOG_WINDOW_NS 1000000000ULL  // 1 s
+
+/**
+ * @brief why a request failed
+ *
+ * Functions returning an int report these negative codes, or the positive
+ * exception code (1 to 255) when the server answered with an exception.
+ * Functions returning a pointer return NULL and leave the code in
+ * modbusLastError. -1 and -2 keep their earlier meaning, so callers testing
+ * for < 0 are unaffected.
+ */
+typedef enum t_modbusError {
+    modbusOk = 0,
+    modbusErrInvalid = -1,       // invalid argument, nothing was sent
+    modbusErrIdMismatch = -2,    // response to another transaction
+    modbusErrTimeout = -3,       // no response within the socket timeout
+    modbusErrClosed = -4,        // connection closed or reset by the peer
+    modbusErrSend = -5,          // other send failure
+    modbusErrReceive = -6,       // other receive failure
+    modbusErrMalformed = -7,     // frame or response does not parse
+    modbusErrUnitMismatch = -8,  // response from another unit
+    modbusErrNoMemory = -9,
+    modbusErrConnect = -10,    // socket setup or connection refused
+    modbusErrTLS = -11,        // TLS handshake or verification failed
+    modbusErrRejected = -12,   // shed by a full queue, never sent
+    modbusErrCancelled = -13,  // dropped unanswered, e.g. pipeline freed
+} ModbusError;
+
+#define MODBUS_ERROR_CODES 14  // modbusOk down to modbusErrCancelled
+
+int modbusRecord(int code);
+int modbusFail(int code, const char* format, ...)
+    __attribute__((format(printf, 2, 3)));
+int modbusErrorFromIO(int result, int sending);
+
+int modbusLastError(void);
+const char* modbusErrorName(int code);
+int modbusRetryable(int code);
+uint64_t modbusErrorCount(int code);
+
+#endif  // _MODBUS_ERROR_H_
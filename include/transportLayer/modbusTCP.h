@@ -4,15 +4,28 @@
 #include <inttypes.h>
 #include <sys/time.h>
 
+#include "transportLayer/tcpControl.h"
+
 #define MODBUS_TIMEOUT_SEC 1
 #define MODBUS_TIMEOUT_USEC 0
 
 #define MODBUS_TCP_PORT 502
+#define MODBUS_TLS_PORT 802
 
 int modbusConnect(char* ip, int port, time_t seconds, suseconds_t microseconds);
+int modbusConnectProfile(char* ip, int port, time_t seconds,
+                         suseconds_t microseconds, const TcpProfile* profile);
+int modbusConnectTLS(char* ip, int port, time_t seconds,
+                     suseconds_t microseconds);
 int modbusDisconnect(int socketfd);
 
 int modbusSend(int socketfd, uint16_t id, uint8_t* pdu, int pLen);
+int modbusSendUnit(int socketfd, uint8_t unit, uint16_t id, uint8_t* pdu,
+                   int pLen);
+int modbusSendFrame(int socketfd, uint8_t* frame, int frameLen);
 uint8_t* modbusReceive(int socketfd, uint16_t id, int* pduLen);
+int modbusReceiveInto(int socketfd, uint16_t id, uint8_t* pdu, int pduCap);
+int modbusReceiveUnit(int socketfd, uint8_t unit, uint16_t id, uint8_t* pdu,
+                      int pduCap);
 
 #endif  // _MODBUS_TCP_H_
\ No newline at end of file
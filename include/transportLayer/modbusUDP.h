@@ -0,0 +1,43 @@
+#ifndef _MODBUS_UDP_H_
+#define _MODBUS_UDP_H_
+
+#include <inttypes.h>
+#include <netinet/in.h>
+
+#include "transportLayer/dataPackaging.h"
+
+#define MODBUS_UDP_PORT 502
+#define MODBUS_UDP_TIMEOUT_MS 200
+#define MODBUS_UDP_RETRIES 3
+
+// datagrams moved per sendmmsg/recvmmsg call
+#define MODBUS_UDP_BATCH 64
+
+/**
+ * @brief one request of a UDP batch transaction
+ *
+ * @param server address of the device the request is sent to
+ * @param id transaction identifier, used to match the response and to
+ *    recognise answers to earlier retries of the same request
+ * @param pdu request protocol data unit
+ * @param pduLen request protocol data unit length
+ * @param response response protocol data unit (filled by the transaction)
+ * @param responseLen response length, > 0 when answered, else a
+ *    ModbusError: modbusErrTimeout if every retry timed out
+ */
+typedef struct _modbusUdpRequest {
+    struct sockaddr_in server;
+    uint16_t id;
+    uint8_t* pdu;
+    int pduLen;
+    uint8_t response[MODBUS_MAX_PDU_SIZE];
+    int responseLen;
+} ModbusUdpRequest;
+
+int modbusUdpOpen(void);
+int modbusUdpClose(int socketfd);
+
+int modbusUdpTransact(int socketfd, ModbusUdpRequest* requests, int count,
+                      int retries, int timeoutMs);
+
+#endif  // _MODBUS_UDP_H_
@@ -0,0 +1,51 @@
+#ifndef _SLAB_POOL_H_
+#define _SLAB_POOL_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#define SLAB_OBJECTS_PER_SLAB 64
+
+/**
+ * @brief allocator statistics
+ *
+ * @param objectSize usable size of each object
+ * @param slabs number of slabs obtained from malloc
+ * @param capacity objects available across all slabs
+ * @param allocs total allocations served
+ * @param frees total objects returned (remoteFrees included)
+ * @param remoteFrees objects returned by a thread other than the owner
+ * @param inUse objects currently allocated
+ * @param peakInUse highest inUse seen
+ */
+typedef struct _slabStats {
+    size_t objectSize;
+    uint64_t slabs;
+    uint64_t capacity;
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t remoteFrees;
+    uint64_t inUse;
+    uint64_t peakInUse;
+} SlabStats;
+
+/**
+ * @brief pool of fixed size objects carved out of slabs and recycled through
+ * free lists, memory is only returned to the system when the pool is freed
+ *
+ * Allocations must come from one thread at a time (the owner), objects may
+ * be freed from any thread.
+ */
+typedef struct _slabPool SlabPool;
+
+SlabPool* newSlabPool(size_t objectSize, int objectsPerSlab);
+void freeSlabPool(SlabPool* pool);
+
+void* slabAlloc(SlabPool* pool);
+void slabFree(void* object);
+
+void slabGetStats(SlabPool* pool, SlabStats* stats);
+
+SlabPool* threadFramePool(void);
+
+#endif  // _SLAB_POOL_H_
@@ -4,12 +4,68 @@
 #include <inttypes.h>
 #include <sys/time.h>
 
+/**
+ * @brief implementation used by tcpSend and tcpReceive
+ *
+ * tcpBlockingBackend issues one send/recv syscall per call,
+ * tcpUringBackend batches them through a per thread io_uring instance
+ */
+typedef enum t_tcpBackend {
+    tcpBlockingBackend = 0,
+    tcpUringBackend = 1,
+} TcpBackend;
+
+/**
+ * @brief socket options applied between opening and connecting a socket
+ *
+ * Zero fields leave the system default.
+ *
+ * @param noDelay disable Nagle, small frames leave without waiting for the
+ * acknowledgement of the previous ones
+ * @param quickAck acknowledge immediately instead of delaying ACKs, renewed
+ * after every receive since the kernel clears it
+ * @param keepIdle seconds of silence before the first keepalive probe
+ * @param keepInterval seconds between keepalive probes
+ * @param keepCount unanswered probes before the connection is dropped
+ * @param userTimeoutMs longest time sent data may stay unacknowledged
+ * before the connection is dropped
+ * @param busyPollUs microseconds a blocking receive busy polls the device
+ * queue, usually needs CAP_NET_ADMIN and is skipped when refused
+ * @param sendBuffer SO_SNDBUF bytes
+ * @param receiveBuffer SO_RCVBUF bytes
+ */
+typedef struct _tcpProfile {
+    int noDelay;
+    int quickAck;
+    int keepIdle;
+    int keepInterval;
+    int keepCount;
+    unsigned int userTimeoutMs;
+    int busyPollUs;
+    int sendBuffer;
+    int receiveBuffer;
+} TcpProfile;
+
+// system defaults, as sockets were before profiles existed
+extern const TcpProfile tcpDefaultProfile;
+// request/response polling: no Nagle, immediate ACKs, dead peers found fast
+extern const TcpProfile tcpLowLatencyProfile;
+
+TcpBackend tcpSelectBackend(TcpBackend backend);
+TcpBackend tcpCurrentBackend(void);
+long tcpSyscallCount(void);
+
 int tcpCloseSocket(int socketfd);
 int tcpOpenSocket(time_t seconds, suseconds_t microseconds);
+int tcpApplyProfile(int socketfd, const TcpProfile* profile);
 
 int tcpConnect(int socketfd, char* ipString, int port);
 
 int tcpSend(int socketfd, uint8_t* packet, int pLen);
 int tcpReceive(int socketfd, uint8_t* packet, int pLen);
 
+void tcpCork(int socketfd);
+int tcpUncork(int socketfd);
+int tcpPending(int socketfd);
+
 #endif  // _TCP_CONTROL_H_
\ No newline at end of file
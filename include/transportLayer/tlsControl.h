@@ -0,0 +1,60 @@
+#ifndef _TLS_CONTROL_H_
+#define _TLS_CONTROL_H_
+
+#include <inttypes.h>
+
+#define TLS_MAX_SOCKETS 65536
+#define TLS_SESSION_CACHE 1024
+#define TLS_PEER_LEN 64
+#define TLS_RECORD_SIZE 16384
+
+/**
+ * @brief credentials of the client side of Modbus/TCP Security
+ *
+ * @param caFile PEM file of the authorities the servers are checked against
+ * @param certFile PEM certificate of the client, NULL if the servers do not
+ * ask for one
+ * @param keyFile PEM private key of certFile
+ * @param verifyPeer 0 to accept any server certificate, e.g. self-signed
+ * test servers without a caFile
+ */
+typedef struct _tlsConfig {
+    const char* caFile;
+    const char* certFile;
+    const char* keyFile;
+    int verifyPeer;
+} TlsConfig;
+
+/**
+ * @brief process wide TLS counters
+ *
+ * @param handshakes completed handshakes
+ * @param resumed handshakes among them that resumed a cached session
+ * @param records application data records written
+ * @param bytes application data bytes written
+ */
+typedef struct _tlsStats {
+    uint64_t handshakes;
+    uint64_t resumed;
+    uint64_t records;
+    uint64_t bytes;
+} TlsStats;
+
+int tlsInit(const TlsConfig* config);
+void tlsCleanup(void);
+
+int tlsAttach(int socketfd, const char* peer);
+int tlsDetach(int socketfd);
+int tlsActive(int socketfd);
+int tlsSessionReused(int socketfd);
+
+int tlsSend(int socketfd, uint8_t* packet, int pLen);
+int tlsReceive(int socketfd, uint8_t* packet, int pLen);
+int tlsPending(int socketfd);
+
+int tlsCork(int socketfd);
+int tlsUncork(int socketfd);
+
+void tlsGetStats(TlsStats* stats);
+
+#endif  // _TLS_CONTROL_H_
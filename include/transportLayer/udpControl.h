@@ -0,0 +1,18 @@
+#ifndef _UDP_CONTROL_H_
+#define _UDP_CONTROL_H_
+
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+int udpOpenSocket(void);
+int udpCloseSocket(int socketfd);
+
+int udpResolve(char* ipString, int port, struct sockaddr_in* address);
+
+int udpSendBatch(int socketfd, struct mmsghdr* messages, int count);
+int udpReceiveBatch(int socketfd, struct mmsghdr* messages, int count,
+                    int timeoutMs);
+
+#endif  // _UDP_CONTROL_H_
@@ -0,0 +1,25 @@
+#ifndef _URING_CONTROL_H_
+#define _URING_CONTROL_H_
+
+#include <inttypes.h>
+
+/**
+ * @brief io_uring instance used by one thread to drive its TCP sockets
+ *
+ * Outgoing frames are copied into registered buffers, incoming data is
+ * delivered by one multishot receive per socket into a provided buffer ring
+ * and staged until tcpReceive consumes it.
+ */
+typedef struct _uringContext UringContext;
+
+UringContext* uringNew(unsigned entries);
+void uringFree(UringContext* ring);
+
+int uringSend(UringContext* ring, int socketfd, uint8_t* packet, int pLen);
+int uringReceive(UringContext* ring, int socketfd, uint8_t* packet, int pLen);
+int uringFlush(UringContext* ring);
+void uringForget(UringContext* ring, int socketfd);
+
+long uringSyscalls(UringContext* ring);
+
+#endif  // _URING_CONTROL_H_
@@ -1,10 +1,16 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "applicationLayer/modbusApp.h"
+#include "applicationLayer/modbusClient.h"
+#include "applicationLayer/pollScheduler.h"
+#include "applicationLayer/scanStream.h"
 #include "log.h"
+#include "transportLayer/tcpControl.h"
 
 void printArrayAsHex(void* s, int len) {
     printf("8bHex: ");
@@ -30,79 +36,177 @@ void printByteArrayAsLongDec(void* s, int len) {
     printf("\n");
 }
 
-int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        printf("Usage: %s <ip> <port>\n", argv[0]);
+/**
+ * @brief state of the periodic read/write scan
+ */
+typedef struct _scan {
+    ModbusClient* client;
+
+    // binary output instead of the hex dumps, NULL if not streaming
+    ScanStream* stream;
+    int schema;
+
+    uint16_t readAddr;
+    uint16_t readQuantity;
+
+    uint16_t writeAddress;
+    uint16_t writeValue;
+    uint16_t writeQuantity;
+} Scan;
+
+#define SCAN_PERIOD_NS 1000000000ULL  // 1 s
+
+/**
+ * @brief one scan cycle, run by the poll scheduler on every deadline
+ *
+ * @return 0 if success, the exception code if the server answered with an
+ * exception, -1 if a request failed
+ */
+int scanCycle(void* context) {
+    Scan* scan = (Scan*)context;
+    uint8_t* buffer = NULL;
+    int buffLen = 0;
+
+    if (scan->stream == NULL) {
+        printf("\nRead Holding Registers request\n");
+        printf("starting address: %d, quantity: %d\n", scan->readAddr,
+               scan->readQuantity);
+    }
+
+    buffer = clientReadHoldingRegisters(scan->client, scan->readAddr,
+                                        scan->readQuantity, &buffLen);
+    if (buffer == NULL) {
+        ERROR("Read Holding Registers failed\n");
         return -1;
     }
+    if (buffer[0] & 0x80) {
+        ERROR("Exeption %d code: %d\n", buffer[0], buffer[1]);
+        int code = buffer[1];
+        free(buffer);
+        return code;
+    }
+    if (scan->stream != NULL) {
+        // registers come big endian after the function code and byte count
+        uint16_t values[MODBUS_RHR_QUANTITY_MAX];
+        for (int i = 0; i < scan->readQuantity; i++)
+            values[i] = buffer[2 + 2 * i] << 8 | buffer[3 + 2 * i];
+
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        uint64_t timestampNs = (uint64_t)now.tv_sec * 1000000000ULL +
+                               now.tv_nsec;
+        if (streamPublish(scan->stream, scan->schema, timestampNs, values) <
+                0 ||
+            streamFlush(scan->stream) < 0) {
+            free(buffer);
+            return -1;
+        }
+    } else {
+        printArrayAsHex(buffer, buffLen);
+        printByteArrayAsLongHex(buffer + 2, buffLen - 2);  // skip header
+        printByteArrayAsLongDec(buffer + 2, buffLen - 2);
+    }
 
-    char* ip = argv[1];
-    int port = atoi(argv[2]);
+    free(buffer);
 
-    int socketfd = connectToServer(ip, port);
-    if (socketfd < 0) {
-        ERROR("cannot connect to server\n");
+    if (scan->stream == NULL) {
+        printf("\nWrite Single Register request\n");
+        printf("address: %d, value: %d\n", scan->writeAddress,
+               scan->writeValue);
+    }
+
+    buffer = clientWriteMultipleRegisters(scan->client, scan->writeAddress,
+                                          scan->writeQuantity,
+                                          &scan->writeValue, &buffLen);
+    if (buffer == NULL) {
+        ERROR("Write Single Register failed\n");
         return -1;
     }
+    if (buffer[0] & 0x80) {
+        ERROR("Exeption %d code: %d\n", buffer[0], buffer[1]);
+        int code = buffer[1];
+        free(buffer);
+        return code;
+    }
+    if (scan->stream == NULL) printArrayAsHex(buffer, buffLen);
+    free(buffer);
 
-    uint16_t readQuantity = 10;
-    uint16_t readAddr = 0;
+    scan->writeValue = (scan->writeValue + 1) % 0xFFFF;
+    return 0;
+}
 
-    uint16_t writeAddress = 7;
-    uint16_t writeValue = 0;
-    uint16_t writeQuantity = 1;
+int main(int argc, char* argv[]) {
+    if (argc < 3 || argc > 5) {
+        printf("Usage: %s <ip> <port> [blocking|uring] [stream socket]\n",
+               argv[0]);
+        return -1;
+    }
 
-    uint8_t* buffer = NULL;
+    char* ip = argv[1];
+    int port = atoi(argv[2]);
 
-    uint16_t transactionID = 0;
+    if (argc >= 4 && strcmp(argv[3], "uring") == 0) {
+        tcpSelectBackend(tcpUringBackend);
+    }
 
-    int retval = 0;
+    ModbusClient* client = newModbusClient(ip, port);
+    if (client == NULL) {
+        ERROR("cannot connect to server\n");
+        return -1;
+    }
 
-    int buffLen = 0;
-    for (;;) {
-        printf("\nRead Holding Registers request\n");
-        printf("starting address: %d, quantity: %d\n", readAddr, readQuantity);
-
-        transactionID++;
-        buffer = readHoldingRegisters(socketfd, transactionID, readAddr,
-                                      readQuantity, &buffLen);
-        if (buffer == NULL) {
-            ERROR("Read Holding Registers failed\n");
-            break;
+    Scan scan = {
+        .client = client,
+        .readAddr = 0,
+        .readQuantity = 10,
+        .writeAddress = 7,
+        .writeValue = 0,
+        .writeQuantity = 1,
+    };
+
+    // read results go to the consumer listening on the socket, if any
+    int streamfd = -1;
+    if (argc == 5) {
+        streamfd = streamConnect(argv[4]);
+        scan.stream = newScanStream(streamfd, streamDrop, 0);
+        if (scan.stream != NULL) {
+            scan.schema = streamAddSchema(scan.stream, 0, scan.readAddr,
+                                          scan.readQuantity, ip);
         }
-        if (buffer[0] & 0x80) {
-            ERROR("Exeption %d code: %d\n", buffer[0], buffer[1]);
-            retval = buffer[1];
-            break;
+        if (scan.stream == NULL || scan.schema < 0) {
+            freeScanStream(scan.stream);
+            if (streamfd >= 0) close(streamfd);
+            freeModbusClient(client);
+            return -1;
         }
-        printArrayAsHex(buffer, buffLen);
-        printByteArrayAsLongHex(buffer + 2, buffLen - 2);  // skip header
-        printByteArrayAsLongDec(buffer + 2, buffLen - 2);
-
-        free(buffer);
+    }
 
-        printf("\nWrite Single Register request\n");
-        printf("address: %d, value: %d\n", writeAddress, writeValue);
-
-        transactionID++;
-        buffer = writeMultipleRegisters(socketfd, transactionID, writeAddress,
-                                        writeQuantity, &writeValue, &buffLen);
-        if (buffer == NULL) {
-            ERROR("Write Single Register failed\n");
-            break;
-        }
-        if (buffer[0] & 0x80) {
-            ERROR("Exeption %d code: %d\n", buffer[0], buffer[1]);
-            retval = buffer[1];
-            break;
-        }
-        printArrayAsHex(buffer, buffLen);
-        free(buffer);
+    PollScheduler* scheduler = newPollScheduler();
+    if (scheduler == NULL ||
+        schedulerAddGroup(scheduler, SCAN_PERIOD_NS, scanCycle, &scan) < 0) {
+        freePollScheduler(scheduler);
+        freeScanStream(scan.stream);
+        if (streamfd >= 0) close(streamfd);
+        freeModbusClient(client);
+        return -1;
+    }
 
-        writeValue = (writeValue + 1) % 0xFFFF;
-        sleep(1);
+    // exception codes are the exit status, transport failures exit with 0
+    int retval = schedulerRun(scheduler);
+    if (retval < 0) retval = 0;
+
+    PollStats stats;
+    if (schedulerGetStats(scheduler, 0, &stats) == 0 && stats.runs > 0) {
+        INFO("\nscans: %" PRIu64 ", overruns: %" PRIu64
+             ", jitter mean/max: %" PRId64 "/%" PRId64 " us\n",
+             stats.runs, stats.overruns,
+             stats.totalJitterNs / (int64_t)stats.runs / 1000,
+             stats.maxJitterNs / 1000);
     }
 
-    disconnectFromServer(socketfd);
+    freePollScheduler(scheduler);
+    freeScanStream(scan.stream);
+    if (streamfd >= 0) close(streamfd);
+    freeModbusClient(client);
     return retval;
 }
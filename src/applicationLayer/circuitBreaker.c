@@ -0,0 +1,99 @@
+#include "applicationLayer/circuitBreaker.h"
+
+#include <time.h>
+
+#include "log.h"
+
+static uint64_t _now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @brief initialise a closed breaker
+ *
+ * @param breaker the breaker
+ * @param threshold consecutive failures that open the breaker
+ * @param backoffNs wait before the first probe of an open breaker
+ * @param maxBackoffNs longest wait between probes
+ */
+void breakerInit(CircuitBreaker* breaker, int threshold, uint64_t backoffNs,
+                 uint64_t maxBackoffNs) {
+    breaker->state = breakerClosed;
+    breaker->threshold = threshold > 0 ? threshold : 1;
+    breaker->failures = 0;
+    breaker->baseBackoffNs = backoffNs;
+    breaker->maxBackoffNs = maxBackoffNs > backoffNs ? maxBackoffNs : backoffNs;
+    breaker->backoffNs = backoffNs;
+    breaker->retryAt = 0;
+    breaker->trips = 0;
+    breaker->rejected = 0;
+}
+
+/**
+ * @brief decide whether a request may be sent to the device
+ *
+ * Every allowed request must be followed by breakerRecord with its outcome.
+ *
+ * @param breaker the breaker
+ * @return int 1 if the request may be sent, 0 if it must fail fast
+ */
+int breakerAllow(CircuitBreaker* breaker) {
+    if (breaker->state == breakerClosed) return 1;
+
+    if (breaker->state == breakerOpen && _now() >= breaker->retryAt) {
+        breaker->state = breakerHalfOpen;
+        return 1;
+    }
+
+    // open and waiting, or a probe is already out
+    breaker->rejected++;
+    return 0;
+}
+
+static void _open(CircuitBreaker* breaker) {
+    breaker->state = breakerOpen;
+    breaker->retryAt = _now() + breaker->backoffNs;
+}
+
+/**
+ * @brief record the outcome of an allowed request
+ *
+ * Timeouts and transport errors count as failures, as do the gateway
+ * exceptions reporting that the slave did not answer. Any other exception
+ * means the device answered and counts as a success.
+ *
+ * @param breaker the breaker
+ * @param result 0 if success, the exception code if the device answered
+ * with an exception, -1 if the request failed
+ */
+void breakerRecord(CircuitBreaker* breaker, int result) {
+    int failed = result < 0 || result == MODBUS_GATEWAY_PATH_UNAVAILABLE ||
+                 result == MODBUS_GATEWAY_TARGET_FAILED;
+
+    if (!failed) {
+        if (breaker->state != breakerClosed) LOG("device recovered\n");
+        breaker->state = breakerClosed;
+        breaker->failures = 0;
+        breaker->backoffNs = breaker->baseBackoffNs;
+        return;
+    }
+
+    if (breaker->state == breakerHalfOpen) {
+        // failed probe: wait longer before the next one
+        breaker->backoffNs *= 2;
+        if (breaker->backoffNs > breaker->maxBackoffNs)
+            breaker->backoffNs = breaker->maxBackoffNs;
+        _open(breaker);
+        return;
+    }
+
+    if (breaker->state == breakerClosed &&
+        ++breaker->failures >= breaker->threshold) {
+        ERROR("device unresponsive after %d failures, failing fast\n",
+              breaker->failures);
+        breaker->trips++;
+        _open(breaker);
+    }
+}
@@ -0,0 +1,916 @@
+#include "applicationLayer/deviceFarm.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "transportLayer/dataPackaging.h"
+
+#define MALLOC_ERR \
+    ERROR("malloc failed in %s: %s, %d\n", __func__, __FILE__, __LINE__)
+
+#define NS_PER_SEC 1000000000ULL
+
+#define FARM_RX_SIZE (4 * MODBUS_MAX_ADU_SIZE)
+#define FARM_EVENTS 64
+#define FARM_BATCH_FRAMES 64  // responses gathered into one write
+
+// epoll tags, the low 32 bits carry the index
+#define TAG_CONNECTION 0ULL
+#define TAG_LISTENER 1ULL
+#define TAG_WAKE 2ULL
+#define TAG_TIMER 3ULL
+
+#define EXCEPTION_ILLEGAL_FUNCTION 0x01
+#define EXCEPTION_ILLEGAL_ADDRESS 0x02
+#define EXCEPTION_ILLEGAL_VALUE 0x03
+#define EXCEPTION_GATEWAY_TARGET 0x0B
+
+/**
+ * @brief one simulated slave
+ *
+ * @param profile current behaviour, swapped atomically by farmSetProfile
+ * @param registers map of the device, written only by the thread serving
+ * its port
+ */
+typedef struct _device {
+    const DeviceProfile* profile;
+    uint16_t* registers;
+} Device;
+
+/**
+ * @brief a client connection, identified in epoll and in the delay heap by
+ * its slot and generation so responses to a closed connection are dropped
+ *
+ * @param tx responses the socket did not accept yet
+ */
+typedef struct _connection {
+    int used;
+    int socketfd;
+    int port;
+    uint32_t generation;
+    uint8_t rx[FARM_RX_SIZE];
+    int rxLen;
+    uint8_t* tx;
+    int txLen;
+    int txCap;
+} Connection;
+
+/**
+ * @brief a response waiting for its simulated latency
+ */
+typedef struct _delayed {
+    uint64_t dueNs;
+    int slot;
+    uint32_t generation;
+    int len;
+    uint8_t frame[MODBUS_MAX_ADU_SIZE];
+} Delayed;
+
+/**
+ * @brief event loop thread serving a share of the ports
+ *
+ * @param heap delayed responses, ordered by due time
+ * @param batch responses to one connection not written yet, built in place
+ * in batchFrames and written together by _flushBatch
+ */
+typedef struct _farmThread {
+    DeviceFarm* farm;
+    pthread_t thread;
+    int epollfd;
+    int wakefd;
+    int timerfd;
+    uint32_t seed;
+
+    Connection* connections;
+    int connectionCount;
+
+    Delayed* heap;
+    int heapLen;
+    int heapCap;
+
+    int batchSlot;
+    uint32_t batchGeneration;
+    int batchCount;
+    struct iovec batch[FARM_BATCH_FRAMES];
+    uint8_t batchFrames[FARM_BATCH_FRAMES][MODBUS_MAX_ADU_SIZE];
+} FarmThread;
+
+struct _deviceFarm {
+    FarmConfig config;
+    int* listeners;
+    int* ports;
+
+    Device* devices;
+    uint16_t* registerBlock;
+    DeviceProfile defaultProfile;
+
+    // profiles replaced by farmSetProfile, freed with the farm
+    pthread_mutex_t profileLock;
+    DeviceProfile** profiles;
+    int profileCount;
+
+    FarmThread* threads;
+    int started;
+    int stopping;
+
+    FarmStats stats;  // updated atomically
+};
+
+static uint64_t _now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static uint32_t _random(FarmThread* thread) {
+    thread->seed ^= thread->seed << 13;
+    thread->seed ^= thread->seed >> 17;
+    thread->seed ^= thread->seed << 5;
+    return thread->seed;
+}
+
+static int _chance(FarmThread* thread, double rate) {
+    return rate > 0 && _random(thread) < rate * 4294967296.0;
+}
+
+static void _count(uint64_t* counter) {
+    __atomic_add_fetch(counter, 1, __ATOMIC_RELAXED);
+}
+
+static int _exception(uint8_t* pdu, uint8_t function, uint8_t code) {
+    pdu[0] = function | 0x80;
+    pdu[1] = code;
+    return 2;
+}
+
+/**
+ * @brief execute a request against a device
+ *
+ * @param pdu request pdu
+ * @param pduLen request pdu length
+ * @param out response pdu
+ * @return int response pdu length
+ */
+static int _execute(Device* device, const DeviceProfile* profile,
+                    FarmThread* thread, uint8_t* pdu, int pduLen,
+                    uint8_t* out) {
+    uint8_t function = pdu[0];
+    if (function != 0x03 && function != 0x04 && function != 0x06 &&
+        function != 0x10)
+        return _exception(out, function, EXCEPTION_ILLEGAL_FUNCTION);
+    if (pduLen < 5) return _exception(out, function, EXCEPTION_ILLEGAL_VALUE);
+
+    uint32_t address = (pdu[1] << 8) | pdu[2];
+    uint32_t quantity =
+        function == 0x06 ? 1 : (uint32_t)((pdu[3] << 8) | pdu[4]);
+    uint32_t quantityMax = function == 0x10 ? 123 : 125;
+
+    if (quantity < 1 || quantity > quantityMax ||
+        (function == 0x10 &&
+         (pduLen < 6 || pdu[5] != 2 * quantity ||
+          pduLen < 6 + 2 * (int)quantity)))
+        return _exception(out, function, EXCEPTION_ILLEGAL_VALUE);
+    if (address + quantity > profile->registers)
+        return _exception(out, function, EXCEPTION_ILLEGAL_ADDRESS);
+
+    if (_chance(thread, profile->exceptionRate))
+        return _exception(out, function, profile->exceptionCode);
+
+    uint16_t* registers = device->registers + address;
+    switch (function) {
+        case 0x03:
+        case 0x04:
+            out[0] = function;
+            out[1] = 2 * quantity;
+            for (uint32_t i = 0; i < quantity; i++) {
+                out[2 + 2 * i] = registers[i] >> 8;
+                out[3 + 2 * i] = registers[i] & 0xFF;
+            }
+            return 2 + 2 * quantity;
+        case 0x06:
+            registers[0] = (pdu[3] << 8) | pdu[4];
+            memcpy(out, pdu, 5);
+            return 5;
+        default:
+            for (uint32_t i = 0; i < quantity; i++)
+                registers[i] = (pdu[6 + 2 * i] << 8) | pdu[7 + 2 * i];
+            memcpy(out, pdu, 5);
+            return 5;
+    }
+}
+
+/**
+ * @brief answer one request frame
+ *
+ * @param frame request frame, MBAP header included
+ * @param len frame length
+ * @param response filled with the response frame
+ * @param delayNs filled with the simulated latency
+ * @return int response frame length, 0 if the request is dropped
+ */
+static int _respond(FarmThread* thread, int port, uint8_t* frame, int len,
+                    uint8_t* response, uint64_t* delayNs) {
+    DeviceFarm* farm = thread->farm;
+    uint8_t unit = frame[6];
+    uint8_t* pdu = frame + MODBUS_MBAP_HEADER_SIZE;
+    int pduLen = len - MODBUS_MBAP_HEADER_SIZE;
+    uint8_t* out = response + MODBUS_MBAP_HEADER_SIZE;
+    int outLen;
+
+    _count(&farm->stats.requests);
+    *delayNs = 0;
+
+    if (unit < 1 || unit > farm->config.units) {
+        outLen = _exception(out, pdu[0], EXCEPTION_GATEWAY_TARGET);
+    } else {
+        Device* device = &farm->devices[port * farm->config.units + unit - 1];
+        const DeviceProfile* profile =
+            __atomic_load_n(&device->profile, __ATOMIC_ACQUIRE);
+
+        if (_chance(thread, profile->dropRate)) {
+            _count(&farm->stats.dropped);
+            return 0;
+        }
+
+        outLen = _execute(device, profile, thread, pdu, pduLen, out);
+
+        uint64_t delayUs = profile->latencyUs;
+        if (profile->jitterUs > 0)
+            delayUs += _random(thread) % (profile->jitterUs + 1);
+        if (_chance(thread, profile->tailRate)) delayUs += profile->tailUs;
+        *delayNs = delayUs * 1000;
+    }
+
+    if (out[0] & 0x80) _count(&farm->stats.exceptions);
+
+    // transaction id, protocol id and unit id are echoed
+    memcpy(response, frame, MODBUS_MBAP_HEADER_SIZE);
+    response[4] = (outLen + 1) >> 8;
+    response[5] = (outLen + 1) & 0xFF;
+    return MODBUS_MBAP_HEADER_SIZE + outLen;
+}
+
+static void _close(FarmThread* thread, int slot) {
+    Connection* connection = &thread->connections[slot];
+    epoll_ctl(thread->epollfd, EPOLL_CTL_DEL, connection->socketfd, NULL);
+    close(connection->socketfd);
+    free(connection->tx);
+    connection->tx = NULL;
+    connection->txLen = connection->txCap = 0;
+    connection->rxLen = 0;
+    connection->used = 0;
+    connection->generation++;
+}
+
+static void _watchOutput(FarmThread* thread, int slot, int on) {
+    struct epoll_event event = {.events = EPOLLIN | (on ? EPOLLOUT : 0),
+                                .data.u64 = (TAG_CONNECTION << 32) | slot};
+    epoll_ctl(thread->epollfd, EPOLL_CTL_MOD,
+              thread->connections[slot].socketfd, &event);
+}
+
+/**
+ * @brief write what the socket accepts of the pending output, once it is
+ * writable again
+ *
+ * @return int 0 if success, -1 if the connection was closed
+ */
+static int _flush(FarmThread* thread, int slot) {
+    Connection* connection = &thread->connections[slot];
+
+    int sent = 0;
+    while (sent < connection->txLen) {
+        int n = send(connection->socketfd, connection->tx + sent,
+                     connection->txLen - sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            _close(thread, slot);
+            return -1;
+        }
+        sent += n;
+    }
+    memmove(connection->tx, connection->tx + sent, connection->txLen - sent);
+    connection->txLen -= sent;
+
+    if (connection->txLen == 0) _watchOutput(thread, slot, 0);
+    return 0;
+}
+
+/**
+ * @brief keep output the socket did not accept for _flush
+ *
+ * @return int 0 if success, -1 if the connection was closed
+ */
+static int _keep(FarmThread* thread, int slot, uint8_t* bytes, int len) {
+    Connection* connection = &thread->connections[slot];
+
+    if (connection->txLen + len > connection->txCap) {
+        int capacity = connection->txCap ? 2 * connection->txCap : 4096;
+        while (capacity < connection->txLen + len) capacity *= 2;
+        uint8_t* tx = (uint8_t*)realloc(connection->tx, capacity);
+        if (tx == NULL) {
+            MALLOC_ERR;
+            _close(thread, slot);
+            return -1;
+        }
+        connection->tx = tx;
+        connection->txCap = capacity;
+    }
+    if (connection->txLen == 0) _watchOutput(thread, slot, 1);
+    memcpy(connection->tx + connection->txLen, bytes, len);
+    connection->txLen += len;
+    return 0;
+}
+
+/**
+ * @brief write the batched responses with one gathering send, keeping what
+ * the socket does not accept for later
+ *
+ * sendmsg is used as writev is, it takes MSG_NOSIGNAL.
+ *
+ * @return int 0 if success, -1 if the connection was closed
+ */
+static int _flushBatch(FarmThread* thread) {
+    int count = thread->batchCount;
+    if (count == 0) return 0;
+    thread->batchCount = 0;
+
+    int slot = thread->batchSlot;
+    Connection* connection = &thread->connections[slot];
+    if (!connection->used ||
+        connection->generation != thread->batchGeneration)
+        return 0;
+    __atomic_add_fetch(&thread->farm->stats.responses, count,
+                       __ATOMIC_RELAXED);
+    _count(&thread->farm->stats.writes);
+
+    // responses queued behind a full socket keep their order
+    ssize_t sent = 0;
+    if (connection->txLen == 0) {
+        struct msghdr message = {.msg_iov = thread->batch,
+                                 .msg_iovlen = count};
+        sent = sendmsg(connection->socketfd, &message, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                _close(thread, slot);
+                return -1;
+            }
+            sent = 0;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        struct iovec* frame = &thread->batch[i];
+        if (sent >= (ssize_t)frame->iov_len) {
+            sent -= frame->iov_len;
+            continue;
+        }
+        if (_keep(thread, slot, (uint8_t*)frame->iov_base + sent,
+                  frame->iov_len - sent) < 0)
+            return -1;
+        sent = 0;
+    }
+    return 0;
+}
+
+/**
+ * @brief buffer of the next response to slot, writing the batch first if
+ * it is full or holds responses to another connection
+ *
+ * @return uint8_t* room for one frame, added to the batch by _batch
+ */
+static uint8_t* _batchFrame(FarmThread* thread, int slot) {
+    if (thread->batchCount > 0 &&
+        (thread->batchSlot != slot ||
+         thread->batchCount == FARM_BATCH_FRAMES))
+        _flushBatch(thread);
+    return thread->batchFrames[thread->batchCount];
+}
+
+/**
+ * @brief add the response built in _batchFrame to the batch
+ *
+ * @return int 0 if success, -1 if the connection was closed
+ */
+static int _batch(FarmThread* thread, int slot, int len) {
+    Connection* connection = &thread->connections[slot];
+    if (!connection->used) return -1;
+
+    thread->batchSlot = slot;
+    thread->batchGeneration = connection->generation;
+    thread->batch[thread->batchCount].iov_base =
+        thread->batchFrames[thread->batchCount];
+    thread->batch[thread->batchCount].iov_len = len;
+    thread->batchCount++;
+    return 0;
+}
+
+static void _armTimer(FarmThread* thread) {
+    struct itimerspec spec = {0};
+    if (thread->heapLen > 0) {
+        uint64_t due = thread->heap[0].dueNs;
+        spec.it_value.tv_sec = due / NS_PER_SEC;
+        spec.it_value.tv_nsec = due % NS_PER_SEC;
+        // a zero value would disarm the timer
+        if (due == 0) spec.it_value.tv_nsec = 1;
+    }
+    timerfd_settime(thread->timerfd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+static int _delay(FarmThread* thread, int slot, uint8_t* frame, int len,
+                  uint64_t dueNs) {
+    if (thread->heapLen == thread->heapCap) {
+        int capacity = thread->heapCap ? 2 * thread->heapCap : 256;
+        Delayed* heap =
+            (Delayed*)realloc(thread->heap, capacity * sizeof(Delayed));
+        if (heap == NULL) {
+            MALLOC_ERR;
+            return -1;
+        }
+        thread->heap = heap;
+        thread->heapCap = capacity;
+    }
+
+    int i = thread->heapLen++;
+    while (i > 0 && thread->heap[(i - 1) / 2].dueNs > dueNs) {
+        thread->heap[i] = thread->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    Delayed* entry = &thread->heap[i];
+    entry->dueNs = dueNs;
+    entry->slot = slot;
+    entry->generation = thread->connections[slot].generation;
+    entry->len = len;
+    memcpy(entry->frame, frame, len);
+
+    if (i == 0) _armTimer(thread);
+    return 0;
+}
+
+static void _popDelayed(FarmThread* thread) {
+    Delayed last = thread->heap[--thread->heapLen];
+    int i = 0;
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= thread->heapLen) break;
+        if (child + 1 < thread->heapLen &&
+            thread->heap[child + 1].dueNs < thread->heap[child].dueNs)
+            child++;
+        if (thread->heap[child].dueNs >= last.dueNs) break;
+        thread->heap[i] = thread->heap[child];
+        i = child;
+    }
+    if (thread->heapLen > 0) thread->heap[i] = last;
+}
+
+/**
+ * @brief send the delayed responses that are due, those to one connection
+ * together
+ */
+static void _sendDue(FarmThread* thread) {
+    uint64_t expirations;
+    if (read(thread->timerfd, &expirations, sizeof(expirations)) < 0 &&
+        errno != EAGAIN)
+        ERROR("farm timer read failed\n");
+
+    uint64_t now = _now();
+    while (thread->heapLen > 0 && thread->heap[0].dueNs <= now) {
+        Delayed* entry = &thread->heap[0];
+        Connection* connection = &thread->connections[entry->slot];
+        if (connection->used && connection->generation == entry->generation) {
+            memcpy(_batchFrame(thread, entry->slot), entry->frame, entry->len);
+            _batch(thread, entry->slot, entry->len);
+        }
+        _popDelayed(thread);
+    }
+    _flushBatch(thread);
+    _armTimer(thread);
+}
+
+/**
+ * @brief read what the client sent and answer every complete request, the
+ * immediate responses to one read with one write
+ */
+static void _receive(FarmThread* thread, int slot) {
+    Connection* connection = &thread->connections[slot];
+
+    for (;;) {
+        int n = recv(connection->socketfd, connection->rx + connection->rxLen,
+                     FARM_RX_SIZE - connection->rxLen, 0);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            _close(thread, slot);
+            return;
+        }
+        if (n < 0) return;
+        connection->rxLen += n;
+
+        int offset = 0;
+        for (;;) {
+            uint8_t* frame = connection->rx + offset;
+            ModbusADU adu;
+            int len = parseModbusADU(frame, connection->rxLen - offset, &adu);
+            if (len == 0) break;
+            if (len < 0) {
+                ERROR("farm: invalid frame length %d, closing\n", adu.length);
+                _flushBatch(thread);
+                if (connection->used) _close(thread, slot);
+                return;
+            }
+            offset += len;
+
+            uint64_t delayNs;
+            uint8_t* response = _batchFrame(thread, slot);
+            // writing out a full batch may have closed the connection
+            if (!connection->used) return;
+            int responseLen = _respond(thread, connection->port, frame, len,
+                                       response, &delayNs);
+            if (responseLen == 0) continue;
+
+            int status = delayNs == 0
+                             ? _batch(thread, slot, responseLen)
+                             : _delay(thread, slot, response, responseLen,
+                                      _now() + delayNs);
+            if (status < 0) {
+                if (connection->used) _close(thread, slot);
+                return;
+            }
+        }
+
+        memmove(connection->rx, connection->rx + offset,
+                connection->rxLen - offset);
+        connection->rxLen -= offset;
+
+        if (_flushBatch(thread) < 0) return;
+    }
+}
+
+static void _accept(FarmThread* thread, int port) {
+    DeviceFarm* farm = thread->farm;
+    for (;;) {
+        int socketfd =
+            accept4(farm->listeners[port], NULL, NULL, SOCK_NONBLOCK);
+        if (socketfd < 0) return;
+
+        int one = 1;
+        setsockopt(socketfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        int slot = 0;
+        while (slot < thread->connectionCount && thread->connections[slot].used)
+            slot++;
+        if (slot == thread->connectionCount) {
+            int count = thread->connectionCount ? 2 * thread->connectionCount
+                                                : 64;
+            Connection* connections = (Connection*)realloc(
+                thread->connections, count * sizeof(Connection));
+            if (connections == NULL) {
+                MALLOC_ERR;
+                close(socketfd);
+                return;
+            }
+            memset(connections + thread->connectionCount, 0,
+                   (count - thread->connectionCount) * sizeof(Connection));
+            thread->connections = connections;
+            thread->connectionCount = count;
+        }
+
+        Connection* connection = &thread->connections[slot];
+        connection->used = 1;
+        connection->socketfd = socketfd;
+        connection->port = port;
+
+        struct epoll_event event = {
+            .events = EPOLLIN, .data.u64 = (TAG_CONNECTION << 32) | slot};
+        if (epoll_ctl(thread->epollfd, EPOLL_CTL_ADD, socketfd, &event) < 0) {
+            ERROR("farm: cannot watch connection\n");
+            close(socketfd);
+            connection->used = 0;
+            continue;
+        }
+        _count(&farm->stats.connections);
+    }
+}
+
+static void* _farmLoop(void* argument) {
+    FarmThread* thread = (FarmThread*)argument;
+    DeviceFarm* farm = thread->farm;
+    struct epoll_event events[FARM_EVENTS];
+
+    while (!__atomic_load_n(&farm->stopping, __ATOMIC_ACQUIRE)) {
+        int n = epoll_wait(thread->epollfd, events, FARM_EVENTS, -1);
+        for (int i = 0; i < n; i++) {
+            uint64_t tag = events[i].data.u64 >> 32;
+            int index = (int)(events[i].data.u64 & 0xFFFFFFFF);
+
+            if (tag == TAG_LISTENER) {
+                _accept(thread, index);
+            } else if (tag == TAG_TIMER) {
+                _sendDue(thread);
+            } else if (tag == TAG_CONNECTION) {
+                if (!thread->connections[index].used) continue;
+                if (events[i].events & EPOLLOUT &&
+                    _flush(thread, index) < 0)
+                    continue;
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                    _receive(thread, index);
+            }
+        }
+    }
+
+    for (int slot = 0; slot < thread->connectionCount; slot++)
+        if (thread->connections[slot].used) _close(thread, slot);
+    return NULL;
+}
+
+static int _listen(int port) {
+    int socketfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (socketfd < 0) return -1;
+
+    int one = 1;
+    setsockopt(socketfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in address = {.sin_family = AF_INET,
+                                  .sin_port = htons(port),
+                                  .sin_addr.s_addr = htonl(INADDR_ANY)};
+    socklen_t len = sizeof(address);
+    if (bind(socketfd, (struct sockaddr*)&address, len) < 0 ||
+        listen(socketfd, 1024) < 0 ||
+        getsockname(socketfd, (struct sockaddr*)&address, &len) < 0) {
+        close(socketfd);
+        return -1;
+    }
+    return socketfd;
+}
+
+static int _watch(int epollfd, int fd, uint64_t tag, int index) {
+    struct epoll_event event = {.events = EPOLLIN,
+                                .data.u64 = (tag << 32) | (uint32_t)index};
+    return epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
+}
+
+static int _initThread(DeviceFarm* farm, int index) {
+    FarmThread* thread = &farm->threads[index];
+    thread->farm = farm;
+    thread->seed = (farm->config.seed ? farm->config.seed : 1) * 2654435761u +
+                   index;
+    if (thread->seed == 0) thread->seed = 1;
+
+    thread->epollfd = epoll_create1(0);
+    thread->wakefd = eventfd(0, EFD_NONBLOCK);
+    thread->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (thread->epollfd < 0 || thread->wakefd < 0 || thread->timerfd < 0 ||
+        _watch(thread->epollfd, thread->wakefd, TAG_WAKE, 0) < 0 ||
+        _watch(thread->epollfd, thread->timerfd, TAG_TIMER, 0) < 0)
+        return -1;
+
+    for (int port = index; port < farm->config.ports;
+         port += farm->config.threads)
+        if (_watch(thread->epollfd, farm->listeners[port], TAG_LISTENER,
+                   port) < 0)
+            return -1;
+    return 0;
+}
+
+/**
+ * @brief open the ports of a farm and start serving them
+ *
+ * @param config layout and initial behaviour of the devices
+ * @return DeviceFarm* the farm, NULL if error
+ */
+DeviceFarm* newDeviceFarm(const FarmConfig* config) {
+    if (config == NULL || config->ports < 1 ||
+        config->ports > FARM_MAX_PORTS || config->units < 1 ||
+        config->units > FARM_MAX_UNITS || config->threads < 1 ||
+        config->threads > FARM_MAX_THREADS ||
+        config->profile.registers < 1 || config->profile.registers > 65536 ||
+        (config->basePort != 0 &&
+         config->basePort + config->ports - 1 > 65535)) {
+        ERROR("newDeviceFarm: invalid parameters\n");
+        return NULL;
+    }
+
+    DeviceFarm* farm = (DeviceFarm*)calloc(1, sizeof(*farm));
+    if (farm == NULL) {
+        MALLOC_ERR;
+        return NULL;
+    }
+    farm->config = *config;
+    if (farm->config.threads > farm->config.ports)
+        farm->config.threads = farm->config.ports;
+    farm->defaultProfile = config->profile;
+    pthread_mutex_init(&farm->profileLock, NULL);
+
+    int devices = config->ports * config->units;
+    size_t registers = config->profile.registers;
+    // descriptors are marked closed as soon as their arrays exist, so that
+    // freeDeviceFarm never closes one it did not open
+    farm->listeners = (int*)malloc(config->ports * sizeof(int));
+    for (int i = 0; farm->listeners != NULL && i < config->ports; i++)
+        farm->listeners[i] = -1;
+    farm->threads =
+        (FarmThread*)calloc(farm->config.threads, sizeof(FarmThread));
+    for (int i = 0; farm->threads != NULL && i < farm->config.threads; i++)
+        farm->threads[i].epollfd = farm->threads[i].wakefd =
+            farm->threads[i].timerfd = -1;
+    farm->ports = (int*)malloc(config->ports * sizeof(int));
+    farm->devices = (Device*)calloc(devices, sizeof(Device));
+    farm->registerBlock =
+        (uint16_t*)malloc(devices * registers * sizeof(uint16_t));
+    if (farm->listeners == NULL || farm->ports == NULL ||
+        farm->devices == NULL || farm->registerBlock == NULL ||
+        farm->threads == NULL) {
+        MALLOC_ERR;
+        freeDeviceFarm(farm);
+        return NULL;
+    }
+
+    for (int d = 0; d < devices; d++) {
+        Device* device = &farm->devices[d];
+        uint16_t unit = d % config->units + 1;
+        device->profile = &farm->defaultProfile;
+        device->registers = farm->registerBlock + d * registers;
+        for (size_t a = 0; a < registers; a++)
+            device->registers[a] = (unit << 8) | (a & 0xFF);
+    }
+
+    for (int i = 0; i < config->ports; i++) {
+        int port = config->basePort ? config->basePort + i : 0;
+        farm->listeners[i] = _listen(port);
+        if (farm->listeners[i] < 0) {
+            ERROR("farm: cannot listen on port %d\n", port);
+            freeDeviceFarm(farm);
+            return NULL;
+        }
+        struct sockaddr_in address;
+        socklen_t len = sizeof(address);
+        getsockname(farm->listeners[i], (struct sockaddr*)&address, &len);
+        farm->ports[i] = ntohs(address.sin_port);
+    }
+
+    for (int i = 0; i < farm->config.threads; i++) {
+        if (_initThread(farm, i) < 0) {
+            ERROR("farm: cannot set up thread %d\n", i);
+            freeDeviceFarm(farm);
+            return NULL;
+        }
+    }
+    for (int i = 0; i < farm->config.threads; i++) {
+        if (pthread_create(&farm->threads[i].thread, NULL, _farmLoop,
+                           &farm->threads[i]) != 0) {
+            ERROR("farm: cannot start thread %d\n", i);
+            freeDeviceFarm(farm);
+            return NULL;
+        }
+        farm->started = i + 1;
+    }
+
+    return farm;
+}
+
+/**
+ * @brief stop the threads, close every port and connection and free the
+ * farm
+ *
+ * @param farm the farm
+ */
+void freeDeviceFarm(DeviceFarm* farm) {
+    if (farm == NULL) return;
+
+    __atomic_store_n(&farm->stopping, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < farm->started; i++) {
+        uint64_t one = 1;
+        if (write(farm->threads[i].wakefd, &one, sizeof(one)) < 0)
+            ERROR("farm: cannot wake thread %d\n", i);
+    }
+    for (int i = 0; i < farm->started; i++)
+        pthread_join(farm->threads[i].thread, NULL);
+
+    for (int i = 0; farm->threads != NULL && i < farm->config.threads; i++) {
+        FarmThread* thread = &farm->threads[i];
+        if (thread->epollfd >= 0) close(thread->epollfd);
+        if (thread->wakefd >= 0) close(thread->wakefd);
+        if (thread->timerfd >= 0) close(thread->timerfd);
+        free(thread->connections);
+        free(thread->heap);
+    }
+    for (int i = 0; farm->listeners != NULL && i < farm->config.ports; i++)
+        if (farm->listeners[i] >= 0) close(farm->listeners[i]);
+    for (int i = 0; i < farm->profileCount; i++) free(farm->profiles[i]);
+
+    pthread_mutex_destroy(&farm->profileLock);
+    free(farm->profiles);
+    free(farm->threads);
+    free(farm->registerBlock);
+    free(farm->devices);
+    free(farm->ports);
+    free(farm->listeners);
+    free(farm);
+}
+
+/**
+ * @brief TCP port of a farm port index
+ *
+ * @return int the port, -1 if the index does not exist
+ */
+int farmPort(DeviceFarm* farm, int index) {
+    if (farm == NULL || index < 0 || index >= farm->config.ports) return -1;
+    return farm->ports[index];
+}
+
+/**
+ * @brief change the behaviour of one device, or of every unit of a port,
+ * while the farm runs
+ *
+ * @param farm the farm
+ * @param index port index
+ * @param unit unit id, 0 for every unit of the port
+ * @param profile new behaviour; its register map cannot be larger than the
+ * farm's
+ * @return int 0 if success, -1 if error
+ */
+int farmSetProfile(DeviceFarm* farm, int index, uint8_t unit,
+                   const DeviceProfile* profile) {
+    if (farm == NULL || profile == NULL || index < 0 ||
+        index >= farm->config.ports || unit > farm->config.units ||
+        profile->registers < 1 ||
+        profile->registers > farm->defaultProfile.registers) {
+        ERROR("farmSetProfile: invalid parameters\n");
+        return -1;
+    }
+
+    pthread_mutex_lock(&farm->profileLock);
+    DeviceProfile** profiles = (DeviceProfile**)realloc(
+        farm->profiles, (farm->profileCount + 1) * sizeof(DeviceProfile*));
+    DeviceProfile* copy = (DeviceProfile*)malloc(sizeof(*copy));
+    if (profiles != NULL) farm->profiles = profiles;
+    if (profiles == NULL || copy == NULL) {
+        pthread_mutex_unlock(&farm->profileLock);
+        free(copy);
+        MALLOC_ERR;
+        return -1;
+    }
+    *copy = *profile;
+    // replaced profiles may still be read by a farm thread, keep them all
+    farm->profiles[farm->profileCount++] = copy;
+    pthread_mutex_unlock(&farm->profileLock);
+
+    int first = unit ? unit : 1;
+    int last = unit ? unit : farm->config.units;
+    for (int u = first; u <= last; u++)
+        __atomic_store_n(
+            &farm->devices[index * farm->config.units + u - 1].profile, copy,
+            __ATOMIC_RELEASE);
+    return 0;
+}
+
+/**
+ * @brief register map of one device, e.g. to preload values or check
+ * writes; it is written by the farm thread serving the port
+ *
+ * @param farm the farm
+ * @param index port index
+ * @param unit unit id
+ * @param count filled with the size of the map
+ * @return uint16_t* the map, NULL if the device does not exist
+ */
+uint16_t* farmRegisters(DeviceFarm* farm, int index, uint8_t unit,
+                        uint32_t* count) {
+    if (farm == NULL || index < 0 || index >= farm->config.ports ||
+        unit < 1 || unit > farm->config.units)
+        return NULL;
+
+    if (count != NULL) *count = farm->defaultProfile.registers;
+    return farm->devices[index * farm->config.units + unit - 1].registers;
+}
+
+/**
+ * @brief farm wide counters
+ *
+ * @param farm the farm
+ * @param stats filled with the counters
+ */
+void farmGetStats(DeviceFarm* farm, FarmStats* stats) {
+    stats->connections =
+        __atomic_load_n(&farm->stats.connections, __ATOMIC_RELAXED);
+    stats->requests = __atomic_load_n(&farm->stats.requests, __ATOMIC_RELAXED);
+    stats->responses =
+        __atomic_load_n(&farm->stats.responses, __ATOMIC_RELAXED);
+    stats->exceptions =
+        __atomic_load_n(&farm->stats.exceptions, __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&farm->stats.dropped, __ATOMIC_RELAXED);
+    stats->writes = __atomic_load_n(&farm->stats.writes, __ATOMIC_RELAXED);
+}
+
+#undef MALLOC_ERR
@@ -2,8 +2,11 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "log.h"
+#include "transportLayer/dataPackaging.h"
+#include "transportLayer/modbusError.h"
 #include "transportLayer/modbusTCP.h"
 
 #define MALLOC_ERR \
@@ -15,12 +18,38 @@
  * @param ip server ip string
  * @param port server port
  *
- * @return socket file descriptor, -1 if error
+ * @return socket file descriptor, a ModbusError if error
  */
 int connectToServer(char* ip, int port) {
     return modbusConnect(ip, port, TIMEOUT_SEC, TIMEOUT_USEC);
 }
 
+/**
+ * @brief Connect to the server with tuned socket options
+ *
+ * @param ip server ip string
+ * @param port server port
+ * @param profile socket options, e.g. &tcpLowLatencyProfile, NULL for the
+ * system defaults
+ *
+ * @return socket file descriptor, a ModbusError if error
+ */
+int connectToServerProfile(char* ip, int port, const TcpProfile* profile) {
+    return modbusConnectProfile(ip, port, TIMEOUT_SEC, TIMEOUT_USEC, profile);
+}
+
+/**
+ * @brief Connect to the server through TLS (Modbus/TCP Security)
+ *
+ * @param ip server ip string
+ * @param port server port
+ *
+ * @return socket file descriptor, a ModbusError if error
+ */
+int connectToServerTLS(char* ip, int port) {
+    return modbusConnectTLS(ip, port, TIMEOUT_SEC, TIMEOUT_USEC);
+}
+
 /**
  * @brief Disconnect from the server
  *
@@ -28,6 +57,97 @@ int connectToServer(char* ip, int port) {
  */
 void disconnectFromServer(int socketfd) { modbusDisconnect(socketfd); }
 
+/**
+ * @brief check the parameters shared by every register request
+ *
+ * @return 0 if valid, modbusErrInvalid otherwise
+ */
+static int _checkRequest(int socketfd, uint16_t startingAddress,
+                         uint16_t quantity, uint16_t quantityMax) {
+    if (socketfd < 0) {
+        return modbusFail(modbusErrInvalid, "invalid socket\n");
+    }
+
+    if (quantity < MODBUS_QUANTITY_MIN || quantity > quantityMax) {
+        return modbusFail(modbusErrInvalid,
+                          "quantity must be between %d and %d\n",
+                          MODBUS_QUANTITY_MIN, quantityMax);
+    }
+
+    if (startingAddress < MODBUS_ADDRESS_MIN ||
+        startingAddress > MODBUS_ADDRESS_MAX) {
+        return modbusFail(modbusErrInvalid,
+                          "starting address must be between %d and %d\n",
+                          MODBUS_ADDRESS_MIN, MODBUS_ADDRESS_MAX);
+    }
+
+    if (startingAddress + quantity > MODBUS_ADDRESS_MAX) {
+        return modbusFail(modbusErrInvalid,
+                          "starting address + quantity must be less than %d\n",
+                          MODBUS_ADDRESS_MAX);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief send a request pdu and receive the response pdu into a caller
+ * provided buffer, without allocating
+ *
+ * Failures were recorded and logged by the transport layer, they are only
+ * passed up here.
+ *
+ * @return response length if success, a ModbusError if error
+ */
+static int _transact(int socketfd, uint16_t id, uint8_t* request, int len,
+                     uint8_t* response, int responseCap) {
+    int sent = modbusSend(socketfd, id, request, len);
+    if (sent < 0) return sent;
+    if (sent != len) {
+        return modbusFail(modbusErrSend,
+                          "short request send\n\tlen: %d sent %d\n", len,
+                          sent);
+    }
+
+    return modbusReceiveInto(socketfd, id, response, responseCap);
+}
+
+/**
+ * @brief copy a response pdu into a new buffer for the allocating API
+ */
+static uint8_t* _dupResponse(uint8_t* response, int len, int* rlen) {
+    uint8_t* copy = (uint8_t*)malloc(len);
+    if (copy == NULL) {
+        MALLOC_ERR;
+        modbusRecord(modbusErrNoMemory);
+        return NULL;
+    }
+
+    memcpy(copy, response, len);
+    *rlen = len;
+    return copy;
+}
+
+/**
+ * @brief write a Read Holding Registers request into a caller provided
+ * buffer
+ *
+ * @param startingAddress starting address of the registers to read
+ * @param quantity number of registers to read
+ * @param pdu buffer of at least MODBUS_RHR_REQUEST_LEN bytes
+ * @return int length of the request
+ */
+int encodeReadHoldingRegs(uint16_t startingAddress, uint16_t quantity,
+                          uint8_t* pdu) {
+    pdu[0] = (uint8_t)(readHoldingRegsFuncCode);
+    pdu[1] = (uint8_t)(startingAddress >> 8);
+    pdu[2] = (uint8_t)(startingAddress & 0xFF);
+    pdu[3] = (uint8_t)(quantity >> 8);
+    pdu[4] = (uint8_t)(quantity & 0xFF);
+
+    return MODBUS_RHR_REQUEST_LEN;
+}
+
 /**
  * @brief Create a Read Holding Registers request
  *
@@ -39,110 +159,216 @@ void disconnectFromServer(int socketfd) { modbusDisconnect(socketfd); }
  */
 uint8_t* newReadHoldingRegs(uint16_t startingAddress, uint16_t quantity,
                             int* len) {
-    *len = 5;  // 1 byte for function code + 2 bytes for starting address + 2
-               // bytes for quantity
-    uint8_t* pdu = (uint8_t*)malloc(*len);
+    uint8_t* pdu = (uint8_t*)malloc(MODBUS_RHR_REQUEST_LEN);
     if (pdu == NULL) {
         MALLOC_ERR;
         return NULL;
     }
 
-    pdu[0] = (uint8_t)(readHoldingRegsFuncCode);
-    pdu[1] = (uint8_t)(startingAddress >> 8);
-    pdu[2] = (uint8_t)(startingAddress & 0xFF);
-    pdu[3] = (uint8_t)(quantity >> 8);
-    pdu[4] = (uint8_t)(quantity & 0xFF);
-
+    *len = encodeReadHoldingRegs(startingAddress, quantity, pdu);
     return pdu;
 }
 
 /**
- * @brief send a Read Holding Registers request to the server
+ * @brief check a Read Holding Registers response pdu and extract the
+ * register values
+ *
+ * @param response response pdu
+ * @param rlen response length
+ * @param quantity number of registers requested
+ * @param values array of at least quantity elements, filled with the
+ * register values in host byte order
+ * @return int 0 if success, the exception code if the response is an
+ * exception, modbusErrMalformed if malformed
+ */
+int parseReadHoldingRegsResponse(uint8_t* response, int rlen,
+                                 uint16_t quantity, uint16_t* values) {
+    if (rlen >= 2 && response[0] == (readHoldingRegsFuncCode | 0x80)) {
+        return modbusRecord(response[1]);
+    }
+
+    if (rlen < 2 || response[0] != readHoldingRegsFuncCode ||
+        response[1] != quantity * 2 || rlen != 2 + quantity * 2) {
+        return modbusFail(modbusErrMalformed,
+                          "malformed Read Holding Registers response\n");
+    }
+
+    for (int i = 0; i < quantity; i++) {
+        values[i] = (uint16_t)(response[2 + 2 * i] << 8 | response[3 + 2 * i]);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief read holding registers straight into a caller provided array,
+ * nothing is allocated
  *
  * @param socketfd socket file descriptor
  * @param id id of the transaction
  * @param startingAddress starting address of the registers to read
  * @param quantity number of registers to read
- * @param response pointer to the sresponse buffer
- * @return int response length if success, -1 if error
+ * @param values array of at least quantity elements, filled with the
+ * register values in host byte order
+ * @return int 0 if success, the exception code if the server answered with
+ * an exception, a ModbusError if error
  */
-uint8_t* readHoldingRegisters(int socketfd, uint16_t id,
-                              uint16_t startingAddress, uint16_t quantity,
-                              int* rlen) {
-    if (socketfd < 0) {
-        ERROR("invalid socket\n");
-        return NULL;
+int readHoldingRegistersInto(int socketfd, uint16_t id,
+                             uint16_t startingAddress, uint16_t quantity,
+                             uint16_t* values) {
+    if (values == NULL) {
+        return modbusFail(modbusErrInvalid, "no array for the values\n");
+    }
+    int err = _checkRequest(socketfd, startingAddress, quantity,
+                            MODBUS_RHR_QUANTITY_MAX);
+    if (err < 0) {
+        return err;
     }
 
-    if (quantity < MODBUS_QUANTITY_MIN || quantity > MODBUS_RHR_QUANTITY_MAX) {
-        ERROR("quantity must be between %d and %d\n", MODBUS_QUANTITY_MIN,
-              MODBUS_RHR_QUANTITY_MAX);
-        return NULL;
+    uint8_t request[MODBUS_RHR_REQUEST_LEN];
+    uint8_t response[MODBUS_MAX_PDU_SIZE];
+    int len = encodeReadHoldingRegs(startingAddress, quantity, request);
+
+    int rlen = _transact(socketfd, id, request, len, response,
+                         sizeof(response));
+    if (rlen < 0) {
+        return rlen;
     }
 
-    if (startingAddress < MODBUS_ADDRESS_MIN ||
-        startingAddress > MODBUS_ADDRESS_MAX) {
-        ERROR("starting address must be between %d and %d\n",
-              MODBUS_ADDRESS_MIN, MODBUS_ADDRESS_MAX);
-        return NULL;
+    return parseReadHoldingRegsResponse(response, rlen, quantity, values);
+}
+
+/**
+ * @brief build the complete Read Holding Registers frame for a fixed
+ * address/quantity pair, validation is done here once
+ *
+ * @param request template to fill
+ * @param startingAddress starting address of the registers to read
+ * @param quantity number of registers to read
+ * @return int 0 if success, modbusErrInvalid if the range is invalid
+ */
+int compileReadHoldingRegs(RequestTemplate* request, uint16_t startingAddress,
+                           uint16_t quantity) {
+    // any valid descriptor passes the socket check, the socket comes later
+    if (request == NULL) {
+        return modbusFail(modbusErrInvalid, "no template to compile\n");
+    }
+    int err = _checkRequest(0, startingAddress, quantity,
+                            MODBUS_RHR_QUANTITY_MAX);
+    if (err < 0) {
+        return err;
     }
 
-    if (startingAddress + quantity > MODBUS_ADDRESS_MAX) {
-        ERROR("starting address + quantity must be less than %d\n",
-              MODBUS_ADDRESS_MAX);
-        return NULL;
+    uint8_t pdu[MODBUS_RHR_REQUEST_LEN];
+    ModbusADU adu = {.transactionID = 0,
+                     .protocolIdentifier = PROTOCOL_ID,
+                     .length = MODBUS_RHR_REQUEST_LEN + 1,
+                     .unitIdentifier = UNIT_ID,
+                     .pdu = pdu};
+    encodeReadHoldingRegs(startingAddress, quantity, pdu);
+    if (encodeModbusADU(&adu, request->frame, sizeof(request->frame)) !=
+        MODBUS_RHR_FRAME_LEN) {
+        return modbusErrInvalid;
     }
 
-    int len, sent;
-    uint8_t* packet = newReadHoldingRegs(startingAddress, quantity, &len);
-    if (packet == NULL) {
-        return NULL;
+    request->quantity = quantity;
+    request->responseLen = 2 + quantity * 2;
+    return 0;
+}
+
+/**
+ * @brief send a compiled Read Holding Registers request, the only per call
+ * work is patching the transaction id into the frame
+ *
+ * The frame is patched in place, so a template must not be sent from two
+ * threads at once.
+ *
+ * @param socketfd socket file descriptor
+ * @param id id of the transaction
+ * @param request template built by compileReadHoldingRegs
+ * @param values array of at least request->quantity elements, filled with
+ * the register values in host byte order
+ * @return int 0 if success, the exception code if the server answered with
+ * an exception, a ModbusError if error
+ */
+int readHoldingRegistersTemplate(int socketfd, uint16_t id,
+                                 RequestTemplate* request, uint16_t* values) {
+    request->frame[0] = (uint8_t)(id >> 8);
+    request->frame[1] = (uint8_t)(id & 0xFF);
+
+    int sent = modbusSendFrame(socketfd, request->frame, MODBUS_RHR_FRAME_LEN);
+    if (sent < 0) return sent;
+    if (sent != MODBUS_RHR_FRAME_LEN) {
+        return modbusFail(modbusErrSend, "short request send\n");
+    }
+
+    uint8_t response[MODBUS_MAX_PDU_SIZE];
+    int rlen = modbusReceiveInto(socketfd, id, response, sizeof(response));
+    if (rlen < 0) {
+        return rlen;
+    }
+
+    if (rlen == 2 && response[0] == (readHoldingRegsFuncCode | 0x80)) {
+        return modbusRecord(response[1]);
     }
 
-    sent = modbusSend(socketfd, id, packet, len);
+    if (rlen != request->responseLen ||
+        response[0] != readHoldingRegsFuncCode ||
+        response[1] != request->responseLen - 2) {
+        return modbusFail(modbusErrMalformed,
+                          "malformed Read Holding Registers response\n");
+    }
+
+    for (int i = 0; i < request->quantity; i++) {
+        values[i] = (uint16_t)(response[2 + 2 * i] << 8 | response[3 + 2 * i]);
+    }
 
-    // free memory
-    free(packet);
+    return 0;
+}
 
-    if (len != sent) {
-        ERROR(
-            "failed to send Write Multiple Registers request\n\tlen: %d sent "
-            "%d\n",
-            len, sent);
+/**
+ * @brief send a Read Holding Registers request to the server
+ *
+ * @param socketfd socket file descriptor
+ * @param id id of the transaction
+ * @param startingAddress starting address of the registers to read
+ * @param quantity number of registers to read
+ * @param rlen pointer to the response length
+ * @return uint8_t* pointer to the response buffer -- must be freed by the
+ * caller, NULL if error, see modbusLastError
+ */
+uint8_t* readHoldingRegisters(int socketfd, uint16_t id,
+                              uint16_t startingAddress, uint16_t quantity,
+                              int* rlen) {
+    if (_checkRequest(socketfd, startingAddress, quantity,
+                      MODBUS_RHR_QUANTITY_MAX) < 0) {
         return NULL;
     }
 
-    packet = modbusReceive(socketfd, id, &len);
+    uint8_t request[MODBUS_RHR_REQUEST_LEN];
+    uint8_t response[MODBUS_MAX_PDU_SIZE];
+    int len = encodeReadHoldingRegs(startingAddress, quantity, request);
 
-    if (packet == NULL) {
-        ERROR("failed to receive Read Holding Registers response\n");
+    len = _transact(socketfd, id, request, len, response, sizeof(response));
+    if (len < 0) {
         return NULL;
     }
 
-    *rlen = len;
-    return packet;
+    return _dupResponse(response, len, rlen);
 }
 
 /**
- * @brief Create a Write Multiple Registers request
+ * @brief write a Write Multiple Registers request into a caller provided
+ * buffer
  *
  * @param startingAddress starting address of the registers to write
  * @param quantity number of registers to write
  * @param data pointer to the data to write
- * @param len pointer to the length of the request
- * @return uint8_t* pointer to the request created -- must be freed by the
- * caller
+ * @param pdu buffer of at least MODBUS_WMR_REQUEST_LEN(quantity) bytes
+ * @return int length of the request
  */
-uint8_t* newWriteMultipleRegs(uint16_t startingAddress, uint16_t quantity,
-                              uint16_t* data, int* len) {
-    *len = quantity * 2 +
-           6;  // 2 bytes for starting address + 2 bytes for quantity
-    uint8_t* pdu = (uint8_t*)malloc(*len);
-    if (pdu == NULL) {
-        MALLOC_ERR;
-        return NULL;
-    }
-
+int encodeWriteMultipleRegs(uint16_t startingAddress, uint16_t quantity,
+                            uint16_t* data, uint8_t* pdu) {
     pdu[0] = (uint8_t)(writeMultipleRegsFuncCode);
     pdu[1] = (uint8_t)(startingAddress >> 8);
     pdu[2] = (uint8_t)(startingAddress & 0xFF);
@@ -156,77 +382,126 @@ uint8_t* newWriteMultipleRegs(uint16_t startingAddress, uint16_t quantity,
         pdu[2 * i + 7] = (uint8_t)(data[i] & 0xFF);  // low byte
     }
 
-    return pdu;
+    return MODBUS_WMR_REQUEST_LEN(quantity);
 }
 
 /**
- * @brief send a Write Multiple Registers request to the server
+ * @brief Create a Write Multiple Registers request
  *
- * @param socketfd socket file descriptor
- * @param id id of the transaction
  * @param startingAddress starting address of the registers to write
- * @param quantity quantity of registers to write
+ * @param quantity number of registers to write
  * @param data pointer to the data to write
- * @param rlen pointer to the response length
- * @return uint8_t* pointer to the response buffer -- must be freed by the
+ * @param len pointer to the length of the request
+ * @return uint8_t* pointer to the request created -- must be freed by the
  * caller
  */
-uint8_t* writeMultipleRegisters(int socketfd, uint16_t id,
-                                uint16_t startingAddress, uint16_t quantity,
-                                uint16_t* data, int* rlen) {
-    if (socketfd < 0) {
-        ERROR("invalid socket\n");
+uint8_t* newWriteMultipleRegs(uint16_t startingAddress, uint16_t quantity,
+                              uint16_t* data, int* len) {
+    uint8_t* pdu = (uint8_t*)malloc(MODBUS_WMR_REQUEST_LEN(quantity));
+    if (pdu == NULL) {
+        MALLOC_ERR;
         return NULL;
     }
 
-    if (quantity < MODBUS_QUANTITY_MIN || quantity > MODBUS_WMR_QUANTITY_MAX) {
-        ERROR("quantity must be between %d and %d\n", MODBUS_QUANTITY_MIN,
-              MODBUS_WMR_QUANTITY_MAX);
-        return NULL;
-    }
+    *len = encodeWriteMultipleRegs(startingAddress, quantity, data, pdu);
+    return pdu;
+}
 
-    if (startingAddress < MODBUS_ADDRESS_MIN ||
-        startingAddress > MODBUS_ADDRESS_MAX) {
-        ERROR("starting address must be between %d and %d\n",
-              MODBUS_ADDRESS_MIN, MODBUS_ADDRESS_MAX);
-        return NULL;
+/**
+ * @brief check a Write Multiple Registers response pdu
+ *
+ * @param response response pdu
+ * @param rlen response length
+ * @param startingAddress starting address of the request
+ * @param quantity quantity of registers of the request
+ * @return int 0 if success, the exception code if the response is an
+ * exception, modbusErrMalformed if malformed
+ */
+int parseWriteMultipleRegsResponse(uint8_t* response, int rlen,
+                                   uint16_t startingAddress,
+                                   uint16_t quantity) {
+    if (rlen >= 2 && response[0] == (writeMultipleRegsFuncCode | 0x80)) {
+        return modbusRecord(response[1]);
     }
 
-    if (startingAddress + quantity > MODBUS_ADDRESS_MAX) {
-        ERROR("starting address + quantity must be less than %d\n",
-              MODBUS_ADDRESS_MAX);
-        return NULL;
+    // the response echoes the starting address and the quantity
+    if (rlen != 5 || response[0] != writeMultipleRegsFuncCode ||
+        ((response[1] << 8) | response[2]) != startingAddress ||
+        ((response[3] << 8) | response[4]) != quantity) {
+        return modbusFail(modbusErrMalformed,
+                          "malformed Write Multiple Registers response\n");
     }
 
-    int len, sent;
-    uint8_t* packet =
-        newWriteMultipleRegs(startingAddress, quantity, data, &len);
-    if (packet == NULL) {
-        return NULL;
+    return 0;
+}
+
+/**
+ * @brief write registers from a caller provided array, nothing is allocated
+ *
+ * @param socketfd socket file descriptor
+ * @param id id of the transaction
+ * @param startingAddress starting address of the registers to write
+ * @param quantity quantity of registers to write
+ * @param data values to write, in host byte order
+ * @return int 0 if success, the exception code if the server answered with
+ * an exception, a ModbusError if error
+ */
+int writeMultipleRegistersFrom(int socketfd, uint16_t id,
+                               uint16_t startingAddress, uint16_t quantity,
+                               uint16_t* data) {
+    if (data == NULL) {
+        return modbusFail(modbusErrInvalid, "no data to write\n");
+    }
+    int err = _checkRequest(socketfd, startingAddress, quantity,
+                            MODBUS_WMR_QUANTITY_MAX);
+    if (err < 0) {
+        return err;
     }
 
-    sent = modbusSend(socketfd, id, packet, len);
+    uint8_t request[MODBUS_WMR_REQUEST_LEN(MODBUS_WMR_QUANTITY_MAX)];
+    uint8_t response[MODBUS_MAX_PDU_SIZE];
+    int len = encodeWriteMultipleRegs(startingAddress, quantity, data, request);
 
-    // free memory
-    free(packet);
+    int rlen = _transact(socketfd, id, request, len, response,
+                         sizeof(response));
+    if (rlen < 0) {
+        return rlen;
+    }
+
+    return parseWriteMultipleRegsResponse(response, rlen, startingAddress,
+                                          quantity);
+}
 
-    if (len != sent) {
-        ERROR(
-            "failed to send Write Multiple Registers request\n\tlen: %d sent "
-            "%d\n",
-            len, sent);
+/**
+ * @brief send a Write Multiple Registers request to the server
+ *
+ * @param socketfd socket file descriptor
+ * @param id id of the transaction
+ * @param startingAddress starting address of the registers to write
+ * @param quantity quantity of registers to write
+ * @param data pointer to the data to write
+ * @param rlen pointer to the response length
+ * @return uint8_t* pointer to the response buffer -- must be freed by the
+ * caller, NULL if error, see modbusLastError
+ */
+uint8_t* writeMultipleRegisters(int socketfd, uint16_t id,
+                                uint16_t startingAddress, uint16_t quantity,
+                                uint16_t* data, int* rlen) {
+    if (_checkRequest(socketfd, startingAddress, quantity,
+                      MODBUS_WMR_QUANTITY_MAX) < 0) {
         return NULL;
     }
 
-    packet = modbusReceive(socketfd, id, &len);
+    uint8_t request[MODBUS_WMR_REQUEST_LEN(MODBUS_WMR_QUANTITY_MAX)];
+    uint8_t response[MODBUS_MAX_PDU_SIZE];
+    int len = encodeWriteMultipleRegs(startingAddress, quantity, data, request);
 
-    if (packet == NULL) {
-        ERROR("failed to receive Write Multiple Registers response\n");
+    len = _transact(socketfd, id, request, len, response, sizeof(response));
+    if (len < 0) {
         return NULL;
     }
 
-    *rlen = len;
-    return packet;
+    return _dupResponse(response, len, rlen);
 }
 
 #undef MALLOC_ERR
\ No newline at end of file
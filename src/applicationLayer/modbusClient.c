@@ -0,0 +1,490 @@
+#include "applicationLayer/modbusClient.h"
+
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include "applicationLayer/circuitBreaker.h"
+#include "applicationLayer/modbusApp.h"
+#include "log.h"
+#include "transportLayer/dataPackaging.h"
+#include "transportLayer/modbusError.h"
+#include "transportLayer/modbusTCP.h"
+#include "transportLayer/tcpControl.h"
+
+#define MALLOC_ERR \
+    ERROR("malloc failed in %s: %s, %d\n", __func__, __FILE__, __LINE__)
+
+/**
+ * @brief a thread waiting for the response to its request
+ *
+ * @param sentNs when the request was sent, its deadline is timeoutNs later
+ * @param done set when the response (or the failure) was routed to it
+ * @param error the ModbusError when the request failed
+ * @param response response protocol data unit, NULL if the request failed
+ */
+typedef struct _clientWaiter {
+    uint16_t id;
+    uint8_t unit;
+    uint8_t receivedUnit;  // unit that answered, on modbusErrUnitMismatch
+    uint64_t sentNs;
+    int done;
+    int error;
+    uint8_t* response;
+    int responseLen;
+    struct _clientWaiter* next;
+} ClientWaiter;
+
+struct _modbusClient {
+    int socketfd;
+    uint16_t nextId;     // updated atomically
+    uint64_t timeoutNs;  // how long a request waits for its response
+
+    pthread_mutex_t writeLock;  // one frame on the wire at a time
+
+    pthread_mutex_t lock;  // protects the fields below
+    pthread_cond_t routed;
+    ClientWaiter* waiters;
+    int readerActive;
+    CircuitBreaker breakers[256];  // health of each unit identifier
+
+    // an io_uring thread keeps a receive armed on the socket, so no other
+    // thread may read it: see _admitThread
+    pthread_t firstUser;
+    int used;
+    int shared;      // more than one thread used the client
+    int uringBound;  // firstUser used it through io_uring
+};
+
+static uint64_t _now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static ModbusClient* _newClient(int socketfd) {
+    if (socketfd < 0) return NULL;
+
+    ModbusClient* client = (ModbusClient*)calloc(1, sizeof(*client));
+    if (client == NULL) {
+        MALLOC_ERR;
+        disconnectFromServer(socketfd);
+        return NULL;
+    }
+    client->socketfd = socketfd;
+
+    // a request times out after as long as one read of the connection
+    struct timeval timeout = {0};
+    socklen_t optlen = sizeof(timeout);
+    getsockopt(socketfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, &optlen);
+    if (timeout.tv_sec == 0 && timeout.tv_usec == 0) {
+        timeout.tv_sec = TIMEOUT_SEC;
+        timeout.tv_usec = TIMEOUT_USEC;
+    }
+    client->timeoutNs =
+        (uint64_t)timeout.tv_sec * 1000000000ULL + timeout.tv_usec * 1000ULL;
+
+    pthread_mutex_init(&client->writeLock, NULL);
+    pthread_mutex_init(&client->lock, NULL);
+    pthread_cond_init(&client->routed, NULL);
+
+    clientSetBreaker(client, BREAKER_DEFAULT_THRESHOLD,
+                     BREAKER_DEFAULT_BACKOFF_NS,
+                     BREAKER_DEFAULT_MAX_BACKOFF_NS);
+
+    return client;
+}
+
+/**
+ * @brief connect to a server and create a client for it
+ *
+ * @param ip server ip string
+ * @param port server port
+ * @return ModbusClient* the client, NULL if error
+ */
+ModbusClient* newModbusClient(char* ip, int port) {
+    return _newClient(connectToServer(ip, port));
+}
+
+/**
+ * @brief connect to a server through TLS (Modbus/TCP Security) and create a
+ * client for it, tlsInit must have been called
+ *
+ * @param ip server ip string
+ * @param port server port
+ * @return ModbusClient* the client, NULL if error
+ */
+ModbusClient* newModbusClientTLS(char* ip, int port) {
+    return _newClient(connectToServerTLS(ip, port));
+}
+
+/**
+ * @brief configure the circuit breakers of every unit, resetting them
+ *
+ * @param client the client
+ * @param threshold consecutive failures after which a unit fails fast
+ * @param backoffNs wait before the first recovery probe
+ * @param maxBackoffNs longest wait between recovery probes
+ */
+void clientSetBreaker(ModbusClient* client, int threshold, uint64_t backoffNs,
+                      uint64_t maxBackoffNs) {
+    pthread_mutex_lock(&client->lock);
+    for (int unit = 0; unit < 256; unit++)
+        breakerInit(&client->breakers[unit], threshold, backoffNs,
+                    maxBackoffNs);
+    pthread_mutex_unlock(&client->lock);
+}
+
+/**
+ * @brief copy the circuit breaker of one unit
+ *
+ * @param client the client
+ * @param unit unit identifier
+ * @param breaker filled with the breaker state and counters
+ */
+void clientUnitHealth(ModbusClient* client, uint8_t unit,
+                      CircuitBreaker* breaker) {
+    pthread_mutex_lock(&client->lock);
+    *breaker = client->breakers[unit];
+    pthread_mutex_unlock(&client->lock);
+}
+
+/**
+ * @brief disconnect and free a client, no thread may be using it
+ *
+ * @param client the client
+ */
+void freeModbusClient(ModbusClient* client) {
+    if (client == NULL) return;
+
+    disconnectFromServer(client->socketfd);
+    pthread_cond_destroy(&client->routed);
+    pthread_mutex_destroy(&client->lock);
+    pthread_mutex_destroy(&client->writeLock);
+    free(client);
+}
+
+/**
+ * @brief admit the calling thread, must hold client->lock
+ *
+ * The io_uring backend arms a multishot receive on the socket that stays
+ * with the thread's ring after it stops reading, and would take the bytes
+ * meant for the next reader. A client used through io_uring therefore
+ * stays with that one thread, and a client shared by several threads
+ * refuses io_uring.
+ *
+ * @return int 0 if the thread may use the client, -1 if not
+ */
+static int _admitThread(ModbusClient* client) {
+    pthread_t self = pthread_self();
+    if (!client->used) {
+        client->firstUser = self;
+        client->used = 1;
+    } else if (!pthread_equal(client->firstUser, self)) {
+        if (client->uringBound) return -1;
+        client->shared = 1;
+    }
+
+    if (tcpCurrentBackend() == tcpUringBackend) {
+        if (client->shared) return -1;
+        client->uringBound = 1;
+    }
+    return 0;
+}
+
+static void _unlink(ModbusClient* client, ClientWaiter* waiter) {
+    for (ClientWaiter** w = &client->waiters; *w != NULL; w = &(*w)->next) {
+        if (*w == waiter) {
+            *w = waiter->next;
+            return;
+        }
+    }
+}
+
+/**
+ * @brief hand a received ADU to its waiter, must hold client->lock
+ */
+static void _route(ModbusClient* client, ModbusADU* adu) {
+    for (ClientWaiter* w = client->waiters; w != NULL; w = w->next) {
+        if (w->done || w->id != adu->transactionID) continue;
+
+        if (adu->unitIdentifier != w->unit) {
+            // logged by the waiter, which owns the failure
+            w->error = modbusErrUnitMismatch;
+            w->receivedUnit = adu->unitIdentifier;
+        } else {
+            // the frame goes back to the reader's pool, the caller owns a copy
+            w->response = (uint8_t*)malloc(adu->length - 1);
+            if (w->response == NULL) {
+                MALLOC_ERR;
+                w->error = modbusErrNoMemory;
+            } else {
+                memcpy(w->response, adu->pdu, adu->length - 1);
+                w->responseLen = adu->length - 1;
+            }
+        }
+        w->done = 1;
+        return;
+    }
+
+    modbusFail(modbusErrIdMismatch, "unexpected response, transaction id: %d\n",
+               adu->transactionID);
+}
+
+/**
+ * @brief fail every waiter with code, must hold client->lock
+ */
+static void _failAll(ModbusClient* client, int code) {
+    for (ClientWaiter* w = client->waiters; w != NULL; w = w->next) {
+        if (w->done) continue;
+        w->error = code;
+        w->done = 1;
+    }
+}
+
+/**
+ * @brief fail the waiters whose deadline passed, must hold client->lock
+ */
+static void _failExpired(ModbusClient* client) {
+    uint64_t now = _now();
+    for (ClientWaiter* w = client->waiters; w != NULL; w = w->next) {
+        if (w->done || now - w->sentNs < client->timeoutNs) continue;
+        w->error = modbusErrTimeout;
+        w->done = 1;
+    }
+}
+
+/**
+ * @brief time left before the earliest waiter deadline, must hold
+ * client->lock
+ *
+ * @return int milliseconds, rounded up
+ */
+static int _untilDeadline(ModbusClient* client) {
+    uint64_t now = _now();
+    uint64_t left = client->timeoutNs;
+    for (ClientWaiter* w = client->waiters; w != NULL; w = w->next) {
+        if (w->done) continue;
+        uint64_t waited = now - w->sentNs;
+        if (waited >= client->timeoutNs) return 0;
+        if (client->timeoutNs - waited < left)
+            left = client->timeoutNs - waited;
+    }
+    return (int)((left + 999999) / 1000000);
+}
+
+/**
+ * @brief wait for the socket to become readable, at most timeoutMs
+ *
+ * A client on the io_uring backend has a single thread, hence a single
+ * waiter whose deadline the receive timeout already bounds: its staged
+ * data is not visible to poll, so it reads straight away.
+ *
+ * @return int 1 if a read may start, 0 if nothing arrived in time
+ */
+static int _readable(int socketfd, int timeoutMs) {
+    if (tcpCurrentBackend() == tcpUringBackend || tcpPending(socketfd))
+        return 1;
+    struct pollfd pfd = {.fd = socketfd, .events = POLLIN};
+    // a failed poll is left to the read to report
+    return poll(&pfd, 1, timeoutMs) != 0;
+}
+
+/**
+ * @brief send a request to the default unit (UNIT_ID) and wait for its
+ * response, may be called from any number of threads at once
+ *
+ * @param client the client
+ * @param pdu request protocol data unit
+ * @param pduLen request protocol data unit length
+ * @param rlen pointer to the response length
+ * @return uint8_t* pointer to the response buffer -- must be freed by the
+ * caller, NULL if error
+ */
+uint8_t* clientTransact(ModbusClient* client, uint8_t* pdu, int pduLen,
+                        int* rlen) {
+    return clientTransactUnit(client, UNIT_ID, pdu, pduLen, rlen);
+}
+
+/**
+ * @brief send a request to one unit behind the server (e.g. a slave of a
+ * TCP to RTU gateway) and wait for its response, every unit shares the
+ * client's connection
+ *
+ * @param client the client
+ * @param unit unit identifier
+ * @param pdu request protocol data unit
+ * @param pduLen request protocol data unit length
+ * @param rlen pointer to the response length
+ * @return uint8_t* pointer to the response buffer -- must be freed by the
+ * caller, NULL if error, see modbusLastError; modbusErrRejected while the
+ * unit's circuit breaker fails fast
+ */
+uint8_t* clientTransactUnit(ModbusClient* client, uint8_t unit, uint8_t* pdu,
+                            int pduLen, int* rlen) {
+    if (client == NULL || pdu == NULL || pduLen <= 0) {
+        modbusFail(modbusErrInvalid, "clientTransact: invalid parameters\n");
+        return NULL;
+    }
+
+    ClientWaiter waiter = {0};
+    waiter.id = __atomic_fetch_add(&client->nextId, 1, __ATOMIC_RELAXED);
+    waiter.unit = unit;
+
+    pthread_mutex_lock(&client->lock);
+    if (_admitThread(client) < 0) {
+        pthread_mutex_unlock(&client->lock);
+        modbusFail(modbusErrInvalid,
+                   "clientTransact: a client used through io_uring cannot "
+                   "be shared between threads\n");
+        return NULL;
+    }
+    if (!breakerAllow(&client->breakers[unit])) {
+        pthread_mutex_unlock(&client->lock);
+        LOG("unit %d unresponsive, request failed fast\n", unit);
+        modbusRecord(modbusErrRejected);
+        return NULL;
+    }
+
+    // register before sending so a fast response always finds its waiter
+    waiter.sentNs = _now();
+    waiter.next = client->waiters;
+    client->waiters = &waiter;
+    pthread_mutex_unlock(&client->lock);
+
+    pthread_mutex_lock(&client->writeLock);
+    int sent = modbusSendUnit(client->socketfd, unit, waiter.id, pdu, pduLen);
+    pthread_mutex_unlock(&client->writeLock);
+
+    // failures this thread already recorded, the others are recorded below
+    int recorded = 0;
+    pthread_mutex_lock(&client->lock);
+    if (sent != pduLen) {
+        // a failed send was recorded and logged by the transport layer
+        waiter.error = sent < 0 ? sent
+                                : modbusFail(modbusErrSend,
+                                             "short request send\n\tlen: %d "
+                                             "sent %d\n",
+                                             pduLen, sent);
+        waiter.done = 1;
+        recorded = 1;
+    }
+
+    while (!waiter.done) {
+        if (client->readerActive) {
+            pthread_cond_wait(&client->routed, &client->lock);
+            continue;
+        }
+
+        // no thread is reading: read on behalf of everybody, until the
+        // earliest deadline at most
+        client->readerActive = 1;
+        int timeoutMs = _untilDeadline(client);
+        pthread_mutex_unlock(&client->lock);
+        ModbusADU* adu = NULL;
+        int ready = _readable(client->socketfd, timeoutMs);
+        if (ready) adu = receiveModbusADU(client->socketfd);
+        pthread_mutex_lock(&client->lock);
+        client->readerActive = 0;
+
+        int readTimedOut = 0;
+        if (adu != NULL) {
+            _route(client, adu);
+            freeModbusADU(adu);
+        } else if (ready && modbusLastError() != modbusErrTimeout) {
+            // a broken or desynchronised stream cannot be recovered
+            _failAll(client, modbusLastError());
+            recorded = 1;
+        } else {
+            readTimedOut = ready;
+        }
+
+        // nothing was lost from the stream: only the requests that waited
+        // their full timeout fail, even while other units keep answering
+        _failExpired(client);
+        if (readTimedOut && waiter.done) recorded = 1;
+        pthread_cond_broadcast(&client->routed);
+    }
+
+    _unlink(client, &waiter);
+    int result = waiter.response == NULL ? waiter.error : 0;
+    if (result == 0 && (waiter.response[0] & 0x80) && waiter.responseLen > 1)
+        result = waiter.response[1];
+    breakerRecord(&client->breakers[unit], result);
+    pthread_mutex_unlock(&client->lock);
+
+    if (waiter.error == modbusErrUnitMismatch) {
+        modbusFail(modbusErrUnitMismatch,
+                   "unit identifier mismatch\n\treceived: %d\n\t"
+                   "expected: %d\n",
+                   waiter.receivedUnit, unit);
+    } else if (waiter.response == NULL && !recorded) {
+        modbusRecord(waiter.error);
+    }
+
+    if (waiter.response != NULL) *rlen = waiter.responseLen;
+    return waiter.response;
+}
+
+/**
+ * @brief Read Holding Registers through a shared client
+ *
+ * @param client the client
+ * @param startingAddress starting address of the registers to read
+ * @param quantity number of registers to read
+ * @param rlen pointer to the response length
+ * @return uint8_t* pointer to the response buffer -- must be freed by the
+ * caller, NULL if error
+ */
+uint8_t* clientReadHoldingRegisters(ModbusClient* client,
+                                    uint16_t startingAddress,
+                                    uint16_t quantity, int* rlen) {
+    if (quantity < MODBUS_QUANTITY_MIN || quantity > MODBUS_RHR_QUANTITY_MAX ||
+        startingAddress + quantity > MODBUS_ADDRESS_MAX) {
+        ERROR("invalid Read Holding Registers range\n");
+        return NULL;
+    }
+
+    int len;
+    uint8_t* pdu = newReadHoldingRegs(startingAddress, quantity, &len);
+    if (pdu == NULL) return NULL;
+
+    uint8_t* response = clientTransact(client, pdu, len, rlen);
+    free(pdu);
+    return response;
+}
+
+/**
+ * @brief Write Multiple Registers through a shared client
+ *
+ * @param client the client
+ * @param startingAddress starting address of the registers to write
+ * @param quantity quantity of registers to write
+ * @param data pointer to the data to write
+ * @param rlen pointer to the response length
+ * @return uint8_t* pointer to the response buffer -- must be freed by the
+ * caller, NULL if error
+ */
+uint8_t* clientWriteMultipleRegisters(ModbusClient* client,
+                                      uint16_t startingAddress,
+                                      uint16_t quantity, uint16_t* data,
+                                      int* rlen) {
+    if (quantity < MODBUS_QUANTITY_MIN || quantity > MODBUS_WMR_QUANTITY_MAX ||
+        startingAddress + quantity > MODBUS_ADDRESS_MAX) {
+        ERROR("invalid Write Multiple Registers range\n");
+        return NULL;
+    }
+
+    int len;
+    uint8_t* pdu = newWriteMultipleRegs(startingAddress, quantity, data, &len);
+    if (pdu == NULL) return NULL;
+
+    uint8_t* response = clientTransact(client, pdu, len, rlen);
+    free(pdu);
+    return response;
+}
+
+#undef MALLOC_ERR
@@ -0,0 +1,909 @@
+#include "applicationLayer/modbusPipeline.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+#include "transportLayer/dataPackaging.h"
+#include "transportLayer/modbusError.h"
+#include "transportLayer/slabPool.h"
+#include "transportLayer/tcpControl.h"
+
+#define MALLOC_ERR \
+    ERROR("malloc failed in %s: %s, %d\n", __func__, __FILE__, __LINE__)
+
+#define PIPELINE_RX_SIZE (8 * MODBUS_MAX_ADU_SIZE)
+
+#define SLOT(id) ((id) & (MODBUS_PIPELINE_MAX_WINDOW - 1))
+
+// the hedge delay is recomputed every this many timed responses
+#define LATENCY_REFRESH (PIPELINE_LATENCY_SAMPLES / 8)
+
+struct _modbusPipeline {
+    int socketfd;
+    uint16_t nextId;
+    int window;
+    int inFlight;
+
+    RequestQueue queue;
+    SlabPool* transactions;  // transaction records of this connection
+
+    // bounds on queued transactions, for the connection and for each unit
+    int queueLimit;
+    int unitQueueLimit;
+    OverloadPolicy policy;
+    int processing;  // non zero while a callback runs
+    QueueStats stats;
+
+    // in-flight transactions indexed by the low bits of their id
+    ModbusTransaction* pending[MODBUS_PIPELINE_MAX_WINDOW];
+    uint16_t expiryCursor;  // oldest id that may still be in flight
+
+    // hedged reads, disabled while hedging.percentile is 0
+    HedgePolicy hedging;
+    double hedgeTokens;
+    uint16_t hedgeCursor;  // oldest id not yet considered for a hedge
+    uint64_t hedgeDelayNs;
+    uint64_t latency[PIPELINE_LATENCY_SAMPLES];  // recent response times
+    uint32_t latencyCount;
+
+    // failed transactions waiting for their retry, ordered by retryAt
+    RetryPolicy retry;
+    ModbusTransaction* retrying;
+    int retryCount;
+    uint32_t random;  // backoff jitter
+
+    HedgeStats hedgeStats;
+
+    // ids whose copy was given up, their late responses are dropped quietly
+    uint8_t discarded[65536 / 8];
+
+    // received bytes not yet parsed into frames
+    uint8_t rx[PIPELINE_RX_SIZE];
+    int rxLen;
+};
+
+static uint64_t _now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void _complete(ModbusPipeline* pipeline, ModbusTransaction* txn) {
+    txn->completedNs = _now();
+    pipeline->processing++;
+    if (txn->callback != NULL) txn->callback(txn, txn->context);
+    pipeline->processing--;
+    slabFree(txn);
+}
+
+static void _discard(ModbusPipeline* pipeline, uint16_t id) {
+    pipeline->discarded[id >> 3] |= (uint8_t)(1 << (id & 7));
+}
+
+static int _takeDiscarded(ModbusPipeline* pipeline, uint16_t id) {
+    uint8_t bit = (uint8_t)(1 << (id & 7));
+    if (!(pipeline->discarded[id >> 3] & bit)) return 0;
+    pipeline->discarded[id >> 3] &= (uint8_t)~bit;
+    return 1;
+}
+
+/**
+ * @brief take a transaction off the wire, hedges hold no lane or unit slot
+ */
+static void _unpend(ModbusPipeline* pipeline, ModbusTransaction* txn) {
+    pipeline->pending[SLOT(txn->id)] = NULL;
+    pipeline->inFlight--;
+    if (!txn->hedge) requestQueueRelease(&pipeline->queue, txn);
+}
+
+/**
+ * @brief give up the hedge of a read, its response is discarded if it
+ * still comes
+ */
+static void _dropHedge(ModbusPipeline* pipeline, ModbusTransaction* txn) {
+    ModbusTransaction* hedge = txn->twin;
+    if (hedge == NULL) return;
+
+    _unpend(pipeline, hedge);
+    _discard(pipeline, hedge->id);
+    slabFree(hedge);
+    txn->twin = NULL;
+}
+
+static uint32_t _random(ModbusPipeline* pipeline) {
+    uint32_t x = pipeline->random;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return pipeline->random = x;
+}
+
+/**
+ * @brief park a failed transaction until its jittered backoff expires
+ */
+static void _scheduleRetry(ModbusPipeline* pipeline, ModbusTransaction* txn) {
+    uint64_t backoff = pipeline->retry.backoffNs;
+    for (int i = 1; i < txn->attempts && backoff < pipeline->retry.maxBackoffNs;
+         i++)
+        backoff *= 2;
+    if (backoff > pipeline->retry.maxBackoffNs)
+        backoff = pipeline->retry.maxBackoffNs;
+
+    // equal jitter: half the backoff plus a random share of the other half
+    txn->retryAt = _now() + backoff / 2 + _random(pipeline) % (backoff / 2 + 1);
+    txn->responseLen = 0;
+
+    ModbusTransaction** link = &pipeline->retrying;
+    while (*link != NULL && (*link)->retryAt <= txn->retryAt)
+        link = &(*link)->next;
+    txn->next = *link;
+    *link = txn;
+    pipeline->retryCount++;
+    pipeline->hedgeStats.retried++;
+}
+
+/**
+ * @brief complete a transaction that left the wire, or park it for a retry
+ * if it failed in a way worth retrying and has attempts left
+ */
+static void _finish(ModbusPipeline* pipeline, ModbusTransaction* txn) {
+    int code = txn->responseLen;
+    if (code >= 0) {
+        code = txn->responseLen >= 2 && (txn->response[0] & 0x80)
+                   ? txn->response[1]
+                   : 0;
+    }
+
+    if (code != 0 && txn->attempts <= pipeline->retry.retries &&
+        modbusRetryable(code)) {
+        _scheduleRetry(pipeline, txn);
+        return;
+    }
+    _complete(pipeline, txn);
+}
+
+/**
+ * @brief fail every in-flight transaction, the ones with attempts left are
+ * retried
+ *
+ * @param code ModbusError reported to the callbacks
+ */
+static void _failInFlight(ModbusPipeline* pipeline, int code) {
+    for (int i = 0; i < MODBUS_PIPELINE_MAX_WINDOW; i++) {
+        ModbusTransaction* txn = pipeline->pending[i];
+        if (txn == NULL || txn->hedge) continue;
+
+        _dropHedge(pipeline, txn);
+        _unpend(pipeline, txn);
+        _discard(pipeline, txn->id);
+        txn->responseLen = code;
+        _finish(pipeline, txn);
+    }
+}
+
+static int _compareNs(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief set the hedge delay from the recent response times
+ */
+static void _refreshHedgeDelay(ModbusPipeline* pipeline) {
+    uint64_t delay = pipeline->hedging.minDelayNs;
+    int count = pipeline->latencyCount < PIPELINE_LATENCY_SAMPLES
+                    ? (int)pipeline->latencyCount
+                    : PIPELINE_LATENCY_SAMPLES;
+
+    if (count >= LATENCY_REFRESH) {
+        uint64_t sorted[PIPELINE_LATENCY_SAMPLES];
+        memcpy(sorted, pipeline->latency, count * sizeof(uint64_t));
+        qsort(sorted, count, sizeof(uint64_t), _compareNs);
+        uint64_t percentile =
+            sorted[(int)(pipeline->hedging.percentile * (count - 1))];
+        if (percentile > delay) delay = percentile;
+    }
+
+    pipeline->hedgeDelayNs = delay;
+}
+
+static void _timeResponse(ModbusPipeline* pipeline, uint64_t ns) {
+    if (pipeline->hedging.percentile <= 0) return;
+
+    pipeline->latency[pipeline->latencyCount++ &
+                      (PIPELINE_LATENCY_SAMPLES - 1)] = ns;
+    if (pipeline->latencyCount % LATENCY_REFRESH == 0)
+        _refreshHedgeDelay(pipeline);
+}
+
+static int _hedgeable(ModbusTransaction* txn) {
+    return txn->pdu[0] == 0x03 || txn->pdu[0] == 0x04;
+}
+
+/**
+ * @brief first in-flight read at or after the hedge cursor that has no
+ * hedge yet, moving the cursor past the transactions that cannot have one
+ */
+static ModbusTransaction* _hedgeCandidate(ModbusPipeline* pipeline) {
+    if (pipeline->hedging.percentile <= 0) return NULL;
+
+    while (pipeline->hedgeCursor != pipeline->nextId) {
+        ModbusTransaction* txn = pipeline->pending[SLOT(pipeline->hedgeCursor)];
+        if (txn != NULL && txn->id == pipeline->hedgeCursor && !txn->hedge &&
+            txn->twin == NULL && _hedgeable(txn))
+            return txn;
+        pipeline->hedgeCursor++;
+    }
+    return NULL;
+}
+
+/**
+ * @brief create the hedge of the oldest overdue read, if the budget allows
+ *
+ * @return ModbusTransaction* the hedge to send, NULL if none is due
+ */
+static ModbusTransaction* _nextHedge(ModbusPipeline* pipeline, uint64_t now) {
+    ModbusTransaction* txn;
+    while ((txn = _hedgeCandidate(pipeline)) != NULL &&
+           txn->sentNs + pipeline->hedgeDelayNs <= now) {
+        pipeline->hedgeCursor++;
+
+        if (pipeline->hedgeTokens < 1) {
+            pipeline->hedgeStats.hedgeDenied++;
+            continue;
+        }
+
+        ModbusTransaction* hedge =
+            (ModbusTransaction*)slabAlloc(pipeline->transactions);
+        if (hedge == NULL) {
+            MALLOC_ERR;
+            return NULL;
+        }
+        pipeline->hedgeTokens -= 1;
+
+        hedge->unit = txn->unit;
+        hedge->lane = txn->lane;
+        memcpy(hedge->pdu, txn->pdu, txn->pduLen);
+        hedge->pduLen = txn->pduLen;
+        hedge->responseLen = 0;
+        hedge->enqueuedNs = now;
+        hedge->sentNs = hedge->completedNs = 0;
+        hedge->attempts = 0;
+        hedge->hedge = 1;
+        hedge->twin = txn;
+        hedge->callback = NULL;
+        hedge->context = NULL;
+        txn->twin = hedge;
+
+        pipeline->hedgeStats.hedged++;
+        return hedge;
+    }
+    return NULL;
+}
+
+/**
+ * @brief queue again the parked transactions whose backoff expired
+ */
+static void _releaseRetries(ModbusPipeline* pipeline, uint64_t now) {
+    while (pipeline->retrying != NULL && pipeline->retrying->retryAt <= now) {
+        ModbusTransaction* txn = pipeline->retrying;
+        pipeline->retrying = txn->next;
+        pipeline->retryCount--;
+        requestQueuePush(&pipeline->queue, txn);
+    }
+}
+
+/**
+ * @brief create a pipelined connection over a connected socket
+ *
+ * @param socketfd socket file descriptor, owned by the caller
+ * @param window maximum transactions in flight, 1 to
+ * MODBUS_PIPELINE_MAX_WINDOW
+ * @return ModbusPipeline* the pipeline, NULL if error
+ */
+ModbusPipeline* newModbusPipeline(int socketfd, int window) {
+    if (socketfd < 0 || window < 1 || window > MODBUS_PIPELINE_MAX_WINDOW) {
+        ERROR("newModbusPipeline: invalid parameters\n");
+        return NULL;
+    }
+
+    ModbusPipeline* pipeline = (ModbusPipeline*)calloc(1, sizeof(*pipeline));
+    if (pipeline == NULL) {
+        MALLOC_ERR;
+        return NULL;
+    }
+
+    pipeline->socketfd = socketfd;
+    pipeline->window = window;
+    requestQueueInit(&pipeline->queue, window);
+    pipeline->queueLimit = PIPELINE_DEFAULT_QUEUE_LIMIT;
+    pipeline->unitQueueLimit = PIPELINE_DEFAULT_UNIT_QUEUE_LIMIT;
+    pipeline->policy = overloadReject;
+    pipeline->random = (uint32_t)_now() | 1;
+
+    pipeline->transactions =
+        newSlabPool(sizeof(ModbusTransaction), SLAB_OBJECTS_PER_SLAB);
+    if (pipeline->transactions == NULL) {
+        free(pipeline);
+        return NULL;
+    }
+
+    return pipeline;
+}
+
+/**
+ * @brief free a pipeline, failing every queued and in-flight transaction
+ *
+ * @param pipeline the pipeline
+ */
+void freeModbusPipeline(ModbusPipeline* pipeline) {
+    if (pipeline == NULL) return;
+
+    _failInFlight(pipeline, modbusErrCancelled);
+
+    ModbusTransaction* txn;
+    while ((txn = pipeline->retrying) != NULL) {
+        pipeline->retrying = txn->next;
+        pipeline->retryCount--;
+        txn->responseLen = modbusErrCancelled;
+        _complete(pipeline, txn);
+    }
+    while ((txn = requestQueueTake(&pipeline->queue)) != NULL) {
+        txn->responseLen = modbusErrCancelled;
+        _complete(pipeline, txn);
+    }
+
+    freeSlabPool(pipeline->transactions);
+    free(pipeline);
+}
+
+/**
+ * @brief limit the number of in-flight slots a lane may use
+ *
+ * @param pipeline the pipeline
+ * @param lane the lane
+ * @param cap maximum in-flight transactions of the lane, 1 to window
+ * @return 0 if success, -1 if error
+ */
+int pipelineSetLaneCap(ModbusPipeline* pipeline, RequestLane lane, int cap) {
+    if (pipeline == NULL || lane < 0 || lane >= REQUEST_LANES || cap < 1 ||
+        cap > pipeline->window) {
+        ERROR("pipelineSetLaneCap: invalid parameters\n");
+        return -1;
+    }
+
+    pipeline->queue.inFlightCap[lane] = cap;
+    return 0;
+}
+
+/**
+ * @brief limit the number of in-flight slots each unit may use, e.g. to
+ * keep a slow slave behind a gateway from filling the window
+ *
+ * @param pipeline the pipeline
+ * @param cap maximum in-flight transactions per unit, 1 to window
+ * @return 0 if success, -1 if error
+ */
+int pipelineSetUnitCap(ModbusPipeline* pipeline, int cap) {
+    if (pipeline == NULL || cap < 1 || cap > pipeline->window) {
+        ERROR("pipelineSetUnitCap: invalid parameters\n");
+        return -1;
+    }
+
+    pipeline->queue.unitInFlightCap = cap;
+    return 0;
+}
+
+/**
+ * @brief bound the number of queued transactions and choose what happens
+ * when a bound is reached
+ *
+ * overloadBlock processes the connection inside pipelineSubmitUnit until a
+ * slot frees up; from within a transaction callback it behaves like
+ * overloadReject.
+ *
+ * @param pipeline the pipeline
+ * @param limit maximum queued transactions on the connection
+ * @param unitLimit maximum queued transactions of a single unit
+ * @param policy overload policy
+ * @return 0 if success, -1 if error
+ */
+int pipelineSetQueueLimits(ModbusPipeline* pipeline, int limit, int unitLimit,
+                           OverloadPolicy policy) {
+    if (pipeline == NULL || limit < 1 || unitLimit < 1 ||
+        policy < overloadReject || policy > overloadBlock) {
+        ERROR("pipelineSetQueueLimits: invalid parameters\n");
+        return -1;
+    }
+
+    pipeline->queueLimit = limit;
+    pipeline->unitQueueLimit = unitLimit < limit ? unitLimit : limit;
+    pipeline->policy = policy;
+    return 0;
+}
+
+/**
+ * @brief send reads again when they are late, see HedgePolicy
+ *
+ * @param pipeline the pipeline
+ * @param policy the policy, NULL to stop hedging
+ * @return 0 if success, -1 if error
+ */
+int pipelineSetHedging(ModbusPipeline* pipeline, const HedgePolicy* policy) {
+    if (pipeline == NULL) {
+        ERROR("pipelineSetHedging: invalid parameters\n");
+        return -1;
+    }
+    if (policy == NULL) {
+        pipeline->hedging.percentile = 0;
+        return 0;
+    }
+    if (policy->percentile <= 0 || policy->percentile > 1 ||
+        policy->budget < 0 || policy->burst < 1) {
+        ERROR("pipelineSetHedging: invalid parameters\n");
+        return -1;
+    }
+
+    pipeline->hedging = *policy;
+    pipeline->hedgeTokens = policy->burst;
+    pipeline->hedgeCursor = pipeline->nextId;
+    _refreshHedgeDelay(pipeline);
+    return 0;
+}
+
+/**
+ * @brief send failed transactions again, see RetryPolicy
+ *
+ * @param pipeline the pipeline
+ * @param policy the policy, NULL to stop retrying
+ * @return 0 if success, -1 if error
+ */
+int pipelineSetRetry(ModbusPipeline* pipeline, const RetryPolicy* policy) {
+    if (pipeline == NULL ||
+        (policy != NULL &&
+         (policy->retries < 0 || policy->maxBackoffNs < policy->backoffNs))) {
+        ERROR("pipelineSetRetry: invalid parameters\n");
+        return -1;
+    }
+
+    if (policy == NULL) {
+        pipeline->retry.retries = 0;
+    } else {
+        pipeline->retry = *policy;
+    }
+    return 0;
+}
+
+static int _full(ModbusPipeline* pipeline, uint8_t unit) {
+    return requestQueueDepth(&pipeline->queue) >= pipeline->queueLimit ||
+           pipeline->queue.unitDepth[unit] >= pipeline->unitQueueLimit;
+}
+
+/**
+ * @brief apply the overload policy until a request for unit fits
+ *
+ * @return 0 if there is room, -1 if the request must be rejected
+ */
+static int _makeRoom(ModbusPipeline* pipeline, uint8_t unit) {
+    if (!_full(pipeline, unit)) return 0;
+
+    if (pipeline->policy == overloadDropOldestPoll) {
+        // shed the poll of the bound that was hit, stale data goes first
+        int scope =
+            pipeline->queue.unitDepth[unit] >= pipeline->unitQueueLimit ? unit
+                                                                        : -1;
+        ModbusTransaction* txn =
+            requestQueueEvict(&pipeline->queue, pollLane, scope);
+        if (txn == NULL) return -1;
+
+        pipeline->stats.dropped++;
+        txn->responseLen = modbusErrRejected;
+        _complete(pipeline, txn);
+        return _full(pipeline, unit) ? -1 : 0;
+    }
+
+    if (pipeline->policy == overloadBlock && !pipeline->processing) {
+        pipeline->stats.blocked++;
+        while (_full(pipeline, unit)) {
+            if (pipelineProcess(pipeline) < 0 && _full(pipeline, unit))
+                return -1;
+        }
+        return 0;
+    }
+
+    return -1;
+}
+
+/**
+ * @brief queue a request for the default unit (UNIT_ID) on one of the
+ * priority lanes
+ *
+ * @param pipeline the pipeline
+ * @param lane dispatch priority
+ * @param pdu request protocol data unit (copied)
+ * @param pduLen request protocol data unit length
+ * @param callback called with the response or the failure
+ * @param context pointer passed to the callback
+ * @return 0 if success, -1 if error
+ */
+int pipelineSubmit(ModbusPipeline* pipeline, RequestLane lane, uint8_t* pdu,
+                   int pduLen, TransactionCallback callback, void* context) {
+    return pipelineSubmitUnit(pipeline, UNIT_ID, lane, pdu, pduLen, callback,
+                              context);
+}
+
+/**
+ * @brief queue a request for one unit behind the connection (e.g. a slave
+ * of a TCP to RTU gateway) on one of the priority lanes, units with queued
+ * work on the same lane are served in turn
+ *
+ * @param pipeline the pipeline
+ * @param unit unit identifier
+ * @param lane dispatch priority
+ * @param pdu request protocol data unit (copied)
+ * @param pduLen request protocol data unit length
+ * @param callback called with the response or the failure
+ * @param context pointer passed to the callback
+ * @return 0 if success, -1 if error
+ */
+int pipelineSubmitUnit(ModbusPipeline* pipeline, uint8_t unit,
+                       RequestLane lane, uint8_t* pdu, int pduLen,
+                       TransactionCallback callback, void* context) {
+    if (pipeline == NULL || lane < 0 || lane >= REQUEST_LANES ||
+        pdu == NULL || pduLen < 1 || pduLen > MODBUS_MAX_PDU_SIZE) {
+        ERROR("pipelineSubmit: invalid parameters\n");
+        return -1;
+    }
+
+    if (_makeRoom(pipeline, unit) < 0) {
+        pipeline->stats.rejected++;
+        LOG("queue full, request for unit %d rejected\n", unit);
+        return -1;
+    }
+
+    ModbusTransaction* txn =
+        (ModbusTransaction*)slabAlloc(pipeline->transactions);
+    if (txn == NULL) {
+        MALLOC_ERR;
+        return -1;
+    }
+
+    txn->unit = unit;
+    txn->lane = lane;
+    memcpy(txn->pdu, pdu, pduLen);
+    txn->pduLen = pduLen;
+    txn->responseLen = 0;
+    txn->enqueuedNs = _now();
+    txn->sentNs = txn->completedNs = 0;
+    txn->attempts = 0;
+    txn->twin = NULL;
+    txn->hedge = 0;
+    txn->callback = callback;
+    txn->context = context;
+
+    requestQueuePush(&pipeline->queue, txn);
+
+    pipeline->stats.accepted++;
+    int depth = requestQueueDepth(&pipeline->queue);
+    if (depth > pipeline->stats.peakDepth) pipeline->stats.peakDepth = depth;
+    return 0;
+}
+
+/**
+ * @brief send due hedges and queued transactions, retries included, while
+ * the window and the lane caps allow, coalescing the frames into as few
+ * sends as possible
+ *
+ * @param pipeline the pipeline
+ * @return number of transactions sent, a negative ModbusError if error
+ */
+int pipelineDispatch(ModbusPipeline* pipeline) {
+    uint8_t frames[8 * MODBUS_MAX_ADU_SIZE];
+    int framesLen = 0;
+    int dispatched = 0;
+    uint64_t now = _now();
+
+    _releaseRetries(pipeline, now);
+
+    // over TLS the sends of one dispatch share records
+    tcpCork(pipeline->socketfd);
+    while (pipeline->inFlight < pipeline->window) {
+        // skip ids whose slot is still taken by an older transaction
+        uint16_t id = pipeline->nextId;
+        if (pipeline->pending[SLOT(id)] != NULL) {
+            pipeline->nextId++;
+            continue;
+        }
+
+        // flushed before taking a transaction: every transaction taken is
+        // pending when a send fails, so _failInFlight completes it
+        if (framesLen + MODBUS_MAX_ADU_SIZE > (int)sizeof(frames)) {
+            if (tcpSend(pipeline->socketfd, frames, framesLen) < 0) {
+                tcpUncork(pipeline->socketfd);
+                return modbusFail(modbusErrorFromIO(-1, 1),
+                                  "Cannot send pipelined requests\n");
+            }
+            framesLen = 0;
+        }
+
+        // late reads are hedged before new work goes out
+        ModbusTransaction* txn = _nextHedge(pipeline, now);
+        if (txn == NULL) txn = requestQueuePop(&pipeline->queue);
+        if (txn == NULL) break;
+
+        txn->id = id;
+        pipeline->nextId++;
+        _takeDiscarded(pipeline, id);
+
+        ModbusADU adu = {.transactionID = txn->id,
+                         .protocolIdentifier = PROTOCOL_ID,
+                         .length = txn->pduLen + 1,
+                         .unitIdentifier = txn->unit,
+                         .pdu = txn->pdu};
+        framesLen += encodeModbusADU(&adu, frames + framesLen,
+                                     sizeof(frames) - framesLen);
+
+        txn->sentNs = _now();
+        pipeline->pending[SLOT(txn->id)] = txn;
+        pipeline->inFlight++;
+        dispatched++;
+        if (txn->hedge) continue;
+
+        uint64_t waitNs = txn->sentNs - txn->enqueuedNs;
+        pipeline->stats.sent[txn->lane]++;
+        pipeline->stats.totalWaitNs[txn->lane] += waitNs;
+        if (waitNs > pipeline->stats.maxWaitNs[txn->lane])
+            pipeline->stats.maxWaitNs[txn->lane] = waitNs;
+
+        txn->attempts++;
+        if (pipeline->hedging.percentile > 0 && _hedgeable(txn)) {
+            pipeline->hedgeTokens += pipeline->hedging.budget;
+            if (pipeline->hedgeTokens > pipeline->hedging.burst)
+                pipeline->hedgeTokens = pipeline->hedging.burst;
+        }
+    }
+
+    if (framesLen > 0 && tcpSend(pipeline->socketfd, frames, framesLen) < 0) {
+        tcpUncork(pipeline->socketfd);
+        return modbusFail(modbusErrorFromIO(-1, 1),
+                          "Cannot send pipelined requests\n");
+    }
+    if (tcpUncork(pipeline->socketfd) < 0) {
+        return modbusFail(modbusErrorFromIO(-1, 1),
+                          "Cannot send pipelined requests\n");
+    }
+
+    return dispatched;
+}
+
+/**
+ * @brief receive once from the socket, complete every answered transaction
+ * and dispatch the next ones
+ *
+ * If the receive fails or times out every in-flight transaction fails, or
+ * is retried if the retry policy allows.
+ *
+ * @param pipeline the pipeline
+ * @return number of transactions completed or retried, a negative
+ * ModbusError if error
+ */
+int pipelineProcess(ModbusPipeline* pipeline) {
+    int result = pipelineDispatch(pipeline);
+    if (result < 0) {
+        _failInFlight(pipeline, result);
+        return result;
+    }
+    if (pipeline->inFlight == 0) return 0;
+
+    int received = tcpReceive(pipeline->socketfd, pipeline->rx + pipeline->rxLen,
+                              PIPELINE_RX_SIZE - pipeline->rxLen);
+    if (received <= 0) {
+        result = modbusFail(modbusErrorFromIO(received, 0),
+                            "pipeline receive failed, %d transactions lost\n",
+                            pipeline->inFlight);
+        _failInFlight(pipeline, result);
+        pipeline->rxLen = 0;
+        return result;
+    }
+    pipeline->rxLen += received;
+    uint64_t now = _now();
+
+    int completed = 0;
+    int offset = 0;
+    for (;;) {
+        // frames are parsed in place in the receive buffer
+        ModbusADU adu;
+        int frameLen = parseModbusADU(pipeline->rx + offset,
+                                      pipeline->rxLen - offset, &adu);
+        if (frameLen == 0) break;
+        if (frameLen < 0) {
+            result = modbusFail(modbusErrMalformed,
+                                "malformed response, %d transactions lost\n",
+                                pipeline->inFlight);
+            _failInFlight(pipeline, result);
+            pipeline->rxLen = 0;
+            return result;
+        }
+        offset += frameLen;
+
+        ModbusTransaction* txn = pipeline->pending[SLOT(adu.transactionID)];
+        if (txn == NULL || txn->id != adu.transactionID ||
+            adu.unitIdentifier != txn->unit) {
+            if (_takeDiscarded(pipeline, adu.transactionID)) {
+                pipeline->hedgeStats.discarded++;
+                continue;
+            }
+            modbusFail(modbusErrIdMismatch,
+                       "unexpected response, transaction id: %d\n",
+                       adu.transactionID);
+            continue;
+        }
+
+        _unpend(pipeline, txn);
+        _timeResponse(pipeline, now - txn->sentNs);
+
+        if (txn->hedge) {
+            // the copy answered first, the original is given up
+            ModbusTransaction* hedge = txn;
+            txn = hedge->twin;
+            txn->twin = NULL;
+            _unpend(pipeline, txn);
+            _discard(pipeline, txn->id);
+            slabFree(hedge);
+            pipeline->hedgeStats.hedgeWins++;
+        } else {
+            _dropHedge(pipeline, txn);
+        }
+
+        txn->responseLen = adu.length - 1;
+        memcpy(txn->response, adu.pdu, txn->responseLen);
+
+        _finish(pipeline, txn);
+        completed++;
+    }
+
+    memmove(pipeline->rx, pipeline->rx + offset, pipeline->rxLen - offset);
+    pipeline->rxLen -= offset;
+
+    result = pipelineDispatch(pipeline);
+    if (result < 0) {
+        _failInFlight(pipeline, result);
+        return result;
+    }
+
+    return completed;
+}
+
+/**
+ * @brief statistics of the connection's transaction record pool
+ *
+ * @param pipeline the pipeline
+ * @param stats filled with the statistics
+ */
+void pipelineAllocatorStats(ModbusPipeline* pipeline, SlabStats* stats) {
+    slabGetStats(pipeline->transactions, stats);
+}
+
+/**
+ * @brief queue depth, shedding and wait time metrics
+ *
+ * @param pipeline the pipeline
+ * @param stats filled with the metrics
+ */
+void pipelineQueueStats(ModbusPipeline* pipeline, QueueStats* stats) {
+    *stats = pipeline->stats;
+    stats->depth = requestQueueDepth(&pipeline->queue);
+}
+
+/**
+ * @brief hedging and retry metrics
+ *
+ * @param pipeline the pipeline
+ * @param stats filled with the metrics
+ */
+void pipelineHedgeStats(ModbusPipeline* pipeline, HedgeStats* stats) {
+    *stats = pipeline->hedgeStats;
+    stats->delayNs = pipeline->hedgeDelayNs;
+}
+
+/**
+ * @brief fail every in-flight transaction with modbusErrTimeout, e.g. when
+ * an event loop gives up waiting for the device; queued transactions stay
+ * queued and failed ones are retried if the retry policy allows
+ *
+ * @param pipeline the pipeline
+ */
+void pipelineAbort(ModbusPipeline* pipeline) {
+    _failInFlight(pipeline, modbusRecord(modbusErrTimeout));
+    pipeline->rxLen = 0;
+}
+
+/**
+ * @brief fail with modbusErrTimeout the in-flight transactions sent
+ * timeoutNs ago or more, failed ones are retried if the retry policy
+ * allows; a unit that stopped answering thus fails its own requests while
+ * the other units behind the same gateway keep answering
+ *
+ * @param pipeline the pipeline
+ * @param timeoutNs how long a transaction waits for its response
+ * @return uint64_t CLOCK_MONOTONIC time the next in-flight transaction
+ * expires, for event loops to bound their wait, 0 if none is in flight
+ */
+uint64_t pipelineExpire(ModbusPipeline* pipeline, uint64_t timeoutNs) {
+    uint64_t now = _now();
+    uint64_t next = 0;
+    int expired = 0;
+
+    // ids are sent in order, so the oldest in-flight one expires first;
+    // hedges expire with the read they copy
+    while (pipeline->expiryCursor != pipeline->nextId) {
+        ModbusTransaction* txn =
+            pipeline->pending[SLOT(pipeline->expiryCursor)];
+        if (txn != NULL && txn->id == pipeline->expiryCursor && !txn->hedge) {
+            if (now - txn->sentNs < timeoutNs) {
+                next = txn->sentNs + timeoutNs;
+                break;
+            }
+
+            _dropHedge(pipeline, txn);
+            _unpend(pipeline, txn);
+            _discard(pipeline, txn->id);
+            txn->responseLen = modbusErrTimeout;
+            _finish(pipeline, txn);
+            expired++;
+        }
+        pipeline->expiryCursor++;
+    }
+
+    if (expired > 0) {
+        modbusFail(modbusErrTimeout,
+                   "no response for %llu ms, %d transactions failed\n",
+                   (unsigned long long)(timeoutNs / 1000000), expired);
+    }
+    return next;
+}
+
+/**
+ * @brief socket of the pipeline, for event loops waiting on several
+ * connections
+ *
+ * @param pipeline the pipeline
+ * @return int socket file descriptor
+ */
+int pipelineSocket(ModbusPipeline* pipeline) { return pipeline->socketfd; }
+
+/**
+ * @brief number of transactions queued, in flight or waiting for a retry,
+ * hedges included
+ *
+ * @param pipeline the pipeline
+ * @return int pending transactions
+ */
+int pipelinePending(ModbusPipeline* pipeline) {
+    return pipeline->inFlight + requestQueueDepth(&pipeline->queue) +
+           pipeline->retryCount;
+}
+
+/**
+ * @brief time pipelineDispatch has a hedge or a retry to send, for event
+ * loops to bound their wait
+ *
+ * @param pipeline the pipeline
+ * @return uint64_t CLOCK_MONOTONIC time, 0 if nothing is scheduled
+ */
+uint64_t pipelineNextDeadline(ModbusPipeline* pipeline) {
+    uint64_t deadline = 0;
+    if (pipeline->retrying != NULL) deadline = pipeline->retrying->retryAt;
+
+    // a hedge cannot go out while the window is full, a response wakes first
+    ModbusTransaction* txn = _hedgeCandidate(pipeline);
+    if (txn != NULL && pipeline->inFlight < pipeline->window) {
+        uint64_t due = txn->sentNs + pipeline->hedgeDelayNs;
+        if (deadline == 0 || due < deadline) deadline = due;
+    }
+    return deadline;
+}
+
+#undef MALLOC_ERR
@@ -0,0 +1,567 @@
+#include "applicationLayer/modbusTask.h"
+
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <ucontext.h>
+
+#include "applicationLayer/modbusApp.h"
+#include "log.h"
+#include "transportLayer/modbusTCP.h"
+#include "transportLayer/tcpControl.h"
+
+#define MALLOC_ERR \
+    ERROR("malloc failed in %s: %s, %d\n", __func__, __FILE__, __LINE__)
+
+#define NS_PER_SEC 1000000000ULL
+
+// a request with no response for this long fails, same as the receive
+// timeout of the blocking API
+#define TASK_IO_TIMEOUT_NS \
+    (MODBUS_TIMEOUT_SEC * NS_PER_SEC + MODBUS_TIMEOUT_USEC * 1000ULL)
+
+// finished tasks kept for reuse, with their stacks
+#define TASK_FREE_LIMIT 1024
+
+typedef struct _task Task;
+
+/**
+ * @brief a task and its stack
+ *
+ * @param wakeAt CLOCK_MONOTONIC time a sleeping task is due
+ * @param response where the awaited transaction copies its response
+ * @param responseLen response length, a negative ModbusError if the
+ * transaction failed
+ * @param next ready queue or free list link
+ */
+struct _task {
+    ucontext_t context;
+    void* stack;
+    TaskFunction function;
+    void* argument;
+    TaskLoop* loop;
+    int done;
+    uint64_t wakeAt;
+    uint8_t* response;
+    int responseLen;
+    Task* next;
+};
+
+struct _taskLoop {
+    ucontext_t main;
+    size_t stackSize;
+    Task* current;
+    int live;
+
+    Task* readyHead;
+    Task* readyTail;
+    Task* free;
+    int freeCount;
+
+    // binary min-heap of sleeping tasks ordered by wakeAt
+    Task** sleepers;
+    int sleeping;
+    int sleepCapacity;
+
+    ModbusPipeline** pipelines;
+    struct pollfd* pollfds;
+    int pipelineCount;
+    int pipelineCapacity;
+};
+
+// loop running on this thread, used by the functions called from tasks
+static __thread TaskLoop* running = NULL;
+
+static uint64_t _now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static void _ready(TaskLoop* loop, Task* task) {
+    task->next = NULL;
+    if (loop->readyTail == NULL)
+        loop->readyHead = task;
+    else
+        loop->readyTail->next = task;
+    loop->readyTail = task;
+}
+
+static Task* _nextReady(TaskLoop* loop) {
+    Task* task = loop->readyHead;
+    if (task == NULL) return NULL;
+
+    loop->readyHead = task->next;
+    if (loop->readyHead == NULL) loop->readyTail = NULL;
+    task->next = NULL;
+    return task;
+}
+
+static void _sleepersSwap(TaskLoop* loop, int a, int b) {
+    Task* tmp = loop->sleepers[a];
+    loop->sleepers[a] = loop->sleepers[b];
+    loop->sleepers[b] = tmp;
+}
+
+static int _sleepersPush(TaskLoop* loop, Task* task) {
+    if (loop->sleeping == loop->sleepCapacity) {
+        int capacity = loop->sleepCapacity ? loop->sleepCapacity * 2 : 64;
+        Task** sleepers =
+            (Task**)realloc(loop->sleepers, capacity * sizeof(Task*));
+        if (sleepers == NULL) {
+            MALLOC_ERR;
+            return -1;
+        }
+        loop->sleepers = sleepers;
+        loop->sleepCapacity = capacity;
+    }
+
+    int i = loop->sleeping++;
+    loop->sleepers[i] = task;
+    while (i > 0 &&
+           loop->sleepers[i]->wakeAt < loop->sleepers[(i - 1) / 2]->wakeAt) {
+        _sleepersSwap(loop, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    return 0;
+}
+
+static Task* _sleepersPop(TaskLoop* loop) {
+    Task* task = loop->sleepers[0];
+    loop->sleepers[0] = loop->sleepers[--loop->sleeping];
+
+    int i = 0;
+    for (;;) {
+        int smallest = i;
+        int left = 2 * i + 1, right = 2 * i + 2;
+        if (left < loop->sleeping &&
+            loop->sleepers[left]->wakeAt < loop->sleepers[smallest]->wakeAt)
+            smallest = left;
+        if (right < loop->sleeping &&
+            loop->sleepers[right]->wakeAt < loop->sleepers[smallest]->wakeAt)
+            smallest = right;
+        if (smallest == i) break;
+        _sleepersSwap(loop, i, smallest);
+        i = smallest;
+    }
+    return task;
+}
+
+/**
+ * @brief create a task loop
+ *
+ * @param stackSize stack size of each task, 0 for TASK_DEFAULT_STACK_SIZE
+ * @return TaskLoop* the loop, NULL if error
+ */
+TaskLoop* newTaskLoop(size_t stackSize) {
+    TaskLoop* loop = (TaskLoop*)calloc(1, sizeof(*loop));
+    if (loop == NULL) {
+        MALLOC_ERR;
+        return NULL;
+    }
+
+    loop->stackSize = stackSize ? stackSize : TASK_DEFAULT_STACK_SIZE;
+    return loop;
+}
+
+static void _destroyTask(TaskLoop* loop, Task* task) {
+    munmap(task->stack, loop->stackSize);
+    free(task);
+}
+
+/**
+ * @brief free a loop, its tasks must have finished; the pipelines belong
+ * to the caller
+ *
+ * @param loop the loop
+ */
+void freeTaskLoop(TaskLoop* loop) {
+    if (loop == NULL) return;
+
+    if (loop->live > 0) ERROR("freeing a task loop with %d tasks\n", loop->live);
+
+    while (loop->free != NULL) {
+        Task* task = loop->free;
+        loop->free = task->next;
+        _destroyTask(loop, task);
+    }
+
+    free(loop->sleepers);
+    free(loop->pipelines);
+    free(loop->pollfds);
+    free(loop);
+}
+
+/**
+ * @brief let the loop drive a pipeline, tasks may await on it from then on
+ *
+ * @param loop the loop
+ * @param pipeline the pipeline, owned by the caller
+ * @return int 0 if success, -1 if error
+ */
+int taskLoopAddPipeline(TaskLoop* loop, ModbusPipeline* pipeline) {
+    if (loop == NULL || pipeline == NULL) {
+        ERROR("taskLoopAddPipeline: invalid parameters\n");
+        return -1;
+    }
+
+    if (loop->pipelineCount == loop->pipelineCapacity) {
+        int capacity = loop->pipelineCapacity ? loop->pipelineCapacity * 2 : 8;
+        ModbusPipeline** pipelines = (ModbusPipeline**)realloc(
+            loop->pipelines, capacity * sizeof(ModbusPipeline*));
+        if (pipelines == NULL) {
+            MALLOC_ERR;
+            return -1;
+        }
+        loop->pipelines = pipelines;
+
+        struct pollfd* pollfds = (struct pollfd*)realloc(
+            loop->pollfds, capacity * sizeof(struct pollfd));
+        if (pollfds == NULL) {
+            MALLOC_ERR;
+            return -1;
+        }
+        loop->pollfds = pollfds;
+        loop->pipelineCapacity = capacity;
+    }
+
+    loop->pipelines[loop->pipelineCount++] = pipeline;
+    return 0;
+}
+
+static void _trampoline(uint32_t high, uint32_t low) {
+    Task* task = (Task*)(((uintptr_t)high << 32) | (uintptr_t)low);
+    task->function(task->argument);
+    task->done = 1;
+    // returning resumes loop->main through uc_link
+}
+
+/**
+ * @brief create a task, it starts running on the next loop iteration
+ *
+ * May be called from inside a task of the same loop.
+ *
+ * @param loop the loop
+ * @param function task body
+ * @param argument pointer passed to the body
+ * @return int 0 if success, -1 if error
+ */
+int taskSpawn(TaskLoop* loop, TaskFunction function, void* argument) {
+    if (loop == NULL || function == NULL) {
+        ERROR("taskSpawn: invalid parameters\n");
+        return -1;
+    }
+
+    Task* task = loop->free;
+    if (task != NULL) {
+        loop->free = task->next;
+        loop->freeCount--;
+    } else {
+        task = (Task*)calloc(1, sizeof(*task));
+        if (task == NULL) {
+            MALLOC_ERR;
+            return -1;
+        }
+
+        // untouched stack pages are never backed by memory
+        task->stack = mmap(NULL, loop->stackSize, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (task->stack == MAP_FAILED) {
+            ERROR("cannot allocate task stack\n");
+            free(task);
+            return -1;
+        }
+    }
+
+    task->function = function;
+    task->argument = argument;
+    task->loop = loop;
+    task->done = 0;
+
+    getcontext(&task->context);
+    task->context.uc_stack.ss_sp = task->stack;
+    task->context.uc_stack.ss_size = loop->stackSize;
+    task->context.uc_link = &loop->main;
+    uintptr_t pointer = (uintptr_t)task;
+    makecontext(&task->context, (void (*)(void))_trampoline, 2,
+                (uint32_t)(pointer >> 32), (uint32_t)pointer);
+
+    loop->live++;
+    _ready(loop, task);
+    return 0;
+}
+
+/**
+ * @brief switch to a task until it suspends or finishes
+ */
+static void _resume(TaskLoop* loop, Task* task) {
+    loop->current = task;
+    swapcontext(&loop->main, &task->context);
+    loop->current = NULL;
+
+    if (!task->done) return;
+
+    loop->live--;
+    if (loop->freeCount < TASK_FREE_LIMIT) {
+        task->next = loop->free;
+        loop->free = task;
+        loop->freeCount++;
+    } else {
+        _destroyTask(loop, task);
+    }
+}
+
+/**
+ * @brief give the thread back to the loop, the caller must have arranged
+ * for the task to be made ready again
+ */
+static void _suspend(Task* task) {
+    swapcontext(&task->context, &task->loop->main);
+}
+
+static Task* _currentTask(const char* function) {
+    if (running == NULL || running->current == NULL) {
+        ERROR("%s called outside of a task\n", function);
+        return NULL;
+    }
+    return running->current;
+}
+
+/**
+ * @brief let the other ready tasks run before continuing
+ */
+void taskYield(void) {
+    Task* task = _currentTask(__func__);
+    if (task == NULL) return;
+
+    _ready(task->loop, task);
+    _suspend(task);
+}
+
+/**
+ * @brief suspend the calling task for at least ns nanoseconds
+ *
+ * @param ns sleep duration
+ */
+void taskSleep(uint64_t ns) {
+    Task* task = _currentTask(__func__);
+    if (task == NULL) return;
+
+    task->wakeAt = _now() + ns;
+    if (_sleepersPush(task->loop, task) < 0) {
+        _ready(task->loop, task);
+    }
+    _suspend(task);
+}
+
+static void _wake(ModbusTransaction* txn, void* context) {
+    Task* task = (Task*)context;
+
+    task->responseLen = txn->responseLen;
+    if (txn->responseLen > 0)
+        memcpy(task->response, txn->response, txn->responseLen);
+    _ready(task->loop, task);
+}
+
+/**
+ * @brief send a request through a pipeline and suspend the calling task
+ * until the response arrives
+ *
+ * @param pipeline pipeline added to the task's loop
+ * @param unit unit identifier
+ * @param lane dispatch priority
+ * @param pdu request protocol data unit (copied)
+ * @param pduLen request protocol data unit length
+ * @param response buffer of at least MODBUS_MAX_PDU_SIZE bytes
+ * @return int response length if success, a negative ModbusError if error
+ */
+int awaitTransact(ModbusPipeline* pipeline, uint8_t unit, RequestLane lane,
+                  uint8_t* pdu, int pduLen, uint8_t* response) {
+    Task* task = _currentTask(__func__);
+    if (task == NULL) return -1;
+
+    task->response = response;
+    task->responseLen = -1;
+    if (pipelineSubmitUnit(pipeline, unit, lane, pdu, pduLen, _wake, task) <
+        0)
+        return -1;
+
+    _suspend(task);
+    return task->responseLen;
+}
+
+/**
+ * @brief Read Holding Registers from a task
+ *
+ * @param pipeline pipeline added to the task's loop
+ * @param unit unit identifier
+ * @param startingAddress starting address of the registers to read
+ * @param quantity number of registers to read
+ * @param values array of at least quantity elements, filled with the
+ * register values in host byte order
+ * @return int 0 if success, the exception code if the server answered with
+ * an exception, a negative ModbusError if error
+ */
+int awaitReadHoldingRegisters(ModbusPipeline* pipeline, uint8_t unit,
+                              uint16_t startingAddress, uint16_t quantity,
+                              uint16_t* values) {
+    if (values == NULL || quantity < MODBUS_QUANTITY_MIN ||
+        quantity > MODBUS_RHR_QUANTITY_MAX ||
+        startingAddress + quantity > MODBUS_ADDRESS_MAX) {
+        ERROR("invalid Read Holding Registers request\n");
+        return -1;
+    }
+
+    uint8_t request[MODBUS_RHR_REQUEST_LEN];
+    uint8_t response[MODBUS_MAX_PDU_SIZE];
+    int len = encodeReadHoldingRegs(startingAddress, quantity, request);
+
+    int rlen = awaitTransact(pipeline, unit, pollLane, request, len, response);
+    if (rlen < 0) return rlen;
+
+    return parseReadHoldingRegsResponse(response, rlen, quantity, values);
+}
+
+/**
+ * @brief Write Multiple Registers from a task, sent on the command lane
+ *
+ * @param pipeline pipeline added to the task's loop
+ * @param unit unit identifier
+ * @param startingAddress starting address of the registers to write
+ * @param quantity quantity of registers to write
+ * @param data values to write, in host byte order
+ * @return int 0 if success, the exception code if the server answered with
+ * an exception, a negative ModbusError if error
+ */
+int awaitWriteMultipleRegisters(ModbusPipeline* pipeline, uint8_t unit,
+                                uint16_t startingAddress, uint16_t quantity,
+                                uint16_t* data) {
+    if (data == NULL || quantity < MODBUS_QUANTITY_MIN ||
+        quantity > MODBUS_WMR_QUANTITY_MAX ||
+        startingAddress + quantity > MODBUS_ADDRESS_MAX) {
+        ERROR("invalid Write Multiple Registers request\n");
+        return -1;
+    }
+
+    uint8_t request[MODBUS_WMR_REQUEST_LEN(MODBUS_WMR_QUANTITY_MAX)];
+    uint8_t response[MODBUS_MAX_PDU_SIZE];
+    int len = encodeWriteMultipleRegs(startingAddress, quantity, data, request);
+
+    int rlen =
+        awaitTransact(pipeline, unit, commandLane, request, len, response);
+    if (rlen < 0) return rlen;
+
+    return parseWriteMultipleRegsResponse(response, rlen, startingAddress,
+                                          quantity);
+}
+
+/**
+ * @brief send what the pipelines can send and wait for responses or the
+ * next sleeper, whichever comes first
+ *
+ * @return int 0 if success, -1 if nothing could ever wake a task
+ */
+static int _waitIO(TaskLoop* loop) {
+    uint64_t now = _now();
+    int count = 0;
+    int64_t timeoutNs = -1;
+
+    for (int i = 0; i < loop->pipelineCount; i++) {
+        ModbusPipeline* pipeline = loop->pipelines[i];
+
+        if (pipelineDispatch(pipeline) < 0) pipelineAbort(pipeline);
+        // each request waits for its own response: a silent unit fails
+        // while the others behind the same gateway keep answering
+        uint64_t expiry = pipelineExpire(pipeline, TASK_IO_TIMEOUT_NS);
+        if (pipelinePending(pipeline) == 0) continue;
+
+        // hedges and retries go out from pipelineDispatch
+        uint64_t due = pipelineNextDeadline(pipeline);
+        if (due == 0 || (expiry != 0 && expiry < due)) due = expiry;
+        if (due != 0) {
+            int64_t dueNs = due > now ? (int64_t)(due - now) : 0;
+            if (timeoutNs < 0 || dueNs < timeoutNs) timeoutNs = dueNs;
+        }
+        // responses already decrypted do not wake poll
+        if (tcpPending(pipelineSocket(pipeline))) timeoutNs = 0;
+
+        loop->pollfds[count].fd = pipelineSocket(pipeline);
+        loop->pollfds[count].events = POLLIN;
+        loop->pollfds[count].revents = 0;
+        count++;
+    }
+
+    // aborted requests have made their tasks ready
+    if (loop->readyHead != NULL) return 0;
+
+    if (loop->sleeping > 0) {
+        int64_t sleepNs = loop->sleepers[0]->wakeAt > now
+                              ? (int64_t)(loop->sleepers[0]->wakeAt - now)
+                              : 0;
+        if (timeoutNs < 0 || sleepNs < timeoutNs) timeoutNs = sleepNs;
+    }
+
+    if (count == 0 && timeoutNs < 0) {
+        ERROR("%d tasks wait for nothing\n", loop->live);
+        return -1;
+    }
+
+    int timeoutMs = timeoutNs < 0 ? -1 : (int)((timeoutNs + 999999) / 1000000);
+    if (poll(loop->pollfds, count, timeoutMs) < 0) return 0;
+
+    // pollfds were filled in pipeline order, skipping idle pipelines
+    int next = 0;
+    for (int i = 0; i < loop->pipelineCount && next < count; i++) {
+        ModbusPipeline* pipeline = loop->pipelines[i];
+        if (loop->pollfds[next].fd != pipelineSocket(pipeline)) continue;
+
+        if (loop->pollfds[next].revents != 0 ||
+            tcpPending(loop->pollfds[next].fd))
+            pipelineProcess(pipeline);
+        next++;
+    }
+    return 0;
+}
+
+/**
+ * @brief run the loop until every task has finished
+ *
+ * @param loop the loop
+ * @return int 0 if every task finished, -1 if the remaining tasks can never
+ * be woken
+ */
+int taskLoopRun(TaskLoop* loop) {
+    if (loop == NULL) return -1;
+
+    TaskLoop* outer = running;
+    running = loop;
+
+    int status = 0;
+    while (loop->live > 0) {
+        // run the tasks ready now, tasks made ready meanwhile wait a turn
+        Task* last = loop->readyTail;
+        Task* task;
+        while (last != NULL && (task = _nextReady(loop)) != NULL) {
+            _resume(loop, task);
+            if (task == last) break;
+        }
+
+        uint64_t now = _now();
+        while (loop->sleeping > 0 && loop->sleepers[0]->wakeAt <= now)
+            _ready(loop, _sleepersPop(loop));
+
+        if (loop->readyHead != NULL || loop->live == 0) continue;
+
+        if (_waitIO(loop) < 0) {
+            status = -1;
+            break;
+        }
+    }
+
+    running = outer;
+    return status;
+}
+
+#undef MALLOC_ERR
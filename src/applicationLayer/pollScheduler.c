@@ -0,0 +1,287 @@
+#include "applicationLayer/pollScheduler.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+
+#define MALLOC_ERR \
+    ERROR("malloc failed in %s: %s, %d\n", __func__, __FILE__, __LINE__)
+
+#define NS_PER_SEC 1000000000ULL
+
+/**
+ * @brief a set of tags polled together with a common period
+ *
+ * @param periodNs poll period
+ * @param deadline next absolute CLOCK_MONOTONIC deadline, always
+ *   anchor + phase + k * period so the schedule never drifts
+ */
+typedef struct _pollGroup {
+    uint64_t periodNs;
+    uint64_t deadline;
+    PollCallback callback;
+    void* context;
+    PollStats stats;
+} PollGroup;
+
+struct _pollScheduler {
+    int timerfd;
+    int started;
+    int stopped;
+
+    PollGroup* groups;
+    int count;
+    int capacity;
+
+    // binary min-heap of group indexes ordered by deadline
+    int* heap;
+};
+
+static uint64_t _now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static int _earlier(PollScheduler* s, int a, int b) {
+    return s->groups[s->heap[a]].deadline < s->groups[s->heap[b]].deadline;
+}
+
+static void _swap(PollScheduler* s, int a, int b) {
+    int tmp = s->heap[a];
+    s->heap[a] = s->heap[b];
+    s->heap[b] = tmp;
+}
+
+static void _siftUp(PollScheduler* s, int i) {
+    while (i > 0 && _earlier(s, i, (i - 1) / 2)) {
+        _swap(s, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void _siftDown(PollScheduler* s, int i) {
+    for (;;) {
+        int smallest = i, l = 2 * i + 1, r = 2 * i + 2;
+        if (l < s->count && _earlier(s, l, smallest)) smallest = l;
+        if (r < s->count && _earlier(s, r, smallest)) smallest = r;
+        if (smallest == i) return;
+        _swap(s, i, smallest);
+        i = smallest;
+    }
+}
+
+/**
+ * @brief spread the first deadline of each group across its period, so
+ * devices added together do not all fire on the same tick
+ */
+static uint64_t _phase(int group, uint64_t periodNs) {
+    // golden ratio sequence: well spread for any number of groups
+    uint64_t fraction = ((uint64_t)group * 0x9E3779B97F4A7C15ULL) >> 32;
+    return (uint64_t)(((unsigned __int128)periodNs * fraction) >> 32);
+}
+
+/**
+ * @brief create a poll scheduler
+ *
+ * @return PollScheduler* the scheduler, NULL if error
+ */
+PollScheduler* newPollScheduler(void) {
+    PollScheduler* scheduler = (PollScheduler*)calloc(1, sizeof(*scheduler));
+    if (scheduler == NULL) {
+        MALLOC_ERR;
+        return NULL;
+    }
+
+    scheduler->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (scheduler->timerfd < 0) {
+        ERROR("cannot create timerfd\n");
+        free(scheduler);
+        return NULL;
+    }
+
+    return scheduler;
+}
+
+/**
+ * @brief free a scheduler created with newPollScheduler
+ *
+ * @param scheduler the scheduler
+ */
+void freePollScheduler(PollScheduler* scheduler) {
+    if (scheduler == NULL) return;
+
+    close(scheduler->timerfd);
+    free(scheduler->groups);
+    free(scheduler->heap);
+    free(scheduler);
+}
+
+/**
+ * @brief add a poll group
+ *
+ * @param scheduler the scheduler
+ * @param periodNs poll period, between POLL_PERIOD_MIN_NS and
+ * POLL_PERIOD_MAX_NS
+ * @param callback work to run on each deadline
+ * @param context pointer passed to the callback
+ * @return group index if success, -1 if error
+ */
+int schedulerAddGroup(PollScheduler* scheduler, uint64_t periodNs,
+                      PollCallback callback, void* context) {
+    if (scheduler == NULL || callback == NULL ||
+        periodNs < POLL_PERIOD_MIN_NS || periodNs > POLL_PERIOD_MAX_NS) {
+        ERROR("schedulerAddGroup: invalid parameters\n");
+        return -1;
+    }
+
+    if (scheduler->count == scheduler->capacity) {
+        int capacity = scheduler->capacity ? scheduler->capacity * 2 : 8;
+        PollGroup* groups = (PollGroup*)realloc(
+            scheduler->groups, capacity * sizeof(*groups));
+        if (groups == NULL) {
+            MALLOC_ERR;
+            return -1;
+        }
+        scheduler->groups = groups;
+
+        int* heap = (int*)realloc(scheduler->heap, capacity * sizeof(*heap));
+        if (heap == NULL) {
+            MALLOC_ERR;
+            return -1;
+        }
+        scheduler->heap = heap;
+        scheduler->capacity = capacity;
+    }
+
+    int group = scheduler->count;
+    PollGroup* g = &scheduler->groups[group];
+    memset(g, 0, sizeof(*g));
+    g->periodNs = periodNs;
+    g->callback = callback;
+    g->context = context;
+    g->deadline = (scheduler->started ? _now() : 0) + _phase(group, periodNs);
+
+    scheduler->heap[scheduler->count++] = group;
+    _siftUp(scheduler, scheduler->count - 1);
+
+    return group;
+}
+
+/**
+ * @brief sleep until the earliest deadline, then run every group that is due
+ *
+ * @param scheduler the scheduler
+ * @return 0 if success, the first non zero callback result otherwise,
+ * -1 if the timer fails
+ */
+int schedulerRunOnce(PollScheduler* scheduler) {
+    if (scheduler == NULL || scheduler->count == 0) {
+        ERROR("schedulerRunOnce: nothing to schedule\n");
+        return -1;
+    }
+
+    if (!scheduler->started) {
+        // anchor every group on the same start time
+        uint64_t anchor = _now();
+        for (int i = 0; i < scheduler->count; i++)
+            scheduler->groups[i].deadline += anchor;
+        scheduler->started = 1;
+    }
+
+    uint64_t deadline = scheduler->groups[scheduler->heap[0]].deadline;
+    if (deadline > _now()) {
+        struct itimerspec spec = {
+            .it_interval = {0, 0},
+            .it_value = {deadline / NS_PER_SEC, deadline % NS_PER_SEC}};
+        if (timerfd_settime(scheduler->timerfd, TFD_TIMER_ABSTIME, &spec,
+                            NULL) < 0) {
+            ERROR("cannot arm timerfd\n");
+            return -1;
+        }
+
+        uint64_t expirations;
+        if (read(scheduler->timerfd, &expirations, sizeof(expirations)) < 0 &&
+            errno != EINTR) {
+            ERROR("cannot read timerfd\n");
+            return -1;
+        }
+    }
+
+    while (scheduler->count > 0) {
+        PollGroup* g = &scheduler->groups[scheduler->heap[0]];
+        uint64_t start = _now();
+        if (g->deadline > start) break;
+
+        int64_t jitter = (int64_t)(start - g->deadline);
+        int ret = g->callback(g->context);
+        uint64_t end = _now();
+
+        g->stats.runs++;
+        g->stats.totalJitterNs += jitter;
+        if (jitter > g->stats.maxJitterNs) g->stats.maxJitterNs = jitter;
+        g->stats.lastDurationNs = (int64_t)(end - start);
+        if (g->stats.lastDurationNs > g->stats.maxDurationNs)
+            g->stats.maxDurationNs = g->stats.lastDurationNs;
+
+        // next deadline stays on the absolute grid, skipped ones are overruns
+        g->deadline += g->periodNs;
+        if (g->deadline <= end) {
+            uint64_t missed = (end - g->deadline) / g->periodNs + 1;
+            g->stats.overruns += missed;
+            g->deadline += missed * g->periodNs;
+            LOG("poll group %d overrun, %" PRIu64 " deadlines missed\n",
+                scheduler->heap[0], missed);
+        }
+        _siftDown(scheduler, 0);
+
+        if (ret != 0) return ret;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief run the scheduler until a callback fails or schedulerStop is called
+ *
+ * @param scheduler the scheduler
+ * @return the non zero callback result that stopped it, 0 if stopped
+ */
+int schedulerRun(PollScheduler* scheduler) {
+    scheduler->stopped = 0;
+    while (!scheduler->stopped) {
+        int ret = schedulerRunOnce(scheduler);
+        if (ret != 0) return ret;
+    }
+    return 0;
+}
+
+/**
+ * @brief make schedulerRun return after the current deadline, may be called
+ * from a callback
+ *
+ * @param scheduler the scheduler
+ */
+void schedulerStop(PollScheduler* scheduler) { scheduler->stopped = 1; }
+
+/**
+ * @brief read the timing statistics of a group
+ *
+ * @param scheduler the scheduler
+ * @param group group index returned by schedulerAddGroup
+ * @param stats filled with the statistics
+ * @return 0 if success, -1 if the group does not exist
+ */
+int schedulerGetStats(PollScheduler* scheduler, int group, PollStats* stats) {
+    if (scheduler == NULL || group < 0 || group >= scheduler->count) return -1;
+
+    *stats = scheduler->groups[group].stats;
+    return 0;
+}
+
+#undef MALLOC_ERR
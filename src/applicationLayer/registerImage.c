@@ -0,0 +1,286 @@
+#include "applicationLayer/registerImage.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "applicationLayer/modbusApp.h"
+#include "log.h"
+
+#define MALLOC_ERR \
+    ERROR("malloc failed in %s: %s, %d\n", __func__, __FILE__, __LINE__)
+
+#define CACHE_LINE 64
+
+// published word: sequence in the high bits, buffer index in the low byte,
+// 0 until the first scan is published
+#define PUBLISHED_BUFFER(word) ((int)((word)&0xFF))
+#define PUBLISHED_SEQUENCE(word) ((word) >> 8)
+
+typedef struct _imageBuffer {
+    int readers;  // pinned snapshots, the poller skips the buffer while > 0
+    uint64_t timestampNs;
+    uint16_t* values;
+} __attribute__((aligned(CACHE_LINE))) ImageBuffer;
+
+struct _registerImage {
+    uint64_t published;  // read by every reader, alone on its line
+    uint8_t pad[CACHE_LINE - sizeof(uint64_t)];
+
+    // poller side
+    uint16_t firstAddress;
+    uint32_t count;
+    int buffers;
+    int current;  // buffer last published, -1 before the first scan
+    int back;     // buffer being filled, -1 if none
+    uint64_t sequence;
+    ImageStats stats;
+
+    ImageBuffer buffer[IMAGE_MAX_BUFFERS];
+};
+
+static uint64_t _now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline void _count(uint64_t* counter) {
+    __atomic_add_fetch(counter, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief create the image of registers firstAddress to firstAddress + count
+ * - 1, e.g. the span of a TagDevice
+ *
+ * @param firstAddress first register
+ * @param count registers, firstAddress + count must not exceed
+ * MODBUS_ADDRESS_MAX like any read range
+ * @param buffers 2 for double buffering, 3 for triple buffering, at most
+ * IMAGE_MAX_BUFFERS
+ * @return RegisterImage* the image, NULL if the arguments are invalid or
+ * out of memory
+ */
+RegisterImage* newRegisterImage(uint16_t firstAddress, uint32_t count,
+                                int buffers) {
+    if (count == 0 || firstAddress + count > MODBUS_ADDRESS_MAX ||
+        buffers < IMAGE_MIN_BUFFERS || buffers > IMAGE_MAX_BUFFERS) {
+        ERROR("invalid register image: %u registers from %u, %d buffers\n",
+              count, firstAddress, buffers);
+        return NULL;
+    }
+
+    size_t size = (sizeof(RegisterImage) + CACHE_LINE - 1) & ~(CACHE_LINE - 1);
+    RegisterImage* image = (RegisterImage*)aligned_alloc(CACHE_LINE, size);
+    if (image == NULL) {
+        MALLOC_ERR;
+        return NULL;
+    }
+    memset(image, 0, sizeof(RegisterImage));
+
+    image->firstAddress = firstAddress;
+    image->count = count;
+    image->buffers = buffers;
+    image->current = -1;
+    image->back = -1;
+
+    for (int i = 0; i < buffers; i++) {
+        image->buffer[i].values = (uint16_t*)calloc(count, sizeof(uint16_t));
+        if (image->buffer[i].values == NULL) {
+            MALLOC_ERR;
+            freeRegisterImage(image);
+            return NULL;
+        }
+    }
+
+    return image;
+}
+
+/**
+ * @brief free the image, no snapshot of it may be held anymore
+ *
+ * @param image the image, NULL is ignored
+ */
+void freeRegisterImage(RegisterImage* image) {
+    if (image == NULL) return;
+    for (int i = 0; i < IMAGE_MAX_BUFFERS; i++) free(image->buffer[i].values);
+    free(image);
+}
+
+/**
+ * @brief start a scan, poller only
+ *
+ * Picks a buffer that is neither published nor pinned by a reader. Its
+ * content is left from an older scan, the poller must write every
+ * register before publishing. Calling it again before imagePublish or
+ * imageAbandon returns the same buffer.
+ *
+ * @param image the image
+ * @return uint16_t* the back buffer, count registers from firstAddress, or
+ * NULL if readers pin every other buffer (the scan is counted as skipped)
+ */
+uint16_t* imageBegin(RegisterImage* image) {
+    if (image->back >= 0) return image->buffer[image->back].values;
+
+    for (int i = 1; i <= image->buffers; i++) {
+        int candidate = (image->current + i) % image->buffers;
+        if (candidate == image->current) continue;
+
+        // pairs with the increment in imageAcquire: a reader either sees
+        // that this buffer is no longer published or is counted here
+        if (__atomic_load_n(&image->buffer[candidate].readers,
+                            __ATOMIC_SEQ_CST) == 0) {
+            image->back = candidate;
+            return image->buffer[candidate].values;
+        }
+    }
+
+    _count(&image->stats.skipped);
+    return NULL;
+}
+
+/**
+ * @brief make the back buffer the current image, poller only
+ *
+ * @param image the image
+ * @param timestampNs time of the scan, reported with its snapshots
+ */
+void imagePublish(RegisterImage* image, uint64_t timestampNs) {
+    if (image->back < 0) return;
+
+    ImageBuffer* buffer = &image->buffer[image->back];
+    buffer->timestampNs = timestampNs;
+
+    image->sequence++;
+    __atomic_store_n(&image->published,
+                     image->sequence << 8 | (uint64_t)image->back,
+                     __ATOMIC_SEQ_CST);
+
+    image->current = image->back;
+    image->back = -1;
+    _count(&image->stats.published);
+}
+
+/**
+ * @brief drop a scan that could not complete, poller only; readers keep
+ * the previous image
+ *
+ * @param image the image
+ */
+void imageAbandon(RegisterImage* image) {
+    if (image->back < 0) return;
+    image->back = -1;
+    _count(&image->stats.failed);
+}
+
+/**
+ * @brief read the whole span with as many Read Holding Registers requests
+ * as needed and publish it, poller only
+ *
+ * @param image the image
+ * @param socketfd connection to the device
+ * @param id transaction id of the first request, the next ones follow
+ * @return int 0 if success, the exception code if the device answered one,
+ * -1 if a read failed or no buffer was free; the previous image stays
+ * current on failure
+ */
+int imageScan(RegisterImage* image, int socketfd, uint16_t id) {
+    uint64_t timestampNs = _now();
+
+    uint16_t* values = imageBegin(image);
+    if (values == NULL) return -1;
+
+    for (uint32_t offset = 0; offset < image->count;) {
+        uint32_t quantity = image->count - offset;
+        if (quantity > MODBUS_RHR_QUANTITY_MAX) {
+            quantity = MODBUS_RHR_QUANTITY_MAX;
+        }
+
+        int result = readHoldingRegistersInto(
+            socketfd, id++, (uint16_t)(image->firstAddress + offset),
+            (uint16_t)quantity, values + offset);
+        if (result != 0) {
+            imageAbandon(image);
+            return result;
+        }
+        offset += quantity;
+    }
+
+    imagePublish(image, timestampNs);
+    return 0;
+}
+
+/**
+ * @brief pin the current image, wait-free for the poller and lock-free for
+ * readers
+ *
+ * The values stay valid and unchanged until imageRelease, which must follow
+ * soon: a pinned buffer is not reused by the poller.
+ *
+ * @param image the image
+ * @param snapshot filled with the current image
+ * @return int 0 if success, -1 if no scan was published yet
+ */
+int imageAcquire(RegisterImage* image, RegisterSnapshot* snapshot) {
+    for (;;) {
+        uint64_t word = __atomic_load_n(&image->published, __ATOMIC_ACQUIRE);
+        if (word == 0) return -1;
+
+        ImageBuffer* buffer = &image->buffer[PUBLISHED_BUFFER(word)];
+        __atomic_add_fetch(&buffer->readers, 1, __ATOMIC_SEQ_CST);
+
+        // still published after pinning: the poller cannot pick it anymore
+        if (__atomic_load_n(&image->published, __ATOMIC_SEQ_CST) == word) {
+            snapshot->values = buffer->values;
+            snapshot->firstAddress = image->firstAddress;
+            snapshot->count = image->count;
+            snapshot->sequence = PUBLISHED_SEQUENCE(word);
+            snapshot->timestampNs = buffer->timestampNs;
+            snapshot->buffer = PUBLISHED_BUFFER(word);
+            return 0;
+        }
+
+        // a newer scan came in between, it may be filling this buffer
+        __atomic_sub_fetch(&buffer->readers, 1, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * @brief unpin a snapshot taken by imageAcquire
+ *
+ * @param image the image
+ * @param snapshot the snapshot, its values must not be used afterwards
+ */
+void imageRelease(RegisterImage* image, RegisterSnapshot* snapshot) {
+    if (snapshot->values == NULL) return;
+    __atomic_sub_fetch(&image->buffer[snapshot->buffer].readers, 1,
+                       __ATOMIC_RELEASE);
+    snapshot->values = NULL;
+}
+
+/**
+ * @brief sequence number of the current image, to check for a new scan
+ * without pinning
+ *
+ * @param image the image
+ * @return uint64_t the sequence, 0 if no scan was published yet
+ */
+uint64_t imageSequence(RegisterImage* image) {
+    return PUBLISHED_SEQUENCE(
+        __atomic_load_n(&image->published, __ATOMIC_ACQUIRE));
+}
+
+/**
+ * @brief copy the scan counters
+ *
+ * @param image the image
+ * @param stats filled with the counters
+ */
+void imageGetStats(RegisterImage* image, ImageStats* stats) {
+    stats->published =
+        __atomic_load_n(&image->stats.published, __ATOMIC_RELAXED);
+    stats->failed = __atomic_load_n(&image->stats.failed, __ATOMIC_RELAXED);
+    stats->skipped = __atomic_load_n(&image->stats.skipped, __ATOMIC_RELAXED);
+}
+
+#undef MALLOC_ERR
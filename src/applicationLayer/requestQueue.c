@@ -0,0 +1,233 @@
+#include "applicationLayer/requestQueue.h"
+
+#include <string.h>
+
+/**
+ * @brief initialise an empty queue
+ *
+ * Polling lanes get a share of the in-flight window, and together leave at
+ * least one slot to commands and alarms, unless the window is 1.
+ *
+ * @param queue the queue
+ * @param window maximum number of transactions in flight on the connection
+ */
+void requestQueueInit(RequestQueue* queue, int window) {
+    memset(queue, 0, sizeof(*queue));
+
+    queue->inFlightCap[commandLane] = window;
+    queue->inFlightCap[alarmLane] = window;
+    queue->inFlightCap[pollLane] = window > 1 ? window * 3 / 4 : 1;
+    queue->inFlightCap[backgroundLane] = window > 3 ? window / 4 : 1;
+    queue->lowInFlightCap = window > 1 ? window - 1 : 1;
+
+    for (int lane = 0; lane < REQUEST_LANES; lane++) queue->ring[lane] = -1;
+    queue->unitInFlightCap = window;
+}
+
+/**
+ * @brief append a transaction to the queue of its lane and unit
+ *
+ * A unit that had nothing queued joins the back of the lane's ring.
+ *
+ * @param queue the queue
+ * @param txn the transaction
+ */
+void requestQueuePush(RequestQueue* queue, ModbusTransaction* txn) {
+    RequestLane lane = txn->lane;
+    UnitQueue* unit = &queue->units[lane][txn->unit];
+    txn->next = NULL;
+
+    if (unit->tail == NULL) {
+        unit->head = txn;
+
+        int last = queue->ring[lane];
+        if (last < 0) {
+            unit->next = txn->unit;
+        } else {
+            unit->next = queue->units[lane][last].next;
+            queue->units[lane][last].next = txn->unit;
+        }
+        queue->ring[lane] = txn->unit;
+    } else {
+        unit->tail->next = txn;
+    }
+    unit->tail = txn;
+    queue->depth[lane]++;
+    queue->unitDepth[txn->unit]++;
+}
+
+/**
+ * @brief find the first unit of a lane's ring that may send
+ *
+ * @return the unit before it in the ring, -1 if none may send
+ */
+static int _eligibleUnit(RequestQueue* queue, int lane) {
+    int last = queue->ring[lane];
+    if (last < 0 || queue->inFlight[lane] >= queue->inFlightCap[lane])
+        return -1;
+    if (lane >= REQUEST_LOW_LANES) {
+        int low = 0;
+        for (int i = REQUEST_LOW_LANES; i < REQUEST_LANES; i++)
+            low += queue->inFlight[i];
+        if (low >= queue->lowInFlightCap) return -1;
+    }
+
+    int previous = last;
+    do {
+        int unit = queue->units[lane][previous].next;
+        if (queue->unitInFlight[unit] < queue->unitInFlightCap)
+            return previous;
+        previous = unit;
+    } while (previous != last);
+
+    return -1;
+}
+
+/**
+ * @brief dequeue the head of the unit following previous in the ring, the
+ * unit leaves the ring once empty, otherwise it moves to the back of the
+ * ring if it was served
+ */
+static ModbusTransaction* _dequeue(RequestQueue* queue, int lane,
+                                   int previous, int served) {
+    UnitQueue* units = queue->units[lane];
+    int current = units[previous].next;
+    UnitQueue* unit = &units[current];
+
+    ModbusTransaction* txn = unit->head;
+    unit->head = txn->next;
+    queue->depth[lane]--;
+    queue->unitDepth[txn->unit]--;
+    txn->next = NULL;
+
+    int last = queue->ring[lane];
+    if (unit->head == NULL) {
+        unit->tail = NULL;
+        if (current == previous)
+            queue->ring[lane] = -1;
+        else {
+            units[previous].next = unit->next;
+            if (current == last) queue->ring[lane] = previous;
+        }
+    } else if (served && current != last) {
+        units[previous].next = unit->next;
+        unit->next = units[last].next;
+        units[last].next = current;
+        queue->ring[lane] = current;
+    }
+
+    return txn;
+}
+
+/**
+ * @brief take the next transaction to send and count it as in flight
+ *
+ * The highest priority lane with work and a free in-flight slot wins, unless
+ * a lower lane has been passed over REQUEST_STARVATION_LIMIT times, in which
+ * case it is served once. Within the lane, units take turns.
+ *
+ * @param queue the queue
+ * @return ModbusTransaction* the transaction, NULL if nothing can be sent
+ */
+ModbusTransaction* requestQueuePop(RequestQueue* queue) {
+    int previous[REQUEST_LANES];
+    int chosen = -1;
+
+    for (int lane = 0; lane < REQUEST_LANES; lane++)
+        previous[lane] = _eligibleUnit(queue, lane);
+
+    for (int lane = 0; lane < REQUEST_LANES; lane++) {
+        if (previous[lane] >= 0 &&
+            queue->skipped[lane] >= REQUEST_STARVATION_LIMIT) {
+            chosen = lane;
+            break;
+        }
+    }
+    for (int lane = 0; chosen < 0 && lane < REQUEST_LANES; lane++) {
+        if (previous[lane] >= 0) chosen = lane;
+    }
+    if (chosen < 0) return NULL;
+
+    for (int lane = 0; lane < REQUEST_LANES; lane++) {
+        if (lane != chosen && previous[lane] >= 0) queue->skipped[lane]++;
+    }
+    queue->skipped[chosen] = 0;
+
+    ModbusTransaction* txn = _dequeue(queue, chosen, previous[chosen], 1);
+    queue->inFlight[chosen]++;
+    queue->unitInFlight[txn->unit]++;
+    return txn;
+}
+
+/**
+ * @brief remove the next queued transaction regardless of lane and unit
+ * limits, used to drain the queue
+ *
+ * @param queue the queue
+ * @return ModbusTransaction* the transaction, NULL if the queue is empty
+ */
+ModbusTransaction* requestQueueTake(RequestQueue* queue) {
+    for (int lane = 0; lane < REQUEST_LANES; lane++) {
+        if (queue->ring[lane] < 0) continue;
+        return _dequeue(queue, lane, queue->ring[lane], 0);
+    }
+    return NULL;
+}
+
+/**
+ * @brief remove the oldest queued transaction of a lane, used to shed load
+ *
+ * The unit keeps its place in the round robin.
+ *
+ * @param queue the queue
+ * @param lane the lane
+ * @param unit only consider this unit, -1 for any unit
+ * @return ModbusTransaction* the transaction, NULL if none is queued
+ */
+ModbusTransaction* requestQueueEvict(RequestQueue* queue, RequestLane lane,
+                                     int unit) {
+    int last = queue->ring[lane];
+    if (last < 0) return NULL;
+
+    // each unit is FIFO, so the oldest transaction heads one of the units
+    ModbusTransaction* oldest = NULL;
+    int oldestPrevious = -1;
+    int previous = last;
+    do {
+        int current = queue->units[lane][previous].next;
+        ModbusTransaction* head = queue->units[lane][current].head;
+        if ((unit < 0 || unit == current) &&
+            (oldest == NULL || head->enqueuedNs < oldest->enqueuedNs)) {
+            oldest = head;
+            oldestPrevious = previous;
+        }
+        previous = current;
+    } while (previous != last);
+
+    if (oldest == NULL) return NULL;
+    return _dequeue(queue, lane, oldestPrevious, 0);
+}
+
+/**
+ * @brief free the in-flight slots of a completed transaction
+ *
+ * @param queue the queue
+ * @param txn the completed transaction
+ */
+void requestQueueRelease(RequestQueue* queue, ModbusTransaction* txn) {
+    if (queue->inFlight[txn->lane] > 0) queue->inFlight[txn->lane]--;
+    if (queue->unitInFlight[txn->unit] > 0) queue->unitInFlight[txn->unit]--;
+}
+
+/**
+ * @brief number of queued transactions, in flight ones excluded
+ *
+ * @param queue the queue
+ * @return int queue depth
+ */
+int requestQueueDepth(RequestQueue* queue) {
+    int depth = 0;
+    for (int lane = 0; lane < REQUEST_LANES; lane++)
+        depth += queue->depth[lane];
+    return depth;
+}
@@ -0,0 +1,533 @@
+#include "applicationLayer/scanRecorder.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "log.h"
+
+#define MALLOC_ERR \
+    ERROR("malloc failed in %s: %s, %d\n", __func__, __FILE__, __LINE__)
+
+#define RECORDER_FILE_MAGIC 0x5354424D   // "MBTS"
+#define RECORDER_BLOCK_MAGIC 0x4B4C424D  // "MBLK"
+#define RECORDER_VERSION 1
+
+// on disk structures are written in host byte order
+
+typedef struct __attribute__((packed)) _fileHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t registers;
+} FileHeader;
+
+typedef struct __attribute__((packed)) _blockHeader {
+    uint32_t magic;
+    uint32_t scans;
+    uint64_t firstNs;
+    uint32_t payloadLen;
+} BlockHeader;
+
+typedef struct __attribute__((packed)) _indexEntry {
+    uint64_t firstNs;
+    uint64_t lastNs;
+    uint64_t offset;  // of the block header in the data file
+    uint32_t length;  // block header + payload
+    uint32_t scans;
+} IndexEntry;
+
+struct _scanRecorder {
+    int datafd;
+    int indexfd;
+    uint64_t offset;       // end of the data file
+    uint64_t indexOffset;  // end of the index file
+    uint64_t lastNs;       // last timestamp already written
+    int registers;
+
+    // current block, RECORDER_BLOCK_SCANS scans at most
+    int scans;
+    uint64_t timestamps[RECORDER_BLOCK_SCANS];
+    uint16_t* values;  // scans x registers
+
+    uint8_t* encoded;  // sized for the worst case block
+    int encodedCap;
+};
+
+struct _scanArchive {
+    int registers;
+    uint8_t* data;
+    size_t dataLen;
+    IndexEntry* index;
+    size_t indexLen;
+    int blocks;
+    uint16_t* values;  // one decoded block
+};
+
+static inline int _putVarint(uint8_t* out, uint64_t v) {
+    int n = 0;
+    while (v >= 0x80) {
+        out[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (uint8_t)v;
+    return n;
+}
+
+static inline int _getVarint(const uint8_t* in, const uint8_t* end,
+                             uint64_t* v) {
+    uint64_t result = 0;
+    int shift = 0, n = 0;
+    while (in + n < end && shift < 64) {
+        uint8_t byte = in[n++];
+        result |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *v = result;
+            return n;
+        }
+        shift += 7;
+    }
+    return -1;
+}
+
+static inline uint64_t _zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t _unzigzag(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static int _writeAll(int fd, const void* buffer, size_t len) {
+    const uint8_t* p = (const uint8_t*)buffer;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * @brief compress the buffered scans into recorder->encoded
+ *
+ * @return payload length
+ */
+static int _encodeBlock(ScanRecorder* recorder) {
+    uint8_t* out = recorder->encoded;
+    int n = 0;
+
+    // timestamps: the first one is in the block header, then delta of delta
+    int64_t previousDelta = 0;
+    for (int i = 1; i < recorder->scans; i++) {
+        int64_t delta =
+            (int64_t)(recorder->timestamps[i] - recorder->timestamps[i - 1]);
+        n += _putVarint(out + n, _zigzag(delta - previousDelta));
+        previousDelta = delta;
+    }
+
+    // one column per register: first value, then value deltas where a zero
+    // byte introduces a run of unchanged scans
+    for (int r = 0; r < recorder->registers; r++) {
+        uint16_t previous = recorder->values[r];
+        n += _putVarint(out + n, previous);
+
+        uint64_t run = 0;
+        for (int i = 1; i < recorder->scans; i++) {
+            uint16_t value = recorder->values[i * recorder->registers + r];
+            int64_t delta = (int16_t)(uint16_t)(value - previous);
+            previous = value;
+
+            if (delta == 0) {
+                run++;
+                continue;
+            }
+            if (run > 0) {
+                out[n++] = 0;
+                n += _putVarint(out + n, run);
+                run = 0;
+            }
+            n += _putVarint(out + n, _zigzag(delta));
+        }
+        if (run > 0) {
+            out[n++] = 0;
+            n += _putVarint(out + n, run);
+        }
+    }
+
+    return n;
+}
+
+/**
+ * @brief decode a block payload into values (scans x registers)
+ *
+ * @return 0 if success, -1 if the payload is corrupt
+ */
+static int _decodeBlock(const uint8_t* in, const uint8_t* end, int scans,
+                        int registers, uint64_t firstNs,
+                        uint64_t* timestamps, uint16_t* values) {
+    uint64_t v;
+    int n;
+
+    timestamps[0] = firstNs;
+    int64_t previousDelta = 0;
+    for (int i = 1; i < scans; i++) {
+        if ((n = _getVarint(in, end, &v)) < 0) return -1;
+        in += n;
+        previousDelta += _unzigzag(v);
+        timestamps[i] = timestamps[i - 1] + previousDelta;
+    }
+
+    for (int r = 0; r < registers; r++) {
+        if ((n = _getVarint(in, end, &v)) < 0) return -1;
+        in += n;
+        uint16_t previous = (uint16_t)v;
+        values[r] = previous;
+
+        for (int i = 1; i < scans;) {
+            if ((n = _getVarint(in, end, &v)) < 0) return -1;
+            in += n;
+
+            if (v == 0) {
+                uint64_t run;
+                if ((n = _getVarint(in, end, &run)) < 0) return -1;
+                in += n;
+                if (run > (uint64_t)(scans - i)) return -1;
+                for (; run > 0; run--, i++) values[i * registers + r] = previous;
+            } else {
+                previous = (uint16_t)(previous + _unzigzag(v));
+                values[i * registers + r] = previous;
+                i++;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief open (or create) a recording file and append scans to it
+ *
+ * @param path data file path, the block index goes to "<path>.idx"
+ * @param registers number of registers of every scan
+ * @return ScanRecorder* the recorder, NULL if error or if the existing file
+ * holds a different number of registers
+ */
+ScanRecorder* newScanRecorder(const char* path, int registers) {
+    if (path == NULL || registers <= 0 || registers > UINT16_MAX) {
+        ERROR("newScanRecorder: invalid parameters\n");
+        return NULL;
+    }
+
+    ScanRecorder* recorder = (ScanRecorder*)calloc(1, sizeof(*recorder));
+    if (recorder == NULL) {
+        MALLOC_ERR;
+        return NULL;
+    }
+    recorder->registers = registers;
+    recorder->datafd = recorder->indexfd = -1;
+
+    // worst case: 10 bytes per timestamp, 3 bytes per value
+    recorder->encodedCap =
+        RECORDER_BLOCK_SCANS * 10 + registers * (RECORDER_BLOCK_SCANS + 1) * 3;
+    recorder->values = (uint16_t*)malloc(RECORDER_BLOCK_SCANS * registers *
+                                         sizeof(*recorder->values));
+    recorder->encoded = (uint8_t*)malloc(recorder->encodedCap);
+    if (recorder->values == NULL || recorder->encoded == NULL) {
+        MALLOC_ERR;
+        goto fail;
+    }
+
+    char indexPath[PATH_MAX];
+    snprintf(indexPath, sizeof(indexPath), "%s.idx", path);
+    recorder->datafd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    recorder->indexfd = open(indexPath, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (recorder->datafd < 0 || recorder->indexfd < 0) {
+        ERROR("cannot open recording %s\n", path);
+        goto fail;
+    }
+
+    struct stat st;
+    fstat(recorder->datafd, &st);
+    if (st.st_size == 0) {
+        FileHeader header = {RECORDER_FILE_MAGIC, RECORDER_VERSION,
+                             (uint16_t)registers};
+        if (_writeAll(recorder->datafd, &header, sizeof(header)) < 0)
+            goto fail;
+        recorder->offset = sizeof(header);
+    } else {
+        FileHeader header;
+        if (pread(recorder->datafd, &header, sizeof(header), 0) !=
+                sizeof(header) ||
+            header.magic != RECORDER_FILE_MAGIC ||
+            header.registers != registers) {
+            ERROR("%s is not a recording of %d registers\n", path, registers);
+            goto fail;
+        }
+        recorder->offset = st.st_size;
+    }
+
+    // queries binary search the whole index: appends continue after the
+    // last block written, and a torn trailing entry is dropped
+    fstat(recorder->indexfd, &st);
+    recorder->indexOffset = st.st_size - st.st_size % sizeof(IndexEntry);
+    if (recorder->indexOffset != (uint64_t)st.st_size &&
+        ftruncate(recorder->indexfd, recorder->indexOffset) < 0) {
+        ERROR("cannot repair the index of %s\n", path);
+        goto fail;
+    }
+    if (recorder->indexOffset > 0) {
+        IndexEntry last;
+        if (pread(recorder->indexfd, &last, sizeof(last),
+                  recorder->indexOffset - sizeof(last)) != sizeof(last)) {
+            ERROR("cannot read the index of %s\n", path);
+            goto fail;
+        }
+        recorder->lastNs = last.lastNs;
+    }
+
+    return recorder;
+
+fail:
+    if (recorder->datafd >= 0) close(recorder->datafd);
+    if (recorder->indexfd >= 0) close(recorder->indexfd);
+    free(recorder->values);
+    free(recorder->encoded);
+    free(recorder);
+    return NULL;
+}
+
+/**
+ * @brief write the buffered scans as one block, then its index entry
+ *
+ * A failed write is cut off the files again and the block stays buffered,
+ * so a later flush can retry it.
+ *
+ * @param recorder the recorder
+ * @return 0 if success, -1 if error
+ */
+int recorderFlush(ScanRecorder* recorder) {
+    if (recorder == NULL) return -1;
+    if (recorder->scans == 0) return 0;
+
+    int payloadLen = _encodeBlock(recorder);
+
+    BlockHeader header = {RECORDER_BLOCK_MAGIC, (uint32_t)recorder->scans,
+                          recorder->timestamps[0], (uint32_t)payloadLen};
+    IndexEntry entry = {recorder->timestamps[0],
+                        recorder->timestamps[recorder->scans - 1],
+                        recorder->offset,
+                        (uint32_t)(sizeof(header) + payloadLen),
+                        (uint32_t)recorder->scans};
+
+    if (_writeAll(recorder->datafd, &header, sizeof(header)) < 0 ||
+        _writeAll(recorder->datafd, recorder->encoded, payloadLen) < 0 ||
+        _writeAll(recorder->indexfd, &entry, sizeof(entry)) < 0) {
+        ERROR("cannot write recording block\n");
+        // later entries must point at the right offsets
+        if (ftruncate(recorder->datafd, recorder->offset) < 0 ||
+            ftruncate(recorder->indexfd, recorder->indexOffset) < 0)
+            ERROR("cannot remove the partial block\n");
+        return -1;
+    }
+
+    recorder->offset += entry.length;
+    recorder->indexOffset += sizeof(entry);
+    recorder->lastNs = entry.lastNs;
+    recorder->scans = 0;
+    return 0;
+}
+
+/**
+ * @brief append one scan, timestamps must not decrease, also across
+ * blocks and reopened files
+ *
+ * @param recorder the recorder
+ * @param timestampNs scan time
+ * @param values the scan, one value per register
+ * @return 0 if success, -1 if the scan was refused or if writing the block
+ * it completed failed; that block stays buffered and scans are refused
+ * until a recorderFlush or recorderAppend manages to write it
+ */
+int recorderAppend(ScanRecorder* recorder, uint64_t timestampNs,
+                   const uint16_t* values) {
+    if (recorder == NULL || values == NULL) return -1;
+
+    if (recorder->scans == RECORDER_BLOCK_SCANS &&
+        recorderFlush(recorder) < 0)
+        return -1;
+
+    uint64_t previousNs = recorder->scans > 0
+                              ? recorder->timestamps[recorder->scans - 1]
+                              : recorder->lastNs;
+    if (timestampNs < previousNs) {
+        ERROR("recorderAppend: timestamps must not decrease\n");
+        return -1;
+    }
+
+    recorder->timestamps[recorder->scans] = timestampNs;
+    memcpy(recorder->values + recorder->scans * recorder->registers, values,
+           recorder->registers * sizeof(*values));
+
+    if (++recorder->scans == RECORDER_BLOCK_SCANS)
+        return recorderFlush(recorder);
+    return 0;
+}
+
+/**
+ * @brief flush the last block and close a recorder
+ *
+ * @param recorder the recorder
+ */
+void freeScanRecorder(ScanRecorder* recorder) {
+    if (recorder == NULL) return;
+
+    recorderFlush(recorder);
+    close(recorder->datafd);
+    close(recorder->indexfd);
+    free(recorder->values);
+    free(recorder->encoded);
+    free(recorder);
+}
+
+static void* _mapFile(const char* path, size_t* len) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    void* map = NULL;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) map = NULL;
+        *len = st.st_size;
+    }
+    close(fd);
+    return map;
+}
+
+/**
+ * @brief map a recording for time range queries
+ *
+ * @param path data file path
+ * @return ScanArchive* the archive, NULL if error
+ */
+ScanArchive* openScanArchive(const char* path) {
+    ScanArchive* archive = (ScanArchive*)calloc(1, sizeof(*archive));
+    if (archive == NULL) {
+        MALLOC_ERR;
+        return NULL;
+    }
+
+    char indexPath[PATH_MAX];
+    snprintf(indexPath, sizeof(indexPath), "%s.idx", path);
+
+    archive->data = (uint8_t*)_mapFile(path, &archive->dataLen);
+    if (archive->data == NULL || archive->dataLen < sizeof(FileHeader) ||
+        ((FileHeader*)archive->data)->magic != RECORDER_FILE_MAGIC) {
+        ERROR("%s is not a recording\n", path);
+        closeScanArchive(archive);
+        return NULL;
+    }
+    archive->registers = ((FileHeader*)archive->data)->registers;
+
+    // an empty index just means no block was written yet
+    archive->index = (IndexEntry*)_mapFile(indexPath, &archive->indexLen);
+    archive->blocks =
+        archive->index != NULL ? archive->indexLen / sizeof(IndexEntry) : 0;
+
+    archive->values = (uint16_t*)malloc(
+        RECORDER_BLOCK_SCANS * archive->registers * sizeof(uint16_t));
+    if (archive->values == NULL) {
+        MALLOC_ERR;
+        closeScanArchive(archive);
+        return NULL;
+    }
+
+    return archive;
+}
+
+/**
+ * @brief number of registers of every scan in the archive
+ */
+int archiveRegisters(ScanArchive* archive) { return archive->registers; }
+
+/**
+ * @brief visit every scan recorded between fromNs and toNs (inclusive)
+ *
+ * @param archive the archive
+ * @param fromNs start of the time range
+ * @param toNs end of the time range
+ * @param visitor called for each scan, in time order
+ * @param context pointer passed to the visitor
+ * @return 0 if success, the visitor result if it stopped the query,
+ * -1 if the archive is corrupt
+ */
+int archiveQuery(ScanArchive* archive, uint64_t fromNs, uint64_t toNs,
+                 ScanVisitor visitor, void* context) {
+    if (archive == NULL || visitor == NULL) return -1;
+
+    // first block that ends at or after fromNs
+    int lo = 0, hi = archive->blocks;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (archive->index[mid].lastNs < fromNs)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    uint64_t timestamps[RECORDER_BLOCK_SCANS];
+    for (int b = lo; b < archive->blocks && archive->index[b].firstNs <= toNs;
+         b++) {
+        IndexEntry* entry = &archive->index[b];
+        if (entry->offset > archive->dataLen ||
+            entry->length > archive->dataLen - entry->offset ||
+            entry->length < sizeof(BlockHeader) ||
+            entry->scans > RECORDER_BLOCK_SCANS)
+            return -1;
+
+        // the header must agree with the index, which was bounds checked
+        BlockHeader* header = (BlockHeader*)(archive->data + entry->offset);
+        const uint8_t* payload = (const uint8_t*)(header + 1);
+        if (header->magic != RECORDER_BLOCK_MAGIC ||
+            header->scans != entry->scans ||
+            sizeof(*header) + header->payloadLen != entry->length ||
+            _decodeBlock(payload, payload + header->payloadLen,
+                         header->scans, archive->registers, header->firstNs,
+                         timestamps, archive->values) < 0) {
+            ERROR("corrupt recording block %d\n", b);
+            return -1;
+        }
+
+        for (uint32_t i = 0; i < header->scans; i++) {
+            if (timestamps[i] < fromNs || timestamps[i] > toNs) continue;
+            int ret = visitor(timestamps[i],
+                              archive->values + i * archive->registers,
+                              archive->registers, context);
+            if (ret != 0) return ret;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief unmap an archive opened with openScanArchive
+ *
+ * @param archive the archive
+ */
+void closeScanArchive(ScanArchive* archive) {
+    if (archive == NULL) return;
+
+    if (archive->data != NULL) munmap(archive->data, archive->dataLen);
+    if (archive->index != NULL) munmap(archive->index, archive->indexLen);
+    free(archive->values);
+    free(archive);
+}
+
+#undef MALLOC_ERR
@@ -0,0 +1,410 @@
+#include "applicationLayer/scanStream.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "log.h"
+
+#define MALLOC_ERR \
+    ERROR("malloc failed in %s: %s, %d\n", __func__, __FILE__, __LINE__)
+
+// how long freeScanStream waits for the consumer to take what is left
+#define STREAM_CLOSE_TIMEOUT_MS 1000
+
+struct _scanStream {
+    int fd;
+    int socket;  // send with MSG_NOSIGNAL, write otherwise
+    int broken;  // the consumer went away
+    StreamPolicy policy;
+    int limit;
+
+    // output not written yet: buffer[head] to buffer[head + len - 1]
+    uint8_t* buffer;
+    int head;
+    int len;
+    int cap;
+
+    uint16_t* counts;  // registers per schema, schema ids start at 1
+    int schemas;
+    int schemaCap;
+
+    uint64_t gap;  // scans dropped and not reported yet
+    StreamStats stats;
+};
+
+/**
+ * @brief connect to a consumer listening on a Unix domain stream socket
+ *
+ * @param path socket path
+ * @return int socket file descriptor, owned by the caller, -1 if error
+ */
+int streamConnect(const char* path) {
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (path == NULL || strlen(path) >= sizeof(address.sun_path)) {
+        ERROR("streamConnect: invalid socket path\n");
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        ERROR("Cannot create stream socket\n");
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        ERROR("Cannot connect to stream consumer %s\n", path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief room for bytes more output at the end of the buffer
+ */
+static uint8_t* _reserve(ScanStream* stream, int bytes) {
+    if (stream->head + stream->len + bytes > stream->cap && stream->head > 0) {
+        memmove(stream->buffer, stream->buffer + stream->head, stream->len);
+        stream->head = 0;
+    }
+    if (stream->len + bytes > stream->cap) {
+        int capacity = stream->cap ? 2 * stream->cap : STREAM_BATCH_BYTES;
+        while (capacity < stream->len + bytes) capacity *= 2;
+        uint8_t* buffer = (uint8_t*)realloc(stream->buffer, capacity);
+        if (buffer == NULL) {
+            MALLOC_ERR;
+            return NULL;
+        }
+        stream->buffer = buffer;
+        stream->cap = capacity;
+    }
+
+    uint8_t* out = stream->buffer + stream->head + stream->len;
+    stream->len += bytes;
+    return out;
+}
+
+/**
+ * @brief write what the consumer accepts without waiting
+ *
+ * @return int 0 if success, -1 if the consumer went away
+ */
+static int _write(ScanStream* stream) {
+    while (stream->len > 0) {
+        uint8_t* out = stream->buffer + stream->head;
+        ssize_t n = stream->socket
+                        ? send(stream->fd, out, stream->len, MSG_NOSIGNAL)
+                        : write(stream->fd, out, stream->len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            ERROR("stream consumer gone, %d bytes lost\n", stream->len);
+            stream->broken = 1;
+            return -1;
+        }
+        stream->head += n;
+        stream->len -= n;
+        stream->stats.bytes += n;
+        stream->stats.writes++;
+    }
+    stream->head = 0;
+    return 0;
+}
+
+/**
+ * @brief wait until the consumer can take more output
+ *
+ * @return int 1 if it can, 0 on timeout, -1 if error
+ */
+static int _waitWritable(ScanStream* stream, int timeoutMs) {
+    struct pollfd pollfd = {.fd = stream->fd, .events = POLLOUT};
+    for (;;) {
+        int n = poll(&pollfd, 1, timeoutMs);
+        if (n >= 0) return n;
+        if (errno != EINTR) return -1;
+    }
+}
+
+static void _appendGap(ScanStream* stream) {
+    StreamGapRecord* record =
+        (StreamGapRecord*)_reserve(stream, sizeof(StreamGapRecord));
+    if (record == NULL) return;
+
+    record->header.length = sizeof(StreamGapRecord);
+    record->header.type = streamGap;
+    record->header.schema = 0;
+    record->dropped = stream->gap;
+    stream->gap = 0;
+}
+
+/**
+ * @brief make room for bytes more output within the limit, applying the
+ * policy
+ *
+ * @return int 0 if there is room, 1 if the output must be dropped, -1 if
+ * the consumer went away
+ */
+static int _makeRoom(ScanStream* stream, int bytes) {
+    if (stream->len + bytes <= stream->limit) return 0;
+    if (_write(stream) < 0) return -1;
+    if (stream->len + bytes <= stream->limit) return 0;
+    if (stream->policy == streamDrop) return 1;
+
+    stream->stats.blocked++;
+    while (stream->len + bytes > stream->limit) {
+        if (_waitWritable(stream, -1) < 0 || _write(stream) < 0) return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief create a stream over a file descriptor and write its streamHello
+ * record
+ *
+ * @param fd connected socket (see streamConnect), pipe or file, owned by the
+ * caller; it is made non blocking
+ * @param policy what to do when the consumer is behind by limit bytes
+ * @param limit most bytes kept for a slow consumer, 0 for
+ * STREAM_DEFAULT_LIMIT
+ * @return ScanStream* the stream, NULL if error
+ */
+ScanStream* newScanStream(int fd, StreamPolicy policy, int limit) {
+    if (limit == 0) limit = STREAM_DEFAULT_LIMIT;
+    if (fd < 0 || policy < streamBlock || policy > streamDrop ||
+        limit < (int)sizeof(StreamHello)) {
+        ERROR("newScanStream: invalid parameters\n");
+        return NULL;
+    }
+
+    struct stat status;
+    int flags = fcntl(fd, F_GETFL);
+    if (fstat(fd, &status) < 0 || flags < 0 ||
+        fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        ERROR("newScanStream: unusable file descriptor\n");
+        return NULL;
+    }
+
+    ScanStream* stream = (ScanStream*)calloc(1, sizeof(ScanStream));
+    if (stream == NULL) {
+        MALLOC_ERR;
+        return NULL;
+    }
+    stream->fd = fd;
+    stream->socket = S_ISSOCK(status.st_mode);
+    stream->policy = policy;
+    stream->limit = limit;
+
+    StreamHello* hello = (StreamHello*)_reserve(stream, sizeof(StreamHello));
+    if (hello == NULL) {
+        free(stream);
+        return NULL;
+    }
+    hello->header.length = sizeof(StreamHello);
+    hello->header.type = streamHello;
+    hello->header.schema = 0;
+    hello->magic = STREAM_MAGIC;
+    hello->version = STREAM_VERSION;
+    hello->reserved = 0;
+
+    return stream;
+}
+
+/**
+ * @brief write what is left, waiting a while for the consumer, and free
+ * the stream; the file descriptor stays open
+ *
+ * @param stream the stream, NULL is ignored
+ */
+void freeScanStream(ScanStream* stream) {
+    if (stream == NULL) return;
+
+    if (stream->gap > 0) _appendGap(stream);
+    while (!stream->broken && stream->len > 0 && _write(stream) == 0 &&
+           stream->len > 0) {
+        if (_waitWritable(stream, STREAM_CLOSE_TIMEOUT_MS) <= 0) {
+            ERROR("stream consumer stalled, %d bytes lost\n", stream->len);
+            break;
+        }
+    }
+
+    free(stream->counts);
+    free(stream->buffer);
+    free(stream);
+}
+
+/**
+ * @brief declare the layout of a device's scans, sent to the consumer
+ * ahead of them
+ *
+ * @param stream the stream
+ * @param device caller defined id of the device, e.g. its index
+ * @param firstAddress address of the first register of each scan
+ * @param count registers per scan
+ * @param name device name for the consumer, NULL for none, truncated to
+ * STREAM_NAME_MAX bytes
+ * @return int schema id for streamPublish, -1 if error
+ */
+int streamAddSchema(ScanStream* stream, uint32_t device,
+                    uint16_t firstAddress, uint16_t count, const char* name) {
+    if (stream == NULL || count == 0 ||
+        (int)(sizeof(StreamScanRecord) + count * sizeof(uint16_t) +
+              sizeof(StreamGapRecord)) > stream->limit ||
+        stream->schemas == STREAM_MAX_SCHEMAS) {
+        ERROR("streamAddSchema: invalid parameters\n");
+        return -1;
+    }
+
+    if (stream->schemas == stream->schemaCap) {
+        int capacity = stream->schemaCap ? 2 * stream->schemaCap : 64;
+        uint16_t* counts =
+            (uint16_t*)realloc(stream->counts, capacity * sizeof(uint16_t));
+        if (counts == NULL) {
+            MALLOC_ERR;
+            return -1;
+        }
+        stream->counts = counts;
+        stream->schemaCap = capacity;
+    }
+
+    // schemas are never dropped, the limit only holds back scans
+    int nameLen = name == NULL ? 0 : (int)strnlen(name, STREAM_NAME_MAX);
+    int length = sizeof(StreamSchemaRecord) + nameLen;
+    StreamSchemaRecord* record =
+        (StreamSchemaRecord*)_reserve(stream, length);
+    if (record == NULL) return -1;
+
+    stream->counts[stream->schemas++] = count;
+    record->header.length = length;
+    record->header.type = streamSchema;
+    record->header.schema = stream->schemas;
+    record->device = device;
+    record->firstAddress = firstAddress;
+    record->count = count;
+    if (nameLen > 0) memcpy(record + 1, name, nameLen);
+    return stream->schemas;
+}
+
+/**
+ * @brief append one scan, writing the batch out once STREAM_BATCH_BYTES are
+ * buffered
+ *
+ * @param stream the stream
+ * @param schema id returned by streamAddSchema
+ * @param timestampNs time of the scan
+ * @param values the schema's count registers
+ * @return int 0 if success, 1 if the scan was dropped by streamDrop, -1 if
+ * error or if the consumer went away
+ */
+int streamPublish(ScanStream* stream, int schema, uint64_t timestampNs,
+                  const uint16_t* values) {
+    if (stream == NULL || schema < 1 || schema > stream->schemas ||
+        values == NULL) {
+        ERROR("streamPublish: invalid parameters\n");
+        return -1;
+    }
+    if (stream->broken) return -1;
+
+    int count = stream->counts[schema - 1];
+    int length = sizeof(StreamScanRecord) + count * sizeof(uint16_t);
+
+    // keep room to report the scans dropped before this one
+    int room = _makeRoom(stream, length + sizeof(StreamGapRecord));
+    if (room < 0) return -1;
+    if (room > 0) {
+        stream->gap++;
+        stream->stats.dropped++;
+        return 1;
+    }
+    if (stream->gap > 0) _appendGap(stream);
+
+    StreamScanRecord* record = (StreamScanRecord*)_reserve(stream, length);
+    if (record == NULL) return -1;
+    record->header.length = length;
+    record->header.type = streamScan;
+    record->header.schema = schema;
+    record->timestampNs = timestampNs;
+    memcpy(record + 1, values, count * sizeof(uint16_t));
+
+    stream->stats.scans++;
+    stream->stats.registers += count;
+
+    if (stream->len >= STREAM_BATCH_BYTES) return _write(stream);
+    return 0;
+}
+
+/**
+ * @brief write the buffered records the consumer accepts now, e.g. at the
+ * end of a scan cycle; what it does not take stays buffered
+ *
+ * @param stream the stream
+ * @return int 0 if success, -1 if the consumer went away
+ */
+int streamFlush(ScanStream* stream) {
+    if (stream == NULL || stream->broken) return -1;
+    if (stream->gap > 0 &&
+        stream->len + (int)sizeof(StreamGapRecord) <= stream->limit)
+        _appendGap(stream);
+    return _write(stream);
+}
+
+/**
+ * @brief bytes the consumer has not taken yet
+ *
+ * @param stream the stream
+ * @return int buffered bytes
+ */
+int streamBuffered(ScanStream* stream) { return stream->len; }
+
+/**
+ * @brief copy the stream statistics
+ *
+ * @param stream the stream
+ * @param stats filled with the statistics
+ */
+void streamGetStats(ScanStream* stream, StreamStats* stats) {
+    *stats = stream->stats;
+}
+
+/**
+ * @brief consumer side: call visitor for every complete record of buffer
+ *
+ * @param buffer bytes read from the stream
+ * @param len bytes in buffer
+ * @param consumed filled with the bytes of the records visited, the rest
+ * is an incomplete record to keep for the next read
+ * @param visitor called for each record
+ * @param context pointer passed to the visitor
+ * @return int 0 if success, what the visitor returned if it stopped the
+ * parse, -1 if a record is malformed
+ */
+int streamParse(const uint8_t* buffer, int len, int* consumed,
+                StreamVisitor visitor, void* context) {
+    int offset = 0;
+    int result = 0;
+
+    while (len - offset >= (int)sizeof(StreamHeader)) {
+        const StreamHeader* record = (const StreamHeader*)(buffer + offset);
+        if (record->length < sizeof(StreamHeader)) {
+            ERROR("malformed stream record at offset %d\n", offset);
+            result = -1;
+            break;
+        }
+        if (record->length > (uint32_t)(len - offset)) break;
+
+        offset += record->length;
+        result = visitor(record, context);
+        if (result != 0) break;
+    }
+
+    *consumed = offset;
+    return result;
+}
+
+#undef MALLOC_ERR
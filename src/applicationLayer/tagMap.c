@@ -0,0 +1,697 @@
+#include "applicationLayer/tagMap.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "log.h"
+
+#define MALLOC_ERR \
+    ERROR("malloc failed in %s: %s, %d\n", __func__, __FILE__, __LINE__)
+
+#define TAG_MAP_FIELDS 8
+#define TAG_MAP_MAX_DEVICES 65536
+#define HASH_STEP 0x9E3779B97F4A7C15ULL
+#define HASH_MAX_DISPLACEMENT (1u << 20)
+#define HASH_MAX_BUCKET 64
+
+/**
+ * @brief compiled map, structure of arrays indexed by slot or device
+ *
+ * @param names every string, referenced by offset
+ * @param displacement per bucket seed of the perfect hash
+ * @param table slot of each hash position, -1 if free
+ */
+struct _tagMap {
+    int deviceCount;
+    int tagCount;
+
+    uint32_t* deviceName;
+    uint32_t* deviceHost;
+    uint16_t* devicePort;
+    uint8_t* deviceUnit;
+    uint32_t* deviceFirst;  // deviceCount + 1 entries
+
+    uint16_t* address;  // sorted within each device
+    TagDecoder* decoder;
+    uint32_t* tagName;
+
+    uint32_t buckets;
+    uint32_t* displacement;
+    uint32_t tableSize;
+    int32_t* table;
+
+    char* names;
+    size_t namesLen;
+    size_t namesCap;
+};
+
+/**
+ * @brief a field of a configuration line, not terminated
+ */
+typedef struct _field {
+    const char* text;
+    int len;
+} Field;
+
+static uint64_t _hash(const char* name) {
+    uint64_t hash = 0xCBF29CE484222325ULL;  // FNV-1a
+    while (*name) {
+        hash ^= (uint8_t)*name++;
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+static uint64_t _mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+static uint32_t _position(TagMap* map, uint64_t hash, uint32_t displacement) {
+    return _mix(hash + displacement * HASH_STEP) % map->tableSize;
+}
+
+/**
+ * @brief append a string to the pool
+ *
+ * @param prefix offset of a pooled string written first, followed by '.',
+ * -1 for none
+ * @return int64_t offset of the new string, -1 if error
+ */
+static int64_t _intern(TagMap* map, int64_t prefix, const char* text,
+                       int len) {
+    size_t prefixLen = prefix >= 0 ? strlen(map->names + prefix) + 1 : 0;
+    size_t need = map->namesLen + prefixLen + len + 1;
+    if (need > map->namesCap) {
+        size_t capacity = map->namesCap ? map->namesCap : 4096;
+        while (capacity < need) capacity *= 2;
+        char* names = (char*)realloc(map->names, capacity);
+        if (names == NULL) {
+            MALLOC_ERR;
+            return -1;
+        }
+        map->names = names;
+        map->namesCap = capacity;
+    }
+
+    int64_t offset = map->namesLen;
+    char* out = map->names + offset;
+    if (prefix >= 0) {
+        memcpy(out, map->names + prefix, prefixLen - 1);
+        out[prefixLen - 1] = '.';
+        out += prefixLen;
+    }
+    memcpy(out, text, len);
+    out[len] = '\0';
+    map->namesLen = need;
+    return offset;
+}
+
+static int _split(const char* line, int len, Field* fields) {
+    int count = 0;
+    int start = 0;
+    for (int i = 0; i <= len && count < TAG_MAP_FIELDS; i++) {
+        if (i < len && line[i] != ',') continue;
+
+        int s = start, e = i;
+        while (s < e && (line[s] == ' ' || line[s] == '\t')) s++;
+        while (e > s && (line[e - 1] == ' ' || line[e - 1] == '\t' ||
+                         line[e - 1] == '\r'))
+            e--;
+        fields[count].text = line + s;
+        fields[count].len = e - s;
+        count++;
+        start = i + 1;
+    }
+    return count;
+}
+
+static int _is(Field field, const char* word) {
+    return field.len == (int)strlen(word) &&
+           memcmp(field.text, word, field.len) == 0;
+}
+
+static int _number(Field field, long min, long max, long* value) {
+    const char* c = field.text;
+    const char* end = c + field.len;
+    int base = 10;
+    if (field.len > 2 && c[0] == '0' && (c[1] == 'x' || c[1] == 'X')) {
+        base = 16;
+        c += 2;
+    }
+    if (c == end) return -1;
+
+    long result = 0;
+    for (; c < end; c++) {
+        int digit;
+        if (*c >= '0' && *c <= '9')
+            digit = *c - '0';
+        else if (base == 16 && (*c | 0x20) >= 'a' && (*c | 0x20) <= 'f')
+            digit = (*c | 0x20) - 'a' + 10;
+        else
+            return -1;
+        result = result * base + digit;
+        if (result > max) return -1;
+    }
+    *value = result;
+    return result < min ? -1 : 0;
+}
+
+static int _real(Field field, float* value) {
+    // plain decimals are parsed here, strtof takes exponents and the rest
+    const char* c = field.text;
+    const char* end = c + field.len;
+    int negative = c < end && *c == '-';
+    if (c < end && (*c == '-' || *c == '+')) c++;
+
+    double result = 0, scale = 1;
+    int digits = 0, point = 0;
+    for (; c < end; c++) {
+        if (*c >= '0' && *c <= '9' && digits < 15) {
+            result = result * 10 + (*c - '0');
+            if (point) scale *= 10;
+            digits++;
+        } else if (*c == '.' && !point) {
+            point = 1;
+        } else {
+            break;
+        }
+    }
+    if (c == end && digits > 0) {
+        *value = (float)((negative ? -result : result) / scale);
+        return 0;
+    }
+
+    char buffer[32];
+    if (field.len == 0 || field.len >= (int)sizeof(buffer)) return -1;
+    memcpy(buffer, field.text, field.len);
+    buffer[field.len] = '\0';
+
+    char* stop;
+    *value = strtof(buffer, &stop);
+    return *stop != '\0' ? -1 : 0;
+}
+
+static int _type(Field field, TagDecoder* decoder) {
+    static const struct {
+        const char* name;
+        TagType type;
+        int words;
+        int wordSwap;
+    } types[] = {{"u16", tagU16, 1, 0},  {"i16", tagI16, 1, 0},
+                 {"u32", tagU32, 2, 0},  {"i32", tagI32, 2, 0},
+                 {"f32", tagF32, 2, 0},  {"u32s", tagU32, 2, 1},
+                 {"i32s", tagI32, 2, 1}, {"f32s", tagF32, 2, 1}};
+
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        if (_is(field, types[i].name)) {
+            decoder->type = types[i].type;
+            decoder->words = types[i].words;
+            decoder->wordSwap = types[i].wordSwap;
+            return 0;
+        }
+    }
+
+    long bit;
+    if (field.len > 3 && memcmp(field.text, "bit", 3) == 0 &&
+        _number((Field){field.text + 3, field.len - 3}, 0, 15, &bit) == 0) {
+        decoder->type = tagBit;
+        decoder->words = 1;
+        decoder->bit = (uint8_t)bit;
+        return 0;
+    }
+    return -1;
+}
+
+static int _compareKeys(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief build the perfect hash of the tag names by hash and displace:
+ * names are grouped in buckets, and each bucket, largest first, gets the
+ * first displacement that sends all its names to free positions
+ *
+ * @return int 0 if success, -1 if error
+ */
+static int _buildIndex(TagMap* map) {
+    int n = map->tagCount;
+    map->buckets = n / 2 + 1;
+    map->tableSize = n + n / 2 + 1;
+
+    uint64_t* hashes = (uint64_t*)malloc((n + 1) * sizeof(uint64_t));
+    uint32_t* bucketStart =
+        (uint32_t*)calloc(map->buckets + 1, sizeof(uint32_t));
+    uint32_t* members = (uint32_t*)malloc((n + 1) * sizeof(uint32_t));
+    uint32_t* order = (uint32_t*)malloc(map->buckets * sizeof(uint32_t));
+    map->displacement = (uint32_t*)calloc(map->buckets, sizeof(uint32_t));
+    map->table = (int32_t*)malloc(map->tableSize * sizeof(int32_t));
+    int status = -1;
+    if (hashes == NULL || bucketStart == NULL || members == NULL ||
+        order == NULL || map->displacement == NULL || map->table == NULL) {
+        MALLOC_ERR;
+        goto done;
+    }
+
+    // members of bucket i are members[bucketStart[i]..bucketStart[i + 1]]
+    for (int slot = 0; slot < n; slot++) {
+        hashes[slot] = _hash(map->names + map->tagName[slot]);
+        bucketStart[hashes[slot] % map->buckets + 1]++;
+    }
+    for (uint32_t i = 0; i < map->buckets; i++)
+        bucketStart[i + 1] += bucketStart[i];
+    for (int slot = 0; slot < n; slot++) {
+        uint32_t bucket = hashes[slot] % map->buckets;
+        members[bucketStart[bucket]++] = slot;
+    }
+    for (uint32_t i = map->buckets; i > 0; i--)
+        bucketStart[i] = bucketStart[i - 1];
+    bucketStart[0] = 0;
+
+    // largest buckets first: counting sort by size, sizes are small
+    uint32_t sizes[HASH_MAX_BUCKET + 2] = {0};
+    for (uint32_t i = 0; i < map->buckets; i++) {
+        uint32_t size = bucketStart[i + 1] - bucketStart[i];
+        if (size > HASH_MAX_BUCKET) {
+            ERROR("tag map: %u names share one hash bucket\n", size);
+            goto done;
+        }
+        sizes[HASH_MAX_BUCKET - size + 1]++;
+    }
+    for (int i = 0; i <= HASH_MAX_BUCKET; i++) sizes[i + 1] += sizes[i];
+    for (uint32_t i = 0; i < map->buckets; i++) {
+        uint32_t size = bucketStart[i + 1] - bucketStart[i];
+        order[sizes[HASH_MAX_BUCKET - size]++] = i;
+    }
+
+    memset(map->table, 0xFF, map->tableSize * sizeof(int32_t));
+    for (uint32_t o = 0; o < map->buckets; o++) {
+        uint32_t bucket = order[o];
+        uint32_t* first = members + bucketStart[bucket];
+        int size = bucketStart[bucket + 1] - bucketStart[bucket];
+        if (size == 0) break;
+
+        for (int i = 0; i < size; i++)
+            for (int j = i + 1; j < size; j++)
+                if (hashes[first[i]] == hashes[first[j]]) {
+                    const char* name = map->names + map->tagName[first[i]];
+                    if (strcmp(name, map->names + map->tagName[first[j]]) == 0)
+                        ERROR("tag map: duplicate tag %s\n", name);
+                    else
+                        ERROR("tag map: hash collision on %s\n", name);
+                    goto done;
+                }
+
+        uint32_t d = 0;
+        for (; d < HASH_MAX_DISPLACEMENT; d++) {
+            int i = 0;
+            for (; i < size; i++) {
+                uint32_t position = _position(map, hashes[first[i]], d);
+                if (map->table[position] >= 0) break;
+                // claim now, released below if the bucket does not fit
+                map->table[position] = first[i];
+            }
+            if (i == size) break;
+            while (i-- > 0)
+                map->table[_position(map, hashes[first[i]], d)] = -1;
+        }
+        if (d == HASH_MAX_DISPLACEMENT) {
+            ERROR("tag map: cannot build the name index\n");
+            goto done;
+        }
+        map->displacement[bucket] = d;
+    }
+    status = 0;
+
+done:
+    free(order);
+    free(members);
+    free(bucketStart);
+    free(hashes);
+    return status;
+}
+
+/**
+ * @brief compile a configuration held in memory
+ *
+ * @param text configuration, see TagMap
+ * @param len length of text
+ * @return TagMap* the map, NULL if error
+ */
+TagMap* parseTagMap(const char* text, size_t len) {
+    if (text == NULL) {
+        ERROR("parseTagMap: invalid parameters\n");
+        return NULL;
+    }
+
+    int lines = 1;
+    for (const char* c = text; (c = memchr(c, '\n', text + len - c)) != NULL;
+         c++)
+        lines++;
+
+    TagMap* map = (TagMap*)calloc(1, sizeof(*map));
+    // staging, in file order, sorted into slots below
+    TagDecoder* decoders = (TagDecoder*)malloc(lines * sizeof(TagDecoder));
+    uint32_t* names = (uint32_t*)malloc(lines * sizeof(uint32_t));
+    uint64_t* keys = (uint64_t*)malloc(lines * sizeof(uint64_t));
+    if (map == NULL || decoders == NULL || names == NULL || keys == NULL) {
+        MALLOC_ERR;
+        goto fail;
+    }
+    map->deviceName = (uint32_t*)malloc(lines * sizeof(uint32_t));
+    map->deviceHost = (uint32_t*)malloc(lines * sizeof(uint32_t));
+    map->devicePort = (uint16_t*)malloc(lines * sizeof(uint16_t));
+    map->deviceUnit = (uint8_t*)malloc(lines * sizeof(uint8_t));
+    if (map->deviceName == NULL || map->deviceHost == NULL ||
+        map->devicePort == NULL || map->deviceUnit == NULL) {
+        MALLOC_ERR;
+        goto fail;
+    }
+
+    const char* line = text;
+    const char* end = text + len;
+    for (int number = 1; line < end; number++) {
+        const char* newline = memchr(line, '\n', end - line);
+        int lineLen = (newline ? newline : end) - line;
+        const char* comment = memchr(line, '#', lineLen);
+        if (comment != NULL) lineLen = comment - line;
+
+        Field fields[TAG_MAP_FIELDS];
+        int count = _split(line, lineLen, fields);
+        line = newline ? newline + 1 : end;
+        if (count == 0 || (count == 1 && fields[0].len == 0)) continue;
+
+        long port, unit, address;
+        if (_is(fields[0], "device")) {
+            int d = map->deviceCount;
+            if (count != 5 || fields[1].len == 0 ||
+                _number(fields[3], 0, 65535, &port) < 0 ||
+                _number(fields[4], 0, 255, &unit) < 0 ||
+                d == TAG_MAP_MAX_DEVICES) {
+                ERROR("tag map: invalid device at line %d\n", number);
+                goto fail;
+            }
+            int64_t name = _intern(map, -1, fields[1].text, fields[1].len);
+            int64_t host = _intern(map, -1, fields[2].text, fields[2].len);
+            if (name < 0 || host < 0) goto fail;
+
+            map->deviceName[d] = name;
+            map->deviceHost[d] = host;
+            map->devicePort[d] = (uint16_t)port;
+            map->deviceUnit[d] = (uint8_t)unit;
+            map->deviceCount++;
+        } else if (_is(fields[0], "tag")) {
+            int t = map->tagCount;
+            TagDecoder* decoder = &decoders[t];
+            memset(decoder, 0, sizeof(*decoder));
+            decoder->scale = 1;
+
+            if (map->deviceCount == 0 || count < 4 || count > 6 ||
+                fields[1].len == 0 ||
+                _number(fields[2], 0, 65535, &address) < 0 ||
+                _type(fields[3], decoder) < 0 ||
+                address + decoder->words > 65536 ||
+                (count > 4 && _real(fields[4], &decoder->scale) < 0) ||
+                (count > 5 && _real(fields[5], &decoder->offset) < 0)) {
+                ERROR("tag map: invalid tag at line %d\n", number);
+                goto fail;
+            }
+            decoder->address = (uint16_t)address;
+            decoder->device = map->deviceCount - 1;
+
+            int64_t name = _intern(map, map->deviceName[decoder->device],
+                                   fields[1].text, fields[1].len);
+            if (name < 0) goto fail;
+            names[t] = name;
+            keys[t] = ((uint64_t)decoder->device << 48) |
+                      ((uint64_t)decoder->address << 32) | (uint32_t)t;
+            map->tagCount++;
+        } else {
+            ERROR("tag map: unknown record at line %d\n", number);
+            goto fail;
+        }
+    }
+
+    // slots: by device, then address, then file order; tags already follow
+    // their device in the file, so only the run of each device is sorted
+    for (int start = 0, end; start < map->tagCount; start = end) {
+        for (end = start + 1;
+             end < map->tagCount && keys[end] >> 48 == keys[start] >> 48; end++)
+            ;
+        qsort(keys + start, end - start, sizeof(uint64_t), _compareKeys);
+    }
+
+    int tags = map->tagCount;
+    map->address = (uint16_t*)malloc((tags + 1) * sizeof(uint16_t));
+    map->decoder = (TagDecoder*)malloc((tags + 1) * sizeof(TagDecoder));
+    map->tagName = (uint32_t*)malloc((tags + 1) * sizeof(uint32_t));
+    map->deviceFirst =
+        (uint32_t*)calloc(map->deviceCount + 1, sizeof(uint32_t));
+    if (map->address == NULL || map->decoder == NULL ||
+        map->tagName == NULL || map->deviceFirst == NULL) {
+        MALLOC_ERR;
+        goto fail;
+    }
+    for (int slot = 0; slot < tags; slot++) {
+        uint32_t t = (uint32_t)keys[slot];
+        map->decoder[slot] = decoders[t];
+        map->address[slot] = decoders[t].address;
+        map->tagName[slot] = names[t];
+        map->deviceFirst[decoders[t].device + 1]++;
+    }
+    for (int d = 0; d < map->deviceCount; d++)
+        map->deviceFirst[d + 1] += map->deviceFirst[d];
+
+    if (_buildIndex(map) < 0) goto fail;
+
+    free(keys);
+    free(names);
+    free(decoders);
+    return map;
+
+fail:
+    free(keys);
+    free(names);
+    free(decoders);
+    freeTagMap(map);
+    return NULL;
+}
+
+/**
+ * @brief compile a configuration file
+ *
+ * @param path configuration file, see TagMap
+ * @return TagMap* the map, NULL if error
+ */
+TagMap* loadTagMap(const char* path) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        ERROR("cannot open tag map %s\n", path);
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return parseTagMap("", 0);
+    }
+
+    const char* text =
+        mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (text == MAP_FAILED) {
+        ERROR("cannot map tag map %s\n", path);
+        return NULL;
+    }
+
+    TagMap* map = parseTagMap(text, st.st_size);
+    munmap((void*)text, st.st_size);
+    return map;
+}
+
+/**
+ * @brief free a map
+ *
+ * @param map the map
+ */
+void freeTagMap(TagMap* map) {
+    if (map == NULL) return;
+
+    free(map->table);
+    free(map->displacement);
+    free(map->tagName);
+    free(map->decoder);
+    free(map->address);
+    free(map->deviceFirst);
+    free(map->deviceUnit);
+    free(map->devicePort);
+    free(map->deviceHost);
+    free(map->deviceName);
+    free(map->names);
+    free(map);
+}
+
+/**
+ * @brief number of devices
+ */
+int tagMapDevices(TagMap* map) { return map->deviceCount; }
+
+/**
+ * @brief number of tags, slots go from 0 to tagMapTags - 1
+ */
+int tagMapTags(TagMap* map) { return map->tagCount; }
+
+/**
+ * @brief describe a device
+ *
+ * @param map the map
+ * @param device device index
+ * @param out filled with the device, strings point into the map
+ * @return int 0 if success, -1 if the device does not exist
+ */
+int tagMapDevice(TagMap* map, int device, TagDevice* out) {
+    if (device < 0 || device >= map->deviceCount) return -1;
+
+    uint32_t first = map->deviceFirst[device];
+    uint32_t last = map->deviceFirst[device + 1];
+    out->name = map->names + map->deviceName[device];
+    out->host = map->names + map->deviceHost[device];
+    out->port = map->devicePort[device];
+    out->unit = map->deviceUnit[device];
+    out->firstSlot = first;
+    out->tagCount = last - first;
+    out->firstAddress = first < last ? map->address[first] : 0;
+
+    uint32_t endAddress = out->firstAddress;
+    for (uint32_t slot = first; slot < last; slot++) {
+        uint32_t tagEnd = map->address[slot] + map->decoder[slot].words;
+        if (tagEnd > endAddress) endAddress = tagEnd;
+    }
+    out->registerCount = endAddress - out->firstAddress;
+    return 0;
+}
+
+/**
+ * @brief slot of a tag
+ *
+ * @param map the map
+ * @param name "<device>.<tag>"
+ * @return int the slot, -1 if there is no such tag
+ */
+int tagMapFind(TagMap* map, const char* name) {
+    if (map->tagCount == 0) return -1;
+
+    uint64_t hash = _hash(name);
+    uint32_t displacement = map->displacement[hash % map->buckets];
+    int32_t slot = map->table[_position(map, hash, displacement)];
+    if (slot < 0 || strcmp(map->names + map->tagName[slot], name) != 0)
+        return -1;
+    return slot;
+}
+
+/**
+ * @brief first slot of a device whose tag starts at an address, by binary
+ * search of the device's address table
+ *
+ * @param map the map
+ * @param device device index
+ * @param address holding register
+ * @return int the slot, -1 if no tag of the device starts there
+ */
+int tagMapFindAddress(TagMap* map, int device, uint16_t address) {
+    if (device < 0 || device >= map->deviceCount) return -1;
+
+    uint32_t low = map->deviceFirst[device];
+    uint32_t high = map->deviceFirst[device + 1];
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (map->address[middle] < address)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    if (low == map->deviceFirst[device + 1] || map->address[low] != address)
+        return -1;
+    return low;
+}
+
+/**
+ * @brief full name of a tag
+ *
+ * @return const char* "<device>.<tag>", NULL if the slot does not exist
+ */
+const char* tagMapName(TagMap* map, int slot) {
+    if (slot < 0 || slot >= map->tagCount) return NULL;
+    return map->names + map->tagName[slot];
+}
+
+/**
+ * @brief decode descriptor of a tag
+ *
+ * @return const TagDecoder* the descriptor, NULL if the slot does not exist
+ */
+const TagDecoder* tagMapDecoder(TagMap* map, int slot) {
+    if (slot < 0 || slot >= map->tagCount) return NULL;
+    return &map->decoder[slot];
+}
+
+/**
+ * @brief value of a tag from a block of registers read from its device
+ *
+ * @param decoder descriptor of the tag
+ * @param registers values of the block, as returned by
+ * readHoldingRegistersInto
+ * @param firstAddress address of registers[0]
+ * @param count registers in the block
+ * @param value filled with raw * scale + offset
+ * @return int 0 if success, -1 if the block does not cover the tag
+ */
+int tagDecode(const TagDecoder* decoder, const uint16_t* registers,
+              uint16_t firstAddress, int count, double* value) {
+    int index = (int)decoder->address - firstAddress;
+    if (index < 0 || index + decoder->words > count) return -1;
+
+    const uint16_t* r = registers + index;
+    uint32_t raw32 = 0;
+    if (decoder->words == 2)
+        raw32 = decoder->wordSwap ? ((uint32_t)r[1] << 16) | r[0]
+                                  : ((uint32_t)r[0] << 16) | r[1];
+
+    double raw;
+    switch (decoder->type) {
+        case tagU16:
+            raw = r[0];
+            break;
+        case tagI16:
+            raw = (int16_t)r[0];
+            break;
+        case tagU32:
+            raw = raw32;
+            break;
+        case tagI32:
+            raw = (int32_t)raw32;
+            break;
+        case tagF32: {
+            float f;
+            memcpy(&f, &raw32, sizeof(f));
+            raw = f;
+            break;
+        }
+        default:
+            raw = (r[0] >> decoder->bit) & 1;
+            break;
+    }
+
+    *value = raw * decoder->scale + decoder->offset;
+    return 0;
+}
+
+#undef MALLOC_ERR
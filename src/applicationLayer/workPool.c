@@ -0,0 +1,368 @@
+#include "applicationLayer/workPool.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+
+#define MALLOC_ERR \
+    ERROR("malloc failed in %s: %s, %d\n", __func__, __FILE__, __LINE__)
+
+#define WORK_QUEUE_INITIAL 64
+
+typedef struct _workItem {
+    WorkFunction function;
+    void* argument;
+} WorkItem;
+
+/**
+ * @brief a worker thread and its job queue
+ *
+ * The queue is a ring: the owner takes the oldest job from the front,
+ * thieves take the newest from the back.
+ */
+typedef struct _worker {
+    pthread_t thread;
+    WorkPool* pool;
+    int index;
+    int cpu;  // -1 if not pinned
+    uint32_t seed;
+
+    pthread_mutex_t lock;  // protects the ring
+    WorkItem* items;
+    int capacity;
+    int head;
+    int count;
+
+    WorkStats stats;  // updated atomically
+} Worker;
+
+struct _workPool {
+    Worker* workers;
+    int count;
+    int started;  // workers whose thread is running
+    unsigned nextHome;  // round robin for jobs without a home, atomic
+    int queued;         // jobs waiting in any ring, atomic
+    int outstanding;    // jobs submitted and not finished, atomic
+    int sleepers;       // workers waiting for work, atomic
+
+    pthread_mutex_t idleLock;
+    pthread_cond_t workAvailable;
+    pthread_cond_t allDone;
+    int stopping;
+};
+
+// index of the worker running on this thread, -1 outside the pool
+static __thread int currentWorker = -1;
+
+static int _push(Worker* worker, WorkItem item) {
+    pthread_mutex_lock(&worker->lock);
+    if (worker->count == worker->capacity) {
+        int capacity = worker->capacity * 2;
+        WorkItem* items = (WorkItem*)malloc(capacity * sizeof(WorkItem));
+        if (items == NULL) {
+            pthread_mutex_unlock(&worker->lock);
+            MALLOC_ERR;
+            return -1;
+        }
+        for (int i = 0; i < worker->count; i++)
+            items[i] = worker->items[(worker->head + i) % worker->capacity];
+        free(worker->items);
+        worker->items = items;
+        worker->capacity = capacity;
+        worker->head = 0;
+    }
+
+    worker->items[(worker->head + worker->count) % worker->capacity] = item;
+    worker->count++;
+    pthread_mutex_unlock(&worker->lock);
+    return 0;
+}
+
+static int _popFront(Worker* worker, WorkItem* item) {
+    pthread_mutex_lock(&worker->lock);
+    if (worker->count == 0) {
+        pthread_mutex_unlock(&worker->lock);
+        return 0;
+    }
+
+    *item = worker->items[worker->head];
+    worker->head = (worker->head + 1) % worker->capacity;
+    worker->count--;
+    pthread_mutex_unlock(&worker->lock);
+    return 1;
+}
+
+static int _popBack(Worker* worker, WorkItem* item) {
+    // peek without the lock so empty victims cost nothing
+    if (__atomic_load_n(&worker->count, __ATOMIC_RELAXED) == 0) return 0;
+
+    pthread_mutex_lock(&worker->lock);
+    if (worker->count == 0) {
+        pthread_mutex_unlock(&worker->lock);
+        return 0;
+    }
+
+    worker->count--;
+    *item = worker->items[(worker->head + worker->count) % worker->capacity];
+    pthread_mutex_unlock(&worker->lock);
+    return 1;
+}
+
+/**
+ * @brief take a job from another worker, victims are visited from a random
+ * starting point so thieves do not all hit the same queue
+ */
+static int _steal(WorkPool* pool, Worker* thief, WorkItem* item) {
+    thief->seed ^= thief->seed << 13;
+    thief->seed ^= thief->seed >> 17;
+    thief->seed ^= thief->seed << 5;
+
+    int start = thief->seed % pool->count;
+    for (int i = 0; i < pool->count; i++) {
+        Worker* victim = &pool->workers[(start + i) % pool->count];
+        if (victim != thief && _popBack(victim, item)) return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief sleep until work is queued or the pool stops
+ *
+ * @return 0 to keep running, -1 to exit
+ */
+static int _idle(WorkPool* pool, Worker* worker) {
+    pthread_mutex_lock(&pool->idleLock);
+    __atomic_add_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&pool->queued, __ATOMIC_SEQ_CST) == 0 &&
+           !pool->stopping) {
+        __atomic_add_fetch(&worker->stats.idleWaits, 1, __ATOMIC_RELAXED);
+        pthread_cond_wait(&pool->workAvailable, &pool->idleLock);
+    }
+    __atomic_sub_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+    int exit = pool->stopping &&
+               __atomic_load_n(&pool->queued, __ATOMIC_SEQ_CST) == 0;
+    pthread_mutex_unlock(&pool->idleLock);
+    return exit ? -1 : 0;
+}
+
+static void* _workerLoop(void* argument) {
+    Worker* worker = (Worker*)argument;
+    WorkPool* pool = worker->pool;
+    currentWorker = worker->index;
+
+    if (worker->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(worker->cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+            ERROR("cannot pin worker %d to cpu %d\n", worker->index,
+                  worker->cpu);
+    }
+
+    for (;;) {
+        WorkItem item;
+        int stolen = 0;
+        if (!_popFront(worker, &item)) {
+            if (!_steal(pool, worker, &item)) {
+                if (_idle(pool, worker) < 0) break;
+                continue;
+            }
+            stolen = 1;
+        }
+        __atomic_sub_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+
+        item.function(item.argument);
+
+        __atomic_add_fetch(&worker->stats.executed, 1, __ATOMIC_RELAXED);
+        if (stolen)
+            __atomic_add_fetch(&worker->stats.stolen, 1, __ATOMIC_RELAXED);
+
+        if (__atomic_sub_fetch(&pool->outstanding, 1, __ATOMIC_SEQ_CST) == 0) {
+            pthread_mutex_lock(&pool->idleLock);
+            pthread_cond_broadcast(&pool->allDone);
+            pthread_mutex_unlock(&pool->idleLock);
+        }
+    }
+
+    currentWorker = -1;
+    return NULL;
+}
+
+/**
+ * @brief start a pool of worker threads
+ *
+ * @param workers number of workers, 1 to WORK_POOL_MAX_WORKERS
+ * @param cpus core of each worker, NULL to leave scheduling to the kernel
+ * @return WorkPool* the pool, NULL if error
+ */
+WorkPool* newWorkPool(int workers, const int* cpus) {
+    if (workers < 1 || workers > WORK_POOL_MAX_WORKERS) {
+        ERROR("newWorkPool: invalid parameters\n");
+        return NULL;
+    }
+
+    WorkPool* pool = (WorkPool*)calloc(1, sizeof(*pool));
+    if (pool == NULL) {
+        MALLOC_ERR;
+        return NULL;
+    }
+
+    pool->workers = (Worker*)calloc(workers, sizeof(Worker));
+    if (pool->workers == NULL) {
+        MALLOC_ERR;
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->idleLock, NULL);
+    pthread_cond_init(&pool->workAvailable, NULL);
+    pthread_cond_init(&pool->allDone, NULL);
+
+    // every queue exists before the first thief starts looking
+    pool->count = workers;
+    for (int i = 0; i < workers; i++) {
+        Worker* worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->index = i;
+        worker->cpu = cpus != NULL ? cpus[i] : -1;
+        worker->seed = 2654435761u * (i + 1);
+        worker->capacity = WORK_QUEUE_INITIAL;
+        worker->items = (WorkItem*)malloc(worker->capacity * sizeof(WorkItem));
+        pthread_mutex_init(&worker->lock, NULL);
+        if (worker->items == NULL) {
+            MALLOC_ERR;
+            freeWorkPool(pool);
+            return NULL;
+        }
+    }
+
+    for (int i = 0; i < workers; i++) {
+        if (pthread_create(&pool->workers[i].thread, NULL, _workerLoop,
+                           &pool->workers[i]) != 0) {
+            ERROR("cannot start worker %d\n", i);
+            freeWorkPool(pool);
+            return NULL;
+        }
+        pool->started = i + 1;
+    }
+
+    return pool;
+}
+
+/**
+ * @brief run the queued jobs, stop the workers and free the pool
+ *
+ * @param pool the pool
+ */
+void freeWorkPool(WorkPool* pool) {
+    if (pool == NULL) return;
+
+    pthread_mutex_lock(&pool->idleLock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->workAvailable);
+    pthread_mutex_unlock(&pool->idleLock);
+
+    for (int i = 0; i < pool->started; i++)
+        pthread_join(pool->workers[i].thread, NULL);
+    for (int i = 0; i < pool->count; i++) {
+        pthread_mutex_destroy(&pool->workers[i].lock);
+        free(pool->workers[i].items);
+    }
+
+    pthread_cond_destroy(&pool->allDone);
+    pthread_cond_destroy(&pool->workAvailable);
+    pthread_mutex_destroy(&pool->idleLock);
+    free(pool->workers);
+    free(pool);
+}
+
+/**
+ * @brief queue a job on its home worker
+ *
+ * @param pool the pool
+ * @param home worker index (taken modulo the worker count), e.g. the device
+ * number; -1 queues on the calling worker, or round robin from outside the
+ * pool
+ * @param function the job
+ * @param argument pointer passed to the job
+ * @return int 0 if success, -1 if error
+ */
+int workPoolSubmit(WorkPool* pool, int home, WorkFunction function,
+                   void* argument) {
+    if (pool == NULL || function == NULL) {
+        ERROR("workPoolSubmit: invalid parameters\n");
+        return -1;
+    }
+
+    // unsigned so the round robin counter wraps without going negative
+    unsigned slot =
+        home >= 0            ? (unsigned)home
+        : currentWorker >= 0 ? (unsigned)currentWorker
+                             : __atomic_fetch_add(&pool->nextHome, 1u,
+                                                  __ATOMIC_RELAXED);
+    Worker* worker = &pool->workers[slot % (unsigned)pool->count];
+
+    __atomic_add_fetch(&pool->outstanding, 1, __ATOMIC_SEQ_CST);
+    WorkItem item = {.function = function, .argument = argument};
+    if (_push(worker, item) < 0) {
+        __atomic_sub_fetch(&pool->outstanding, 1, __ATOMIC_SEQ_CST);
+        return -1;
+    }
+
+    // a sleeper registers before checking queued, so it cannot miss this
+    __atomic_add_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&pool->sleepers, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&pool->idleLock);
+        pthread_cond_signal(&pool->workAvailable);
+        pthread_mutex_unlock(&pool->idleLock);
+    }
+    return 0;
+}
+
+/**
+ * @brief wait until every submitted job has finished, including jobs
+ * submitted by jobs; must not be called from a worker
+ *
+ * @param pool the pool
+ */
+void workPoolWait(WorkPool* pool) {
+    pthread_mutex_lock(&pool->idleLock);
+    while (__atomic_load_n(&pool->outstanding, __ATOMIC_SEQ_CST) > 0)
+        pthread_cond_wait(&pool->allDone, &pool->idleLock);
+    pthread_mutex_unlock(&pool->idleLock);
+}
+
+/**
+ * @brief number of workers of the pool
+ */
+int workPoolWorkers(WorkPool* pool) { return pool->count; }
+
+/**
+ * @brief index of the worker running the calling thread
+ *
+ * @return int worker index, -1 if the caller is not a worker
+ */
+int workPoolCurrentWorker(void) { return currentWorker; }
+
+/**
+ * @brief activity counters of one worker
+ *
+ * @param pool the pool
+ * @param worker worker index
+ * @param stats filled with the counters
+ * @return int 0 if success, -1 if the worker does not exist
+ */
+int workPoolGetStats(WorkPool* pool, int worker, WorkStats* stats) {
+    if (pool == NULL || worker < 0 || worker >= pool->count) return -1;
+
+    WorkStats* source = &pool->workers[worker].stats;
+    stats->executed = __atomic_load_n(&source->executed, __ATOMIC_RELAXED);
+    stats->stolen = __atomic_load_n(&source->stolen, __ATOMIC_RELAXED);
+    stats->idleWaits = __atomic_load_n(&source->idleWaits, __ATOMIC_RELAXED);
+    return 0;
+}
+
+#undef MALLOC_ERR
@@ -4,27 +4,40 @@
 #include <string.h>
 
 #include "log.h"
+#include "transportLayer/modbusError.h"
+#include "transportLayer/slabPool.h"
 #include "transportLayer/tcpControl.h"
 
-#define MODBUS_MBAP_HEADER_SIZE 7
 #define MALLOC_ERR \
     ERROR("malloc failed in %s: %s, %d\n", __func__, __FILE__, __LINE__)
 
 /**
  * @brief create a modbus ADU instance
  *
+ * The ADU and room for the largest PDU come as one object from the calling
+ * thread's frame pool, so no allocation reaches malloc in steady state.
+ *
  * @param transactionID transaction identifier
  * @param protocolIdentifier protocol identifier (0 for Modbus/TCP)
  * @param unitIdentifier unit identifier (0 for Modbus/TCP)
- * @param pdu protocol data unit
+ * @param pdu protocol data unit (may be NULL to only reserve room for it)
  * @param pduLen protocol data unit length
- * @return modbusADU* pointer to the created modbus ADU
+ * @return modbusADU* pointer to the created modbus ADU, NULL if error, see
+ * modbusLastError
  */
 ModbusADU* _newModbusADU(uint16_t transactionID, uint16_t protocolIdentifier,
                          uint8_t unitIdentifier, uint8_t* pdu, int pduLen) {
-    ModbusADU* adu = (ModbusADU*)malloc(sizeof(ModbusADU));
+    if (pduLen > MODBUS_MAX_PDU_SIZE) {
+        modbusFail(modbusErrInvalid, "_newModbusADU: pdu too long: %d\n",
+                   pduLen);
+        return NULL;
+    }
+
+    SlabPool* pool = threadFramePool();
+    ModbusADU* adu = pool != NULL ? (ModbusADU*)slabAlloc(pool) : NULL;
     if (adu == NULL) {
         MALLOC_ERR;
+        modbusRecord(modbusErrNoMemory);
         return NULL;
     }
 
@@ -32,18 +45,9 @@ ModbusADU* _newModbusADU(uint16_t transactionID, uint16_t protocolIdentifier,
     adu->protocolIdentifier = protocolIdentifier;
     adu->length = pduLen + 1;  // +1 for unit identifier
     adu->unitIdentifier = unitIdentifier;
+    adu->pdu = (uint8_t*)(adu + 1);
 
-    if (pduLen <= 0 || pdu == NULL) {
-        adu->pdu = NULL;
-        return adu;
-    }
-
-    adu->pdu = (uint8_t*)malloc(pduLen);
-    if (adu->pdu == NULL) {
-        MALLOC_ERR;
-        return NULL;
-    }
-    memcpy(adu->pdu, pdu, pduLen);
+    if (pduLen > 0 && pdu != NULL) memcpy(adu->pdu, pdu, pduLen);
 
     return adu;
 }
@@ -55,14 +59,14 @@ ModbusADU* _newModbusADU(uint16_t transactionID, uint16_t protocolIdentifier,
  * @param pdu protocol data unit (function code + data, must be at least 1 byte)
  * @param pduLen protocol data unit length (must be at least 1)
  * @return modbusADU* pointer to the created modbus ADU
- *         NUll if error
+ *         NUll if error, see modbusLastError
  */
 ModbusADU* newModbusADU(uint16_t transactionID, uint8_t* pdu, int pduLen) {
     if (transactionID < 0 || pdu == NULL || pduLen <= 0) {
-        ERROR(
-            "newModbusADU: invalid parameters\n\ttransactionID: %d, pdu: %p, "
-            "pduLen: %d\n",
-            transactionID, pdu, pduLen);
+        modbusFail(modbusErrInvalid,
+                   "newModbusADU: invalid parameters\n\ttransactionID: %d, "
+                   "pdu: %p, pduLen: %d\n",
+                   transactionID, pdu, pduLen);
         return NULL;
     }
 
@@ -74,11 +78,109 @@ ModbusADU* newModbusADU(uint16_t transactionID, uint8_t* pdu, int pduLen) {
  *
  * @param adu pointer to the modbus ADU to free
  */
-void freeModbusADU(ModbusADU* adu) {
-    if (adu == NULL) return;
+void freeModbusADU(ModbusADU* adu) { slabFree(adu); }
+
+/**
+ * @brief write the MBAP header followed by the PDU of a modbus ADU into a
+ * frame buffer, ready to be sent through any transport
+ *
+ * @param adu modbus ADU to encode
+ * @param frame buffer to write the frame to
+ * @param frameLen size of the frame buffer
+ * @return encoded frame length if success, modbusErrInvalid if error
+ */
+int encodeModbusADU(ModbusADU* adu, uint8_t* frame, int frameLen) {
+    if (adu == NULL || frame == NULL) {
+        return modbusFail(modbusErrInvalid,
+                          "encodeModbusADU: invalid parameters\n");
+    }
+
+    // pdu length = adu->length - unit identifier
+    int pduLen = adu->length - 1;
+    if (MODBUS_MBAP_HEADER_SIZE + pduLen > frameLen) {
+        return modbusFail(modbusErrInvalid,
+                          "encodeModbusADU: frame buffer too small\n");
+    }
+
+    // create the MBAP header
+    frame[0] = (uint8_t)((adu->transactionID >> 8) & 0xFF);
+    frame[1] = (uint8_t)(adu->transactionID & 0xFF);
+    frame[2] = (uint8_t)((adu->protocolIdentifier >> 8) & 0xFF);
+    frame[3] = (uint8_t)(adu->protocolIdentifier & 0xFF);
+    frame[4] = (uint8_t)((adu->length >> 8) & 0xFF);
+    frame[5] = (uint8_t)(adu->length & 0xFF);
+    frame[6] = (uint8_t)(adu->unitIdentifier);
+
+    // the MBAP header is not included in the length field
+    memcpy(frame + MODBUS_MBAP_HEADER_SIZE, adu->pdu, pduLen);
+
+    return MODBUS_MBAP_HEADER_SIZE + pduLen;
+}
+
+/**
+ * @brief parse a MBAP header into the header fields of a modbus ADU
+ *
+ * @param header MODBUS_MBAP_HEADER_SIZE bytes
+ * @param adu filled with the header fields (pdu is left untouched)
+ * @return length of the PDU that follows, -1 if the length field is invalid
+ */
+int parseMBAPHeader(uint8_t* header, ModbusADU* adu) {
+    adu->transactionID = (uint16_t)((header[0] << 8) | header[1]);
+    adu->protocolIdentifier = (uint16_t)((header[2] << 8) | header[3]);
+    adu->length = (uint16_t)((header[4] << 8) | header[5]);
+    adu->unitIdentifier = header[6];
+
+    // pdu length = adu->length - unit identifier
+    int pduLen = adu->length - 1;
+    if (pduLen < 1 || pduLen > MODBUS_MAX_PDU_SIZE) return -1;
+
+    return pduLen;
+}
+
+/**
+ * @brief parse the frame at the start of a buffer without copying it, the
+ * ADU's pdu points into the buffer
+ *
+ * @param frame buffer holding one or more back to back frames
+ * @param frameLen number of valid bytes in the buffer
+ * @param adu filled with the parsed frame
+ * @return length of the parsed frame, 0 if the buffer holds only part of a
+ * frame, -1 if the frame is malformed
+ */
+int parseModbusADU(uint8_t* frame, int frameLen, ModbusADU* adu) {
+    if (frameLen < MODBUS_MBAP_HEADER_SIZE) return 0;
+
+    int pduLen = parseMBAPHeader(frame, adu);
+    if (pduLen < 0) return -1;
+    if (MODBUS_MBAP_HEADER_SIZE + pduLen > frameLen) return 0;
+
+    adu->pdu = frame + MODBUS_MBAP_HEADER_SIZE;
+    return MODBUS_MBAP_HEADER_SIZE + pduLen;
+}
+
+/**
+ * @brief parse a complete frame (MBAP header + PDU) into a modbus ADU
+ *
+ * @param frame buffer holding the frame
+ * @param frameLen number of valid bytes in the frame buffer
+ * @return modbusADU* pointer to the decoded modbus ADU, NULL if the frame is
+ * truncated or malformed, see modbusLastError
+ */
+ModbusADU* decodeModbusADU(uint8_t* frame, int frameLen) {
+    if (frame == NULL) {
+        modbusFail(modbusErrInvalid, "decodeModbusADU: invalid parameters\n");
+        return NULL;
+    }
+
+    ModbusADU parsed;
+    if (parseModbusADU(frame, frameLen, &parsed) <= 0) {
+        modbusFail(modbusErrMalformed, "decodeModbusADU: malformed frame\n");
+        return NULL;
+    }
 
-    free(adu->pdu);
-    free(adu);
+    return _newModbusADU(parsed.transactionID, parsed.protocolIdentifier,
+                         parsed.unitIdentifier, parsed.pdu,
+                         parsed.length - 1);
 }
 
 /**
@@ -86,97 +188,128 @@ void freeModbusADU(ModbusADU* adu) {
  *
  * @param socketfd socket file descriptor
  * @param adu modbus ADU to send
- * @return sent bytes if success, -1 if error
+ * @return sent bytes if success, a ModbusError if error
  */
 int sendModbusADU(int socketfd, ModbusADU* adu) {
     if (socketfd < 0 || adu == NULL) {
-        ERROR("sendModbusADU: invalid parameters\n");
-        return -1;
+        return modbusFail(modbusErrInvalid,
+                          "sendModbusADU: invalid parameters\n");
     }
 
-    // create the MBAP header
-    uint8_t mbapHeader[MODBUS_MBAP_HEADER_SIZE];
-    mbapHeader[0] = (uint8_t)((adu->transactionID >> 8) & 0xFF);
-    mbapHeader[1] = (uint8_t)(adu->transactionID & 0xFF);
-    mbapHeader[2] = (uint8_t)((adu->protocolIdentifier >> 8) & 0xFF);
-    mbapHeader[3] = (uint8_t)(adu->protocolIdentifier & 0xFF);
-    mbapHeader[4] = (uint8_t)((adu->length >> 8) & 0xFF);
-    mbapHeader[5] = (uint8_t)(adu->length & 0xFF);
-    mbapHeader[6] = (uint8_t)(adu->unitIdentifier);
-
-    // pdu length = adu->length - unit identifier
-    int pduLen = adu->length - 1;
-
     // concatenate the MBAP header and the PDU
-    // the MBAP header is not included in the length field
-    uint8_t* packet =
-        (uint8_t*)malloc((MODBUS_MBAP_HEADER_SIZE + pduLen) * sizeof(*packet));
-    if (packet == NULL) {
-        MALLOC_ERR;
-        return -1;
+    uint8_t packet[MODBUS_MAX_ADU_SIZE];
+    int packetLen = encodeModbusADU(adu, packet, sizeof(packet));
+    if (packetLen < 0) {
+        return packetLen;
     }
 
-    memcpy(packet, mbapHeader, MODBUS_MBAP_HEADER_SIZE);
-    memcpy(packet + MODBUS_MBAP_HEADER_SIZE, adu->pdu, pduLen);
-
     // send the packet
-    int sent = tcpSend(socketfd, packet, MODBUS_MBAP_HEADER_SIZE + pduLen);
+    int sent = tcpSend(socketfd, packet, packetLen);
     if (sent < 0) {
-        ERROR("Cannot send modbus ADU\n");
-        return -1;
+        return modbusFail(modbusErrorFromIO(sent, 1),
+                          "Cannot send modbus ADU\n");
     }
 
-    free(packet);
-
     return sent - MODBUS_MBAP_HEADER_SIZE;
 }
 
 /**
- * @brief receive a modbus ADU through TCP
+ * @brief read exactly len bytes, looping on short reads
  *
  * @param socketfd socket file descriptor
- * @return modbusADU* pointer to the received modbus ADU, NULL if error
+ * @param buffer buffer to fill
+ * @param len number of bytes to read
+ * @param started bytes of the frame already read before this call
+ * @return int len, or a ModbusError; a timeout once part of the frame was
+ * read is modbusErrMalformed since the stream is no longer in sync
  */
-ModbusADU* receiveModbusADU(int socketfd) {
-    if (socketfd < 0) {
-        ERROR("receiveModbusADU: invalid parameters\n");
-        return NULL;
+static int _receiveAll(int socketfd, uint8_t* buffer, int len, int started) {
+    int received = 0;
+    while (received < len) {
+        int n = tcpReceive(socketfd, buffer + received, len - received);
+        if (n <= 0) {
+            int code = modbusErrorFromIO(n, 0);
+            if (code == modbusErrTimeout && started + received > 0)
+                code = modbusErrMalformed;
+            return code;
+        }
+        received += n;
     }
+    return received;
+}
 
-    ModbusADU* adu = _newModbusADU(0, 0, 0, NULL, 0);
+/**
+ * @brief receive one frame through TCP: the MBAP header into adu and the
+ * PDU into a caller provided buffer
+ *
+ * The header and the PDU are each read in full. modbusErrTimeout means no
+ * byte of a new frame arrived and the stream is still in sync; a frame cut
+ * short by a timeout, or whose header does not parse, is reported as
+ * modbusErrMalformed and the stream is out of sync. A PDU longer than
+ * pduCap is read off the socket and dropped, so the next frame still
+ * lines up, and also reported as modbusErrMalformed.
+ *
+ * @param socketfd socket file descriptor
+ * @param adu filled with the header fields, adu->pdu is left untouched
+ * @param pdu buffer for the PDU
+ * @param pduCap size of the pdu buffer (MODBUS_MAX_PDU_SIZE always fits)
+ * @return int PDU length if success, a ModbusError if error
+ */
+int receiveModbusFrame(int socketfd, ModbusADU* adu, uint8_t* pdu,
+                       int pduCap) {
+    uint8_t header[MODBUS_MBAP_HEADER_SIZE];
+    int received = _receiveAll(socketfd, header, MODBUS_MBAP_HEADER_SIZE, 0);
+    if (received < 0) {
+        return modbusFail(received, "Cannot receive modbus ADU\n");
+    }
 
-    // receive the MBAP header
-    uint8_t mbapHeader[MODBUS_MBAP_HEADER_SIZE];
-    int received = tcpReceive(socketfd, mbapHeader, MODBUS_MBAP_HEADER_SIZE);
+    int pduLen = parseMBAPHeader(header, adu);
+    if (pduLen < 0) {
+        return modbusFail(modbusErrMalformed,
+                          "Invalid modbus ADU length: %d\n", adu->length);
+    }
+
+    // the pdu is always read so the stream stays aligned on frames
+    uint8_t scratch[MODBUS_MAX_PDU_SIZE];
+    uint8_t* target = pduLen <= pduCap ? pdu : scratch;
+    received = _receiveAll(socketfd, target, pduLen, MODBUS_MBAP_HEADER_SIZE);
     if (received < 0) {
-        ERROR("Cannot receive modbus ADU\n");
-        return NULL;
+        return modbusFail(received, "Cannot receive modbus data\n");
+    }
+    if (target == scratch) {
+        return modbusFail(modbusErrMalformed,
+                          "modbus pdu of %d bytes does not fit in %d\n",
+                          pduLen, pduCap);
     }
 
-    // parse the MBAP header
-    adu->transactionID = (uint16_t)((mbapHeader[0] << 8) | mbapHeader[1]);
-    adu->protocolIdentifier = (uint16_t)((mbapHeader[2] << 8) | mbapHeader[3]);
-    adu->length = (uint16_t)((mbapHeader[4] << 8) | mbapHeader[5]);
-    adu->unitIdentifier = mbapHeader[6];
+    return pduLen;
+}
 
-    // pdu length = adu->length - unit identifier
-    int pduLen = adu->length - 1;
+/**
+ * @brief receive a modbus ADU through TCP, see receiveModbusFrame
+ *
+ * @param socketfd socket file descriptor
+ * @return modbusADU* pointer to the received modbus ADU, NULL if error, see
+ * modbusLastError
+ */
+ModbusADU* receiveModbusADU(int socketfd) {
+    if (socketfd < 0) {
+        modbusFail(modbusErrInvalid, "receiveModbusADU: invalid parameters\n");
+        return NULL;
+    }
 
-    // receive the PDU
-    adu->pdu = (uint8_t*)malloc(pduLen);
-    if (adu->pdu == NULL) {
-        MALLOC_ERR;
+    ModbusADU* adu = _newModbusADU(0, 0, 0, NULL, 0);
+    if (adu == NULL) {
         return NULL;
     }
 
-    // receive the PDU (function code + data)
-    received = tcpReceive(socketfd, adu->pdu, pduLen);
-    if (received < 0) {
-        ERROR("Cannot receive modbus data\n");
+    // the PDU (function code + data) goes into the pooled frame
+    if (receiveModbusFrame(socketfd, adu, adu->pdu, MODBUS_MAX_PDU_SIZE) < 0) {
+        freeModbusADU(adu);
         return NULL;
     }
 
     return adu;
 }
 
-#undef MALOC_ERR
\ No newline at end of file
+#undef MALLOC_ERR
\ No newline at end of file
@@ -0,0 +1,234 @@
+#include "transportLayer/modbusError.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "log.h"
+
+/**
+ * @brief log budget of one error code
+ *
+ * Updated without locks: under contention a window may let a message or two
+ * more through, which is fine for logging.
+ */
+typedef struct _logWindow {
+    uint64_t startNs;
+    uint32_t logged;
+    uint64_t suppressed;
+} LogWindow;
+
+static __thread int lastError = modbusOk;
+
+// errors indexed by -code, exceptions by their code
+static uint64_t errorCounts[MODBUS_ERROR_CODES];
+static uint64_t exceptionCounts[256];
+static LogWindow windows[MODBUS_ERROR_CODES];
+
+static const char* errorNames[MODBUS_ERROR_CODES] = {
+    "ok",
+    "invalid argument",
+    "transaction id mismatch",
+    "timeout",
+    "connection closed",
+    "send failed",
+    "receive failed",
+    "malformed response",
+    "unit id mismatch",
+    "out of memory",
+    "connect failed",
+    "tls failed",
+    "rejected",
+    "cancelled",
+};
+
+static uint64_t _coarseNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @brief take one message from the budget of an error code, reporting how
+ * many were dropped when a new window starts
+ *
+ * @return int 1 if the message may be logged, 0 otherwise
+ */
+static int _allowLog(int index) {
+    LogWindow* window = &windows[index];
+    uint64_t now = _coarseNow();
+    uint64_t start = __atomic_load_n(&window->startNs, __ATOMIC_RELAXED);
+
+    if (now - start >= MODBUS_LOG_WINDOW_NS &&
+        __atomic_compare_exchange_n(&window->startNs, &start, now, 0,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&window->logged, 0, __ATOMIC_RELAXED);
+        uint64_t suppressed =
+            __atomic_exchange_n(&window->suppressed, 0, __ATOMIC_RELAXED);
+        if (suppressed > 0) {
+            ERROR("%lu more \"%s\" errors were not logged\n",
+                  (unsigned long)suppressed, errorNames[index]);
+        }
+    }
+
+    if (__atomic_add_fetch(&window->logged, 1, __ATOMIC_RELAXED) <=
+        MODBUS_LOG_BURST) {
+        return 1;
+    }
+    __atomic_add_fetch(&window->suppressed, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/**
+ * @brief count an outcome and make it the calling thread's last error,
+ * without logging; used for exceptions and for errors already logged
+ *
+ * @param code a ModbusError or an exception code
+ * @return int the code, so it can be returned directly
+ */
+int modbusRecord(int code) {
+    lastError = code;
+    if (code < 0 && code > -MODBUS_ERROR_CODES) {
+        __atomic_add_fetch(&errorCounts[-code], 1, __ATOMIC_RELAXED);
+    } else if (code > 0 && code < 256) {
+        __atomic_add_fetch(&exceptionCounts[code], 1, __ATOMIC_RELAXED);
+    }
+    return code;
+}
+
+/**
+ * @brief record an error and log it, unless its code already logged
+ * MODBUS_LOG_BURST messages in the current window
+ *
+ * The message is only formatted when it is logged, so a failure storm costs
+ * a counter increment per error.
+ *
+ * @param code a negative ModbusError
+ * @param format printf format of the message, NULL to only record
+ * @return int the code, so it can be returned directly
+ */
+int modbusFail(int code, const char* format, ...) {
+    modbusRecord(code);
+    if (format == NULL || code >= 0 || code <= -MODBUS_ERROR_CODES ||
+        !_allowLog(-code)) {
+        return code;
+    }
+
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "[ERROR] ");
+    vfprintf(stderr, format, args);
+    va_end(args);
+    return code;
+}
+
+/**
+ * @brief classify a failed send or receive from its result and errno
+ *
+ * @param result return of the send or receive, 0 for a receive means the
+ * peer closed the connection
+ * @param sending non zero for a send
+ * @return int the ModbusError, not recorded
+ */
+int modbusErrorFromIO(int result, int sending) {
+    if (result == 0 && !sending) return modbusErrClosed;
+
+    switch (errno) {
+        case EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+        case EWOULDBLOCK:
+#endif
+        case ETIMEDOUT:
+            return modbusErrTimeout;
+        case EPIPE:
+        case ECONNRESET:
+        case ENOTCONN:
+            return modbusErrClosed;
+        default:
+            return sending ? modbusErrSend : modbusErrReceive;
+    }
+}
+
+/**
+ * @brief outcome last recorded by the calling thread, for the functions
+ * that return NULL on error
+ *
+ * @return int a ModbusError or an exception code
+ */
+int modbusLastError(void) { return lastError; }
+
+/**
+ * @brief constant description of an outcome
+ *
+ * @param code a ModbusError or an exception code
+ * @return const char* the description, never NULL
+ */
+const char* modbusErrorName(int code) {
+    if (code <= 0 && code > -MODBUS_ERROR_CODES) return errorNames[-code];
+
+    switch (code) {
+        case MODBUS_ILLEGAL_FUNCTION:
+            return "illegal function";
+        case MODBUS_ILLEGAL_DATA_ADDRESS:
+            return "illegal data address";
+        case MODBUS_ILLEGAL_DATA_VALUE:
+            return "illegal data value";
+        case MODBUS_SERVER_DEVICE_FAILURE:
+            return "server device failure";
+        case MODBUS_ACKNOWLEDGE:
+            return "acknowledge";
+        case MODBUS_SERVER_DEVICE_BUSY:
+            return "server device busy";
+        case MODBUS_GATEWAY_PATH_UNAVAILABLE:
+            return "gateway path unavailable";
+        case MODBUS_GATEWAY_TARGET_FAILED:
+            return "gateway target failed to respond";
+        default:
+            return code > 0 && code < 256 ? "exception" : "unknown error";
+    }
+}
+
+/**
+ * @brief tell whether sending the same request again may succeed
+ *
+ * Lost or late responses and busy devices are worth a retry, after
+ * reconnecting for modbusErrClosed. Invalid requests, malformed responses
+ * and exceptions about the request itself are not.
+ *
+ * @param code a ModbusError or an exception code
+ * @return int 1 if retryable, 0 otherwise
+ */
+int modbusRetryable(int code) {
+    switch (code) {
+        case modbusErrIdMismatch:
+        case modbusErrTimeout:
+        case modbusErrClosed:
+        case modbusErrSend:
+        case modbusErrReceive:
+        case modbusErrUnitMismatch:
+        case MODBUS_ACKNOWLEDGE:
+        case MODBUS_SERVER_DEVICE_BUSY:
+        case MODBUS_GATEWAY_PATH_UNAVAILABLE:
+        case MODBUS_GATEWAY_TARGET_FAILED:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief number of times an outcome was recorded since start
+ *
+ * @param code a negative ModbusError or an exception code
+ * @return uint64_t the count, 0 for unknown codes
+ */
+uint64_t modbusErrorCount(int code) {
+    if (code < 0 && code > -MODBUS_ERROR_CODES) {
+        return __atomic_load_n(&errorCounts[-code], __ATOMIC_RELAXED);
+    }
+    if (code > 0 && code < 256) {
+        return __atomic_load_n(&exceptionCounts[code], __ATOMIC_RELAXED);
+    }
+    return 0;
+}
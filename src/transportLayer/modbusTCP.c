@@ -13,68 +13,159 @@
 
 #include "log.h"
 #include "transportLayer/dataPackaging.h"
+#include "transportLayer/modbusError.h"
 #include "transportLayer/tcpControl.h"
+#include "transportLayer/tlsControl.h"
 
 #define MALLOC_ERR \
     ERROR("malloc failed in %s: %s, %d\n", __func__, __FILE__, __LINE__)
 
 /**
- * @brief send a modbus Request
+ * @brief send a modbus Request to the default unit (UNIT_ID)
  *
  * @param socketfd socket file descriptor
  * @param id transaction identifier
  * @param pdu protocol data unit
  * @param pLen protocol data unit length
- * @return int sent bytes if success (< 0 if error)
+ * @return int sent bytes if success, a ModbusError if error
  */
 int modbusSend(int socketfd, uint16_t id, uint8_t* pdu, int pLen) {
-    ModbusADU* adu = newModbusADU(id, pdu, pLen);
-    if (adu == NULL) {
-        return -1;
+    return modbusSendUnit(socketfd, UNIT_ID, id, pdu, pLen);
+}
+
+/**
+ * @brief send a modbus Request to one unit, e.g. a slave behind a gateway
+ *
+ * @param socketfd socket file descriptor
+ * @param unit unit identifier
+ * @param id transaction identifier
+ * @param pdu protocol data unit
+ * @param pLen protocol data unit length
+ * @return int sent bytes if success, a ModbusError if error
+ */
+int modbusSendUnit(int socketfd, uint8_t unit, uint16_t id, uint8_t* pdu,
+                   int pLen) {
+    if (socketfd < 0 || pdu == NULL || pLen <= 0 ||
+        pLen > MODBUS_MAX_PDU_SIZE) {
+        return modbusFail(modbusErrInvalid, "modbusSend: invalid parameters\n");
+    }
+
+    // the frame is built on the stack, nothing is allocated per request
+    ModbusADU adu = {.transactionID = id,
+                     .protocolIdentifier = PROTOCOL_ID,
+                     .length = pLen + 1,
+                     .unitIdentifier = unit,
+                     .pdu = pdu};
+    uint8_t frame[MODBUS_MAX_ADU_SIZE];
+    int frameLen = encodeModbusADU(&adu, frame, sizeof(frame));
+
+    int sent = tcpSend(socketfd, frame, frameLen);
+    if (sent < 0) {
+        return modbusFail(modbusErrorFromIO(sent, 1),
+                          "Cannot send modbus ADU\n");
+    }
+
+    return sent - MODBUS_MBAP_HEADER_SIZE;
+}
+
+/**
+ * @brief send an already encoded modbus ADU
+ *
+ * @param socketfd socket file descriptor
+ * @param frame complete frame, MBAP header included
+ * @param frameLen frame length
+ * @return int sent bytes if success, a ModbusError if error
+ */
+int modbusSendFrame(int socketfd, uint8_t* frame, int frameLen) {
+    if (socketfd < 0 || frame == NULL || frameLen < MODBUS_MBAP_HEADER_SIZE ||
+        frameLen > MODBUS_MAX_ADU_SIZE) {
+        return modbusFail(modbusErrInvalid,
+                          "modbusSendFrame: invalid parameters\n");
+    }
+
+    int sent = tcpSend(socketfd, frame, frameLen);
+    if (sent < 0) {
+        return modbusFail(modbusErrorFromIO(sent, 1),
+                          "Cannot send modbus ADU\n");
     }
-    int sent = sendModbusADU(socketfd, adu);
-    freeModbusADU(adu);
+
     return sent;
 }
 
 /**
- * @brief receive a modbus Response
+ * @brief receive a modbus Response of the default unit (UNIT_ID) into a
+ * caller provided buffer
  *
  * @param socketfd socket file descriptor
- * @param pdu pointer to the pdu buffer (must be freed by the caller)
- * @return int pdu length if success, -1 if error, -2 id mismatch
+ * @param id expected transaction identifier
+ * @param pdu buffer for the response pdu
+ * @param pduCap size of the pdu buffer (MODBUS_MAX_PDU_SIZE always fits)
+ * @return int pdu length if success, a ModbusError if error
  */
-uint8_t* modbusReceive(int socketfd, uint16_t id, int* pduLen) {
-    ModbusADU* adu = receiveModbusADU(socketfd);
-    if (adu == NULL) {
-        return NULL;
+int modbusReceiveInto(int socketfd, uint16_t id, uint8_t* pdu, int pduCap) {
+    return modbusReceiveUnit(socketfd, UNIT_ID, id, pdu, pduCap);
+}
+
+/**
+ * @brief receive the modbus Response of one unit into a caller provided
+ * buffer
+ *
+ * @param socketfd socket file descriptor
+ * @param unit expected unit identifier
+ * @param id expected transaction identifier
+ * @param pdu buffer for the response pdu
+ * @param pduCap size of the pdu buffer (MODBUS_MAX_PDU_SIZE always fits)
+ * @return int pdu length if success, a ModbusError if error, e.g.
+ * modbusErrTimeout or modbusErrIdMismatch
+ */
+int modbusReceiveUnit(int socketfd, uint8_t unit, uint16_t id, uint8_t* pdu,
+                      int pduCap) {
+    ModbusADU adu;
+    int pduLen = receiveModbusFrame(socketfd, &adu, pdu, pduCap);
+    if (pduLen < 0) return pduLen;
+
+    if (adu.unitIdentifier != unit) {
+        return modbusFail(
+            modbusErrUnitMismatch,
+            "unit identifier mismatch\n\treceived: %d\n\texpected: %d\n",
+            adu.unitIdentifier, unit);
     }
 
-    if (adu->unitIdentifier != UNIT_ID) {
-        freeModbusADU(adu);
-        ERROR("unit identifier mismatch\n\treceived: %d\n\texpected: %d\n",
-              adu->unitIdentifier, UNIT_ID);
-        return NULL;
+    if (adu.transactionID != id) {
+        return modbusFail(
+            modbusErrIdMismatch,
+            "transaction id mismatch\n\treceived: %d\n\texpected: %d\n",
+            adu.transactionID, id);
     }
 
-    if (adu->transactionID != id) {
-        freeModbusADU(adu);
-        ERROR("transaction id mismatch\n\treceived: %d\n\texpected: %d\n",
-              adu->transactionID, id);
+    return pduLen;
+}
+
+/**
+ * @brief receive a modbus Response
+ *
+ * @param socketfd socket file descriptor
+ * @param id expected transaction identifier
+ * @param pduLen pointer to the pdu length
+ * @return uint8_t* pointer to the pdu buffer (must be freed by the caller),
+ * NULL if error, see modbusLastError
+ */
+uint8_t* modbusReceive(int socketfd, uint16_t id, int* pduLen) {
+    uint8_t buffer[MODBUS_MAX_PDU_SIZE];
+    int len = modbusReceiveInto(socketfd, id, buffer, sizeof(buffer));
+    if (len < 0) {
         return NULL;
     }
 
-    *pduLen = adu->length - 1;
-    uint8_t* pdu = (uint8_t*)malloc(*pduLen);
+    uint8_t* pdu = (uint8_t*)malloc(len);
     if (pdu == NULL) {
         MALLOC_ERR;
-        freeModbusADU(adu);
+        modbusRecord(modbusErrNoMemory);
         return NULL;
     }
 
-    memcpy(pdu, adu->pdu, *pduLen);
-    freeModbusADU(adu);
-
+    memcpy(pdu, buffer, len);
+    *pduLen = len;
     return pdu;
 }
 
@@ -85,20 +176,77 @@ uint8_t* modbusReceive(int socketfd, uint16_t id, int* pduLen) {
  * @param port server port - 502 for modbus
  * @param seconds connection timeout seconds
  * @param microseconds connection timeout microseconds
- * @return socket file descriptor if success, -1 if error
+ * @return socket file descriptor if success, a ModbusError if error
  */
 int modbusConnect(char* ip, int port, time_t seconds,
                   suseconds_t microseconds) {
+    return modbusConnectProfile(ip, port, seconds, microseconds, NULL);
+}
+
+/**
+ * @brief connect to a modbus server through TCP with tuned socket options
+ *
+ * @param ip server IP address
+ * @param port server port - 502 for modbus
+ * @param seconds connection timeout seconds
+ * @param microseconds connection timeout microseconds
+ * @param profile socket options, NULL for the system defaults
+ * @return socket file descriptor if success, modbusErrConnect if error
+ */
+int modbusConnectProfile(char* ip, int port, time_t seconds,
+                         suseconds_t microseconds, const TcpProfile* profile) {
     int socketfd = tcpOpenSocket(seconds, microseconds);
     if (socketfd < 0) {
-        ERROR("Cannot opening tcp socket: \n\tError code: %d\n", socketfd);
-        return -1;
+        return modbusFail(modbusErrConnect,
+                          "Cannot opening tcp socket: \n\tError code: %d\n",
+                          socketfd);
     }
 
-    int err = tcpConnect(socketfd, ip, port);
+    int err = tcpApplyProfile(socketfd, profile);
     if (err < 0) {
-        ERROR("Cannot connect to modbus tcp server: \n\tError code: %d\n", err);
-        return -1;
+        tcpCloseSocket(socketfd);
+        return modbusFail(
+            modbusErrConnect,
+            "Cannot apply tcp socket profile: \n\tError code: %d\n", err);
+    }
+
+    err = tcpConnect(socketfd, ip, port);
+    if (err < 0) {
+        tcpCloseSocket(socketfd);
+        return modbusFail(
+            modbusErrConnect,
+            "Cannot connect to modbus tcp server: \n\tError code: %d\n", err);
+    }
+
+    return socketfd;
+}
+
+/**
+ * @brief connect to a modbus server through Modbus/TCP Security
+ *
+ * tlsInit must have been called. The handshake resumes the previous session
+ * with the same server when possible, the socket is then used like any
+ * other modbus socket.
+ *
+ * @param ip server IP address
+ * @param port server port - 802 for modbus over TLS
+ * @param seconds connection timeout seconds
+ * @param microseconds connection timeout microseconds
+ * @return socket file descriptor if success, modbusErrConnect or
+ * modbusErrTLS if error
+ */
+int modbusConnectTLS(char* ip, int port, time_t seconds,
+                     suseconds_t microseconds) {
+    int socketfd = modbusConnect(ip, port, seconds, microseconds);
+    if (socketfd < 0) return socketfd;
+
+    char peer[TLS_PEER_LEN];
+    snprintf(peer, sizeof(peer), "%s:%d", ip, port);
+    if (tlsAttach(socketfd, peer) < 0) {
+        tcpCloseSocket(socketfd);
+        return modbusFail(modbusErrTLS,
+                          "Cannot establish TLS with modbus server %s\n",
+                          peer);
     }
 
     return socketfd;
@@ -0,0 +1,256 @@
+#include "transportLayer/modbusUDP.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include "log.h"
+#include "transportLayer/modbusError.h"
+#include "transportLayer/udpControl.h"
+
+#define MALLOC_ERR \
+    ERROR("malloc failed in %s: %s, %d\n", __func__, __FILE__, __LINE__)
+
+/**
+ * @brief open the UDP socket used to reach every device of a batch
+ *
+ * @return socket file descriptor if success, -1 if error
+ */
+int modbusUdpOpen(void) {
+    int socketfd = udpOpenSocket();
+    if (socketfd < 0) {
+        ERROR("Cannot open udp socket: \n\tError code: %d\n", socketfd);
+        return -1;
+    }
+    return socketfd;
+}
+
+/**
+ * @brief close the UDP socket
+ *
+ * @param socketfd socket file descriptor
+ * @return 0 if success, -1 if error
+ */
+int modbusUdpClose(int socketfd) { return udpCloseSocket(socketfd); }
+
+static long _elapsedMs(struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 +
+           (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+static unsigned _slot(uint16_t id, struct sockaddr_in* address,
+                      unsigned mask) {
+    uint32_t key = ((uint32_t)id << 16) ^ address->sin_addr.s_addr ^
+                   address->sin_port;
+    return (key * 2654435761u) & mask;
+}
+
+/**
+ * @brief find the pending request a response belongs to
+ *
+ * @return index of the request, -1 if the response is unknown
+ */
+static int _lookup(int* index, unsigned mask, ModbusUdpRequest* requests,
+                   uint16_t id, struct sockaddr_in* source) {
+    for (unsigned s = _slot(id, source, mask); index[s] != 0;
+         s = (s + 1) & mask) {
+        ModbusUdpRequest* r = &requests[index[s] - 1];
+        if (r->id == id && r->server.sin_port == source->sin_port &&
+            r->server.sin_addr.s_addr == source->sin_addr.s_addr)
+            return index[s] - 1;
+    }
+    return -1;
+}
+
+/**
+ * @brief send every pending request, MODBUS_UDP_BATCH datagrams per syscall
+ *
+ * @return number of requests that could not be encoded, which are failed
+ * and never sent, or a ModbusError if error
+ */
+static int _sendPending(int socketfd, ModbusUdpRequest* requests, int count) {
+    uint8_t frames[MODBUS_UDP_BATCH][MODBUS_MAX_ADU_SIZE];
+    struct iovec iov[MODBUS_UDP_BATCH];
+    struct mmsghdr messages[MODBUS_UDP_BATCH];
+
+    int batched = 0;
+    int failed = 0;
+    for (int i = 0; i < count; i++) {
+        ModbusUdpRequest* r = &requests[i];
+        if (r->responseLen != 0) continue;
+
+        // same MBAP encoding as the TCP transport
+        ModbusADU adu = {.transactionID = r->id,
+                         .protocolIdentifier = PROTOCOL_ID,
+                         .length = r->pduLen + 1,
+                         .unitIdentifier = UNIT_ID,
+                         .pdu = r->pdu};
+        int frameLen =
+            encodeModbusADU(&adu, frames[batched], MODBUS_MAX_ADU_SIZE);
+        if (frameLen < 0) {
+            r->responseLen = frameLen;
+            failed++;
+            continue;
+        }
+
+        iov[batched].iov_base = frames[batched];
+        iov[batched].iov_len = frameLen;
+        memset(&messages[batched], 0, sizeof(messages[batched]));
+        messages[batched].msg_hdr.msg_name = &r->server;
+        messages[batched].msg_hdr.msg_namelen = sizeof(r->server);
+        messages[batched].msg_hdr.msg_iov = &iov[batched];
+        messages[batched].msg_hdr.msg_iovlen = 1;
+
+        if (++batched == MODBUS_UDP_BATCH) {
+            if (udpSendBatch(socketfd, messages, batched) < 0)
+                return modbusErrorFromIO(-1, 1);
+            batched = 0;
+        }
+    }
+
+    if (batched > 0 && udpSendBatch(socketfd, messages, batched) < 0)
+        return modbusErrorFromIO(-1, 1);
+
+    return failed;
+}
+
+/**
+ * @brief receive responses until every request is answered or the timeout
+ * expires
+ *
+ * @return number of requests answered, a ModbusError if error
+ */
+static int _receivePending(int socketfd, ModbusUdpRequest* requests,
+                           int* index, unsigned mask, int pending,
+                           int timeoutMs) {
+    uint8_t frames[MODBUS_UDP_BATCH][MODBUS_MAX_ADU_SIZE];
+    struct sockaddr_in sources[MODBUS_UDP_BATCH];
+    struct iovec iov[MODBUS_UDP_BATCH];
+    struct mmsghdr messages[MODBUS_UDP_BATCH];
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int answered = 0;
+    long remaining = timeoutMs;
+    while (answered < pending && remaining > 0) {
+        for (int i = 0; i < MODBUS_UDP_BATCH; i++) {
+            iov[i].iov_base = frames[i];
+            iov[i].iov_len = MODBUS_MAX_ADU_SIZE;
+            memset(&messages[i], 0, sizeof(messages[i]));
+            messages[i].msg_hdr.msg_name = &sources[i];
+            messages[i].msg_hdr.msg_namelen = sizeof(sources[i]);
+            messages[i].msg_hdr.msg_iov = &iov[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int received =
+            udpReceiveBatch(socketfd, messages, MODBUS_UDP_BATCH, remaining);
+        if (received < 0) return modbusErrorFromIO(-1, 0);
+
+        for (int i = 0; i < received; i++) {
+            ModbusADU adu;
+            if (parseModbusADU(frames[i], messages[i].msg_len, &adu) <= 0)
+                continue;
+
+            int r = _lookup(index, mask, requests, adu.transactionID,
+                            &sources[i]);
+            // late duplicates of an already answered retry are dropped
+            if (r >= 0 && requests[r].responseLen == 0 &&
+                adu.unitIdentifier == UNIT_ID) {
+                requests[r].responseLen = adu.length - 1;
+                memcpy(requests[r].response, adu.pdu, adu.length - 1);
+                answered++;
+            } else {
+                LOG("dropping unexpected udp response, id: %d\n",
+                    adu.transactionID);
+            }
+        }
+
+        remaining = timeoutMs - _elapsedMs(&start);
+    }
+
+    return answered;
+}
+
+/**
+ * @brief send a batch of requests, possibly to many devices, and collect
+ * their responses
+ *
+ * Requests that stay unanswered for timeoutMs are resent with the same
+ * transaction identifier, up to retries times, so a response to any attempt
+ * completes the request.
+ *
+ * @param socketfd socket file descriptor
+ * @param requests requests to send, responses are written back into them
+ * @param count number of requests
+ * @param retries number of retransmissions of unanswered requests
+ * @param timeoutMs time to wait for responses after each transmission
+ * @return number of answered requests if success, a ModbusError if error;
+ * unanswered requests get the ModbusError that ended them in responseLen
+ */
+int modbusUdpTransact(int socketfd, ModbusUdpRequest* requests, int count,
+                      int retries, int timeoutMs) {
+    if (socketfd < 0 || requests == NULL || count <= 0) {
+        return modbusFail(modbusErrInvalid,
+                          "modbusUdpTransact: invalid parameters\n");
+    }
+
+    // open addressing index over (transaction id, device address)
+    unsigned size = 1;
+    while (size < (unsigned)count * 2) size <<= 1;
+    int* index = (int*)calloc(size, sizeof(*index));
+    if (index == NULL) {
+        MALLOC_ERR;
+        return modbusRecord(modbusErrNoMemory);
+    }
+
+    for (int i = 0; i < count; i++) {
+        requests[i].responseLen = 0;
+        unsigned s = _slot(requests[i].id, &requests[i].server, size - 1);
+        while (index[s] != 0) s = (s + 1) & (size - 1);
+        index[s] = i + 1;
+    }
+
+    int answered = 0;
+    int unsendable = 0;  // requests that failed to encode, never answered
+    int failure = modbusErrTimeout;
+    for (int attempt = 0; attempt <= retries && answered + unsendable < count;
+         attempt++) {
+        if (attempt > 0)
+            LOG("udp retry %d, %d requests pending\n", attempt,
+                count - answered - unsendable);
+
+        int err = _sendPending(socketfd, requests, count);
+        if (err < 0) {
+            failure = modbusFail(err, "Cannot send modbus udp batch\n");
+            break;
+        }
+        unsendable += err;
+        if (answered + unsendable == count) break;
+
+        int n = _receivePending(socketfd, requests, index, size - 1,
+                                count - answered - unsendable, timeoutMs);
+        if (n < 0) {
+            failure = modbusFail(n, "Cannot receive modbus udp batch\n");
+            break;
+        }
+        answered += n;
+    }
+
+    // one timeout per request left unanswered, socket failures were
+    // recorded above
+    for (int i = 0; i < count; i++) {
+        if (requests[i].responseLen != 0) continue;
+        requests[i].responseLen = failure;
+        if (failure == modbusErrTimeout) modbusRecord(modbusErrTimeout);
+    }
+
+    free(index);
+    return answered;
+}
+
+#undef MALLOC_ERR
@@ -0,0 +1,200 @@
+#include "transportLayer/slabPool.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "transportLayer/dataPackaging.h"
+
+#define MALLOC_ERR \
+    ERROR("malloc failed in %s: %s, %d\n", __func__, __FILE__, __LINE__)
+
+// every object is preceded by a header naming its pool, padded so that
+// objects stay 16 byte aligned
+#define SLAB_HEADER_SIZE 16
+
+typedef struct _slabObject {
+    SlabPool* pool;
+    struct _slabObject* next;  // free list link, only while free
+} SlabObject;
+
+struct _slabPool {
+    size_t objectSize;
+    size_t stride;
+    int objectsPerSlab;
+    pthread_t owner;
+
+    SlabObject* freeList;     // owner only
+    SlabObject* remoteFree;   // pushed by other threads, atomically
+
+    void** slabs;
+    int slabCount;
+    int slabCapacity;
+
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t remoteFrees;  // atomic
+    uint64_t peakInUse;
+};
+
+/**
+ * @brief create a pool owned by the calling thread
+ *
+ * @param objectSize size of each object
+ * @param objectsPerSlab objects obtained per malloc
+ * @return SlabPool* the pool, NULL if error
+ */
+SlabPool* newSlabPool(size_t objectSize, int objectsPerSlab) {
+    if (objectSize == 0 || objectsPerSlab <= 0) {
+        ERROR("newSlabPool: invalid parameters\n");
+        return NULL;
+    }
+
+    SlabPool* pool = (SlabPool*)calloc(1, sizeof(*pool));
+    if (pool == NULL) {
+        MALLOC_ERR;
+        return NULL;
+    }
+
+    pool->objectSize = objectSize;
+    pool->stride = SLAB_HEADER_SIZE + ((objectSize + 15) & ~(size_t)15);
+    pool->objectsPerSlab = objectsPerSlab;
+    pool->owner = pthread_self();
+
+    return pool;
+}
+
+/**
+ * @brief release every slab of a pool, objects still allocated become
+ * invalid
+ *
+ * @param pool the pool
+ */
+void freeSlabPool(SlabPool* pool) {
+    if (pool == NULL) return;
+
+    for (int i = 0; i < pool->slabCount; i++) free(pool->slabs[i]);
+    free(pool->slabs);
+    free(pool);
+}
+
+static int _grow(SlabPool* pool) {
+    if (pool->slabCount == pool->slabCapacity) {
+        int capacity = pool->slabCapacity ? pool->slabCapacity * 2 : 8;
+        void** slabs = (void**)realloc(pool->slabs, capacity * sizeof(*slabs));
+        if (slabs == NULL) {
+            MALLOC_ERR;
+            return -1;
+        }
+        pool->slabs = slabs;
+        pool->slabCapacity = capacity;
+    }
+
+    uint8_t* slab = (uint8_t*)aligned_alloc(
+        16, pool->stride * pool->objectsPerSlab);
+    if (slab == NULL) {
+        MALLOC_ERR;
+        return -1;
+    }
+    pool->slabs[pool->slabCount++] = slab;
+
+    for (int i = pool->objectsPerSlab - 1; i >= 0; i--) {
+        SlabObject* object = (SlabObject*)(slab + i * pool->stride);
+        object->pool = pool;
+        object->next = pool->freeList;
+        pool->freeList = object;
+    }
+    return 0;
+}
+
+/**
+ * @brief take an object from the pool
+ *
+ * @param pool the pool
+ * @return void* the object (pool->objectSize bytes), NULL if out of memory
+ */
+void* slabAlloc(SlabPool* pool) {
+    if (pool->freeList == NULL) {
+        // adopt everything other threads gave back before growing
+        pool->freeList =
+            __atomic_exchange_n(&pool->remoteFree, NULL, __ATOMIC_ACQUIRE);
+        if (pool->freeList == NULL && _grow(pool) < 0) return NULL;
+    }
+
+    SlabObject* object = pool->freeList;
+    pool->freeList = object->next;
+
+    pool->allocs++;
+    uint64_t inUse = pool->allocs - pool->frees -
+                     __atomic_load_n(&pool->remoteFrees, __ATOMIC_RELAXED);
+    if (inUse > pool->peakInUse) pool->peakInUse = inUse;
+
+    return (uint8_t*)object + SLAB_HEADER_SIZE;
+}
+
+/**
+ * @brief give an object back to the pool it came from, from any thread
+ *
+ * @param object object returned by slabAlloc (NULL is ignored)
+ */
+void slabFree(void* object) {
+    if (object == NULL) return;
+
+    SlabObject* header = (SlabObject*)((uint8_t*)object - SLAB_HEADER_SIZE);
+    SlabPool* pool = header->pool;
+
+    if (pthread_equal(pool->owner, pthread_self())) {
+        header->next = pool->freeList;
+        pool->freeList = header;
+        pool->frees++;
+        return;
+    }
+
+    // lock free push, the owner takes the whole list at once
+    header->next = __atomic_load_n(&pool->remoteFree, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&pool->remoteFree, &header->next,
+                                        header, 1, __ATOMIC_RELEASE,
+                                        __ATOMIC_RELAXED))
+        ;
+    __atomic_add_fetch(&pool->remoteFrees, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief read the statistics of a pool
+ *
+ * @param pool the pool
+ * @param stats filled with the statistics
+ */
+void slabGetStats(SlabPool* pool, SlabStats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (pool == NULL) return;
+
+    uint64_t remote = __atomic_load_n(&pool->remoteFrees, __ATOMIC_RELAXED);
+    stats->objectSize = pool->objectSize;
+    stats->slabs = pool->slabCount;
+    stats->capacity = (uint64_t)pool->slabCount * pool->objectsPerSlab;
+    stats->allocs = pool->allocs;
+    stats->frees = pool->frees + remote;
+    stats->remoteFrees = remote;
+    stats->inUse = stats->allocs - stats->frees;
+    stats->peakInUse = pool->peakInUse;
+}
+
+// frame pools are per thread and live as long as the process, since frames
+// may still be in use by other threads when their allocating thread exits
+static __thread SlabPool* framePool = NULL;
+
+/**
+ * @brief pool of the calling thread for modbus frames (ADU + largest PDU)
+ *
+ * @return SlabPool* the pool, NULL if out of memory
+ */
+SlabPool* threadFramePool(void) {
+    if (framePool == NULL)
+        framePool = newSlabPool(sizeof(ModbusADU) + MODBUS_MAX_PDU_SIZE,
+                                SLAB_OBJECTS_PER_SLAB);
+    return framePool;
+}
+
+#undef MALLOC_ERR
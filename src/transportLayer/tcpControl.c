@@ -3,6 +3,8 @@
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/socket.h>
@@ -11,6 +13,76 @@
 #include <unistd.h>
 
 #include "log.h"
+#include "transportLayer/tlsControl.h"
+#include "transportLayer/uringControl.h"
+
+#define URING_ENTRIES 256
+#define TCP_MAX_SOCKETS 65536
+
+const TcpProfile tcpDefaultProfile = {0};
+
+const TcpProfile tcpLowLatencyProfile = {
+    .noDelay = 1,
+    .quickAck = 1,
+    .keepIdle = 10,
+    .keepInterval = 2,
+    .keepCount = 3,
+    .userTimeoutMs = 10000,
+    .busyPollUs = 50,
+};
+
+// sockets whose TCP_QUICKACK is renewed after each receive, one bit each
+static uint64_t quickAckSockets[TCP_MAX_SOCKETS / 64];
+
+// backend state is per thread, each thread drives its own ring
+static __thread TcpBackend backend = tcpBlockingBackend;
+static __thread UringContext* ring = NULL;
+static __thread long syscalls = 0;
+
+/**
+ * @brief select the transport backend of the calling thread
+ *
+ * Falls back to the blocking backend if io_uring is not available.
+ *
+ * @param requested backend to use
+ * @return the backend in effect after the call
+ */
+TcpBackend tcpSelectBackend(TcpBackend requested) {
+    if (requested == tcpUringBackend && ring == NULL) {
+        ring = uringNew(URING_ENTRIES);
+        if (ring == NULL) {
+            INFO("io_uring not available, using blocking sockets\n");
+            requested = tcpBlockingBackend;
+        }
+    }
+
+    if (requested == tcpBlockingBackend && ring != NULL) {
+        // submit any queued sends before leaving the ring
+        uringFlush(ring);
+        syscalls += uringSyscalls(ring);
+        uringFree(ring);
+        ring = NULL;
+    }
+
+    backend = requested;
+    return backend;
+}
+
+/**
+ * @brief backend in effect for the calling thread
+ *
+ * @return TcpBackend
+ */
+TcpBackend tcpCurrentBackend(void) { return backend; }
+
+/**
+ * @brief number of send/receive syscalls issued by the calling thread
+ *
+ * @return long syscall count
+ */
+long tcpSyscallCount(void) {
+    return syscalls + (ring != NULL ? uringSyscalls(ring) : 0);
+}
 
 /**
  * @brief create a TCP socket and set timeout and keepalive options
@@ -42,6 +114,67 @@ int tcpOpenSocket(time_t seconds, suseconds_t microseconds) {
     return socketfd;
 }
 
+static int _quickAck(int socketfd) {
+    if (socketfd < 0 || socketfd >= TCP_MAX_SOCKETS) return 0;
+    uint64_t word =
+        __atomic_load_n(&quickAckSockets[socketfd / 64], __ATOMIC_RELAXED);
+    return (word >> (socketfd % 64)) & 1;
+}
+
+static void _setQuickAck(int socketfd, int on) {
+    if (socketfd < 0 || socketfd >= TCP_MAX_SOCKETS) return;
+    uint64_t bit = (uint64_t)1 << (socketfd % 64);
+    if (on)
+        __atomic_or_fetch(&quickAckSockets[socketfd / 64], bit,
+                          __ATOMIC_RELAXED);
+    else
+        __atomic_and_fetch(&quickAckSockets[socketfd / 64], ~bit,
+                           __ATOMIC_RELAXED);
+}
+
+static int _setInt(int socketfd, int level, int option, int value) {
+    return setsockopt(socketfd, level, option, &value, sizeof(value));
+}
+
+/**
+ * @brief apply a socket profile, before tcpConnect so buffer sizes take part
+ * in the window negotiation
+ *
+ * @param socketfd socket file descriptor
+ * @param profile options to set, NULL for tcpDefaultProfile
+ * @return 0 if success, -2 if error setting an option
+ */
+int tcpApplyProfile(int socketfd, const TcpProfile* profile) {
+    if (profile == NULL) profile = &tcpDefaultProfile;
+
+    if ((profile->noDelay &&
+         _setInt(socketfd, IPPROTO_TCP, TCP_NODELAY, 1) < 0) ||
+        (profile->quickAck &&
+         _setInt(socketfd, IPPROTO_TCP, TCP_QUICKACK, 1) < 0) ||
+        (profile->keepIdle > 0 &&
+         _setInt(socketfd, IPPROTO_TCP, TCP_KEEPIDLE, profile->keepIdle) < 0) ||
+        (profile->keepInterval > 0 &&
+         _setInt(socketfd, IPPROTO_TCP, TCP_KEEPINTVL, profile->keepInterval) <
+             0) ||
+        (profile->keepCount > 0 &&
+         _setInt(socketfd, IPPROTO_TCP, TCP_KEEPCNT, profile->keepCount) < 0) ||
+        (profile->userTimeoutMs > 0 &&
+         _setInt(socketfd, IPPROTO_TCP, TCP_USER_TIMEOUT,
+                 (int)profile->userTimeoutMs) < 0) ||
+        (profile->sendBuffer > 0 &&
+         _setInt(socketfd, SOL_SOCKET, SO_SNDBUF, profile->sendBuffer) < 0) ||
+        (profile->receiveBuffer > 0 &&
+         _setInt(socketfd, SOL_SOCKET, SO_RCVBUF, profile->receiveBuffer) < 0))
+        return -2;
+
+    if (profile->busyPollUs > 0 &&
+        _setInt(socketfd, SOL_SOCKET, SO_BUSY_POLL, profile->busyPollUs) < 0)
+        INFO("busy polling not permitted, skipped\n");
+
+    _setQuickAck(socketfd, profile->quickAck);
+    return 0;
+}
+
 /**
  * @brief close a TCP socket
  *
@@ -49,6 +182,10 @@ int tcpOpenSocket(time_t seconds, suseconds_t microseconds) {
  * @return 0 if success, -1 if error
  */
 int tcpCloseSocket(int socketfd) {
+    tlsDetach(socketfd);
+    _setQuickAck(socketfd, 0);
+    if (ring != NULL)
+        uringForget(ring, socketfd);
     return close(socketfd);
 }
 
@@ -77,16 +214,24 @@ int tcpConnect(int socketfd, char* ipString, int port) {
 /**
  * @brief send a packet through a TCP socket
  *
+ * Sockets attached to TLS (see tlsAttach) always use blocking I/O.
+ *
  * @param socketfd socket file descriptor
  * @param packet packet to send
  * @param pLen packet length
  * @return n bytes sent if success, -1 if error
  */
 int tcpSend(int socketfd, uint8_t* packet, int pLen) {
+    if (tlsActive(socketfd))
+        return tlsSend(socketfd, packet, pLen);
+    if (backend == tcpUringBackend)
+        return uringSend(ring, socketfd, packet, pLen);
+
     int sent = 0;
     int n = 0;
     while (sent < pLen) {
-        n = send(socketfd, packet + sent, pLen - sent, 0);
+        syscalls++;
+        n = send(socketfd, packet + sent, pLen - sent, MSG_NOSIGNAL);
         if (n < 0) {
             return -1;
         }
@@ -101,16 +246,61 @@ int tcpSend(int socketfd, uint8_t* packet, int pLen) {
  * @param socketfd socket file descriptor
  * @param packet packet to receive
  * @param pLen packet length
- * @return n bytes received if success, -1 if error
+ * @return n bytes received if success, -1 if error with errno set; not
+ * logged here, the caller knows whether a timeout is an error
  */
 int tcpReceive(int socketfd, uint8_t* packet, int pLen) {
     int received = 0;
 
-    received = recv(socketfd, packet, pLen, 0);
-    if (received < 0) {
-        ERROR("invalid packet\n");
-        return -1;
+    if (tlsActive(socketfd)) {
+        received = tlsReceive(socketfd, packet, pLen);
+    } else if (backend == tcpUringBackend) {
+        received = uringReceive(ring, socketfd, packet, pLen);
+    } else {
+        syscalls++;
+        received = recv(socketfd, packet, pLen, 0);
+    }
+    if (received < 0) return -1;
+
+    // the kernel falls back to delayed ACKs, ask again for the next response
+    if (received > 0 && _quickAck(socketfd)) {
+        syscalls++;
+        _setInt(socketfd, IPPROTO_TCP, TCP_QUICKACK, 1);
     }
 
     return received;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief gather the following sends of a socket until tcpUncork
+ *
+ * Only TLS sockets gather, so pipelined requests share records; callers of
+ * plain sockets already coalesce their frames before tcpSend.
+ *
+ * @param socketfd socket file descriptor
+ */
+void tcpCork(int socketfd) {
+    if (tlsActive(socketfd))
+        tlsCork(socketfd);
+}
+
+/**
+ * @brief send what was gathered since tcpCork
+ *
+ * @param socketfd socket file descriptor
+ * @return 0 if success, -1 if error
+ */
+int tcpUncork(int socketfd) {
+    if (tlsActive(socketfd))
+        return tlsUncork(socketfd);
+    return 0;
+}
+
+/**
+ * @brief whether received data waits above the socket, where poll does not
+ * see it
+ *
+ * @param socketfd socket file descriptor
+ * @return 1 if data is waiting, 0 otherwise
+ */
+int tcpPending(int socketfd) { return tlsPending(socketfd); }
@@ -0,0 +1,463 @@
+#include "transportLayer/tlsControl.h"
+
+#include <errno.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "log.h"
+
+#define MALLOC_ERR \
+    ERROR("malloc failed in %s: %s, %d\n", __func__, __FILE__, __LINE__)
+
+/**
+ * @brief TLS state of one connected socket
+ *
+ * The lock serializes the SSL object, which cannot be used by two threads
+ * at once; receivers wait for data without it so senders are not held up.
+ * While corked, sends are gathered in out and written as one record.
+ */
+typedef struct _tlsSession {
+    SSL* ssl;
+    pthread_mutex_t lock;
+    int timeoutMs;  // -1 to wait forever
+    int corked;
+    int outLen;
+    uint8_t out[TLS_RECORD_SIZE];
+    char peer[TLS_PEER_LEN];
+} TlsSession;
+
+/**
+ * @brief session ticket of a server, replaced in insertion order once the
+ * cache is full
+ */
+typedef struct _cachedSession {
+    char peer[TLS_PEER_LEN];
+    SSL_SESSION* session;
+} CachedSession;
+
+static SSL_CTX* context = NULL;
+
+// indexed by socket, written on attach/detach and read on every send
+static TlsSession* sessions[TLS_MAX_SOCKETS];
+
+// looked up once per connect, a linear scan is enough
+static pthread_mutex_t cacheLock = PTHREAD_MUTEX_INITIALIZER;
+static CachedSession cache[TLS_SESSION_CACHE];
+static int cacheNext = 0;
+
+static TlsStats stats;  // updated atomically
+
+static void _logErrors(const char* what) {
+    unsigned long code;
+    char buffer[256];
+    ERROR("%s\n", what);
+    while ((code = ERR_get_error()) != 0) {
+        ERR_error_string_n(code, buffer, sizeof(buffer));
+        ERROR("\t%s\n", buffer);
+    }
+}
+
+static TlsSession* _session(int socketfd) {
+    if (socketfd < 0 || socketfd >= TLS_MAX_SOCKETS) return NULL;
+    return __atomic_load_n(&sessions[socketfd], __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief keep a reference to the session of a server for the next connect
+ *
+ * Called by OpenSSL when a handshake completes or, with TLS 1.3, when the
+ * server sends a ticket after the handshake.
+ *
+ * @return int 1, the cache owns the reference
+ */
+static int _storeSession(SSL* ssl, SSL_SESSION* session) {
+    TlsSession* tls = (TlsSession*)SSL_get_app_data(ssl);
+    if (tls == NULL) return 0;
+
+    pthread_mutex_lock(&cacheLock);
+    CachedSession* slot = NULL;
+    for (int i = 0; i < TLS_SESSION_CACHE && slot == NULL; i++)
+        if (cache[i].session != NULL && strcmp(cache[i].peer, tls->peer) == 0)
+            slot = &cache[i];
+    if (slot == NULL) {
+        slot = &cache[cacheNext];
+        cacheNext = (cacheNext + 1) % TLS_SESSION_CACHE;
+        strcpy(slot->peer, tls->peer);
+    }
+    if (slot->session != NULL) SSL_SESSION_free(slot->session);
+    slot->session = session;
+    pthread_mutex_unlock(&cacheLock);
+    return 1;
+}
+
+/**
+ * @brief cached session of a server
+ *
+ * @return SSL_SESSION* new reference, NULL if none
+ */
+static SSL_SESSION* _cachedSession(const char* peer) {
+    SSL_SESSION* session = NULL;
+    pthread_mutex_lock(&cacheLock);
+    for (int i = 0; i < TLS_SESSION_CACHE; i++) {
+        if (cache[i].session != NULL && strcmp(cache[i].peer, peer) == 0) {
+            session = cache[i].session;
+            SSL_SESSION_up_ref(session);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&cacheLock);
+    return session;
+}
+
+/**
+ * @brief create the client context shared by every TLS connection
+ *
+ * Must be called once before tlsAttach. Only TLS 1.2 and later are
+ * negotiated, as required by Modbus/TCP Security. Servers are checked
+ * against caFile but not against their address, devices seldom carry it in
+ * their certificate.
+ *
+ * @param config client credentials
+ * @return int 0 if success, -1 if error
+ */
+int tlsInit(const TlsConfig* config) {
+    if (config == NULL || (config->verifyPeer && config->caFile == NULL)) {
+        ERROR("tlsInit: invalid parameters\n");
+        return -1;
+    }
+    if (context != NULL) {
+        ERROR("tlsInit: already initialized\n");
+        return -1;
+    }
+
+    SSL_CTX* ctx = SSL_CTX_new(TLS_client_method());
+    if (ctx == NULL) {
+        _logErrors("Cannot create TLS context");
+        return -1;
+    }
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+
+    if (config->caFile != NULL &&
+        SSL_CTX_load_verify_locations(ctx, config->caFile, NULL) != 1) {
+        _logErrors("Cannot load TLS authorities");
+        SSL_CTX_free(ctx);
+        return -1;
+    }
+    if (config->certFile != NULL &&
+        (SSL_CTX_use_certificate_chain_file(ctx, config->certFile) != 1 ||
+         SSL_CTX_use_PrivateKey_file(ctx, config->keyFile, SSL_FILETYPE_PEM) !=
+             1 ||
+         SSL_CTX_check_private_key(ctx) != 1)) {
+        _logErrors("Cannot load TLS client certificate");
+        SSL_CTX_free(ctx);
+        return -1;
+    }
+    SSL_CTX_set_verify(ctx,
+                       config->verifyPeer ? SSL_VERIFY_PEER : SSL_VERIFY_NONE,
+                       NULL);
+
+    // sessions are kept per server address, not in OpenSSL's own cache
+    SSL_CTX_set_session_cache_mode(
+        ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, _storeSession);
+
+    context = ctx;
+    return 0;
+}
+
+/**
+ * @brief free the client context and the cached sessions, every TLS socket
+ * must have been closed
+ */
+void tlsCleanup(void) {
+    pthread_mutex_lock(&cacheLock);
+    for (int i = 0; i < TLS_SESSION_CACHE; i++) {
+        if (cache[i].session != NULL) SSL_SESSION_free(cache[i].session);
+        cache[i].session = NULL;
+    }
+    cacheNext = 0;
+    pthread_mutex_unlock(&cacheLock);
+
+    SSL_CTX_free(context);
+    context = NULL;
+}
+
+/**
+ * @brief run the TLS handshake over a connected socket, tcpSend and
+ * tcpReceive then go through TLS until the socket is closed
+ *
+ * The handshake resumes the last session of the same peer when the server
+ * still accepts it. The socket receive timeout also bounds the handshake.
+ *
+ * @param socketfd connected socket file descriptor
+ * @param peer key of the server in the session cache, e.g. "ip:port"
+ * @return int 0 if success, -1 if error
+ */
+int tlsAttach(int socketfd, const char* peer) {
+    if (socketfd < 0 || socketfd >= TLS_MAX_SOCKETS || peer == NULL ||
+        strlen(peer) >= TLS_PEER_LEN) {
+        ERROR("tlsAttach: invalid parameters\n");
+        return -1;
+    }
+    if (context == NULL) {
+        ERROR("tlsAttach: TLS is not initialized\n");
+        return -1;
+    }
+
+    TlsSession* tls = (TlsSession*)calloc(1, sizeof(*tls));
+    if (tls == NULL) {
+        MALLOC_ERR;
+        return -1;
+    }
+    strcpy(tls->peer, peer);
+    pthread_mutex_init(&tls->lock, NULL);
+
+    struct timeval timeout = {0};
+    socklen_t optlen = sizeof(timeout);
+    getsockopt(socketfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, &optlen);
+    tls->timeoutMs = timeout.tv_sec == 0 && timeout.tv_usec == 0
+                         ? -1
+                         : (int)(timeout.tv_sec * 1000 +
+                                 (timeout.tv_usec + 999) / 1000);
+
+    tls->ssl = SSL_new(context);
+    if (tls->ssl == NULL || SSL_set_fd(tls->ssl, socketfd) != 1) {
+        _logErrors("Cannot create TLS connection");
+        goto fail;
+    }
+    SSL_set_app_data(tls->ssl, tls);
+    // return after post-handshake messages so receivers can release the lock
+    SSL_clear_mode(tls->ssl, SSL_MODE_AUTO_RETRY);
+
+    SSL_SESSION* cached = _cachedSession(peer);
+    if (cached != NULL) {
+        SSL_set_session(tls->ssl, cached);
+        SSL_SESSION_free(cached);
+    }
+
+    if (SSL_connect(tls->ssl) != 1) {
+        _logErrors("TLS handshake failed");
+        goto fail;
+    }
+
+    __atomic_add_fetch(&stats.handshakes, 1, __ATOMIC_RELAXED);
+    if (SSL_session_reused(tls->ssl))
+        __atomic_add_fetch(&stats.resumed, 1, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&sessions[socketfd], tls, __ATOMIC_RELEASE);
+    return 0;
+
+fail:
+    SSL_free(tls->ssl);
+    pthread_mutex_destroy(&tls->lock);
+    free(tls);
+    return -1;
+}
+
+/**
+ * @brief send close_notify and free the TLS state of a socket, the socket
+ * itself stays open
+ *
+ * @param socketfd socket file descriptor
+ * @return int 0 if success, -1 if the socket has no TLS state
+ */
+int tlsDetach(int socketfd) {
+    if (socketfd < 0 || socketfd >= TLS_MAX_SOCKETS) return -1;
+    TlsSession* tls =
+        __atomic_exchange_n(&sessions[socketfd], NULL, __ATOMIC_ACQ_REL);
+    if (tls == NULL) return -1;
+
+    // no wait for the peer's close_notify, the socket is closed next
+    SSL_shutdown(tls->ssl);
+    SSL_free(tls->ssl);
+    pthread_mutex_destroy(&tls->lock);
+    free(tls);
+    return 0;
+}
+
+/**
+ * @brief whether a socket goes through TLS
+ *
+ * @return int 1 if it does, 0 otherwise
+ */
+int tlsActive(int socketfd) { return _session(socketfd) != NULL; }
+
+/**
+ * @brief whether the handshake of a socket resumed a cached session
+ *
+ * @return int 1 if resumed, 0 if full handshake, -1 if not a TLS socket
+ */
+int tlsSessionReused(int socketfd) {
+    TlsSession* tls = _session(socketfd);
+    if (tls == NULL) return -1;
+    return SSL_session_reused(tls->ssl) ? 1 : 0;
+}
+
+// call with the lock held
+static int _write(TlsSession* tls, uint8_t* packet, int pLen) {
+    int sent = 0;
+    while (sent < pLen) {
+        int chunk = pLen - sent;
+        if (chunk > TLS_RECORD_SIZE) chunk = TLS_RECORD_SIZE;
+
+        int n = SSL_write(tls->ssl, packet + sent, chunk);
+        if (n <= 0) {
+            _logErrors("TLS send failed");
+            return -1;
+        }
+        sent += n;
+        __atomic_add_fetch(&stats.records, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_add_fetch(&stats.bytes, sent, __ATOMIC_RELAXED);
+    return sent;
+}
+
+// call with the lock held
+static int _flush(TlsSession* tls) {
+    if (tls->outLen == 0) return 0;
+    int n = _write(tls, tls->out, tls->outLen);
+    tls->outLen = 0;
+    return n < 0 ? -1 : 0;
+}
+
+/**
+ * @brief send a packet through a TLS socket, in one record unless corked
+ *
+ * @param socketfd socket file descriptor
+ * @param packet packet to send
+ * @param pLen packet length
+ * @return n bytes sent (or queued) if success, -1 if error
+ */
+int tlsSend(int socketfd, uint8_t* packet, int pLen) {
+    TlsSession* tls = _session(socketfd);
+    if (tls == NULL) return -1;
+
+    pthread_mutex_lock(&tls->lock);
+    int n = pLen;
+    if (!tls->corked) {
+        n = _write(tls, packet, pLen);
+    } else if (tls->outLen + pLen <= TLS_RECORD_SIZE) {
+        memcpy(tls->out + tls->outLen, packet, pLen);
+        tls->outLen += pLen;
+    } else if (_flush(tls) < 0) {
+        n = -1;
+    } else if (pLen <= TLS_RECORD_SIZE) {
+        memcpy(tls->out, packet, pLen);
+        tls->outLen = pLen;
+    } else {
+        n = _write(tls, packet, pLen);
+    }
+    pthread_mutex_unlock(&tls->lock);
+    return n;
+}
+
+/**
+ * @brief receive from a TLS socket, waiting at most the socket receive
+ * timeout for data
+ *
+ * @param socketfd socket file descriptor
+ * @param packet buffer
+ * @param pLen buffer size
+ * @return n bytes received, 0 if the peer closed, -1 if error or timeout
+ */
+int tlsReceive(int socketfd, uint8_t* packet, int pLen) {
+    TlsSession* tls = _session(socketfd);
+    if (tls == NULL) return -1;
+
+    for (;;) {
+        pthread_mutex_lock(&tls->lock);
+        int buffered = SSL_has_pending(tls->ssl);
+        pthread_mutex_unlock(&tls->lock);
+
+        if (!buffered) {
+            struct pollfd pfd = {.fd = socketfd, .events = POLLIN};
+            int ready = poll(&pfd, 1, tls->timeoutMs);
+            if (ready < 0 && errno == EINTR) continue;
+            if (ready <= 0) {
+                if (ready == 0) errno = EAGAIN;
+                return -1;
+            }
+        }
+
+        pthread_mutex_lock(&tls->lock);
+        int n = SSL_read(tls->ssl, packet, pLen);
+        int error = n > 0 ? SSL_ERROR_NONE : SSL_get_error(tls->ssl, n);
+        pthread_mutex_unlock(&tls->lock);
+
+        if (n > 0) return n;
+        // a ticket or another record without application data
+        if (error == SSL_ERROR_WANT_READ) continue;
+        if (error == SSL_ERROR_ZERO_RETURN) return 0;
+        _logErrors("TLS receive failed");
+        return -1;
+    }
+}
+
+/**
+ * @brief whether data was already read from a TLS socket and waits in its
+ * buffers, where poll cannot see it
+ *
+ * @return int 1 if data is buffered, 0 otherwise
+ */
+int tlsPending(int socketfd) {
+    TlsSession* tls = _session(socketfd);
+    if (tls == NULL) return 0;
+
+    pthread_mutex_lock(&tls->lock);
+    int buffered = SSL_has_pending(tls->ssl);
+    pthread_mutex_unlock(&tls->lock);
+    return buffered;
+}
+
+/**
+ * @brief gather the following sends of a socket into shared records until
+ * the matching tlsUncork, calls nest
+ *
+ * @return int 0 if success, -1 if not a TLS socket
+ */
+int tlsCork(int socketfd) {
+    TlsSession* tls = _session(socketfd);
+    if (tls == NULL) return -1;
+
+    pthread_mutex_lock(&tls->lock);
+    tls->corked++;
+    pthread_mutex_unlock(&tls->lock);
+    return 0;
+}
+
+/**
+ * @brief end a tlsCork, the gathered sends are written when the outermost
+ * one ends
+ *
+ * @return int 0 if success, -1 if error
+ */
+int tlsUncork(int socketfd) {
+    TlsSession* tls = _session(socketfd);
+    if (tls == NULL) return -1;
+
+    pthread_mutex_lock(&tls->lock);
+    int status = 0;
+    if (tls->corked > 0 && --tls->corked == 0) status = _flush(tls);
+    pthread_mutex_unlock(&tls->lock);
+    return status;
+}
+
+/**
+ * @brief process wide TLS counters
+ *
+ * @param out filled with the counters
+ */
+void tlsGetStats(TlsStats* out) {
+    out->handshakes = __atomic_load_n(&stats.handshakes, __ATOMIC_RELAXED);
+    out->resumed = __atomic_load_n(&stats.resumed, __ATOMIC_RELAXED);
+    out->records = __atomic_load_n(&stats.records, __ATOMIC_RELAXED);
+    out->bytes = __atomic_load_n(&stats.bytes, __ATOMIC_RELAXED);
+}
+
+#undef MALLOC_ERR
@@ -0,0 +1,123 @@
+#include "transportLayer/udpControl.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "log.h"
+
+/**
+ * @brief create a non blocking UDP socket, shared by every device polled
+ * through it
+ *
+ * @return socket file descriptor if success,
+ *         -1 if error creating the socket,
+ *         -2 if error setting the options
+ */
+int udpOpenSocket(void) {
+    int socketfd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (socketfd < 0)
+        return -1;
+
+    // a large fleet answers in bursts, make room for them in the kernel
+    int bufferSize = 1 << 20;
+    if (setsockopt(socketfd, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize)) < 0) {
+        close(socketfd);
+        return -2;
+    }
+
+    return socketfd;
+}
+
+/**
+ * @brief close a UDP socket
+ *
+ * @param socketfd socket file descriptor
+ * @return 0 if success, -1 if error
+ */
+int udpCloseSocket(int socketfd) {
+    return close(socketfd);
+}
+
+/**
+ * @brief fill a socket address from an IPv4 string and a port
+ *
+ * @param ipString server IP address
+ * @param port server port
+ * @param address address to fill
+ * @return 0 if success, -2 if the IP address is invalid
+ */
+int udpResolve(char* ipString, int port, struct sockaddr_in* address) {
+    memset(address, 0, sizeof(*address));
+    address->sin_family = AF_INET;
+    address->sin_port = htons(port);
+
+    // convert IPv4 addresses from text to binary form
+    if (inet_aton(ipString, &address->sin_addr) == 0)
+        return -2;
+
+    return 0;
+}
+
+/**
+ * @brief send a batch of datagrams with as few syscalls as possible
+ *
+ * @param socketfd socket file descriptor
+ * @param messages datagrams to send (msg_hdr must name the destination)
+ * @param count number of datagrams
+ * @return number of datagrams sent if success, -1 if error
+ */
+int udpSendBatch(int socketfd, struct mmsghdr* messages, int count) {
+    int sent = 0;
+    while (sent < count) {
+        int n = sendmmsg(socketfd, messages + sent, count - sent, 0);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // socket buffer full, wait until the kernel drains it
+                struct pollfd pfd = {.fd = socketfd, .events = POLLOUT};
+                poll(&pfd, 1, -1);
+                continue;
+            }
+            return -1;
+        }
+        sent += n;
+    }
+    return sent;
+}
+
+/**
+ * @brief receive a batch of datagrams, waiting at most timeoutMs for the
+ * first one to arrive
+ *
+ * @param socketfd socket file descriptor
+ * @param messages datagram slots to fill (msg_name receives the source)
+ * @param count number of slots
+ * @param timeoutMs maximum time to wait in milliseconds
+ * @return number of datagrams received if success, 0 on timeout, -1 if error
+ */
+int udpReceiveBatch(int socketfd, struct mmsghdr* messages, int count,
+                    int timeoutMs) {
+    struct pollfd pfd = {.fd = socketfd, .events = POLLIN};
+    int ready = poll(&pfd, 1, timeoutMs);
+    if (ready <= 0)
+        return (ready < 0 && errno != EINTR) ? -1 : 0;
+
+    int received = recvmmsg(socketfd, messages, count, MSG_DONTWAIT, NULL);
+    if (received < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            return 0;
+        ERROR("invalid datagram batch\n");
+        return -1;
+    }
+
+    return received;
+}
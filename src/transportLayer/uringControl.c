@@ -0,0 +1,634 @@
+#include "transportLayer/uringControl.h"
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "log.h"
+
+#define MALLOC_ERR \
+    ERROR("malloc failed in %s: %s, %d\n", __func__, __FILE__, __LINE__)
+
+#define URING_FRAME_SIZE 512         // registered send buffer size
+#define URING_SEND_SLOTS 64          // registered send buffers
+#define URING_RECV_BUFFERS 64        // provided receive buffers, power of 2
+#define URING_RECV_BUFFER_SIZE 2048  // provided receive buffer size
+#define URING_BUFFER_GROUP 0
+
+// user_data layout: op | slot << 8 | fd << 24 | generation << 48
+#define URING_OP_SEND 1
+#define URING_OP_RECV 2
+#define URING_OP_CANCEL 3
+
+#define _userData(op, slot, fd, gen)                             \
+    ((uint64_t)(op) | (uint64_t)(slot) << 8 | (uint64_t)(fd) << 24 | \
+     (uint64_t)(gen) << 48)
+#define _userOp(data) ((int)((data)&0xFF))
+#define _userSlot(data) ((int)(((data) >> 8) & 0xFFFF))
+#define _userFd(data) ((int)(((data) >> 24) & 0xFFFFFF))
+#define _userGen(data) ((uint16_t)((data) >> 48))
+
+/**
+ * @brief receive side state of one socket
+ *
+ * @param armed a multishot receive is outstanding for the socket
+ * @param generation bumped when the socket is forgotten, so completions of
+ *   a cancelled receive are not mistaken for the next socket with the same fd
+ * @param error errno of a failed send or receive, reported by the next call
+ * @param closed the peer closed the connection
+ * @param timeoutMs receive timeout (SO_RCVTIMEO), -1 until read, 0 = forever
+ * @param data bytes received but not consumed yet
+ */
+typedef struct _uringStream {
+    int armed;
+    uint16_t generation;
+    int error;
+    int closed;
+    int timeoutMs;
+    uint8_t* data;
+    int start;
+    int end;
+    int capacity;
+} UringStream;
+
+struct _uringContext {
+    int ringfd;
+
+    // submission queue
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned sqMask;
+    unsigned* sqArray;
+    struct io_uring_sqe* sqes;
+    unsigned toSubmit;
+
+    // completion queue
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe* cqes;
+
+    void* ringMemory;
+    size_t ringSize;
+    size_t sqesSize;
+
+    // registered send buffers
+    uint8_t* sendArena;
+    uint8_t sendBusy[URING_SEND_SLOTS];
+    int sendFd[URING_SEND_SLOTS];
+    uint16_t sendLen[URING_SEND_SLOTS];   // bytes queued in each buffer
+    uint16_t sendDone[URING_SEND_SLOTS];  // of which the kernel wrote
+    int sendNext;
+    unsigned sendInFlight;
+
+    // provided buffer ring feeding the multishot receives
+    struct io_uring_buf_ring* bufRing;
+    uint8_t* recvArena;
+    uint16_t bufTail;
+
+    UringStream* streams;
+    int streamCount;
+
+    long syscalls;
+};
+
+static int _enter(UringContext* ring, unsigned minComplete, int timeoutMs) {
+    struct __kernel_timespec ts = {.tv_sec = timeoutMs / 1000,
+                                   .tv_nsec = (timeoutMs % 1000) * 1000000L};
+    struct io_uring_getevents_arg arg = {.sigmask = 0,
+                                         .sigmask_sz = _NSIG / 8,
+                                         .ts = (uint64_t)(uintptr_t)&ts};
+    unsigned flags = minComplete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    void* argp = NULL;
+    size_t argsz = 0;
+    if (minComplete > 0 && timeoutMs > 0) {
+        flags |= IORING_ENTER_EXT_ARG;
+        argp = &arg;
+        argsz = sizeof(arg);
+    }
+
+    ring->syscalls++;
+    int ret = syscall(__NR_io_uring_enter, ring->ringfd, ring->toSubmit,
+                      minComplete, flags, argp, argsz);
+    if (ret < 0) return -errno;
+
+    ring->toSubmit -= ret;
+    return ret;
+}
+
+static struct io_uring_sqe* _getSqe(UringContext* ring) {
+    unsigned tail = *ring->sqTail;
+    unsigned head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+
+    // submission queue full: hand the pending entries to the kernel first
+    if (tail - head > ring->sqMask) {
+        if (_enter(ring, 0, 0) < 0) return NULL;
+    }
+
+    struct io_uring_sqe* sqe = &ring->sqes[tail & ring->sqMask];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sqArray[tail & ring->sqMask] = tail & ring->sqMask;
+    __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+    ring->toSubmit++;
+    return sqe;
+}
+
+static UringStream* _stream(UringContext* ring, int socketfd) {
+    if (socketfd >= ring->streamCount) {
+        int count = ring->streamCount ? ring->streamCount : 64;
+        while (count <= socketfd) count *= 2;
+
+        UringStream* streams =
+            (UringStream*)realloc(ring->streams, count * sizeof(*streams));
+        if (streams == NULL) {
+            MALLOC_ERR;
+            return NULL;
+        }
+        memset(streams + ring->streamCount, 0,
+               (count - ring->streamCount) * sizeof(*streams));
+        for (int i = ring->streamCount; i < count; i++)
+            streams[i].timeoutMs = -1;
+
+        ring->streams = streams;
+        ring->streamCount = count;
+    }
+
+    UringStream* stream = &ring->streams[socketfd];
+    if (stream->timeoutMs < 0) {
+        // honour the SO_RCVTIMEO set by tcpOpenSocket
+        struct timeval timeout = {0};
+        socklen_t len = sizeof(timeout);
+        ring->syscalls++;
+        if (getsockopt(socketfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, &len) < 0)
+            timeout.tv_sec = timeout.tv_usec = 0;
+        stream->timeoutMs = timeout.tv_sec * 1000 + timeout.tv_usec / 1000;
+    }
+    return stream;
+}
+
+static void _recycleBuffer(UringContext* ring, int bid) {
+    struct io_uring_buf* buf =
+        &ring->bufRing->bufs[ring->bufTail & (URING_RECV_BUFFERS - 1)];
+    buf->addr = (uint64_t)(uintptr_t)(ring->recvArena +
+                                      (size_t)bid * URING_RECV_BUFFER_SIZE);
+    buf->len = URING_RECV_BUFFER_SIZE;
+    buf->bid = bid;
+    ring->bufTail++;
+    __atomic_store_n(&ring->bufRing->tail, ring->bufTail, __ATOMIC_RELEASE);
+}
+
+static int _stage(UringStream* stream, uint8_t* data, int len) {
+    if (stream->start == stream->end) stream->start = stream->end = 0;
+
+    if (stream->end + len > stream->capacity) {
+        // compact first, grow only if still needed
+        memmove(stream->data, stream->data + stream->start,
+                stream->end - stream->start);
+        stream->end -= stream->start;
+        stream->start = 0;
+
+        if (stream->end + len > stream->capacity) {
+            int capacity = stream->capacity ? stream->capacity : 1024;
+            while (capacity < stream->end + len) capacity *= 2;
+            uint8_t* grown = (uint8_t*)realloc(stream->data, capacity);
+            if (grown == NULL) {
+                MALLOC_ERR;
+                return -1;
+            }
+            stream->data = grown;
+            stream->capacity = capacity;
+        }
+    }
+
+    memcpy(stream->data + stream->end, data, len);
+    stream->end += len;
+    return 0;
+}
+
+/**
+ * @brief queue the unwritten part of a send buffer
+ *
+ * @return struct io_uring_sqe* the submission, NULL if the ring is broken
+ */
+static struct io_uring_sqe* _submitSend(UringContext* ring, int slot) {
+    struct io_uring_sqe* sqe = _getSqe(ring);
+    if (sqe == NULL) return NULL;
+
+    uint8_t* buffer = ring->sendArena + (size_t)slot * URING_FRAME_SIZE;
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->fd = ring->sendFd[slot];
+    sqe->addr = (uint64_t)(uintptr_t)(buffer + ring->sendDone[slot]);
+    sqe->len = ring->sendLen[slot] - ring->sendDone[slot];
+    sqe->buf_index = 0;
+    sqe->user_data = _userData(URING_OP_SEND, slot, ring->sendFd[slot], 0);
+    return sqe;
+}
+
+/**
+ * @brief resubmit the rest of a short write, unless another send on the
+ * socket is in flight and the rest could land after it
+ *
+ * @return 0 if resubmitted, -1 if not
+ */
+static int _resend(UringContext* ring, int slot) {
+    for (int i = 0; i < URING_SEND_SLOTS; i++)
+        if (i != slot && ring->sendBusy[i] &&
+            ring->sendFd[i] == ring->sendFd[slot])
+            return -1;
+    return _submitSend(ring, slot) != NULL ? 0 : -1;
+}
+
+static void _reap(UringContext* ring) {
+    unsigned head = *ring->cqHead;
+    unsigned tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++) {
+        struct io_uring_cqe* cqe = &ring->cqes[head & ring->cqMask];
+        int fd = _userFd(cqe->user_data);
+        UringStream* stream =
+            fd < ring->streamCount ? &ring->streams[fd] : NULL;
+
+        switch (_userOp(cqe->user_data)) {
+            case URING_OP_SEND: {
+                int slot = _userSlot(cqe->user_data);
+                if (cqe->res > 0) ring->sendDone[slot] += cqe->res;
+                int shortWrite = ring->sendDone[slot] < ring->sendLen[slot];
+                // the slot stays busy until its whole frame is written
+                if (cqe->res > 0 && shortWrite && _resend(ring, slot) == 0)
+                    break;
+
+                ring->sendBusy[slot] = 0;
+                ring->sendInFlight--;
+                if (stream == NULL) break;
+                if (cqe->res < 0)
+                    stream->error = -cqe->res;
+                else if (shortWrite)
+                    stream->error = EIO;
+                break;
+            }
+
+            case URING_OP_RECV: {
+                int hasBuffer = cqe->flags & IORING_CQE_F_BUFFER;
+                int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+                int current = stream != NULL &&
+                              stream->generation == _userGen(cqe->user_data);
+
+                if (current) {
+                    if (cqe->res > 0 && hasBuffer) {
+                        if (_stage(stream, ring->recvArena +
+                                               (size_t)bid *
+                                                   URING_RECV_BUFFER_SIZE,
+                                   cqe->res) < 0)
+                            stream->error = ENOMEM;
+                    } else if (cqe->res == 0) {
+                        stream->closed = 1;
+                    } else if (cqe->res < 0 && cqe->res != -ENOBUFS &&
+                               cqe->res != -ECANCELED) {
+                        // ECANCELED: the linked send was short, the
+                        // receive is armed again by the next call
+                        stream->error = -cqe->res;
+                    }
+                    // multishot ended (error, EOF or out of buffers)
+                    if (!(cqe->flags & IORING_CQE_F_MORE)) stream->armed = 0;
+                }
+                if (hasBuffer) _recycleBuffer(ring, bid);
+                break;
+            }
+
+            default:
+                break;
+        }
+    }
+
+    __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+}
+
+static int _armReceive(UringContext* ring, int socketfd,
+                       UringStream* stream) {
+    struct io_uring_sqe* sqe = _getSqe(ring);
+    if (sqe == NULL) return -1;
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = socketfd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data =
+        _userData(URING_OP_RECV, 0, socketfd, stream->generation);
+    stream->armed = 1;
+    return 0;
+}
+
+static void _unmap(UringContext* ring) {
+    if (ring->ringMemory != NULL && ring->ringMemory != MAP_FAILED)
+        munmap(ring->ringMemory, ring->ringSize);
+    if (ring->sqes != NULL && (void*)ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->sqesSize);
+    if (ring->bufRing != NULL && (void*)ring->bufRing != MAP_FAILED)
+        munmap(ring->bufRing,
+               URING_RECV_BUFFERS * sizeof(struct io_uring_buf));
+}
+
+/**
+ * @brief create an io_uring instance with registered send buffers and a
+ * provided buffer ring for multishot receives
+ *
+ * @param entries submission queue size
+ * @return UringContext* the ring, NULL if io_uring or one of the required
+ * features is not available
+ */
+UringContext* uringNew(unsigned entries) {
+    UringContext* ring = (UringContext*)calloc(1, sizeof(UringContext));
+    if (ring == NULL) {
+        MALLOC_ERR;
+        return NULL;
+    }
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->ringfd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->ringfd < 0) {
+        LOG("io_uring_setup failed: %d\n", errno);
+        free(ring);
+        return NULL;
+    }
+
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) ||
+        !(params.features & IORING_FEAT_EXT_ARG)) {
+        LOG("io_uring too old for this backend\n");
+        goto fail;
+    }
+
+    size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cqSize =
+        params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->ringSize = sqSize > cqSize ? sqSize : cqSize;
+    ring->ringMemory =
+        mmap(NULL, ring->ringSize, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, ring->ringfd, IORING_OFF_SQ_RING);
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe*)mmap(
+        NULL, ring->sqesSize, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->ringfd, IORING_OFF_SQES);
+    if (ring->ringMemory == MAP_FAILED || ring->sqes == MAP_FAILED) goto fail;
+
+    uint8_t* base = (uint8_t*)ring->ringMemory;
+    ring->sqHead = (unsigned*)(base + params.sq_off.head);
+    ring->sqTail = (unsigned*)(base + params.sq_off.tail);
+    ring->sqMask = *(unsigned*)(base + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned*)(base + params.sq_off.array);
+    ring->cqHead = (unsigned*)(base + params.cq_off.head);
+    ring->cqTail = (unsigned*)(base + params.cq_off.tail);
+    ring->cqMask = *(unsigned*)(base + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(base + params.cq_off.cqes);
+
+    // registered buffers for outgoing frames
+    ring->sendArena = (uint8_t*)aligned_alloc(
+        4096, URING_SEND_SLOTS * URING_FRAME_SIZE);
+    if (ring->sendArena == NULL) {
+        MALLOC_ERR;
+        goto fail;
+    }
+    struct iovec sendIov = {.iov_base = ring->sendArena,
+                            .iov_len = URING_SEND_SLOTS * URING_FRAME_SIZE};
+    if (syscall(__NR_io_uring_register, ring->ringfd,
+                IORING_REGISTER_BUFFERS, &sendIov, 1) < 0) {
+        LOG("cannot register io_uring buffers: %d\n", errno);
+        goto fail;
+    }
+
+    // provided buffer ring for multishot receives
+    ring->bufRing = (struct io_uring_buf_ring*)mmap(
+        NULL, URING_RECV_BUFFERS * sizeof(struct io_uring_buf),
+        PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    ring->recvArena =
+        (uint8_t*)malloc(URING_RECV_BUFFERS * URING_RECV_BUFFER_SIZE);
+    if ((void*)ring->bufRing == MAP_FAILED || ring->recvArena == NULL) {
+        MALLOC_ERR;
+        goto fail;
+    }
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)ring->bufRing;
+    reg.ring_entries = URING_RECV_BUFFERS;
+    reg.bgid = URING_BUFFER_GROUP;
+    if (syscall(__NR_io_uring_register, ring->ringfd,
+                IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        LOG("cannot register io_uring buffer ring: %d\n", errno);
+        goto fail;
+    }
+    for (int bid = 0; bid < URING_RECV_BUFFERS; bid++)
+        _recycleBuffer(ring, bid);
+
+    return ring;
+
+fail:
+    _unmap(ring);
+    free(ring->sendArena);
+    free(ring->recvArena);
+    close(ring->ringfd);
+    free(ring);
+    return NULL;
+}
+
+/**
+ * @brief release an io_uring instance created with uringNew
+ *
+ * @param ring the ring to release
+ */
+void uringFree(UringContext* ring) {
+    if (ring == NULL) return;
+
+    _unmap(ring);
+    close(ring->ringfd);
+    free(ring->sendArena);
+    free(ring->recvArena);
+    for (int i = 0; i < ring->streamCount; i++) free(ring->streams[i].data);
+    free(ring->streams);
+    free(ring);
+}
+
+/**
+ * @brief queue a packet for sending through a TCP socket
+ *
+ * The packet is copied into a registered buffer and the submission is
+ * deferred to the next uringReceive (or uringFlush), so a request/response
+ * exchange costs a single io_uring_enter. The first send on a socket is
+ * linked to the multishot receive that serves the socket from then on.
+ *
+ * @param ring io_uring instance
+ * @param socketfd socket file descriptor
+ * @param packet packet to send
+ * @param pLen packet length
+ * @return n bytes queued if success, -1 if error
+ */
+int uringSend(UringContext* ring, int socketfd, uint8_t* packet, int pLen) {
+    UringStream* stream = _stream(ring, socketfd);
+    if (stream == NULL) return -1;
+
+    if (stream->error) {
+        errno = stream->error;
+        stream->error = 0;
+        return -1;
+    }
+
+    int queued = 0;
+    while (queued < pLen) {
+        // find a registered buffer whose previous send has completed
+        int slot = -1;
+        while (slot < 0) {
+            for (int i = 0; i < URING_SEND_SLOTS; i++) {
+                int candidate = (ring->sendNext + i) % URING_SEND_SLOTS;
+                if (!ring->sendBusy[candidate]) {
+                    slot = candidate;
+                    break;
+                }
+            }
+            if (slot < 0) {
+                if (_enter(ring, 1, 0) < 0) return -1;
+                _reap(ring);
+            }
+        }
+        ring->sendNext = (slot + 1) % URING_SEND_SLOTS;
+
+        int chunk = pLen - queued;
+        if (chunk > URING_FRAME_SIZE) chunk = URING_FRAME_SIZE;
+        uint8_t* buffer = ring->sendArena + (size_t)slot * URING_FRAME_SIZE;
+        memcpy(buffer, packet + queued, chunk);
+        ring->sendFd[slot] = socketfd;
+        ring->sendLen[slot] = chunk;
+        ring->sendDone[slot] = 0;
+
+        struct io_uring_sqe* sqe = _submitSend(ring, slot);
+        if (sqe == NULL) return -1;
+        ring->sendBusy[slot] = 1;
+        ring->sendInFlight++;
+        queued += chunk;
+
+        // linked send/recv: the receive is armed once the request is out
+        if (!stream->armed && queued == pLen) {
+            sqe->flags |= IOSQE_IO_LINK;
+            if (_armReceive(ring, socketfd, stream) < 0) return -1;
+        }
+    }
+
+    return queued;
+}
+
+/**
+ * @brief receive up to pLen bytes from a TCP socket
+ *
+ * Waits for the socket's multishot receive to deliver data, at most for the
+ * socket's SO_RCVTIMEO.
+ *
+ * @param ring io_uring instance
+ * @param socketfd socket file descriptor
+ * @param packet buffer for the received bytes
+ * @param pLen buffer length
+ * @return n bytes received if success, 0 if the peer closed the connection,
+ * -1 if error or timeout
+ */
+int uringReceive(UringContext* ring, int socketfd, uint8_t* packet,
+                 int pLen) {
+    UringStream* stream = _stream(ring, socketfd);
+    if (stream == NULL) return -1;
+
+    _reap(ring);
+    for (;;) {
+        if (stream->end > stream->start) {
+            int n = stream->end - stream->start;
+            if (n > pLen) n = pLen;
+            memcpy(packet, stream->data + stream->start, n);
+            stream->start += n;
+            return n;
+        }
+
+        if (stream->error) {
+            errno = stream->error;
+            stream->error = 0;
+            return -1;
+        }
+        if (stream->closed) return 0;
+
+        if (!stream->armed && _armReceive(ring, socketfd, stream) < 0)
+            return -1;
+
+        // every outstanding send completes too, wait past them so the
+        // request and its response share one io_uring_enter
+        int ret = _enter(ring, ring->sendInFlight + 1, stream->timeoutMs);
+        if (ret == -ETIME) {
+            // a slow send to another socket can hold back the count while
+            // this socket's data already arrived
+            _reap(ring);
+            if (stream->end > stream->start || stream->error ||
+                stream->closed)
+                continue;
+            errno = EAGAIN;
+            return -1;
+        }
+        if (ret < 0 && ret != -EINTR) {
+            errno = -ret;
+            return -1;
+        }
+        _reap(ring);
+    }
+}
+
+/**
+ * @brief submit queued sends without waiting for any completion
+ *
+ * @param ring io_uring instance
+ * @return 0 if success, -1 if error
+ */
+int uringFlush(UringContext* ring) {
+    if (ring->toSubmit == 0) return 0;
+    return _enter(ring, 0, 0) < 0 ? -1 : 0;
+}
+
+/**
+ * @brief cancel the multishot receive of a socket and drop its staged data,
+ * must be called before the socket is closed
+ *
+ * @param ring io_uring instance
+ * @param socketfd socket file descriptor
+ */
+void uringForget(UringContext* ring, int socketfd) {
+    if (socketfd < 0 || socketfd >= ring->streamCount) return;
+
+    UringStream* stream = &ring->streams[socketfd];
+    if (stream->armed) {
+        struct io_uring_sqe* sqe = _getSqe(ring);
+        if (sqe != NULL) {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr =
+                _userData(URING_OP_RECV, 0, socketfd, stream->generation);
+            sqe->user_data = _userData(URING_OP_CANCEL, 0, socketfd, 0);
+            uringFlush(ring);
+        }
+    }
+
+    stream->armed = 0;
+    stream->generation++;
+    stream->error = 0;
+    stream->closed = 0;
+    stream->timeoutMs = -1;
+    stream->start = stream->end = 0;
+}
+
+/**
+ * @brief number of syscalls issued by the ring so far
+ *
+ * @param ring io_uring instance
+ * @return long syscall count
+ */
+long uringSyscalls(UringContext* ring) { return ring->syscalls; }
+
+#undef MALLOC_ERR
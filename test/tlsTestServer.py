@@ -0,0 +1,110 @@
+# !/usr/bin/env python3
+
+import argparse
+import logging
+import os
+import socket
+import ssl
+import struct
+import subprocess
+import threading
+
+from udpTestServer import handle_pdu
+
+
+def make_self_signed(cert, key):
+    """Create a self-signed certificate for localhost with the openssl CLI."""
+    subprocess.run(
+        [
+            "openssl", "req", "-x509", "-newkey", "rsa:2048", "-nodes",
+            "-keyout", key, "-out", cert, "-days", "30",
+            "-subj", "/CN=localhost",
+            "-addext", "subjectAltName=DNS:localhost,IP:127.0.0.1",
+        ],
+        check=True,
+        stdout=subprocess.DEVNULL,
+        stderr=subprocess.DEVNULL,
+    )
+
+
+def recv_exact(conn, n):
+    data = b""
+    while len(data) < n:
+        chunk = conn.recv(n - len(data))
+        if not chunk:
+            return None
+        data += chunk
+    return data
+
+
+def serve(conn, address):
+    """Answer pipelined requests of one client until it disconnects."""
+    logging.info("%s connected, %s, resumed: %s",
+                 address, conn.version(), conn.session_reused)
+    try:
+        while True:
+            header = recv_exact(conn, 7)
+            if header is None:
+                break
+            tid, pid, length, unit = struct.unpack(">HHHB", header)
+            pdu = recv_exact(conn, length - 1)
+            if pdu is None:
+                break
+            response = handle_pdu(pdu)
+            conn.sendall(
+                struct.pack(">HHHB", tid, pid, len(response) + 1, unit) + response
+            )
+    except (ConnectionError, ssl.SSLError) as error:
+        logging.info("%s: %s", address, error)
+    finally:
+        conn.close()
+
+
+if __name__ == "__main__":
+    # parse args
+    parser = argparse.ArgumentParser()
+    parser.add_argument(
+        "-H", "--host", type=str, default="localhost", help="Host (default: localhost)"
+    )
+    parser.add_argument(
+        "-p", "--port", type=int, default=802, help="TLS port (default: 802)"
+    )
+    parser.add_argument(
+        "-c", "--cert", type=str, default="tlsTestServer.crt",
+        help="certificate, created self-signed if missing (default: tlsTestServer.crt)",
+    )
+    parser.add_argument(
+        "-k", "--key", type=str, default="tlsTestServer.key",
+        help="private key of the certificate (default: tlsTestServer.key)",
+    )
+    parser.add_argument(
+        "--no-tickets", action="store_true",
+        help="disable session tickets, every connection does a full handshake",
+    )
+    args = parser.parse_args()
+
+    # set logging level
+    logging.basicConfig(format="%(asctime)s %(message)s", level=logging.INFO)
+
+    if not os.path.exists(args.cert):
+        logging.info("creating self-signed certificate %s", args.cert)
+        make_self_signed(args.cert, args.key)
+
+    context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+    context.minimum_version = ssl.TLSVersion.TLSv1_2
+    context.load_cert_chain(args.cert, args.key)
+    if args.no_tickets:
+        context.options |= ssl.OP_NO_TICKET
+        context.num_tickets = 0
+
+    listener = socket.create_server((args.host, args.port))
+    logging.info("Start server...")
+    while True:
+        raw, address = listener.accept()
+        try:
+            conn = context.wrap_socket(raw, server_side=True)
+        except (ConnectionError, ssl.SSLError) as error:
+            logging.info("%s: handshake failed, %s", address, error)
+            raw.close()
+            continue
+        threading.Thread(target=serve, args=(conn, address), daemon=True).start()
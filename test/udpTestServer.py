@@ -0,0 +1,76 @@
+# !/usr/bin/env python3
+
+import argparse
+import logging
+import random
+import socket
+import struct
+
+v_regs_d = [0x0000 for _ in range(0, 127)]
+
+ILLEGAL_FUNCTION = 0x01
+ILLEGAL_DATA_ADDRESS = 0x02
+
+
+def handle_pdu(pdu):
+    """Execute a request PDU against the register bank, return the response PDU."""
+    function = pdu[0]
+
+    if function == 0x03:
+        address, number = struct.unpack(">HH", pdu[1:5])
+        if address + number > len(v_regs_d):
+            return bytes([function | 0x80, ILLEGAL_DATA_ADDRESS])
+        values = v_regs_d[address : address + number]
+        return struct.pack(">BB%dH" % number, function, number * 2, *values)
+
+    if function == 0x10:
+        address, number, _ = struct.unpack(">HHB", pdu[1:6])
+        if address + number > len(v_regs_d):
+            return bytes([function | 0x80, ILLEGAL_DATA_ADDRESS])
+        values = struct.unpack(">%dH" % number, pdu[6 : 6 + number * 2])
+        for a, v in enumerate(values, start=address):
+            logging.info("reg[%d] change from %04X to %04X" % (a + 1, v_regs_d[a], v))
+            v_regs_d[a] = v
+        return struct.pack(">BHH", function, address, number)
+
+    return bytes([function | 0x80, ILLEGAL_FUNCTION])
+
+
+if __name__ == "__main__":
+    # parse args
+    parser = argparse.ArgumentParser()
+    parser.add_argument(
+        "-H", "--host", type=str, default="localhost", help="Host (default: localhost)"
+    )
+    parser.add_argument(
+        "-p", "--port", type=int, default=502, help="UDP port (default: 502)"
+    )
+    parser.add_argument(
+        "-d",
+        "--drop",
+        type=float,
+        default=0.0,
+        help="fraction of requests silently dropped, to exercise retries (default: 0)",
+    )
+    args = parser.parse_args()
+
+    # set logging level
+    logging.basicConfig(format="%(asctime)s %(message)s", level=logging.INFO)
+
+    server = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    server.bind((args.host, args.port))
+    logging.info("Start udp server...")
+
+    try:
+        while True:
+            frame, client = server.recvfrom(260)
+            if len(frame) < 8:
+                continue
+            tid, pid, length, uid = struct.unpack(">HHHB", frame[:7])
+            if random.random() < args.drop:
+                logging.info("dropping transaction %d from %s" % (tid, client))
+                continue
+            pdu = handle_pdu(frame[7 : 6 + length])
+            server.sendto(struct.pack(">HHHB", tid, pid, len(pdu) + 1, uid) + pdu, client)
+    except KeyboardInterrupt:
+        pass
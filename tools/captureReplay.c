@@ -0,0 +1,598 @@
+/**
+ * Decodes the Modbus TCP traffic of a pcap or pcapng capture with the same
+ * MBAP parser as receiveModbusADU, and optionally replays the captured
+ * requests against a server.
+ *
+ * Usage: captureReplay [-p serverPort] [-r ip:port] [-f] [-s speed] <capture>
+ *   -p  port identifying the server side of the captured flows (default 502)
+ *   -r  replay the captured requests against this server
+ *   -f  replay as fast as possible instead of with the captured timing
+ *   -s  speed factor applied to the captured timing (default 1.0)
+ *
+ * The capture is mapped in memory and frames are decoded in place: no
+ * allocation happens per packet or per frame.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "transportLayer/dataPackaging.h"
+#include "transportLayer/modbusTCP.h"
+#include "transportLayer/tcpControl.h"
+
+#define FLOW_TABLE_SIZE 4096  // power of 2
+#define FLOW_PENDING 8        // out of order segments kept per flow
+
+#define LINKTYPE_NULL 0
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW 101
+#define LINKTYPE_LINUX_SLL 113
+#define LINKTYPE_LINUX_SLL2 276
+
+/**
+ * @brief a segment that arrived ahead of the expected sequence number,
+ * pointing into the mapped capture
+ */
+typedef struct _segment {
+    uint32_t seq;
+    const uint8_t* data;
+    int len;
+} Segment;
+
+/**
+ * @brief one direction of a TCP connection
+ *
+ * @param partial the start of a frame split across segments
+ */
+typedef struct _flow {
+    int used;
+    uint8_t key[36];  // addresses and ports
+    int toServer;
+    int synced;
+    uint32_t nextSeq;
+    uint8_t partial[MODBUS_MAX_ADU_SIZE];
+    int partialLen;
+    Segment pending[FLOW_PENDING];
+    int pendingCount;
+} Flow;
+
+typedef struct _stats {
+    uint64_t packets;
+    uint64_t segments;
+    uint64_t bytes;
+    uint64_t requests;
+    uint64_t responses;
+    uint64_t exceptions;
+    uint64_t malformed;
+    uint64_t gaps;
+    uint64_t byFunction[128];
+    uint64_t replayed;  // shared with the drainer, accessed atomically
+} Stats;
+
+typedef struct _replay {
+    int socketfd;
+    int fast;
+    double speed;
+    uint64_t firstNs;
+    double startWall;
+    uint64_t answered;  // shared with the drainer, accessed atomically
+    int done;           // shared with the drainer, accessed atomically
+} Replay;
+
+static Flow* flows;
+static Stats stats;
+static Replay replay = {.socketfd = -1, .speed = 1.0};
+static int serverPort = MODBUS_TCP_PORT;
+
+static double _now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static inline uint16_t _be16(const uint8_t* p) { return p[0] << 8 | p[1]; }
+static inline uint32_t _be32(const uint8_t* p) {
+    return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static inline uint16_t _rd16(const uint8_t* p, int swap) {
+    uint16_t v;
+    memcpy(&v, p, 2);
+    return swap ? __builtin_bswap16(v) : v;
+}
+static inline uint32_t _rd32(const uint8_t* p, int swap) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return swap ? __builtin_bswap32(v) : v;
+}
+
+/**
+ * @brief find or create the flow of a segment
+ */
+static Flow* _flow(const uint8_t* key) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < (int)sizeof(flows->key); i++)
+        hash = (hash ^ key[i]) * 16777619u;
+
+    for (int probe = 0; probe < FLOW_TABLE_SIZE; probe++) {
+        Flow* flow = &flows[(hash + probe) & (FLOW_TABLE_SIZE - 1)];
+        if (!flow->used) {
+            flow->used = 1;
+            memcpy(flow->key, key, sizeof(flow->key));
+            return flow;
+        }
+        if (memcmp(flow->key, key, sizeof(flow->key)) == 0) return flow;
+    }
+    return NULL;
+}
+
+/**
+ * @brief account for (and possibly replay) one decoded frame
+ */
+static void _frame(Flow* flow, uint8_t* frame, int frameLen, uint64_t tsNs) {
+    ModbusADU adu;
+    if (parseModbusADU(frame, frameLen, &adu) <= 0) {
+        stats.malformed++;
+        return;
+    }
+
+    stats.byFunction[adu.pdu[0] & 0x7F]++;
+    if (!flow->toServer) {
+        stats.responses++;
+        if (adu.pdu[0] & 0x80) stats.exceptions++;
+        return;
+    }
+
+    stats.requests++;
+    if (replay.socketfd < 0) return;
+
+    if (!replay.fast) {
+        // keep the captured inter-arrival times; a timestamp stepping back
+        // before the first packet is sent at once
+        int64_t offsetNs = (int64_t)(tsNs - replay.firstNs);
+        if (offsetNs < 0) offsetNs = 0;
+        double due = replay.startWall + offsetNs * 1e-9 / replay.speed;
+        double wait = due - _now();
+        if (wait > 0) {
+            struct timespec ts = {(time_t)wait,
+                                  (long)((wait - (time_t)wait) * 1e9)};
+            nanosleep(&ts, NULL);
+        }
+    }
+    if (tcpSend(replay.socketfd, frame, frameLen) == frameLen)
+        __atomic_add_fetch(&stats.replayed, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief split in-order stream data into frames, keeping a split frame in
+ * the flow until the rest arrives
+ */
+static void _consume(Flow* flow, const uint8_t* data, int len, uint64_t tsNs) {
+    // complete a frame started in an earlier segment
+    while (flow->partialLen > 0 && len > 0) {
+        int need = MODBUS_MBAP_HEADER_SIZE;
+        if (flow->partialLen >= MODBUS_MBAP_HEADER_SIZE) {
+            need = MODBUS_MBAP_HEADER_SIZE - 1 + _be16(flow->partial + 4);
+            if (need > MODBUS_MAX_ADU_SIZE || need <= MODBUS_MBAP_HEADER_SIZE) {
+                stats.malformed++;
+                flow->partialLen = 0;
+                break;
+            }
+        }
+
+        int take = need - flow->partialLen;
+        if (take > len) take = len;
+        memcpy(flow->partial + flow->partialLen, data, take);
+        flow->partialLen += take;
+        data += take;
+        len -= take;
+
+        if (flow->partialLen == need && need > MODBUS_MBAP_HEADER_SIZE) {
+            _frame(flow, flow->partial, flow->partialLen, tsNs);
+            flow->partialLen = 0;
+        }
+    }
+
+    // whole frames are decoded in place in the mapped capture
+    while (len > 0) {
+        ModbusADU adu;
+        int n = parseModbusADU((uint8_t*)data, len, &adu);
+        if (n < 0) {
+            // lost framing, wait for the next segment boundary
+            stats.malformed++;
+            return;
+        }
+        if (n == 0) {
+            memcpy(flow->partial, data, len);
+            flow->partialLen = len;
+            return;
+        }
+        _frame(flow, (uint8_t*)data, n, tsNs);
+        data += n;
+        len -= n;
+    }
+}
+
+static void _segment(Flow* flow, uint32_t seq, const uint8_t* data, int len,
+                     uint64_t tsNs) {
+    int32_t ahead = (int32_t)(seq - flow->nextSeq);
+
+    if (ahead > 0) {
+        if (flow->pendingCount < FLOW_PENDING) {
+            flow->pending[flow->pendingCount++] = (Segment){seq, data, len};
+            return;
+        }
+        // too many holes: give the missing bytes up and resync here
+        stats.gaps++;
+        flow->partialLen = 0;
+        flow->pendingCount = 0;
+        flow->nextSeq = seq;
+        ahead = 0;
+    }
+
+    // drop what was already seen (retransmissions)
+    if (ahead < 0) {
+        if (-ahead >= len) return;
+        data += -ahead;
+        len -= -ahead;
+    }
+
+    _consume(flow, data, len, tsNs);
+    flow->nextSeq += len;
+
+    // the hole may be filled now
+    for (int i = 0; i < flow->pendingCount;) {
+        Segment* s = &flow->pending[i];
+        if ((int32_t)(s->seq - flow->nextSeq) <= 0) {
+            Segment ready = *s;
+            *s = flow->pending[--flow->pendingCount];
+            _segment(flow, ready.seq, ready.data, ready.len, tsNs);
+            i = 0;
+        } else {
+            i++;
+        }
+    }
+}
+
+static void _tcp(const uint8_t* key, int keyLen, const uint8_t* tcp, int len,
+                 uint64_t tsNs) {
+    if (len < 20) return;
+    int headerLen = (tcp[12] >> 4) * 4;
+    if (headerLen < 20 || headerLen > len) return;
+
+    uint16_t srcPort = _be16(tcp), dstPort = _be16(tcp + 2);
+    if (srcPort != serverPort && dstPort != serverPort) return;
+
+    uint8_t flowKey[36] = {0};
+    memcpy(flowKey, key, keyLen);
+    memcpy(flowKey + 32, tcp, 4);
+
+    Flow* flow = _flow(flowKey);
+    if (flow == NULL) return;
+    flow->toServer = dstPort == serverPort;
+
+    uint32_t seq = _be32(tcp + 4);
+    uint8_t flags = tcp[13];
+    if (flags & 0x02) {  // SYN
+        flow->synced = 1;
+        flow->nextSeq = seq + 1;
+        flow->partialLen = flow->pendingCount = 0;
+        return;
+    }
+
+    int payloadLen = len - headerLen;
+    if (payloadLen <= 0) return;
+    if (!flow->synced) {
+        // capture started mid connection
+        flow->synced = 1;
+        flow->nextSeq = seq;
+    }
+
+    stats.segments++;
+    stats.bytes += payloadLen;
+    _segment(flow, seq, tcp + headerLen, payloadLen, tsNs);
+}
+
+static void _ip(const uint8_t* ip, int len, uint64_t tsNs) {
+    if (len < 1) return;
+
+    if ((ip[0] >> 4) == 4) {
+        if (len < 20) return;
+        int headerLen = (ip[0] & 0x0F) * 4;
+        int totalLen = _be16(ip + 2);
+        if (ip[9] != 6 || headerLen < 20 || totalLen > len ||
+            totalLen < headerLen)
+            return;
+        // fragments are not reassembled
+        if (_be16(ip + 6) & 0x3FFF) return;
+        _tcp(ip + 12, 8, ip + headerLen, totalLen - headerLen, tsNs);
+    } else if ((ip[0] >> 4) == 6) {
+        if (len < 40 || ip[6] != 6) return;  // no extension headers
+        int payloadLen = _be16(ip + 4);
+        if (40 + payloadLen > len) return;
+        _tcp(ip + 8, 32, ip + 40, payloadLen, tsNs);
+    }
+}
+
+static void _packet(int linktype, const uint8_t* data, int len,
+                    uint64_t tsNs) {
+    stats.packets++;
+    if (replay.firstNs == 0) replay.firstNs = tsNs;
+
+    uint16_t ethertype;
+    switch (linktype) {
+        case LINKTYPE_ETHERNET:
+            if (len < 14) return;
+            ethertype = _be16(data + 12);
+            data += 14;
+            len -= 14;
+            while (ethertype == 0x8100 || ethertype == 0x88A8) {  // VLAN
+                if (len < 4) return;
+                ethertype = _be16(data + 2);
+                data += 4;
+                len -= 4;
+            }
+            if (ethertype != 0x0800 && ethertype != 0x86DD) return;
+            break;
+        case LINKTYPE_LINUX_SLL:
+            if (len < 16) return;
+            data += 16;
+            len -= 16;
+            break;
+        case LINKTYPE_LINUX_SLL2:
+            if (len < 20) return;
+            data += 20;
+            len -= 20;
+            break;
+        case LINKTYPE_NULL:
+            if (len < 4) return;
+            data += 4;
+            len -= 4;
+            break;
+        case LINKTYPE_RAW:
+        case 12:  // raw IP on some platforms
+            break;
+        default:
+            return;
+    }
+
+    _ip(data, len, tsNs);
+}
+
+static int _readPcap(const uint8_t* map, size_t size) {
+    uint32_t magic;
+    memcpy(&magic, map, 4);
+
+    int swap = magic == 0xD4C3B2A1 || magic == 0x4D3CB2A1;
+    int nano = magic == 0xA1B23C4D || magic == 0x4D3CB2A1;
+    int linktype = _rd32(map + 20, swap);
+
+    size_t offset = 24;
+    while (offset + 16 <= size) {
+        const uint8_t* record = map + offset;
+        uint64_t tsNs = (uint64_t)_rd32(record, swap) * 1000000000ULL +
+                        (uint64_t)_rd32(record + 4, swap) * (nano ? 1 : 1000);
+        uint32_t captured = _rd32(record + 8, swap);
+        if (offset + 16 + captured > size) break;
+
+        _packet(linktype, record + 16, captured, tsNs);
+        offset += 16 + captured;
+    }
+    return 0;
+}
+
+static int _readPcapng(const uint8_t* map, size_t size) {
+    int swap = 0;
+    int linktypes[64];
+    uint64_t tsUnits[64];  // interface timestamp resolution in ns per unit
+    int interfaces = 0;
+
+    size_t offset = 0;
+    while (offset + 12 <= size) {
+        const uint8_t* block = map + offset;
+        uint32_t type = _rd32(block, swap);
+
+        if (type == 0x0A0D0D0A) {  // section header: byte order may change
+            uint32_t bom;
+            memcpy(&bom, block + 8, 4);
+            swap = bom == 0x4D3C2B1A;
+            interfaces = 0;
+        }
+
+        uint32_t length = _rd32(block + 4, swap);
+        if (length < 12 || offset + length > size) break;
+
+        if (type == 1 && interfaces < 64) {  // interface description
+            linktypes[interfaces] = _rd16(block + 8, swap);
+            tsUnits[interfaces] = 1000;  // microseconds by default
+
+            // look for if_tsresol
+            size_t opt = 16;
+            while (opt + 4 <= length - 4) {
+                uint16_t code = _rd16(block + opt, swap);
+                uint16_t optLen = _rd16(block + opt + 2, swap);
+                if (code == 0) break;
+                if (code == 9 && optLen >= 1) {
+                    uint8_t res = block[opt + 4];
+                    uint64_t unitsPerSec = 1;
+                    for (int i = 0;
+                         i < (res & 0x7F) && unitsPerSec < 1000000000ULL; i++)
+                        unitsPerSec *= (res & 0x80) ? 2 : 10;
+                    tsUnits[interfaces] = unitsPerSec >= 1000000000ULL
+                                              ? 1
+                                              : 1000000000ULL / unitsPerSec;
+                }
+                opt += 4 + ((optLen + 3) & ~3u);
+            }
+            interfaces++;
+        } else if (type == 6 && length >= 32) {  // enhanced packet
+            uint32_t interface = _rd32(block + 8, swap);
+            uint64_t ts = (uint64_t)_rd32(block + 12, swap) << 32 |
+                          _rd32(block + 16, swap);
+            uint32_t captured = _rd32(block + 20, swap);
+            if ((int)interface < interfaces && 28 + captured <= length)
+                _packet(linktypes[interface], block + 28, captured,
+                        ts * tsUnits[interface]);
+        } else if (type == 3 && length >= 16 && interfaces > 0) {  // simple
+            uint32_t captured = length - 16;
+            uint32_t original = _rd32(block + 8, swap);
+            if (original < captured) captured = original;
+            _packet(linktypes[0], block + 12, captured, 0);
+        }
+
+        offset += length;
+    }
+    return 0;
+}
+
+/**
+ * @brief drain and count the responses of the replayed requests, until all
+ * of them are answered or the server closes the connection
+ */
+static void* _drainResponses(void* arg) {
+    uint8_t buffer[16 * MODBUS_MAX_ADU_SIZE];
+    int len = 0;
+
+    while (!__atomic_load_n(&replay.done, __ATOMIC_ACQUIRE) ||
+           __atomic_load_n(&replay.answered, __ATOMIC_RELAXED) <
+               __atomic_load_n(&stats.replayed, __ATOMIC_ACQUIRE)) {
+        int n = tcpReceive(replay.socketfd, buffer + len, sizeof(buffer) - len);
+        if (n == 0) {
+            ERROR("replay server closed the connection\n");
+            break;
+        }
+        if (n < 0) {
+            // only the receive timeout is worth another try
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                break;
+            if (__atomic_load_n(&replay.done, __ATOMIC_ACQUIRE)) break;
+            continue;
+        }
+        len += n;
+
+        int offset = 0, frameLen;
+        ModbusADU adu;
+        while ((frameLen = parseModbusADU(buffer + offset, len - offset,
+                                          &adu)) > 0) {
+            __atomic_add_fetch(&replay.answered, 1, __ATOMIC_RELAXED);
+            offset += frameLen;
+        }
+        if (frameLen < 0) break;
+        memmove(buffer, buffer + offset, len - offset);
+        len -= offset;
+    }
+    return NULL;
+}
+
+int main(int argc, char* argv[]) {
+    char* target = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:r:fs:")) != -1) {
+        switch (opt) {
+            case 'p':
+                serverPort = atoi(optarg);
+                break;
+            case 'r':
+                target = optarg;
+                break;
+            case 'f':
+                replay.fast = 1;
+                break;
+            case 's':
+                replay.speed = atof(optarg);
+                break;
+            default:
+                break;
+        }
+    }
+    if (optind != argc - 1 || replay.speed <= 0) {
+        printf("Usage: %s [-p serverPort] [-r ip:port] [-f] [-s speed] "
+               "<capture>\n",
+               argv[0]);
+        return -1;
+    }
+
+    int fd = open(argv[optind], O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || st.st_size < 24) {
+        ERROR("cannot open capture %s\n", argv[optind]);
+        return -1;
+    }
+    const uint8_t* map =
+        mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        ERROR("cannot map capture %s\n", argv[optind]);
+        return -1;
+    }
+    madvise((void*)map, st.st_size, MADV_SEQUENTIAL);
+
+    flows = (Flow*)calloc(FLOW_TABLE_SIZE, sizeof(*flows));
+    if (flows == NULL) return -1;
+
+    pthread_t drainer;
+    if (target != NULL) {
+        char ip[64];
+        int port;
+        if (sscanf(target, "%63[^:]:%d", ip, &port) != 2) {
+            ERROR("replay target must be ip:port\n");
+            return -1;
+        }
+        replay.socketfd =
+            modbusConnect(ip, port, MODBUS_TIMEOUT_SEC, MODBUS_TIMEOUT_USEC);
+        if (replay.socketfd < 0) return -1;
+        pthread_create(&drainer, NULL, _drainResponses, NULL);
+    }
+
+    uint32_t magic;
+    memcpy(&magic, map, 4);
+    double start = _now();
+    replay.startWall = start;
+
+    if (magic == 0x0A0D0D0A)
+        _readPcapng(map, st.st_size);
+    else if (magic == 0xA1B2C3D4 || magic == 0xD4C3B2A1 ||
+             magic == 0xA1B23C4D || magic == 0x4D3CB2A1)
+        _readPcap(map, st.st_size);
+    else {
+        ERROR("%s is not a pcap or pcapng file\n", argv[optind]);
+        return -1;
+    }
+    double elapsed = _now() - start;
+
+    if (replay.socketfd >= 0) {
+        __atomic_store_n(&replay.done, 1, __ATOMIC_RELEASE);
+        pthread_join(drainer, NULL);
+        modbusDisconnect(replay.socketfd);
+    }
+
+    printf("packets: %" PRIu64 ", tcp segments: %" PRIu64 ", bytes: %" PRIu64
+           "\n",
+           stats.packets, stats.segments, stats.bytes);
+    printf("requests: %" PRIu64 ", responses: %" PRIu64
+           ", exceptions: %" PRIu64 ", malformed: %" PRIu64
+           ", gaps: %" PRIu64 "\n",
+           stats.requests, stats.responses, stats.exceptions, stats.malformed,
+           stats.gaps);
+    for (int fc = 0; fc < 128; fc++)
+        if (stats.byFunction[fc] > 0)
+            printf("  function %3d: %" PRIu64 "\n", fc, stats.byFunction[fc]);
+    printf("%.3f s, %.0f frames/s, %.1f MB/s\n", elapsed,
+           (stats.requests + stats.responses) / elapsed,
+           stats.bytes / elapsed / 1e6);
+    if (replay.socketfd >= 0)
+        printf("replayed: %" PRIu64 ", answered: %" PRIu64 "\n",
+               stats.replayed, (uint64_t)replay.answered);
+
+    munmap((void*)map, st.st_size);
+    free(flows);
+    return 0;
+}
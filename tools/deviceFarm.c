@@ -0,0 +1,132 @@
+/**
+ * Serves a farm of simulated Modbus TCP slaves until interrupted, printing
+ * the request rate every few seconds.
+ *
+ * Usage: deviceFarm [-p basePort] [-n ports] [-u units] [-t threads]
+ *                   [-r registers] [-l latencyUs] [-j jitterUs]
+ *                   [-T tailRate] [-L tailUs] [-d dropRate]
+ *                   [-e exceptionRate] [-x exceptionCode] [-s seed]
+ *   -p  first port, the others follow (default 5020, 0 for ephemeral)
+ *   -n  listening ports (default 1)
+ *   -u  unit ids 1..u served on every port (default 1)
+ *   -t  event loop threads (default 1)
+ *   -r  holding registers per device (default 1024)
+ *   -l  base response latency (default 0)
+ *   -j  uniform latency jitter (default 0)
+ *   -T  fraction of responses delayed by -L more (default 0)
+ *   -L  extra latency of those tail responses (default 0)
+ *   -d  fraction of requests left unanswered (default 0)
+ *   -e  fraction of requests answered with exception -x (default 0, 0x04)
+ *
+ * Example, 10 gateways of 200 devices with 2 ms +- 1 ms latency:
+ *   deviceFarm -p 5020 -n 10 -u 200 -t 4 -l 1000 -j 2000
+ */
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "applicationLayer/deviceFarm.h"
+
+#define REPORT_SECONDS 5
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void _interrupt(int sig) { interrupted = 1; }
+
+int main(int argc, char* argv[]) {
+    FarmConfig config = {.basePort = 5020,
+                         .ports = 1,
+                         .units = 1,
+                         .threads = 1,
+                         .profile = {.registers = 1024,
+                                     .exceptionCode = 0x04}};
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:n:u:t:r:l:j:T:L:d:e:x:s:")) != -1) {
+        switch (opt) {
+            case 'p':
+                config.basePort = atoi(optarg);
+                break;
+            case 'n':
+                config.ports = atoi(optarg);
+                break;
+            case 'u':
+                config.units = atoi(optarg);
+                break;
+            case 't':
+                config.threads = atoi(optarg);
+                break;
+            case 'r':
+                config.profile.registers = atoi(optarg);
+                break;
+            case 'l':
+                config.profile.latencyUs = atoi(optarg);
+                break;
+            case 'j':
+                config.profile.jitterUs = atoi(optarg);
+                break;
+            case 'T':
+                config.profile.tailRate = atof(optarg);
+                break;
+            case 'L':
+                config.profile.tailUs = atoi(optarg);
+                break;
+            case 'd':
+                config.profile.dropRate = atof(optarg);
+                break;
+            case 'e':
+                config.profile.exceptionRate = atof(optarg);
+                break;
+            case 'x':
+                config.profile.exceptionCode =
+                    (uint8_t)strtol(optarg, NULL, 0);
+                break;
+            case 's':
+                config.seed = (uint32_t)atol(optarg);
+                break;
+            default:
+                printf("Usage: %s [-p basePort] [-n ports] [-u units] "
+                       "[-t threads] [-r registers] [-l latencyUs] "
+                       "[-j jitterUs] [-T tailRate] [-L tailUs] "
+                       "[-d dropRate] [-e exceptionRate] [-x exceptionCode] "
+                       "[-s seed]\n",
+                       argv[0]);
+                return -1;
+        }
+    }
+
+    DeviceFarm* farm = newDeviceFarm(&config);
+    if (farm == NULL) return -1;
+
+    signal(SIGINT, _interrupt);
+    signal(SIGTERM, _interrupt);
+
+    printf("%d devices on ports", config.ports * config.units);
+    for (int i = 0; i < config.ports; i++) printf(" %d", farmPort(farm, i));
+    printf("\n");
+    fflush(stdout);
+
+    FarmStats last = {0};
+    while (!interrupted) {
+        for (int i = 0; i < REPORT_SECONDS * 10 && !interrupted; i++)
+            usleep(100000);
+
+        FarmStats stats;
+        farmGetStats(farm, &stats);
+        uint64_t writes = stats.writes - last.writes;
+        printf("%8.0f req/s, %.1f responses/write, %lu connections, "
+               "%lu exceptions, %lu dropped\n",
+               (double)(stats.requests - last.requests) / REPORT_SECONDS,
+               writes ? (double)(stats.responses - last.responses) / writes
+                      : 0.0,
+               (unsigned long)stats.connections,
+               (unsigned long)stats.exceptions, (unsigned long)stats.dropped);
+        fflush(stdout);
+        last = stats;
+    }
+
+    freeDeviceFarm(farm);
+    return 0;
+}
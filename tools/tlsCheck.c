@@ -0,0 +1,126 @@
+/**
+ * Connects to a Modbus/TCP Security server several times in a row, reads
+ * one holding register over each connection and reports whether the later
+ * handshakes resumed the session cached by the first one, e.g. against
+ * test/tlsTestServer.py.
+ *
+ * Usage: tlsCheck [-n connections] [-a caFile] [-c certFile -k keyFile]
+ *                 <ip> [port]
+ *   -n  connections to open one after the other (default 2)
+ *   -a  check the server certificate against this authority, any
+ *       certificate is accepted without it
+ *   -c  client certificate, for servers asking for one
+ *   -k  private key of the client certificate
+ *
+ * Exits with an error if a connection or its request failed. A server
+ * without session tickets (tlsTestServer.py --no-tickets) is reported with
+ * 0 resumed handshakes but is not an error.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "applicationLayer/modbusClient.h"
+#include "transportLayer/modbusError.h"
+#include "transportLayer/modbusTCP.h"
+#include "transportLayer/tlsControl.h"
+
+static double _now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief open one connection, read a register through it and close it
+ *
+ * @return 0 if success, a ModbusError if error
+ */
+static int _check(char* ip, int port, int attempt) {
+    TlsStats before, after;
+    tlsGetStats(&before);
+
+    double start = _now();
+    ModbusClient* client = newModbusClientTLS(ip, port);
+    if (client == NULL) {
+        fprintf(stderr, "connection %d: cannot connect, %s\n", attempt,
+                modbusErrorName(modbusLastError()));
+        return modbusLastError() < 0 ? modbusLastError() : modbusErrConnect;
+    }
+    double connected = _now();
+
+    int len;
+    uint8_t* response = clientReadHoldingRegisters(client, 0, 1, &len);
+    double answered = _now();
+    freeModbusClient(client);
+    if (response == NULL) {
+        fprintf(stderr, "connection %d: request failed, %s\n", attempt,
+                modbusErrorName(modbusLastError()));
+        return modbusLastError();
+    }
+    free(response);
+
+    tlsGetStats(&after);
+    printf("%10d %10s %12.2f %12.2f\n", attempt,
+           after.resumed > before.resumed ? "resumed" : "full",
+           (connected - start) * 1e3, (answered - connected) * 1e3);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    int connections = 2;
+    TlsConfig config = {0};
+
+    int option;
+    while ((option = getopt(argc, argv, "n:a:c:k:")) != -1) {
+        switch (option) {
+            case 'n':
+                connections = atoi(optarg);
+                break;
+            case 'a':
+                config.caFile = optarg;
+                config.verifyPeer = 1;
+                break;
+            case 'c':
+                config.certFile = optarg;
+                break;
+            case 'k':
+                config.keyFile = optarg;
+                break;
+            default:
+                optind = argc + 1;
+                break;
+        }
+    }
+    if (optind >= argc || optind + 2 < argc || connections < 1 ||
+        (config.certFile == NULL) != (config.keyFile == NULL)) {
+        fprintf(stderr,
+                "Usage: %s [-n connections] [-a caFile] "
+                "[-c certFile -k keyFile] <ip> [port]\n",
+                argv[0]);
+        return -1;
+    }
+    char* ip = argv[optind];
+    int port = optind + 1 < argc ? atoi(argv[optind + 1]) : MODBUS_TLS_PORT;
+
+    if (tlsInit(&config) < 0) {
+        fprintf(stderr, "cannot set up TLS\n");
+        return -1;
+    }
+
+    printf("%10s %10s %12s %12s\n", "connection", "handshake", "connect ms",
+           "request ms");
+    int status = 0;
+    for (int i = 1; i <= connections && status == 0; i++)
+        status = _check(ip, port, i);
+
+    TlsStats stats;
+    tlsGetStats(&stats);
+    printf("\nhandshakes: %lu, resumed: %lu, records: %lu, bytes: %lu\n",
+           (unsigned long)stats.handshakes, (unsigned long)stats.resumed,
+           (unsigned long)stats.records, (unsigned long)stats.bytes);
+
+    tlsCleanup();
+    return status < 0 ? -1 : 0;
+}